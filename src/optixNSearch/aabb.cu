@@ -1,6 +1,8 @@
 #include <optix.h>
 #include <sutil/vec_math.h>
 
+#include "helper_quantize.h"
+
 __global__ void kGenAABB_t (
       const float3* points,
       float radius,
@@ -34,3 +36,43 @@ void kGenAABB(float3* points, float radius, unsigned int numPrims, OptixAabb* d_
       d_aabb
      );
 }
+
+// AABBs around the decoded points (see |quantizePoints|). |radius| must include
+// |QuantInfo::errBound| so that every AABB covers the one of the real point.
+__global__ void kGenAABBQuantized_t (
+      const QuantInfo quant,
+      const unsigned int* cells,
+      const ushort3* offsets,
+      float radius,
+      unsigned int N,
+      OptixAabb* aabb
+)
+{
+  unsigned int particleIndex = blockIdx.x * blockDim.x + threadIdx.x;
+  if (particleIndex >= N) return;
+
+  float3 center = quantDecode(quant, cells[particleIndex], offsets[particleIndex]);
+
+  float3 m_min = center - radius;
+  float3 m_max = center + radius;
+
+  aabb[particleIndex] =
+  {
+    m_min.x, m_min.y, m_min.z,
+    m_max.x, m_max.y, m_max.z
+  };
+}
+
+void kGenAABBQuantized(QuantInfo quant, const unsigned int* cells, const ushort3* offsets, float radius, unsigned int numPrims, OptixAabb* d_aabb, cudaStream_t stream) {
+  unsigned int threadsPerBlock = 64;
+  unsigned int numOfBlocks = numPrims / threadsPerBlock + 1;
+
+  kGenAABBQuantized_t <<<numOfBlocks, threadsPerBlock, 0, stream>>> (
+      quant,
+      cells,
+      offsets,
+      radius,
+      numPrims,
+      d_aabb
+     );
+}
@@ -0,0 +1,110 @@
+#include <algorithm>
+#include <climits>
+#include <cmath>
+
+#include <sutil/vec_math.h>
+
+#include "accuracy.h"
+#include "hostgrid.h"
+#include "parallel.h"
+
+void knnGroundTruth(const float3* points, unsigned int numPoints, const float3* queries, unsigned int numQueries,
+                    float radius, unsigned int k, unsigned int numThreads, KnnGroundTruth& gt) {
+  gt.k = k;
+  gt.counts.assign(numQueries, 0);
+  gt.sqDists.resize((size_t)numQueries * k);
+  if (numPoints == 0) return; // no neighbors to find
+
+  float3 sceneMin = points[0], sceneMax = points[0];
+  for (unsigned int i = 1; i < numPoints; i++) {
+    sceneMin = fminf(sceneMin, points[i]);
+    sceneMax = fmaxf(sceneMax, points[i]);
+  }
+  for (unsigned int i = 0; i < numQueries; i++) {
+    sceneMin = fminf(sceneMin, queries[i]);
+    sceneMax = fmaxf(sceneMax, queries[i]);
+  }
+
+  HostGrid grid;
+  buildSparseHostGrid(grid, points, numPoints, sceneMin, sceneMax, radius, k, numThreads);
+
+  parallelFor(numQueries, numThreads, [&](unsigned int b, unsigned int e, unsigned int) {
+    std::vector<unsigned int> ids(k);
+    for (unsigned int q = b; q < e; q++)
+      gt.counts[q] = hostKnnSearch(grid, queries[q], radius, k, ids.data(), gt.sqDists.data() + (size_t)q * k);
+  });
+}
+
+namespace {
+struct PartialAccuracy
+{
+  unsigned long long          found           = 0;
+  unsigned long long          expected        = 0;
+  double                      ratioSum        = 0;
+  unsigned long long          ratioCount      = 0;
+  double                      maxRatio        = 1;
+};
+}
+
+KnnAccuracy knnAccuracy(const KnnGroundTruth& gt, const float3* points, unsigned int numPoints, const float3* queries,
+                        const unsigned int* results, unsigned int numThreads) {
+  unsigned int k = gt.k;
+  unsigned int numQueries = (unsigned int)gt.counts.size();
+
+  std::vector<PartialAccuracy> partials(numHostThreads(numThreads));
+  parallelFor(numQueries, numThreads, [&](unsigned int b, unsigned int e, unsigned int tid) {
+    PartialAccuracy& part = partials[tid];
+    std::vector<unsigned int> ids;
+    std::vector<float> sqDists;
+    for (unsigned int q = b; q < e; q++) {
+      const unsigned int* row = results + (size_t)q * k;
+      const float* gtDists = gt.sqDists.data() + (size_t)q * k;
+      unsigned int expected = gt.counts[q];
+      float maxDist = (expected == k) ? gtDists[k - 1] : INFINITY;
+
+      // distinct, valid ids, by distance.
+      ids.assign(row, row + k);
+      std::sort(ids.begin(), ids.end());
+      sqDists.clear();
+      for (unsigned int n = 0; n < k; n++) {
+        unsigned int p = ids[n];
+        if (p >= numPoints || (n > 0 && p == ids[n - 1])) continue;
+        float3 diff = points[p] - queries[q];
+        sqDists.push_back(dot(diff, diff));
+      }
+      std::sort(sqDists.begin(), sqDists.end());
+
+      unsigned int found = 0;
+      for (float d : sqDists)
+        if ((d > 0) && (d <= maxDist)) found++;
+      part.found += std::min(found, expected);
+      part.expected += expected;
+
+      // the i-th found neighbor against the true i-th neighbor.
+      unsigned int ranks = std::min((unsigned int)sqDists.size(), expected);
+      for (unsigned int i = 0; i < ranks; i++) {
+        if (gtDists[i] <= 0) continue;
+        double ratio = std::sqrt((double)sqDists[i] / gtDists[i]);
+        part.ratioSum += ratio;
+        part.ratioCount++;
+        part.maxRatio = std::max(part.maxRatio, ratio);
+      }
+    }
+  });
+
+  PartialAccuracy total;
+  for (const PartialAccuracy& part : partials) {
+    total.found += part.found;
+    total.expected += part.expected;
+    total.ratioSum += part.ratioSum;
+    total.ratioCount += part.ratioCount;
+    total.maxRatio = std::max(total.maxRatio, part.maxRatio);
+  }
+
+  KnnAccuracy acc;
+  acc.recall = total.expected ? (double)total.found / total.expected : 1.0;
+  acc.missing = total.expected - total.found;
+  acc.distanceRatio = total.ratioCount ? total.ratioSum / total.ratioCount : 1.0;
+  acc.maxDistanceRatio = total.maxRatio;
+  return acc;
+}
@@ -0,0 +1,35 @@
+#pragma once
+
+#include <vector>
+
+#include <vector_types.h>
+
+// Accuracy of KNN results against exact ground truth, for measuring what the
+// approximate query partitioning (|approxMode|, see |radiusFromMegacell|)
+// costs; rtnnBench (bench.cpp) reports it next to the search time. The
+// ground truth comes from a host grid (see hostgrid.h), so it is exact and
+// needs no GPU. Plain host code.
+
+struct KnnGroundTruth
+{
+  unsigned int                k               = 0;
+  std::vector<unsigned int>   counts; // true neighbors of each query (up to k)
+  std::vector<float>          sqDists; // k per query, ascending; only the first counts[q] are used
+};
+
+struct KnnAccuracy
+{
+  double                      recall          = 1; // true neighbors found / true neighbors
+  double                      distanceRatio   = 1; // mean over found ranks of dist(found i-th) / dist(true i-th)
+  double                      maxDistanceRatio = 1;
+  unsigned long long          missing         = 0; // true neighbors not found
+};
+
+// the K nearest neighbors (excluding the query itself) of every query within |radius|.
+void knnGroundTruth(const float3* points, unsigned int numPoints, const float3* queries, unsigned int numQueries,
+                    float radius, unsigned int k, unsigned int numThreads, KnnGroundTruth&);
+// |results| has k ids per query (indices into |points|), padded with UINT_MAX,
+// in any order within a row. a found neighbor counts toward recall if it is
+// no farther than the true k-th neighbor, so ties can go either way.
+KnnAccuracy knnAccuracy(const KnnGroundTruth&, const float3* points, unsigned int numPoints, const float3* queries,
+                        const unsigned int* results, unsigned int numThreads);
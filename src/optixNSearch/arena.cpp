@@ -0,0 +1,85 @@
+#include <algorithm>
+
+#include "arena.h"
+
+static size_t alignUp(size_t x, size_t a) {
+  return (x + a - 1) / a * a;
+}
+
+static bool blockReady(Arena& arena, ArenaBlock& block) {
+  if (block.fence == 0) return true;
+  if (!arena.fenceDone || !arena.fenceDone(block.fence)) return false;
+  block.fence = 0;
+  return true;
+}
+
+uintptr_t arenaAlloc(Arena& arena, ArenaScope scope, size_t bytes) {
+  bytes = alignUp(std::max<size_t>(bytes, 1), arena.alignment);
+  std::vector<ArenaBlock>& blocks = arena.scopes[scope];
+
+  if (!blocks.empty()) {
+    ArenaBlock& cur = blocks.back();
+    if (cur.used + bytes <= cur.size) {
+      uintptr_t ptr = cur.base + cur.used;
+      cur.used += bytes;
+      return ptr;
+    }
+  }
+
+  // the smallest reusable block that fits; a large request (e.g., the cell
+  // arrays) shouldn't take a block that a small one could have used.
+  auto best = arena.freeBlocks.end();
+  for (auto it = arena.freeBlocks.begin(); it != arena.freeBlocks.end(); it++) {
+    if ((it->size < bytes) || ((best != arena.freeBlocks.end()) && (it->size >= best->size))) continue;
+    if (blockReady(arena, *it)) best = it;
+  }
+
+  ArenaBlock block;
+  if (best != arena.freeBlocks.end()) {
+    block = *best;
+    arena.freeBlocks.erase(best);
+  } else {
+    size_t size = std::max(bytes, arena.blockSize);
+    uintptr_t base = arena.allocBlock ? arena.allocBlock(size) : 0;
+    if (base == 0) return 0;
+    block = {base, size, 0, 0};
+    arena.reserved += size;
+    arena.peak = std::max(arena.peak, arena.reserved);
+  }
+
+  block.used = bytes;
+  // keep bumping the block with more room left.
+  if (!blocks.empty() && (blocks.back().size - blocks.back().used > block.size - block.used))
+    blocks.insert(blocks.end() - 1, block);
+  else blocks.push_back(block);
+  return block.base;
+}
+
+void arenaRelease(Arena& arena, ArenaScope scope, uint64_t fence) {
+  std::vector<ArenaBlock>& blocks = arena.scopes[scope];
+  for (auto& block : blocks) {
+    block.used = 0;
+    block.fence = fence;
+  }
+  arena.freeBlocks.insert(arena.freeBlocks.end(), blocks.begin(), blocks.end());
+  blocks.clear();
+}
+
+size_t arenaUsed(const Arena& arena, ArenaScope scope) {
+  size_t used = 0;
+  for (const auto& block : arena.scopes[scope]) used += block.used;
+  return used;
+}
+
+std::vector<ArenaBlock> arenaTrim(Arena& arena) {
+  std::vector<ArenaBlock> trimmed;
+  std::vector<ArenaBlock> kept;
+  for (auto& block : arena.freeBlocks) {
+    if (blockReady(arena, block)) {
+      trimmed.push_back(block);
+      arena.reserved -= block.size;
+    } else kept.push_back(block);
+  }
+  arena.freeBlocks.swap(kept);
+  return trimmed;
+}
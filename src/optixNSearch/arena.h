@@ -0,0 +1,59 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <vector>
+
+// Scoped sub-allocator for the device intermediates of a search (--arena).
+// Allocations bump a pointer in blocks owned by a scope; releasing a scope
+// hands all its blocks back at once, without freeing any memory. Blocks are
+// reused by later allocations (of any scope) once the work that used them is
+// done, which the caller tells with a fence: a released block carries the
+// fence passed to |arenaRelease| and is only reused once |fenceDone| says so.
+// So neither allocating nor releasing ever synchronizes, unlike
+// cudaMalloc/cudaFree.
+//
+// This is plain host code over opaque addresses; where the blocks come from
+// and what a fence is (a CUDA event) is up to the caller, see
+// |arenaAllocDevice| in util.cpp.
+enum ArenaScope
+{
+    ARENA_GRID      = 0, // sorting/partitioning grids; gone after the sort (see |freeGridPointers|)
+    ARENA_BATCH     = 1, // per-batch queries and maps; live until the search ends
+    ARENA_RESULTS   = 2, // launch parameters and output buffers of a search
+    ARENA_NUM_SCOPES
+};
+
+struct ArenaBlock
+{
+  uintptr_t                   base;
+  size_t                      size;
+  size_t                      used;
+  uint64_t                    fence; // 0: free to reuse
+};
+
+struct Arena
+{
+  size_t                      blockSize       = 16 << 20; // smallest block requested from |allocBlock|
+  size_t                      alignment       = 256; // of every allocation
+  std::vector<ArenaBlock>     scopes[ARENA_NUM_SCOPES]; // the last block of a scope is the one being bumped
+  std::vector<ArenaBlock>     freeBlocks;
+  size_t                      reserved        = 0; // bytes in all blocks
+  size_t                      peak            = 0; // max of |reserved|
+
+  // returns 0 on failure
+  std::function<uintptr_t(size_t)> allocBlock;
+  std::function<bool(uint64_t)> fenceDone;
+};
+
+// 0 if a new block was needed and |allocBlock| failed.
+uintptr_t arenaAlloc(Arena&, ArenaScope, size_t);
+// give all the blocks of the scope back; they can be reused once |fence| is
+// done (0 means right away). doesn't depend on the number of allocations.
+void arenaRelease(Arena&, ArenaScope, uint64_t fence);
+// bytes allocated in the scope (alignment included).
+size_t arenaUsed(const Arena&, ArenaScope);
+// remove the free blocks whose fence is done and return them to the caller
+// to free, e.g., to make room for something allocated outside the arena.
+std::vector<ArenaBlock> arenaTrim(Arena&);
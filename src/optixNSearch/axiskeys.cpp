@@ -0,0 +1,26 @@
+#include <algorithm>
+#include <vector>
+
+#include "axiskeys.h"
+#include "parallel.h"
+
+int sortAxis(int axis, float3 sceneMin, float3 sceneMax) {
+  if (axis >= 0 && axis <= 2) return axis;
+
+  float3 extent = sceneMax - sceneMin;
+  if (extent.x >= extent.y && extent.x >= extent.z) return 0;
+  return (extent.y >= extent.z) ? 1 : 2;
+}
+
+void axisKeys(const float3* particles, const unsigned int* indices, unsigned int N, int axis, float* keys, unsigned int numThreads) {
+  parallelFor(N, numThreads, [&](unsigned int b, unsigned int e, unsigned int) {
+    for (unsigned int i = b; i < e; i++) keys[i] = axisKey(particles[indices ? indices[i] : i], axis);
+  });
+}
+
+void axisOrder(const float3* particles, unsigned int N, int axis, unsigned int* order, unsigned int numThreads) {
+  std::vector<float> keys(N);
+  axisKeys(particles, nullptr, N, axis, keys.data(), numThreads);
+  for (unsigned int i = 0; i < N; i++) order[i] = i;
+  std::stable_sort(order, order + N, [&](unsigned int a, unsigned int b) { return keys[a] < keys[b]; });
+}
@@ -0,0 +1,18 @@
+#pragma once
+
+#include "grid.h"
+
+// Keys of the 1D sorts (-ps/-qs 3 and -s 1): a coordinate of each particle,
+// along an axis chosen per call. |sortAxis| picks the longest side of the
+// scene, which spreads the keys the most. The GPU builds the keys with
+// |kAxisKeys| (grid.cu); this is the host counterpart, which the CPU backend
+// uses and which needs no GPU to test. Both go through |axisKey| (grid.h).
+// Plain host code.
+
+// -1 means the longest side of the scene; 0/1/2 are kept as is.
+int sortAxis(int axis, float3 sceneMin, float3 sceneMax);
+// keys of |N| particles, or of particles[indices[i]] if |indices| isn't null,
+// batched over |numThreads| host threads.
+void axisKeys(const float3* particles, const unsigned int* indices, unsigned int N, int axis, float* keys, unsigned int numThreads);
+// the order in which to visit |N| particles along |axis|.
+void axisOrder(const float3* particles, unsigned int N, int axis, unsigned int* order, unsigned int numThreads);
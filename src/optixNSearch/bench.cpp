@@ -0,0 +1,192 @@
+#include <sutil/Exception.h>
+#include <sutil/Timing.h>
+
+#include <chrono>
+#include <cstdio>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "optixNSearch.h"
+#include "state.h"
+#include "func.h"
+#include "rtnn.h"
+#include "accuracy.h"
+
+// Recall versus time of the approximate KNN search. For every dataset (its
+// points are also the queries), the exact K nearest neighbors are computed on
+// the host (see accuracy.h), and then the GPU search runs once per
+// approximation level (-a); each level is timed (best of a few runs) and
+// scored against the ground truth. The table goes to a JSON file:
+//
+//   {"K": 50, "radius": 2, "repeats": 3, "datasets": [
+//     {"name": "a.txt", "points": 1000, "groundTruthMs": 12.3, "runs": [
+//       {"approxMode": 0, "timeMs": 4.5, "recall": 1, "distanceRatio": 1, "maxDistanceRatio": 1, "missing": 0},
+//       ...]},
+//     ...]}
+//
+// Any optixNSearch option (e.g., -r, -p, -nb) sets up the searches; the
+// search mode is always knn, and K is the compile-time one.
+
+static void printBenchUsageAndExit(const char* argv0) {
+  std::cerr << "Usage  : " << argv0 << " [options] -bd <file> [-bd <file> ...]\n";
+  std::cerr << "Options: any optixNSearch option, plus\n";
+  std::cerr << "  --benchdata       | -bd     Dataset to benchmark; repeat for a suite. Its points are also the queries.\n";
+  std::cerr << "  --benchapprox     | -ba     Comma-separated approximation levels (-a) to run. Default is 0,1,2.\n";
+  std::cerr << "  --benchrepeats    | -br     Timed runs per level; the fastest counts. Default is 3.\n";
+  std::cerr << "  --benchout        | -bo     JSON output file. Default is rtnn_bench.json.\n";
+  exit(0);
+}
+
+struct BenchRun
+{
+  int                         approxMode;
+  double                      timeMs;
+  KnnAccuracy                 accuracy;
+};
+
+struct BenchDataset
+{
+  std::string                 name;
+  unsigned int                numPoints;
+  double                      groundTruthMs;
+  std::vector<BenchRun>       runs;
+};
+
+static double elapsedMs(std::chrono::steady_clock::time_point start) {
+  return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+}
+
+static std::string jsonString(const std::string& s) {
+  std::string out = "\"";
+  for (char c : s) {
+    if (c == '"' || c == '\\') out += '\\';
+    out += c;
+  }
+  return out + "\"";
+}
+
+static void writeJson(const char* file, const RTNNState& config, unsigned int repeats, const std::vector<BenchDataset>& datasets) {
+  FILE* fp = fopen(file, "w");
+  if (!fp) {
+    fprintf(stderr, "Could not open %s\n", file);
+    exit(1);
+  }
+
+  fprintf(fp, "{\"K\": %u, \"radius\": %g, \"repeats\": %u, \"datasets\": [", config.knn, config.radius, repeats);
+  for (size_t d = 0; d < datasets.size(); d++) {
+    const BenchDataset& ds = datasets[d];
+    fprintf(fp, "%s\n  {\"name\": %s, \"points\": %u, \"groundTruthMs\": %.3f, \"runs\": [",
+        d ? "," : "", jsonString(ds.name).c_str(), ds.numPoints, ds.groundTruthMs);
+    for (size_t r = 0; r < ds.runs.size(); r++) {
+      const BenchRun& run = ds.runs[r];
+      fprintf(fp, "%s\n    {\"approxMode\": %d, \"timeMs\": %.3f, \"recall\": %.6f, \"distanceRatio\": %.6f, \"maxDistanceRatio\": %.6f, \"missing\": %llu}",
+          r ? "," : "", run.approxMode, run.timeMs, run.accuracy.recall,
+          run.accuracy.distanceRatio, run.accuracy.maxDistanceRatio, run.accuracy.missing);
+    }
+    fprintf(fp, "]}");
+  }
+  fprintf(fp, "]}\n");
+  fclose(fp);
+}
+
+int main( int argc, char* argv[] )
+{
+  std::vector<std::string> files;
+  std::vector<int> approxModes {0, 1, 2};
+  unsigned int repeats = 3;
+  std::string outFile = "rtnn_bench.json";
+
+  // take out the bench options; the rest configure the search.
+  std::vector<char*> args {argv[0]};
+  for (int i = 1; i < argc; i++) {
+    const std::string arg = argv[i];
+    bool hasValue = (i < argc - 1);
+    if (arg == "--help" || arg == "-h") printBenchUsageAndExit(argv[0]);
+    else if (arg == "--benchdata" || arg == "-bd") {
+      if (!hasValue) printBenchUsageAndExit(argv[0]);
+      files.push_back(argv[++i]);
+    } else if (arg == "--benchapprox" || arg == "-ba") {
+      if (!hasValue) printBenchUsageAndExit(argv[0]);
+      approxModes.clear();
+      std::stringstream ss(argv[++i]);
+      std::string level;
+      while (std::getline(ss, level, ',')) approxModes.push_back(atoi(level.c_str()));
+    } else if (arg == "--benchrepeats" || arg == "-br") {
+      if (!hasValue) printBenchUsageAndExit(argv[0]);
+      repeats = std::max(atoi(argv[++i]), 1);
+    } else if (arg == "--benchout" || arg == "-bo") {
+      if (!hasValue) printBenchUsageAndExit(argv[0]);
+      outFile = argv[++i];
+    } else args.push_back(argv[i]);
+  }
+  if (files.empty()) printBenchUsageAndExit(argv[0]);
+
+  RTNNState config;
+  parseArgs( config, (int)args.size(), args.data() );
+  if (!config.traceFile.empty() || !config.traceProfileFile.empty())
+    Timing::enableTrace(config.traceFile, config.traceProfileFile);
+  config.searchMode = "knn";
+  config.knn = K; // see |parseArgs|
+  config.sanCheck = false;
+
+  std::vector<BenchDataset> datasets;
+  try
+  {
+    for (const std::string& file : files) {
+      RTNNState data = config;
+      data.pfile = file;
+      data.qfile.clear();
+      data.samepq = true;
+      readData(data);
+
+      BenchDataset ds;
+      ds.name = file;
+      ds.numPoints = data.numPoints;
+      fprintf(stdout, "Dataset %s: %u points\n", file.c_str(), data.numPoints);
+
+      auto start = std::chrono::steady_clock::now();
+      KnnGroundTruth gt;
+      knnGroundTruth(data.h_points, data.numPoints, data.h_points, data.numPoints,
+          config.radius, config.knn, config.numThreads, gt);
+      ds.groundTruthMs = elapsedMs(start);
+
+      for (int approxMode : approxModes) {
+        rtnn::NeighborSearch ns(config);
+        ns.state().approxMode = approxMode;
+        ns.setSearchMode("knn");
+        ns.setRadius(config.radius);
+        ns.setPoints(data.h_points, data.numPoints);
+
+        BenchRun run;
+        run.approxMode = approxMode;
+        run.timeMs = 0;
+        for (unsigned int r = 0; r < repeats; r++) {
+          Timing::reset();
+          start = std::chrono::steady_clock::now();
+          ns.search();
+          double ms = elapsedMs(start);
+          if (r == 0 || ms < run.timeMs) run.timeMs = ms;
+        }
+
+        run.accuracy = knnAccuracy(gt, data.h_points, data.numPoints, data.h_points, ns.results().data(), config.numThreads);
+        fprintf(stdout, "\t-a %d: %.3f ms, recall %.6f, distance ratio %.6f (max %.6f)\n", approxMode, run.timeMs,
+            run.accuracy.recall, run.accuracy.distanceRatio, run.accuracy.maxDistanceRatio);
+        ds.runs.push_back(run);
+      }
+
+      if (isMappedHostPtr(data, data.h_points)) unmapPointFiles(data);
+      else delete[] data.h_points;
+      datasets.push_back(ds);
+    }
+  }
+  catch( std::exception& e )
+  {
+    std::cerr << "Caught exception: " << e.what() << "\n";
+    return 1;
+  }
+
+  writeJson(outFile.c_str(), config, repeats, datasets);
+  fprintf(stdout, "Wrote %s\n", outFile.c_str());
+  return 0;
+}
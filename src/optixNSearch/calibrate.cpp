@@ -0,0 +1,137 @@
+#include <sutil/Exception.h>
+#include <sutil/Timing.h>
+#include <thrust/device_vector.h>
+
+#include <chrono>
+#include <climits>
+#include <random>
+
+#include "optixNSearch.h"
+#include "state.h"
+#include "func.h"
+
+// microbenchmarks for the batching cost model (see costmodel.h). uniformly
+// random points in a unit cube double as queries, and the radius is chosen so
+// that a query has about 2K points in its AABB, i.e., a radius search stops
+// after K IS calls and a KNN search makes ~8r^3 * N of them, the same
+// quantities the batching estimates.
+
+static double syncedMs(std::chrono::steady_clock::time_point start) {
+  CUDA_CHECK( cudaDeviceSynchronize() );
+  return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+}
+
+static float calibrationRadius(unsigned int N, unsigned int knn) {
+  return 0.5f * cbrtf(2.0f * knn / N);
+}
+
+static void setupCalibrationSearch(RTNNState& state, std::vector<float3>& points, float radius, std::string& optixMode) {
+  state.h_points = points.data();
+  state.h_queries = state.h_points;
+  state.numPoints = points.size();
+  state.numQueries = points.size();
+  state.radius = radius;
+  state.params.radius = radius;
+  state.numOfBatches = -1;
+
+  uploadData(state);
+  initBatches(state);
+
+  if (state.context && (optixMode != state.searchMode)) cleanupOptiX(state);
+  if (!state.context) {
+    setupOptiX(state);
+    optixMode = state.searchMode;
+  } else createPipeline(state);
+
+  // samepq: sorting the queries sorts the points too.
+  sortParticles(state, QUERY, state.querySortMode);
+  setupSearch(state);
+}
+
+// best of a few launches over all points with |mode|.
+static double timeLaunch(RTNNState& state, SearchType mode) {
+  unsigned int numQueries = state.numActQueries[0];
+  state.params.limit = state.knn;
+  state.params.d_r2q_map = nullptr;
+  state.params.mode = mode;
+  state.params.radius = state.launchRadius[0];
+
+  thrust::device_ptr<unsigned int> output_buffer;
+  allocThrustDevicePtr(&output_buffer, numQueries * state.params.limit, state, ARENA_RESULTS);
+
+  double best = 0;
+  for (int rep = 0; rep < 3; rep++) {
+    fillByValue(output_buffer, numQueries * state.params.limit, UINT_MAX);
+    CUDA_CHECK( cudaDeviceSynchronize() );
+    auto start = std::chrono::steady_clock::now();
+    launchSubframe( thrust::raw_pointer_cast(output_buffer), state, 0 );
+    double ms = syncedMs(start);
+    if ((rep == 0) || (ms < best)) best = ms;
+  }
+  return best;
+}
+
+void calibrateCostModel( RTNNState& state ) {
+  setDevice(state);
+
+  // one batch over everything, as the cost model is per batch.
+  state.partition = false;
+  state.autoNB = false;
+  state.samepq = true;
+  state.sameData = true;
+  state.qGasSortMode = 0;
+  state.toGather = false;
+  state.filterQueries = false;
+  state.quantize = false;
+  state.dynamic = false;
+  state.csr = false;
+  state.gasCacheDir.clear();
+  state.outFile.clear();
+
+  CostRecord record;
+  record.device = state.deviceName;
+  std::mt19937 rng(0);
+  std::uniform_real_distribution<float> unit(0.0f, 1.0f);
+  std::string optixMode;
+
+  const char* modes[] = {"radius", "knn"};
+  for (const char* mode : modes) {
+    state.searchMode = mode;
+
+    for (unsigned int N = 1 << 17; N <= (1 << 21); N <<= 1) {
+      std::vector<float3> points(N);
+      for (auto& p : points) p = make_float3(unit(rng), unit(rng), unit(rng));
+      float radius = calibrationRadius(N, state.knn);
+      setupCalibrationSearch(state, points, radius, optixMode);
+
+      auto start = std::chrono::steady_clock::now();
+      createGeometry(state, 0, state.launchRadius[0]);
+      record.buildGas.push_back({(double)N, syncedMs(start)});
+
+      if (state.searchMode == "radius") {
+        double queriesK = (double)N * state.knn;
+        record.aabbTest.push_back({queriesK, timeLaunch(state, AABBTEST)});
+        record.sphereTest.push_back({queriesK, timeLaunch(state, PRECISE)});
+      } else {
+        double numIS = (double)N * 8 * radius * radius * radius * N;
+        record.knnSearch.push_back({numIS, timeLaunch(state, PRECISE)});
+      }
+
+      cleanupSearch(state);
+    }
+  }
+  cleanupState(state);
+
+  CostModel model = fitCostModel(record);
+  std::string dir = state.profileDir.empty() ? "." : state.profileDir;
+  std::string path = dir + "/" + costProfileName(state.deviceName);
+  if (!saveCostProfile(path, model, record)) {
+    fprintf(stderr, "Could not write the cost profile %s\n", path.c_str());
+    exit(1);
+  }
+
+  fprintf(stdout, "\tCost model for %s saved in %s\n", model.device.c_str(), path.c_str());
+  fprintf(stdout, "\tGAS build: %g ms/AABB + %g ms\n", model.buildGasPerAABB, model.buildGasIntercept);
+  fprintf(stdout, "\tAABB test: %g ms/IS, sphere test: %g ms/IS, KNN: %g ms/IS\n",
+      model.aabbTestPerIS, model.sphereTestPerIS, model.knnSearchPerIS);
+}
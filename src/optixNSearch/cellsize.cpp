@@ -0,0 +1,167 @@
+#include <algorithm>
+#include <cmath>
+
+#include <sutil/vec_math.h>
+
+#include "cellsize.h"
+
+static unsigned int padTo(unsigned int dim, unsigned int bits) {
+  return (dim + (1u << bits) - 1) >> bits << bits;
+}
+
+uint3 chooseMetaGridBits(uint3 gridDim, float maxWaste) {
+  unsigned int dims[3] = {std::max(gridDim.x, 1u), std::max(gridDim.y, 1u), std::max(gridDim.z, 1u)};
+  // past the bits that cover an axis, a larger meta grid is only padding.
+  unsigned int maxBits[3];
+  for (int i = 0; i < 3; i++) {
+    maxBits[i] = 0;
+    while (maxBits[i] < 10 && (1u << maxBits[i]) < dims[i]) maxBits[i]++;
+  }
+  double cells = (double)dims[0] * dims[1] * dims[2];
+
+  uint3 best = make_uint3(0, 0, 0);
+  unsigned int bestBits = 0, bestMin = 0;
+  double bestPadded = cells;
+  for (unsigned int bx = 0; bx <= maxBits[0]; bx++) {
+    for (unsigned int by = 0; by <= maxBits[1]; by++) {
+      for (unsigned int bz = 0; bz <= maxBits[2]; bz++) {
+        double padded = (double)padTo(dims[0], bx) * padTo(dims[1], by) * padTo(dims[2], bz);
+        if (padded > cells * (1 + maxWaste)) continue;
+
+        unsigned int totalBits = bx + by + bz;
+        unsigned int minBits = std::min({bx, by, bz});
+        bool better = (totalBits > bestBits) ||
+                      (totalBits == bestBits && padded < bestPadded) ||
+                      (totalBits == bestBits && padded == bestPadded && minBits > bestMin);
+        if (better) {
+          best = make_uint3(bx, by, bz);
+          bestBits = totalBits;
+          bestMin = minBits;
+          bestPadded = padded;
+        }
+      }
+    }
+  }
+  return best;
+}
+
+static unsigned int ceilLog2(unsigned int dim) {
+  unsigned int bits = 0;
+  while ((1u << bits) < dim) bits++;
+  return bits;
+}
+
+unsigned int calcGridInfo(float3 sceneMin, float3 sceneMax, float cellSize, int mcScale, unsigned int N, GridInfo& gridInfo, float metaGridWaste) {
+  gridInfo.ParticleCount = N;
+  gridInfo.GridMin = sceneMin;
+
+  float3 gridSize = sceneMax - sceneMin;
+  gridInfo.GridDimension.x = static_cast<unsigned int>(ceilf(gridSize.x / cellSize));
+  gridInfo.GridDimension.y = static_cast<unsigned int>(ceilf(gridSize.y / cellSize));
+  gridInfo.GridDimension.z = static_cast<unsigned int>(ceilf(gridSize.z / cellSize));
+
+  // Adjust grid size to multiple of cell size
+  gridSize.x = gridInfo.GridDimension.x * cellSize;
+  gridSize.y = gridInfo.GridDimension.y * cellSize;
+  gridSize.z = gridInfo.GridDimension.z * cellSize;
+
+  gridInfo.GridDelta.x = gridInfo.GridDimension.x / gridSize.x;
+  gridInfo.GridDelta.y = gridInfo.GridDimension.y / gridSize.y;
+  gridInfo.GridDelta.z = gridInfo.GridDimension.z / gridSize.z;
+
+  // see |genGridInfo| for the meta grids.
+  if (metaGridWaste >= 0) {
+    gridInfo.meta_grid_bits = chooseMetaGridBits(gridInfo.GridDimension, metaGridWaste);
+    gridInfo.meta_grid_dims = make_uint3(1u << gridInfo.meta_grid_bits.x, 1u << gridInfo.meta_grid_bits.y, 1u << gridInfo.meta_grid_bits.z);
+  } else {
+    unsigned int shortestSide = std::min({gridInfo.GridDimension.x, gridInfo.GridDimension.y, gridInfo.GridDimension.z});
+    // dim should at least be 1; otherwise we won't get 0 cells.
+    unsigned int metaGridDim = std::max((int)pow(2, floorf(log2(shortestSide)))/mcScale, 1);
+    gridInfo.meta_grid_dims = make_uint3(metaGridDim, metaGridDim, metaGridDim);
+    unsigned int bits = ceilLog2(metaGridDim);
+    gridInfo.meta_grid_bits = make_uint3(bits, bits, bits);
+  }
+  gridInfo.meta_grid_size = gridInfo.meta_grid_dims.x * gridInfo.meta_grid_dims.y * gridInfo.meta_grid_dims.z;
+
+  gridInfo.MetaGridDimension.x = static_cast<unsigned int>(ceilf(gridInfo.GridDimension.x / (float)gridInfo.meta_grid_dims.x));
+  gridInfo.MetaGridDimension.y = static_cast<unsigned int>(ceilf(gridInfo.GridDimension.y / (float)gridInfo.meta_grid_dims.y));
+  gridInfo.MetaGridDimension.z = static_cast<unsigned int>(ceilf(gridInfo.GridDimension.z / (float)gridInfo.meta_grid_dims.z));
+
+  unsigned int numberOfCells = (gridInfo.MetaGridDimension.x * gridInfo.MetaGridDimension.y * gridInfo.MetaGridDimension.z) * gridInfo.meta_grid_size;
+  return numberOfCells;
+}
+
+double gridCellCount(const GridInfo& gridInfo) {
+  return (double)gridInfo.MetaGridDimension.x * gridInfo.MetaGridDimension.y * gridInfo.MetaGridDimension.z * gridInfo.meta_grid_size;
+}
+
+double metaGridPadding(const GridInfo& gridInfo) {
+  double cells = (double)gridInfo.GridDimension.x * gridInfo.GridDimension.y * gridInfo.GridDimension.z;
+  return cells > 0 ? gridCellCount(gridInfo) / cells - 1 : 0;
+}
+
+// with |padded| false, the cells are counted without the meta grid padding:
+// a lower bound on the bytes that, unlike the padded count, never grows with
+// the cell size (see |solveCellSize|).
+static CellSizePlan planCellSize(const CellSizeProblem& problem, float cellSize, bool padded) {
+  CellSizePlan plan;
+  plan.cellSize = cellSize;
+  plan.numOfBatches = problem.oneBatch ? 1.0 : problem.radius / (sqrt(3) * cellSize) + 1;
+  plan.gasBytes = (double)plan.numOfBatches * problem.gasSize;
+
+  GridInfo gridInfo;
+  calcGridInfo(problem.sceneMin, problem.sceneMax, cellSize, problem.mcScale, 0, gridInfo, problem.metaGridWaste);
+  double numOfCells = padded ? gridCellCount(gridInfo) :
+      (double)gridInfo.GridDimension.x * gridInfo.GridDimension.y * gridInfo.GridDimension.z;
+  bool addressable = true;
+  if (problem.occupied > 0) {
+    // the cell arrays, plus the keys the table is made from.
+    plan.sortBytes = (std::min(numOfCells, (double)problem.occupied) * problem.cellArrayCount + problem.occupied) * sizeof(unsigned int);
+    addressable = (numOfCells < NO_CELL);
+  } else plan.sortBytes = numOfCells * (problem.cellArrayCount * sizeof(unsigned int));
+
+  plan.fits = addressable && (plan.gasBytes + plan.sortBytes < problem.spaceAvail);
+  return plan;
+}
+
+CellSizePlan evalCellSize(const CellSizeProblem& problem, float cellSize) {
+  return planCellSize(problem, cellSize, true);
+}
+
+CellSizePlan solveCellSize(const CellSizeProblem& problem, float initial) {
+  // a cell covering the whole scene (and radius) is as few cells and batches
+  // as it gets; past that, nothing changes.
+  float largest = 2 * std::max(fmaxf(problem.sceneMax - problem.sceneMin), problem.radius);
+  if (!(initial > 0)) initial = largest * 1e-6f; // e.g., a flat scene
+  float step = (problem.step > 1) ? problem.step : 1.01f;
+  auto candidate = [&](int k) { return initial * powf(step, (float)k); };
+
+  CellSizePlan plan = evalCellSize(problem, initial);
+  if (plan.fits) return plan;
+
+  // whether a candidate fits isn't monotone: rounding the grid up to whole
+  // meta grids can add more cells at a larger cell size (e.g., the adaptive
+  // meta grids of a smaller grid may be larger and pad more, see
+  // |chooseMetaGridBits|). the unpadded cell count is monotone, so bisect on
+  // it for the first candidate that may fit: grow the exponent until |hi| may
+  // fit while |lo| can't.
+  auto mayFit = [&](int k) { return planCellSize(problem, candidate(k), false).fits; };
+  int lo = 0, hi = 1;
+  while (!mayFit(hi)) {
+    if (candidate(hi) >= largest) return evalCellSize(problem, candidate(hi)); // nothing fits
+    lo = hi;
+    hi *= 2;
+  }
+  while (hi - lo > 1) {
+    int mid = lo + (hi - lo) / 2;
+    if (mayFit(mid)) hi = mid;
+    else lo = mid;
+  }
+
+  // from there, walk the candidates like the linear walk did; the padding is
+  // a bounded fraction of the cells, so it's only a few of them.
+  for (int k = hi; ; k++) {
+    plan = evalCellSize(problem, candidate(k));
+    if (plan.fits || plan.cellSize >= largest) return plan;
+  }
+}
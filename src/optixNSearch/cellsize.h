@@ -0,0 +1,64 @@
+#pragma once
+
+#include <vector_types.h>
+
+#include "grid.h"
+
+// Cell size planning for the automatic crRatio (see |calcCRRatio|). Smaller
+// cells mean more batches (so more GASes) and more sorting cells, and the
+// smallest cell size whose GASes and sorting arrays fit the memory left is
+// the one to use. The candidates are the ones the old linear walk visited
+// (the initial estimate times powers of |step|), and the answer is the same,
+// but most of them are skipped by bisection (see |solveCellSize|), and
+// nothing here prints. A sparse grid (see |CellTable|) needs
+// memory for its occupied cells only, but its cell indices must fit 32 bits.
+//
+// Plain host code, shared by |genGridInfo| and |calcCRRatio|.
+
+// the grid (with meta grids, see |genGridInfo|) of cell size |cellSize| over
+// the scene; returns the number of cells. the meta grids are cubes sized by
+// |mcScale|, or, if |metaGridWaste| isn't negative, adaptive (see
+// |chooseMetaGridBits|).
+unsigned int calcGridInfo(float3 sceneMin, float3 sceneMax, float cellSize, int mcScale, unsigned int N, GridInfo&, float metaGridWaste = -1);
+// same as the return of |calcGridInfo|, but without wrapping around.
+double gridCellCount(const GridInfo&);
+// the padded cells the meta grids add, as a fraction of the scene's cells.
+double metaGridPadding(const GridInfo&);
+
+// Adaptive meta grids. The fixed heuristic makes cubic meta grids from the
+// shortest side, so an elongated scene (e.g., a road corridor) gets tiny meta
+// grids and is mostly in raster order. Instead, pick a power-of-2 meta grid
+// size per axis for |gridDim| cells: the most cells per meta grid (the
+// longest stretch of morton order), as long as padding the grid to whole meta
+// grids adds at most |maxWaste| of its cells; ties go to less padding, then
+// to more cubic meta grids. An axis gets at most 10 bits, like |MortonCode3|.
+uint3 chooseMetaGridBits(uint3 gridDim, float maxWaste);
+
+struct CellSizeProblem
+{
+  float3                      sceneMin;
+  float3                      sceneMax;
+  int                         mcScale;
+  float                       metaGridWaste; // see |calcGridInfo|
+  float                       radius;
+  float                       spaceAvail; // bytes
+  float                       gasSize; // bytes per GAS; 0 only counts the sorting arrays
+  bool                        oneBatch; // one GAS regardless of the cell size
+  int                         cellArrayCount; // sorting arrays with an element per cell
+  float                       step; // ratio between candidate cell sizes (crStep)
+  float                       occupied; // sparse grid: most occupied cells (particles inserted); 0 for a dense grid
+};
+
+struct CellSizePlan
+{
+  float                       cellSize;
+  bool                        fits; // false if even the largest candidate doesn't fit
+  double                      gasBytes;
+  double                      sortBytes;
+  float                       numOfBatches;
+};
+
+// bytes needed at |cellSize|.
+CellSizePlan evalCellSize(const CellSizeProblem&, float cellSize);
+// the smallest candidate |initial| * step^k that fits.
+CellSizePlan solveCellSize(const CellSizeProblem&, float initial);
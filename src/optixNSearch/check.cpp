@@ -3,8 +3,29 @@
 #include <algorithm>
 #include <unordered_set>
 #include <iterator>
+#include <random>
+
+#include <sutil/Exception.h>
+#include <sutil/Timing.h>
 
 #include "state.h"
+#include "csr.h"
+#include "func.h"
+#include "hostgrid.h"
+#include "parallel.h"
+
+// the neighbors of query |q| of a batch, in either result layout.
+const unsigned int* getNeighbors( RTNNState& state, int batch_id, unsigned int q, unsigned int& size ) {
+  const unsigned int* res = static_cast<const unsigned int*>( state.h_res[batch_id] );
+  if (state.csr) {
+    const unsigned int* offsets = state.h_resOffsets[batch_id];
+    size = offsets[q + 1] - offsets[q];
+    return res + offsets[q];
+  }
+  const unsigned int* row = res + (size_t)q * state.knn;
+  size = countRowNeighbors(row, state.knn);
+  return row;
+}
 
 typedef std::pair<float, unsigned int> knn_res_t;
 class Compare
@@ -62,17 +83,16 @@ void sanityCheckKNN( RTNNState& state, int batch_id ) {
     if (printRes) std::cout << "RTX: ";
     std::unordered_set<unsigned int> gpu_idxs;
     std::unordered_set<float> gpu_dists;
-    for (unsigned int n = 0; n < state.knn; n++) {
-      unsigned int p = static_cast<unsigned int*>( state.h_res[batch_id] )[ q * state.knn + n ];
-      if (p == UINT_MAX) break;
-      else {
-        float3 diff = state.h_points[p] - query;
-        float dists = dot(diff, diff);
-        gpu_idxs.insert(p);
-        gpu_dists.insert(sqrt(dists));
-        if (printRes) {
-          std::cout << "[" << sqrt(dists) << ", " << p << "] ";
-        }
+    unsigned int numNeighbors;
+    const unsigned int* neighbors = getNeighbors(state, batch_id, q, numNeighbors);
+    for (unsigned int n = 0; n < numNeighbors; n++) {
+      unsigned int p = neighbors[n];
+      float3 diff = state.h_points[p] - query;
+      float dists = dot(diff, diff);
+      gpu_idxs.insert(p);
+      gpu_dists.insert(sqrt(dists));
+      if (printRes) {
+        std::cout << "[" << sqrt(dists) << ", " << p << "] ";
       }
     }
     if (printRes) std::cout << std::endl;
@@ -108,25 +128,24 @@ void sanityCheckRadius( RTNNState& state, int batch_id ) {
   unsigned int totalWrongNeighbors = 0;
   double totalWrongDist = 0;
   for (unsigned int q = 0; q < state.numQueries; q++) {
-    for (unsigned int n = 0; n < state.knn; n++) {
-      unsigned int p = reinterpret_cast<unsigned int*>( state.h_res[batch_id] )[ q * state.knn + n ];
+    unsigned int numNeighbors;
+    const unsigned int* neighbors = getNeighbors(state, batch_id, q, numNeighbors);
+    for (unsigned int n = 0; n < numNeighbors; n++) {
+      unsigned int p = neighbors[n];
       //std::cout << p << std::endl; break;
-      if (p == UINT_MAX) break;
-      else {
-        totalNeighbors++;
-        float3 diff = state.h_points[p] - state.h_queries[q];
-        float dists = dot(diff, diff);
-        if (dists > state.gRadius * state.gRadius) {
-          fprintf(stdout, "Point %u [%f, %f, %f] is not a neighbor of query %u [%f, %f, %f]. Dist is %lf.\n",
-            p, state.h_points[p].x, state.h_points[p].y, state.h_points[p].z,
-            q, state.h_queries[q].x, state.h_queries[q].y, state.h_queries[q].z,
-            sqrt(dists));
-          totalWrongNeighbors++;
-          totalWrongDist += sqrt(dists);
-          exit(1);
-        }
-        //std::cout << sqrt(dists) << " ";
+      totalNeighbors++;
+      float3 diff = state.h_points[p] - state.h_queries[q];
+      float dists = dot(diff, diff);
+      if (dists > state.gRadius * state.gRadius) {
+        fprintf(stdout, "Point %u [%f, %f, %f] is not a neighbor of query %u [%f, %f, %f]. Dist is %lf.\n",
+          p, state.h_points[p].x, state.h_points[p].y, state.h_points[p].z,
+          q, state.h_queries[q].x, state.h_queries[q].y, state.h_queries[q].z,
+          sqrt(dists));
+        totalWrongNeighbors++;
+        totalWrongDist += sqrt(dists);
+        exit(1);
       }
+      //std::cout << sqrt(dists) << " ";
       //std::cout << p << " ";
     }
     //std::cout << "\n";
@@ -138,6 +157,119 @@ void sanityCheckRadius( RTNNState& state, int batch_id ) {
   if (totalWrongNeighbors != 0) std::cerr << "Avg wrong dist: " << totalWrongDist / totalWrongNeighbors << std::endl;
 }
 
+struct ExactCheckStats
+{
+  unsigned long long          queries         = 0;
+  unsigned long long          returned        = 0; // neighbors the search returned
+  unsigned long long          correct         = 0; // ... that are true neighbors
+  unsigned long long          expected        = 0; // true neighbors the search should return (up to |knn|)
+  unsigned long long          truncated       = 0; // radius search: queries with more neighbors than |knn|
+  unsigned long long          wrongQueries    = 0; // queries with a wrong or a missing neighbor
+
+  void add(const ExactCheckStats& o) {
+    queries += o.queries;
+    returned += o.returned;
+    correct += o.correct;
+    expected += o.expected;
+    truncated += o.truncated;
+    wrongQueries += o.wrongQueries;
+  }
+};
+
+// the queries of a batch of |N| to check: all of them, or one random query
+// from each of |sample| equal index ranges. queries are usually sorted, so
+// the ranges are spread over the scene.
+static std::vector<unsigned int> exactCheckQueries(unsigned int N, unsigned int sample) {
+  std::vector<unsigned int> queries;
+  if (sample == 0 || sample >= N) {
+    queries.resize(N);
+    for (unsigned int q = 0; q < N; q++) queries[q] = q;
+    return queries;
+  }
+
+  std::mt19937 rng(N); // deterministic across runs
+  queries.resize(sample);
+  for (unsigned int s = 0; s < sample; s++) {
+    unsigned int begin = (unsigned int)((unsigned long long)N * s / sample);
+    unsigned int end = (unsigned int)((unsigned long long)N * (s + 1) / sample);
+    queries[s] = begin + rng() % (end - begin);
+  }
+  return queries;
+}
+
+// check the neighbors of query |q| against the host grid. a returned
+// neighbor is correct if it is a valid, distinct point that the search
+// should have returned: within the radius for radius search, and no farther
+// than the true K-th neighbor for KNN search (so ties are fine either way).
+static void exactCheckQuery(RTNNState& state, const HostGrid& grid, int batch_id, unsigned int q,
+                            unsigned int* gtIds, float* gtDists, std::vector<unsigned int>& ids, ExactCheckStats& stats) {
+  float3 query = state.h_queries[q];
+  float sqRadius = state.gRadius * state.gRadius;
+  bool knn = (state.searchMode == "knn");
+
+  float maxDist = sqRadius;
+  unsigned int expected;
+  if (knn) {
+    expected = hostKnnSearch(grid, query, state.gRadius, state.knn, gtIds, gtDists);
+    if (expected == state.knn) maxDist = gtDists[expected - 1];
+  } else {
+    // one more than the limit tells whether the search had to truncate.
+    unsigned int size = hostRadiusSearch(grid, query, state.gRadius, state.knn + 1, gtIds);
+    if (size > state.knn) stats.truncated++;
+    expected = std::min(size, state.knn);
+  }
+
+  unsigned int numNeighbors;
+  const unsigned int* neighbors = getNeighbors(state, batch_id, q, numNeighbors);
+  ids.assign(neighbors, neighbors + numNeighbors);
+  std::sort(ids.begin(), ids.end());
+
+  unsigned int correct = 0;
+  for (unsigned int n = 0; n < numNeighbors; n++) {
+    unsigned int p = ids[n];
+    if (p >= state.numPoints || (n > 0 && p == ids[n - 1])) continue;
+    float3 diff = state.h_points[p] - query;
+    float dists = dot(diff, diff);
+    bool inRange = knn ? ((dists > 0) && (dists < sqRadius) && (dists <= maxDist)) : (dists < sqRadius);
+    if (inRange) correct++;
+  }
+  correct = std::min(correct, expected);
+
+  stats.queries++;
+  stats.returned += numNeighbors;
+  stats.correct += correct;
+  stats.expected += expected;
+  if ((correct != numNeighbors) || (correct != expected)) stats.wrongQueries++;
+}
+
+// an exact check of every query (or a sample of |exactCheckSample| per batch)
+// against a host cell grid of the points, on all host threads. unlike
+// |sanityCheckKNN| and |sanityCheckRadius|, this also finds missing
+// neighbors, and reports instead of stopping at the first wrong one.
+static void sanityCheckExact( RTNNState& state, const HostGrid& grid, int batch_id, ExactCheckStats& total ) {
+  std::vector<unsigned int> queries = exactCheckQueries(state.numQueries, state.exactCheckSample);
+
+  unsigned int numThreads = numHostThreads(state.numThreads);
+  std::vector<ExactCheckStats> threadStats(numThreads);
+  parallelFor((unsigned int)queries.size(), numThreads, [&](unsigned int b, unsigned int e, unsigned int tid) {
+    std::vector<unsigned int> gtIds(state.knn + 1);
+    std::vector<float> gtDists(state.knn + 1);
+    std::vector<unsigned int> ids;
+    for (unsigned int i = b; i < e; i++)
+      exactCheckQuery(state, grid, batch_id, queries[i], gtIds.data(), gtDists.data(), ids, threadStats[tid]);
+  });
+
+  ExactCheckStats stats;
+  for (const ExactCheckStats& s : threadStats) stats.add(s);
+  total.add(stats);
+
+  fprintf(stdout, "\tbatch %d: %llu of %u queries, precision %.6f, recall %.6f, truncated %llu, wrong queries %llu\n",
+      batch_id, stats.queries, state.numQueries,
+      stats.returned ? (double)stats.correct / stats.returned : 1.0,
+      stats.expected ? (double)stats.correct / stats.expected : 1.0,
+      stats.truncated, stats.wrongQueries);
+}
+
 void checkFilteredQueries(RTNNState& state) {
   // sanity check for filtered queries
   for (unsigned int q = 0; q < state.numFltQs; q++) {
@@ -157,6 +289,18 @@ void checkFilteredQueries(RTNNState& state) {
 }
 
 void sanityCheck(RTNNState& state) {
+  // the per-batch checks read the batch from numQueries/h_queries; restore them afterwards.
+  unsigned int numQueries = state.numQueries;
+  float3* h_queries = state.h_queries;
+
+  HostGrid grid;
+  ExactCheckStats total;
+  if (state.exactCheck) {
+    Timing::startTiming("exact sanity check");
+    buildSparseHostGrid(grid, state.h_points, state.numPoints, state.Min, state.Max, state.gRadius,
+        (state.searchMode == "knn") ? state.knn : 0, state.numThreads);
+  }
+
   for (int i = 0; i < state.numOfBatches; i++) {
   //for (int i = 0; i < 1; i++) {
     state.numQueries = state.numActQueries[i];
@@ -165,9 +309,25 @@ void sanityCheck(RTNNState& state) {
     // for empty batches, skip sanity check.
     if (state.numQueries == 0) continue;
 
-    if (state.searchMode == "radius") sanityCheckRadius( state, i );
+    if (state.csr && !validateCSR(state.h_resOffsets[i], static_cast<const unsigned int*>(state.h_res[i]),
+                                  state.numQueries, state.knn, state.numPoints)) exit(1);
+
+    if (state.exactCheck) sanityCheckExact( state, grid, i, total );
+    else if (state.searchMode == "radius") sanityCheckRadius( state, i );
     else sanityCheckKNN( state, i );
 
   }
   //checkFilteredQueries(state);
+
+  if (state.exactCheck) {
+    fprintf(stdout, "\ttotal: %llu queries, precision %.6f, recall %.6f, truncated %llu, wrong queries %llu\n",
+        total.queries,
+        total.returned ? (double)total.correct / total.returned : 1.0,
+        total.expected ? (double)total.correct / total.expected : 1.0,
+        total.truncated, total.wrongQueries);
+    Timing::stopTiming(true);
+  }
+
+  state.numQueries = numQueries;
+  state.h_queries = h_queries;
 }
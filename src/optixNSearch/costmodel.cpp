@@ -0,0 +1,139 @@
+#include <algorithm>
+#include <cctype>
+#include <fstream>
+#include <sstream>
+
+#include "costmodel.h"
+
+bool fitLine(const std::vector<CostSample>& samples, double& slope, double& intercept) {
+  size_t n = samples.size();
+  if (n < 2) return false;
+
+  double sx = 0, sy = 0;
+  for (const auto& s : samples) {
+    sx += s.x;
+    sy += s.ms;
+  }
+  double mx = sx / n, my = sy / n;
+
+  double sxx = 0, sxy = 0;
+  for (const auto& s : samples) {
+    sxx += (s.x - mx) * (s.x - mx);
+    sxy += (s.x - mx) * (s.ms - my);
+  }
+  if (sxx == 0) return false;
+
+  slope = sxy / sxx;
+  intercept = my - slope * mx;
+  return true;
+}
+
+static void fitSlope(const std::vector<CostSample>& samples, float& coeff, float* intercept = nullptr) {
+  double slope, icept;
+  if (!fitLine(samples, slope, icept) || (slope <= 0)) return;
+  coeff = (float)slope;
+  // a negative intercept is just noise around a small one.
+  if (intercept) *intercept = (float)std::max(icept, 0.0);
+}
+
+CostModel fitCostModel(const CostRecord& record) {
+  CostModel model;
+  model.device = record.device;
+  fitSlope(record.buildGas, model.buildGasPerAABB, &model.buildGasIntercept);
+  fitSlope(record.aabbTest, model.aabbTestPerIS);
+  fitSlope(record.sphereTest, model.sphereTestPerIS);
+  fitSlope(record.knnSearch, model.knnSearchPerIS);
+  return model;
+}
+
+std::string costProfileName(const std::string& device) {
+  std::string name = "rtnn-";
+  for (char c : device) name += (isalnum((unsigned char)c) || c == '-') ? c : '_';
+  return name + ".profile";
+}
+
+static void writeSamples(std::ofstream& out, const char* key, const std::vector<CostSample>& samples) {
+  for (const auto& s : samples) out << "sample " << key << " " << s.x << " " << s.ms << "\n";
+}
+
+bool saveCostProfile(const std::string& path, const CostModel& model, const CostRecord& record) {
+  std::ofstream out(path);
+  if (!out) return false;
+
+  out.precision(9);
+  out << "version " << RTNN_PROFILE_VERSION << "\n";
+  out << "device " << model.device << "\n";
+  out << "buildGasPerAABB " << model.buildGasPerAABB << "\n";
+  out << "buildGasIntercept " << model.buildGasIntercept << "\n";
+  out << "aabbTestPerIS " << model.aabbTestPerIS << "\n";
+  out << "sphereTestPerIS " << model.sphereTestPerIS << "\n";
+  out << "knnSearchPerIS " << model.knnSearchPerIS << "\n";
+  writeSamples(out, "buildGas", record.buildGas);
+  writeSamples(out, "aabbTest", record.aabbTest);
+  writeSamples(out, "sphereTest", record.sphereTest);
+  writeSamples(out, "knnSearch", record.knnSearch);
+  return (bool)out;
+}
+
+bool loadCostProfile(const std::string& path, CostModel& model, CostRecord* record) {
+  std::ifstream in(path);
+  if (!in) return false;
+
+  CostModel loaded;
+  CostRecord samples;
+  std::string line;
+  while (std::getline(in, line)) {
+    std::istringstream ls(line);
+    std::string key;
+    if (!(ls >> key)) continue;
+
+    if (key == "version") {
+      int version;
+      if (!(ls >> version) || (version != RTNN_PROFILE_VERSION)) return false;
+    } else if (key == "device") {
+      std::getline(ls >> std::ws, loaded.device);
+      samples.device = loaded.device;
+      continue; // may be empty
+    } else if (key == "buildGasPerAABB") ls >> loaded.buildGasPerAABB;
+    else if (key == "buildGasIntercept") ls >> loaded.buildGasIntercept;
+    else if (key == "aabbTestPerIS") ls >> loaded.aabbTestPerIS;
+    else if (key == "sphereTestPerIS") ls >> loaded.sphereTestPerIS;
+    else if (key == "knnSearchPerIS") ls >> loaded.knnSearchPerIS;
+    else if (key == "sample") {
+      std::string which;
+      CostSample s;
+      if (!(ls >> which >> s.x >> s.ms)) return false;
+      if (which == "buildGas") samples.buildGas.push_back(s);
+      else if (which == "aabbTest") samples.aabbTest.push_back(s);
+      else if (which == "sphereTest") samples.sphereTest.push_back(s);
+      else if (which == "knnSearch") samples.knnSearch.push_back(s);
+    }
+    if (ls.fail()) return false;
+  }
+
+  model = loaded;
+  if (record) *record = samples;
+  return true;
+}
+
+float gasBuildTime(const CostModel& model, unsigned int numAABBs) {
+  return numAABBs * model.buildGasPerAABB + model.buildGasIntercept;
+}
+
+int chooseBatchSplit(const std::vector<float>& extraTime, float tBuildGAS) {
+  int numAvailBatches = (int)extraTime.size();
+
+  // incrementally combine batch i with the last batch (assuming all other
+  // batches are independent) and calculate the cost. choose the min cost.
+  float overhead = 0;
+  float maxOverhead = 0; // overhead must be negative for bundling to be useful
+  int splitId = numAvailBatches - 1; // by default we don't bundle
+  for (int i = numAvailBatches - 2; i >= 0; i--) {
+    overhead += extraTime[i] - tBuildGAS;
+    if (overhead < maxOverhead) {
+      maxOverhead = overhead;
+      splitId = i;
+    }
+  }
+  return splitId;
+}
@@ -0,0 +1,60 @@
+#pragma once
+
+#include <string>
+#include <vector>
+
+// Cost model behind the automatic batching (see |autoBatchingRange| and
+// |autoBatchingKNN|): building a GAS costs time linear in its AABBs, and a
+// batch searched with a larger radius (or with sphere instead of AABB tests)
+// costs time linear in the extra IS calls. The coefficients default to the
+// ones measured on a 2080/2080Ti; --calibrate measures them on the current GPU
+// (see calibrate.cpp) and saves them, with the samples they were fitted to, as
+// a per-device profile in the --profile directory, which later runs load.
+//
+// Everything here is plain host code, so profiles recorded on any GPU can be
+// refitted and replayed through the batching decision offline.
+#define RTNN_PROFILE_VERSION 1
+
+struct CostModel
+{
+  float                       buildGasPerAABB   = 3.8e-6; // GAS building time in *ms* / AABB
+  float                       buildGasIntercept = 20; // ms
+  float                       aabbTestPerIS     = 1e-5/50; // IS call time in *ms* if doing aabb test (by 50 as it's per K)
+  float                       sphereTestPerIS   = 1e-4/50; // IS call time in *ms* if doing sphere test
+  float                       knnSearchPerIS    = 6e-2; // knn search time in *ms* per IS call
+  std::string                 device; // empty for the defaults
+};
+
+struct CostSample
+{
+  double                      x; // AABBs or IS calls
+  double                      ms;
+};
+
+// what a calibration measured; |fitCostModel| turns it into coefficients.
+struct CostRecord
+{
+  std::string                 device;
+  std::vector<CostSample>     buildGas;
+  std::vector<CostSample>     aabbTest; // x is queries * K
+  std::vector<CostSample>     sphereTest; // x is queries * K
+  std::vector<CostSample>     knnSearch; // x is the expected IS calls
+};
+
+// least squares; false (and nothing set) with fewer than 2 distinct x.
+bool fitLine(const std::vector<CostSample>&, double& slope, double& intercept);
+// coefficients that can't be fitted (too few samples, or a non-positive
+// slope) keep their defaults.
+CostModel fitCostModel(const CostRecord&);
+
+// e.g., "GeForce RTX 3090" -> "rtnn-GeForce_RTX_3090.profile"
+std::string costProfileName(const std::string& device);
+bool saveCostProfile(const std::string& path, const CostModel&, const CostRecord&);
+// the record, if given, gets the samples the profile was fitted to.
+bool loadCostProfile(const std::string& path, CostModel&, CostRecord* record = nullptr);
+
+float gasBuildTime(const CostModel&, unsigned int numAABBs);
+// |extraTime[i]| is the time batch i would add if it were searched as part of
+// the last batch instead of on its own GAS; returns the first batch that is
+// merged into the last one (the last batch itself if none is).
+int chooseBatchSplit(const std::vector<float>& extraTime, float tBuildGAS);
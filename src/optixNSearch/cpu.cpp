@@ -0,0 +1,157 @@
+#include <sutil/Timing.h>
+#include <sutil/Exception.h>
+
+#include <algorithm>
+#include <climits>
+#include <cmath>
+#include <limits>
+#include <vector>
+
+#include "optixNSearch.h"
+#include "state.h"
+#include "func.h"
+#include "grid.h"
+#include "hostgrid.h"
+#include "morton.h"
+#include "axiskeys.h"
+#include "csr.h"
+#include "parallel.h"
+
+// host counterpart of |computeMinMax|; same floor/ceil semantics so that the
+// grid generated by |genGridInfo| is identical to the one of the GPU backend.
+void computeMinMaxHost(unsigned int N, float3* particles, float3& min, float3& max, unsigned int numThreads)
+{
+  unsigned int threads = numHostThreads(numThreads);
+  std::vector<int3> minCells(threads, make_int3(std::numeric_limits<int>::max(), std::numeric_limits<int>::max(), std::numeric_limits<int>::max()));
+  std::vector<int3> maxCells(threads, make_int3(std::numeric_limits<int>::min(), std::numeric_limits<int>::min(), std::numeric_limits<int>::min()));
+
+  parallelFor(N, threads, [&](unsigned int b, unsigned int e, unsigned int tid) {
+    int3 minCell = minCells[tid];
+    int3 maxCell = maxCells[tid];
+    for (unsigned int i = b; i < e; i++) {
+      int3 cell = make_int3((int)floorf(particles[i].x), (int)floorf(particles[i].y), (int)floorf(particles[i].z));
+      minCell = make_int3(std::min(minCell.x, cell.x), std::min(minCell.y, cell.y), std::min(minCell.z, cell.z));
+      maxCell = make_int3(std::max(maxCell.x, cell.x), std::max(maxCell.y, cell.y), std::max(maxCell.z, cell.z));
+    }
+    minCells[tid] = minCell;
+    maxCells[tid] = maxCell;
+  });
+
+  int3 minCell = minCells[0];
+  int3 maxCell = maxCells[0];
+  for (unsigned int t = 1; t < threads; t++) {
+    minCell = make_int3(std::min(minCell.x, minCells[t].x), std::min(minCell.y, minCells[t].y), std::min(minCell.z, minCells[t].z));
+    maxCell = make_int3(std::max(maxCell.x, maxCells[t].x), std::max(maxCell.y, maxCells[t].y), std::max(maxCell.z, maxCells[t].z));
+  }
+  maxCell = maxCell + make_int3(1, 1, 1);
+
+  min = make_float3(minCell.x, minCell.y, minCell.z);
+  max = make_float3(maxCell.x, maxCell.y, maxCell.z);
+
+  fprintf(stdout, "\tscene boundary: (%f, %f, %f), (%f, %f, %f)\n", min.x, min.y, min.z, max.x, max.y, max.z);
+}
+
+void searchCPU(RTNNState& state) {
+  // the CPU backend needs no device; it keeps the GPU output layout (a single
+  // batch, |knn| slots per query padded with UINT_MAX) so that the sanity
+  // check and anything reading |h_res| work unchanged.
+  unsigned int numThreads = numHostThreads(state.numThreads);
+  fprintf(stdout, "\tHost threads: %u\n", numThreads);
+
+  Timing::startTiming("create host grid");
+    computeMinMaxHost(state.numPoints, state.h_points, state.pMin, state.pMax, numThreads);
+    if (state.samepq) {
+      state.qMin = state.pMin;
+      state.qMax = state.pMax;
+    } else computeMinMaxHost(state.numQueries, state.h_queries, state.qMin, state.qMax, numThreads);
+    state.Min = fminf(state.qMin, state.pMin);
+    state.Max = fmaxf(state.qMax, state.pMax);
+
+    // see |uploadData|.
+    state.gRadius = state.radius;
+    float3 O = state.Min - state.Max;
+    state.radius = std::min(state.radius, sqrtf(dot(O, O)));
+    fprintf(stdout, "\tGiven radius: %f\n", state.gRadius);
+    fprintf(stdout, "\tActual radius: %f\n", state.radius);
+
+    state.crRatio = state.radius / hostCellSize(state.Min, state.Max, state.radius,
+        (state.searchMode == "knn") ? state.knn : 0, state.numPoints, state.sparseGrid);
+    GridInfo gridInfo;
+    unsigned int numberOfCells = genGridInfo(state, state.numPoints, gridInfo);
+
+    // raster or Hilbert order only if asked for; morton otherwise
+    CellOrder cellOrder = MORTON_ORDER;
+    if (state.pointSortMode == 2) cellOrder = RASTER_ORDER;
+    else if (state.pointSortMode == 5) cellOrder = HILBERT_ORDER;
+
+    HostGrid grid;
+    buildHostGrid(grid, state.h_points, state.numPoints, gridInfo, numberOfCells,
+        cellOrder,
+        numThreads,
+        state.sparseGrid);
+  Timing::stopTiming(true);
+
+  state.maxBatchCount = 1;
+  state.numOfBatches = 1;
+  state.numActQueries = new unsigned int[1];
+  state.launchRadius = new float[1];
+  state.h_res = new void*[1]();
+  state.h_actQs = new float3*[1]();
+  state.numActQueries[0] = state.numQueries;
+  state.launchRadius[0] = state.radius;
+  state.h_actQs[0] = state.h_queries;
+
+  Timing::startTiming("host search");
+    unsigned int limit = state.knn;
+    bool knn = (state.searchMode == "knn");
+    unsigned int* res = new unsigned int[(size_t)state.numQueries * limit];
+
+    // with -qs 4, visit the queries along the 64-bit morton curve so that
+    // consecutive queries touch the same cells (-qs 3: along |sortAxis|);
+    // results stay in query order.
+    std::vector<unsigned int> order;
+    if (state.querySortMode == 4) {
+      GridInfo mortonGrid;
+      calcGridInfo(state.Min, state.Max, morton64CellSize(state.Min, state.Max), state.mcScale, state.numQueries, mortonGrid);
+      order.resize(state.numQueries);
+      mortonOrder64(mortonGrid, state.h_queries, state.numQueries, order.data(), numThreads);
+    } else if (state.querySortMode == 3) {
+      order.resize(state.numQueries);
+      axisOrder(state.h_queries, state.numQueries, sortAxis(state.sortAxis, state.Min, state.Max), order.data(), numThreads);
+    }
+
+    parallelFor(state.numQueries, numThreads, [&](unsigned int b, unsigned int e, unsigned int) {
+      for (unsigned int i = b; i < e; i++) {
+        unsigned int q = order.empty() ? i : order[i];
+        unsigned int* qRes = res + (size_t)q * limit;
+        unsigned int size;
+        if (knn) size = hostKnnSearch(grid, state.h_queries[q], state.radius, limit, qRes);
+        else size = hostRadiusSearch(grid, state.h_queries[q], state.radius, limit, qRes);
+        std::fill(qRes + size, qRes + limit, UINT_MAX);
+      }
+    });
+    state.h_res[0] = res;
+  Timing::stopTiming(true);
+
+  if (state.csr) {
+    // same CSR layout as the GPU path, compacted on the host.
+    Timing::startTiming("result compaction");
+      state.h_resOffsets = new unsigned int*[1];
+      state.h_resOffsets[0] = new unsigned int[state.numQueries + 1];
+      state.h_res[0] = denseToCSR(res, state.numQueries, limit, state.h_resOffsets[0]);
+      delete[] res;
+    Timing::stopTiming(true);
+  }
+}
+
+void cleanupCPUState(RTNNState& state) {
+  delete[] static_cast<unsigned int*>(state.h_res[0]);
+  delete[] state.h_res;
+  if (state.h_resOffsets) delete[] state.h_resOffsets[0];
+  delete[] state.h_resOffsets;
+  state.h_resOffsets = nullptr;
+  delete[] state.numActQueries;
+  delete[] state.launchRadius;
+  delete[] state.h_actQs;
+  unmapPointFiles(state);
+}
@@ -0,0 +1,60 @@
+#include <algorithm>
+#include <climits>
+#include <cstdio>
+#include <unordered_set>
+
+#include "csr.h"
+
+unsigned int countRowNeighbors(const unsigned int* row, unsigned int limit) {
+  unsigned int n = 0;
+  while (n < limit && row[n] != UINT_MAX) n++;
+  return n;
+}
+
+unsigned int* denseToCSR(const unsigned int* dense, unsigned int numQueries, unsigned int limit, unsigned int* offsets) {
+  offsets[0] = 0;
+  for (unsigned int q = 0; q < numQueries; q++)
+    offsets[q + 1] = offsets[q] + countRowNeighbors(dense + (size_t)q * limit, limit);
+
+  unsigned int* indices = new unsigned int[offsets[numQueries]];
+  for (unsigned int q = 0; q < numQueries; q++) {
+    const unsigned int* row = dense + (size_t)q * limit;
+    std::copy(row, row + (offsets[q + 1] - offsets[q]), indices + offsets[q]);
+  }
+
+  return indices;
+}
+
+bool validateCSR(const unsigned int* offsets, const unsigned int* indices, unsigned int numQueries, unsigned int limit, unsigned int numPoints) {
+  if (offsets[0] != 0) {
+    fprintf(stdout, "CSR offsets start at %u instead of 0\n", offsets[0]);
+    return false;
+  }
+
+  std::unordered_set<unsigned int> seen;
+  for (unsigned int q = 0; q < numQueries; q++) {
+    if (offsets[q + 1] < offsets[q]) {
+      fprintf(stdout, "CSR offsets decrease at query %u: %u -> %u\n", q, offsets[q], offsets[q + 1]);
+      return false;
+    }
+    if (offsets[q + 1] - offsets[q] > limit) {
+      fprintf(stdout, "Query %u has %u neighbors, more than the limit %u\n", q, offsets[q + 1] - offsets[q], limit);
+      return false;
+    }
+
+    seen.clear();
+    for (unsigned int i = offsets[q]; i < offsets[q + 1]; i++) {
+      unsigned int p = indices[i];
+      if (p >= numPoints) {
+        fprintf(stdout, "Query %u has an invalid neighbor %u (%u points)\n", q, p, numPoints);
+        return false;
+      }
+      if (!seen.insert(p).second) {
+        fprintf(stdout, "Query %u lists neighbor %u more than once\n", q, p);
+        return false;
+      }
+    }
+  }
+
+  return true;
+}
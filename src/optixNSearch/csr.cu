@@ -0,0 +1,62 @@
+#include <climits>
+
+// one thread per query: count the leading (i.e., valid) slots of its padded row.
+__global__ void kCountNeighbors_t (
+      const unsigned int* dense,
+      unsigned int numQueries,
+      unsigned int limit,
+      unsigned int* counts
+)
+{
+  unsigned int q = blockIdx.x * blockDim.x + threadIdx.x;
+  if (q >= numQueries) return;
+
+  const unsigned int* row = dense + (size_t)q * limit;
+  unsigned int n = 0;
+  while (n < limit && row[n] != UINT_MAX) n++;
+  counts[q] = n;
+}
+
+// one thread per query: move its valid slots to offsets[q] in the CSR indices.
+__global__ void kCompactNeighbors_t (
+      const unsigned int* dense,
+      unsigned int numQueries,
+      unsigned int limit,
+      const unsigned int* offsets,
+      unsigned int* indices
+)
+{
+  unsigned int q = blockIdx.x * blockDim.x + threadIdx.x;
+  if (q >= numQueries) return;
+
+  const unsigned int* row = dense + (size_t)q * limit;
+  unsigned int begin = offsets[q];
+  unsigned int n = offsets[q + 1] - begin;
+  for (unsigned int i = 0; i < n; i++)
+    indices[begin + i] = row[i];
+}
+
+void kCountNeighbors(const unsigned int* dense, unsigned int numQueries, unsigned int limit, unsigned int* counts, cudaStream_t stream) {
+  unsigned int threadsPerBlock = 64;
+  unsigned int numOfBlocks = numQueries / threadsPerBlock + 1;
+
+  kCountNeighbors_t <<<numOfBlocks, threadsPerBlock, 0, stream>>> (
+      dense,
+      numQueries,
+      limit,
+      counts
+     );
+}
+
+void kCompactNeighbors(const unsigned int* dense, unsigned int numQueries, unsigned int limit, const unsigned int* offsets, unsigned int* indices, cudaStream_t stream) {
+  unsigned int threadsPerBlock = 64;
+  unsigned int numOfBlocks = numQueries / threadsPerBlock + 1;
+
+  kCompactNeighbors_t <<<numOfBlocks, threadsPerBlock, 0, stream>>> (
+      dense,
+      numQueries,
+      limit,
+      offsets,
+      indices
+     );
+}
@@ -0,0 +1,19 @@
+#pragma once
+
+// Compressed sparse row (CSR) neighbor lists, the compact alternative to the
+// padded |knn|-slots-per-query result layout. For a batch of |numQueries|
+// queries, |offsets| has numQueries + 1 entries and the neighbors of query q
+// are indices[offsets[q]] .. indices[offsets[q + 1] - 1]; offsets[numQueries]
+// is the total neighbor count. The GPU path builds the CSR on the device (see
+// |kCountNeighbors| and |kCompactNeighbors|); the functions here are the host
+// equivalents and need no device.
+
+// number of neighbors in a padded row, i.e., the slots before the first UINT_MAX.
+unsigned int countRowNeighbors(const unsigned int*, unsigned int);
+// compact |numQueries| padded rows of |limit| slots each; fills |offsets| and
+// returns the indices, allocated with new[].
+unsigned int* denseToCSR(const unsigned int*, unsigned int, unsigned int, unsigned int*);
+// checks that the offsets are monotonic, that no row has more than |limit|
+// neighbors, and that every index is a valid point id (< |numPoints|) that
+// appears at most once in its row. prints the first violation.
+bool validateCSR(const unsigned int*, const unsigned int*, unsigned int, unsigned int, unsigned int);
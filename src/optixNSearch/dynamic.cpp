@@ -0,0 +1,37 @@
+#include <algorithm>
+#include <vector>
+
+#include <sutil/vec_math.h>
+
+#include "dynamic.h"
+#include "parallel.h"
+
+float maxDisplacement(const float3* from, const float3* to, unsigned int N, unsigned int numThreads) {
+  numThreads = numHostThreads(numThreads);
+  std::vector<float> threadMax(numThreads, 0.0f);
+
+  parallelFor(N, numThreads, [&](unsigned int b, unsigned int e, unsigned int tid) {
+    float maxSqDist = threadMax[tid];
+    for (unsigned int i = b; i < e; i++) {
+      float3 d = to[i] - from[i];
+      maxSqDist = std::max(maxSqDist, dot(d, d));
+    }
+    threadMax[tid] = maxSqDist;
+  });
+
+  return sqrtf(*std::max_element(threadMax.begin(), threadMax.end()));
+}
+
+FrameAction planFrame(const RefitSchedule& schedule, float maxDisp, float radius, float maxDrift, unsigned int maxRefits) {
+  if (schedule.refits >= maxRefits) return FRAME_REBUILD;
+  if (maxDisp > maxDrift * radius) return FRAME_REBUILD;
+  return FRAME_REFIT;
+}
+
+void recordFrame(RefitSchedule& schedule, FrameAction action) {
+  if (action == FRAME_REFIT) schedule.refits++;
+  else {
+    schedule.refits = 0;
+    schedule.rebuilds++;
+  }
+}
@@ -0,0 +1,30 @@
+#pragma once
+
+#include <vector_types.h>
+
+// When to refit and when to rebuild in the dynamic (time-stepped) mode, see
+// |NeighborSearch::updatePoints|. A refit keeps the BVH topology and the point
+// order of the last full build and only updates the bounds: results stay exact,
+// but as particles drift away from where they were at the build, sibling
+// bounds overlap more (more AABB tests per ray) and the sorted order loses its
+// locality. So a frame is refit only while the largest displacement since the
+// last build is a small fraction of the search radius (the AABB half width),
+// and at most |maxRefits| times in a row; otherwise everything is rebuilt
+// (and re-sorted).
+enum FrameAction
+{
+    FRAME_REBUILD = 0,
+    FRAME_REFIT   = 1
+};
+
+struct RefitSchedule
+{
+  unsigned int                refits          = 0; // since the last build
+  unsigned int                rebuilds        = 0;
+};
+
+// largest distance any point moved between |from| and |to| (same order).
+float maxDisplacement(const float3*, const float3*, unsigned int, unsigned int numThreads = 0);
+// |maxDisp| is measured against the positions of the last build.
+FrameAction planFrame(const RefitSchedule&, float maxDisp, float radius, float maxDrift, unsigned int maxRefits);
+void recordFrame(RefitSchedule&, FrameAction);
@@ -10,6 +10,8 @@
 
 #include "state.h"
 #include "grid.h"
+#include "arena.h"
+#include "cellsize.h"
 
 void sortByKey( thrust::device_ptr<float>, thrust::device_ptr<unsigned int>, unsigned int, cudaStream_t );
 void sortByKey( thrust::device_ptr<float>, thrust::device_ptr<unsigned int>, unsigned int );
@@ -19,10 +21,14 @@ void sortByKey( thrust::device_vector<float>*, thrust::device_ptr<float3> );
 void sortByKey( thrust::device_ptr<float>, thrust::device_ptr<float3>, unsigned int );
 void sortByKey( thrust::device_ptr<unsigned int>, thrust::device_ptr<float3>, unsigned int );
 void sortByKey( thrust::device_ptr<unsigned int>, thrust::device_ptr<int>, unsigned int );
+void stableSortByKey( thrust::device_ptr<unsigned long long>, thrust::device_ptr<float3>, unsigned int );
+void stableSortByKey( thrust::device_ptr<unsigned long long>, thrust::device_ptr<unsigned int>, unsigned int );
+void stableSortByKey( thrust::device_ptr<unsigned long long>, thrust::device_ptr<int>, unsigned int );
 void gatherByKey ( thrust::device_vector<unsigned int>*, thrust::device_ptr<float3>, thrust::device_ptr<float3> );
 void gatherByKey ( thrust::device_vector<unsigned int>*, thrust::device_ptr<float3>, thrust::device_ptr<float3>, cudaStream_t );
 void gatherByKey ( thrust::device_ptr<unsigned int>, thrust::device_ptr<float3>, thrust::device_ptr<float3>, unsigned int, cudaStream_t );
 void gatherByKey ( thrust::device_ptr<unsigned int>, thrust::device_ptr<float3>, thrust::device_ptr<float3>, unsigned int );
+void gatherByKey ( thrust::device_ptr<unsigned int>, thrust::device_ptr<unsigned int>, thrust::device_ptr<unsigned int>, unsigned int, cudaStream_t );
 void gatherByKey ( thrust::device_ptr<unsigned int>, thrust::device_vector<float>*, thrust::device_ptr<float>, unsigned int, cudaStream_t );
 void gatherByKey ( thrust::device_ptr<unsigned int>, thrust::device_vector<float>*, thrust::device_ptr<float>, unsigned int );
 void gatherByKey ( thrust::device_ptr<unsigned int>, thrust::device_ptr<float>, thrust::device_ptr<float>, unsigned int );
@@ -35,13 +41,17 @@ void fillByValue(thrust::device_ptr<unsigned int>, unsigned int, int);
 void copyIfIdMatch(float3*, unsigned int, thrust::device_ptr<int>, thrust::device_ptr<float3>, int);
 void copyIfInRange(float3*, unsigned int, thrust::device_ptr<float3>, thrust::device_ptr<float3>, float3, float3);
 void copyIfNotInRange(float3*, unsigned int, float3*, float3*, float3, float3);
+void copyIfInRange(unsigned int*, unsigned int, thrust::device_ptr<float3>, thrust::device_ptr<unsigned int>, float3, float3);
 void copyIfIdInRange(float3*, unsigned int, thrust::device_ptr<int>, thrust::device_ptr<float3>, int, int);
+void copyIfIdInRange(unsigned int*, unsigned int, thrust::device_ptr<int>, thrust::device_ptr<unsigned int>, int, int);
 void copyIfNonZero(float3*, unsigned int, thrust::device_ptr<bool>, thrust::device_ptr<float3>);
 unsigned int countById(thrust::device_ptr<int>, unsigned int, int);
 unsigned int countIfInRange(thrust::device_ptr<float3>, unsigned int, float3, float3);
 unsigned int uniqueByKey(thrust::device_ptr<unsigned int>, unsigned int N, thrust::device_ptr<unsigned int> dest);
 unsigned int countUniq(thrust::device_ptr<unsigned int>, unsigned int);
+void sortKeys(thrust::device_ptr<unsigned int>, unsigned int);
 void thrustCopyD2D(thrust::device_ptr<unsigned int>, thrust::device_ptr<unsigned int>, unsigned int N);
+void thrustCopyD2D(thrust::device_ptr<unsigned long long>, thrust::device_ptr<unsigned long long>, unsigned int N);
 unsigned int thrustGenHist(const thrust::device_ptr<int>, thrust::device_vector<unsigned int>&, unsigned int);
 bool operator<=(float3, float3);
 bool operator>=(float3, float3);
@@ -62,14 +72,42 @@ template <typename T> T* allocThrustDevicePtr(thrust::device_ptr<T>* d_memory, u
   return d_memory_raw;
 }
 
+// allocate from |scope| of the device arena (see arena.h), or without one
+// (|useArena| off) from cudaMalloc, tracked in d_gridPointers for ARENA_GRID
+// and in d_pointers otherwise.
+void* arenaAllocDevice(RTNNState&, ArenaScope, size_t);
+void releaseArenaScope(RTNNState&, ArenaScope);
+void trimDeviceArena(RTNNState&, bool);
+void destroyDeviceArena(RTNNState&);
+
+// pinned host memory from the pool (see pinned.h), or straight from
+// cudaMallocHost without one (|usePinnedPool| off).
+void* allocPinned(RTNNState&, size_t);
+void freePinned(RTNNState&, void*);
+void destroyPinnedPool(RTNNState&);
+// a synchronous H2D copy from pageable memory, staged through pinned buffers.
+void uploadStaged(RTNNState&, void*, const void*, size_t);
+
+template <typename T> T* allocThrustDevicePtr(thrust::device_ptr<T>* d_memory, unsigned int N, RTNNState& state, ArenaScope scope) {
+  T* d_memory_raw = static_cast<T*>(arenaAllocDevice(state, scope, (size_t)N * sizeof(T)));
+  *d_memory = thrust::device_pointer_cast(d_memory_raw);
+  return d_memory_raw;
+}
+
 void kComputeMinMax (unsigned int, unsigned int, float3*, unsigned int, int3*, int3*);
-void kInsertParticles(unsigned int, unsigned int, GridInfo, float3*, unsigned int*, unsigned int*, unsigned int*, bool);
+void kInsertParticles(unsigned int, unsigned int, GridInfo, CellTable, float3*, unsigned int*, unsigned int*, unsigned int*, CellOrder);
+void kCellKeys(unsigned int, unsigned int, GridInfo, float3*, unsigned int*, CellOrder);
+void kMortonKeys64(unsigned int, unsigned int, GridInfo, float3*, unsigned long long*);
+void kAxisKeys(unsigned int, unsigned int, float3*, unsigned int*, unsigned int, int, float*, cudaStream_t);
+void kQuantizePoints(unsigned int, unsigned int, QuantInfo, float3*, unsigned int, unsigned int*, ushort3*);
+void kAxisKeysQuantized(unsigned int, unsigned int, QuantInfo, const unsigned int*, const ushort3*, unsigned int*, unsigned int, int, float*, cudaStream_t);
 void kCountingSortIndices(unsigned int, unsigned int, GridInfo, unsigned int*, unsigned int*, unsigned int*, unsigned int*);
 void kCountingSortIndices_setRayMask(unsigned int, unsigned int, GridInfo, unsigned int*, unsigned int*, unsigned int*, unsigned int*, int*, int*);
 void kCalcSearchSize(unsigned int,
                      unsigned int,
                      GridInfo,
-                     bool, 
+                     CellOrder,
+                     CellTable,
                      unsigned int*,
                      unsigned int*,
                      float3*,
@@ -80,7 +118,8 @@ void kCalcSearchSize(unsigned int,
                     );
 void calcSearchSize(int3,
                     GridInfo,
-                    bool, 
+                    CellOrder,
+                    CellTable,
                     unsigned int*,
                     float,
                     float,
@@ -90,33 +129,65 @@ void calcSearchSize(int3,
 float kGetWidthFromIter(int, float);
 
 void sanityCheck(RTNNState&);
+const unsigned int* getNeighbors(RTNNState&, int, unsigned int, unsigned int&);
 
 void computeMinMax(unsigned, float3*, float3&, float3&);
 unsigned int genGridInfo(RTNNState&, unsigned int, GridInfo&);
-void gridSort(RTNNState&, unsigned int, float3*, float3*, bool, ParticleType);
+void gridSort(RTNNState&, unsigned int, float3*, float3*, CellOrder, ParticleType);
+thrust::device_ptr<unsigned long long> genMortonKeys64(RTNNState&, unsigned int, float3*);
+void morton64Sort(RTNNState&, unsigned int, float3*, float3*, ParticleType);
 void sortParticles(RTNNState&, ParticleType, int);
-thrust::device_ptr<unsigned int> sortQueriesByFHCoord(RTNNState&, thrust::device_ptr<unsigned int>, int);
+thrust::device_ptr<unsigned int> sortQueriesByFHCoord(RTNNState&, thrust::device_ptr<unsigned int>, int, int);
 thrust::device_ptr<unsigned int> sortQueriesByFHIdx(RTNNState&, thrust::device_ptr<unsigned int>, int);
 void gatherQueries(RTNNState&, thrust::device_ptr<unsigned int>, int);
 
 void kGenAABB(float3*, float, unsigned int, OptixAabb*, cudaStream_t);
+void kGenAABBQuantized(QuantInfo, const unsigned int*, const ushort3*, float, unsigned int, OptixAabb*, cudaStream_t);
+void kCountNeighbors(const unsigned int*, unsigned int, unsigned int, unsigned int*, cudaStream_t);
+void kCompactNeighbors(const unsigned int*, unsigned int, unsigned int, const unsigned int*, unsigned int*, cudaStream_t);
 void uploadData(RTNNState&);
 void createGeometry(RTNNState&, int, float);
+void refitGeometry(RTNNState&, int, float);
+void createInstanceGeometry(RTNNState&, int, const OptixTraversableHandle*, const unsigned int*, unsigned int);
 void launchSubframe(unsigned int*, RTNNState&, int);
 void initLaunchParams(RTNNState&);
 void setupOptiX(RTNNState&);
+void createPipeline(RTNNState&);
+void cleanupSearch(RTNNState&);
+void cleanupOptiX(RTNNState&);
 void cleanupState(RTNNState&);
 float maxInscribedWidth(float, int);
 float minCircumscribedRadius(float, int);
 float radiusEquiVolume(float, int);
 
-int tokenize(std::string, std::string, float3**, unsigned int);
+float3* read_pc_data(const char*, unsigned int*, unsigned int);
+float3** read_pc_data(const char*, unsigned int*, int*, unsigned int);
 void parseArgs(RTNNState&, int, char**);
 void readData(RTNNState&);
+bool isMappedHostPtr(RTNNState&, void*);
+void unmapPointFiles(RTNNState&);
 void initBatches(RTNNState&);
+void initSingleBatch(RTNNState&);
 bool isClose(float3, float3);
 void freeGridPointers(RTNNState&);
+void setDevice(RTNNState&);
+
+void runServer(RTNNState&);
 
+void startResultWriter(RTNNState&, unsigned int);
+void writeResultAsync(RTNNState&, int);
+void finishResultWriter(RTNNState&);
+
+void quantizePoints(RTNNState&);
+void releaseExactPoints(RTNNState&);
+void setupSearch(RTNNState&);
+void loadDeviceProfile(RTNNState&);
+void calibrateCostModel(RTNNState&);
 void search(RTNNState&, int);
+void finishCompactResults(RTNNState&);
 void gasSortSearch(RTNNState&, int);
 thrust::device_ptr<unsigned int> initialTraversal(RTNNState&);
+
+void computeMinMaxHost(unsigned int, float3*, float3&, float3&, unsigned int);
+void searchCPU(RTNNState&);
+void cleanupCPUState(RTNNState&);
@@ -0,0 +1,153 @@
+#include <algorithm>
+#include <cinttypes>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <sstream>
+
+#include <unistd.h>
+
+#include "gascache.h"
+#include "parallel.h"
+
+// fixed chunking so that the hash doesn't depend on the thread count.
+static const unsigned int HASH_CHUNK = 1u << 20;
+
+static inline uint64_t mix64(uint64_t h) {
+  h ^= h >> 33;
+  h *= 0xff51afd7ed558ccdull;
+  h ^= h >> 33;
+  h *= 0xc4ceb9fe1a85ec53ull;
+  h ^= h >> 33;
+  return h;
+}
+
+static uint64_t hashWords(const uint32_t* words, size_t N, uint64_t seed) {
+  uint64_t h = seed;
+  for (size_t i = 0; i < N; i++) h = mix64(h ^ words[i]) + 0x9e3779b97f4a7c15ull;
+  return h;
+}
+
+uint64_t hashPoints(const float3* points, unsigned int N, unsigned int numThreads) {
+  unsigned int numChunks = (N + HASH_CHUNK - 1) / HASH_CHUNK;
+  std::vector<uint64_t> chunkHashes(numChunks);
+
+  parallelFor(numChunks, numThreads, 1, [&](unsigned int b, unsigned int e, unsigned int) {
+    for (unsigned int c = b; c < e; c++) {
+      size_t begin = (size_t)c * HASH_CHUNK;
+      size_t end = std::min(begin + HASH_CHUNK, (size_t)N);
+      chunkHashes[c] = hashWords(reinterpret_cast<const uint32_t*>(points + begin), (end - begin) * 3, c);
+    }
+  });
+
+  return hashWords(reinterpret_cast<const uint32_t*>(chunkHashes.data()), chunkHashes.size() * 2, N);
+}
+
+std::string gasCacheName(const GasCacheKey& key) {
+  uint32_t radiusBits;
+  memcpy(&radiusBits, &key.radius, sizeof(radiusBits));
+
+  char name[128];
+  snprintf(name, sizeof(name), "%016" PRIx64 "-%u-%08x-%u-%d.gas",
+      key.pointsHash, key.numPoints, radiusBits, key.optixVersion, key.driverVersion);
+  return name;
+}
+
+void loadGasCacheIndex(GasCacheIndex& index, const std::string& dir) {
+  index.dir = dir;
+  index.entries.clear();
+
+  std::ifstream in(dir + "/" + RTNN_GAS_INDEX);
+  std::string line;
+  while (std::getline(in, line)) {
+    std::istringstream fields(line);
+    GasCacheEntry entry;
+    if (fields >> entry.name >> entry.size >> entry.lastUse) index.entries.push_back(entry);
+  }
+}
+
+bool saveGasCacheIndex(const GasCacheIndex& index) {
+  std::string path = index.dir + "/" + RTNN_GAS_INDEX;
+  std::string tmp = path + ".tmp." + std::to_string(getpid());
+
+  std::ofstream out(tmp);
+  for (const auto& entry : index.entries)
+    out << entry.name << " " << entry.size << " " << entry.lastUse << "\n";
+  out.close();
+
+  if (!out || rename(tmp.c_str(), path.c_str()) != 0) {
+    unlink(tmp.c_str());
+    return false;
+  }
+  return true;
+}
+
+GasCacheEntry* findGasCacheEntry(GasCacheIndex& index, const std::string& name) {
+  for (auto& entry : index.entries)
+    if (entry.name == name) return &entry;
+  return nullptr;
+}
+
+void touchGasCacheEntry(GasCacheIndex& index, const std::string& name, uint64_t size, int64_t now) {
+  GasCacheEntry* entry = findGasCacheEntry(index, name);
+  if (entry) {
+    entry->size = size;
+    entry->lastUse = now;
+  } else index.entries.push_back({name, size, now});
+}
+
+void removeGasCacheEntry(GasCacheIndex& index, const std::string& name) {
+  index.entries.erase(std::remove_if(index.entries.begin(), index.entries.end(),
+      [&](const GasCacheEntry& entry) { return entry.name == name; }), index.entries.end());
+}
+
+std::vector<std::string> evictGasCacheEntries(GasCacheIndex& index, uint64_t maxBytes, const std::string& keep) {
+  uint64_t total = 0;
+  for (const auto& entry : index.entries) total += entry.size;
+
+  // oldest first; stable so that entries used at the same time go in index order.
+  std::vector<GasCacheEntry> byAge = index.entries;
+  std::stable_sort(byAge.begin(), byAge.end(),
+      [](const GasCacheEntry& a, const GasCacheEntry& b) { return a.lastUse < b.lastUse; });
+
+  std::vector<std::string> victims;
+  for (const auto& entry : byAge) {
+    if (total <= maxBytes) break;
+    if (entry.name == keep) continue;
+    total -= entry.size;
+    victims.push_back(entry.name);
+    removeGasCacheEntry(index, entry.name);
+  }
+  return victims;
+}
+
+bool readGasFile(const std::string& path, const GasCacheKey& key, GasFileHeader& header, std::vector<char>& gas) {
+  FILE* fp = fopen(path.c_str(), "rb");
+  if (!fp) return false;
+
+  bool ok = (fread(&header, sizeof(header), 1, fp) == 1) &&
+            (memcmp(header.magic, RTNN_GAS_MAGIC, sizeof(header.magic)) == 0) &&
+            (header.version == RTNN_GAS_VERSION) &&
+            (memcmp(&header.key, &key, sizeof(key)) == 0);
+  if (ok) {
+    gas.resize(header.gasSize);
+    ok = (fread(gas.data(), 1, header.gasSize, fp) == header.gasSize);
+  }
+
+  fclose(fp);
+  return ok;
+}
+
+bool writeGasFile(const std::string& path, const GasFileHeader& header, const void* gas) {
+  std::string tmp = path + ".tmp." + std::to_string(getpid());
+  FILE* fp = fopen(tmp.c_str(), "wb");
+  if (!fp) return false;
+
+  bool ok = (fwrite(&header, sizeof(header), 1, fp) == 1) &&
+            (fwrite(gas, 1, header.gasSize, fp) == header.gasSize);
+  ok = (fclose(fp) == 0) && ok;
+
+  if (ok) ok = (rename(tmp.c_str(), path.c_str()) == 0);
+  if (!ok) unlink(tmp.c_str());
+  return ok;
+}
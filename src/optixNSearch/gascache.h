@@ -0,0 +1,76 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include <vector_types.h>
+
+// On-disk cache of compacted GASes (--gascache). A GAS only depends on the
+// (sorted) points, the AABB radius and the OptiX/driver that built it, so a
+// static map searched with many query files can load and relocate its GASes
+// instead of rebuilding them. Each GAS is one file in the cache directory,
+// named after its key; an index file there records the size and last use of
+// every entry so that the directory can be kept under a size limit (least
+// recently used entries go first).
+//
+// Everything here is plain host code; the device side (copy in/out, the
+// relocation) is in |createGeometry|.
+#define RTNN_GAS_MAGIC "RTNNGAS\0"
+#define RTNN_GAS_VERSION 1
+#define RTNN_GAS_INDEX "index.txt"
+
+struct GasCacheKey
+{
+  uint64_t                    pointsHash;
+  uint32_t                    numPoints;
+  float                       radius;
+  uint32_t                    optixVersion;
+  int32_t                     driverVersion;
+};
+
+// file layout: this header, then |gasSize| bytes of the compacted GAS.
+struct GasFileHeader
+{
+  char                        magic[8];
+  uint32_t                    version;
+  uint32_t                    reserved;
+  GasCacheKey                 key;
+  uint64_t                    relocInfo[4]; // OptixAccelRelocationInfo of the GAS
+  uint64_t                    gasSize;
+};
+
+struct GasCacheEntry
+{
+  std::string                 name;
+  uint64_t                    size;
+  int64_t                     lastUse;
+};
+
+struct GasCacheIndex
+{
+  std::string                 dir;
+  std::vector<GasCacheEntry>  entries;
+};
+
+// order-sensitive hash of the point coordinates (bit patterns); independent of
+// |numThreads|.
+uint64_t hashPoints(const float3*, unsigned int, unsigned int numThreads = 0);
+std::string gasCacheName(const GasCacheKey&);
+
+// a missing or unreadable index is an empty one.
+void loadGasCacheIndex(GasCacheIndex&, const std::string&);
+bool saveGasCacheIndex(const GasCacheIndex&);
+GasCacheEntry* findGasCacheEntry(GasCacheIndex&, const std::string&);
+// add an entry or refresh its size and last use.
+void touchGasCacheEntry(GasCacheIndex&, const std::string&, uint64_t, int64_t);
+void removeGasCacheEntry(GasCacheIndex&, const std::string&);
+// drop least recently used entries until the total size is within |maxBytes|
+// and return their names; |keep| is never dropped (e.g., the entry just added).
+std::vector<std::string> evictGasCacheEntries(GasCacheIndex&, uint64_t, const std::string& keep = "");
+
+// the payload is only read if the header matches |key|; returns false on a
+// miss or a mismatch.
+bool readGasFile(const std::string&, const GasCacheKey&, GasFileHeader&, std::vector<char>&);
+bool writeGasFile(const std::string&, const GasFileHeader&, const void*);
@@ -0,0 +1,161 @@
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include <sutil/vec_math.h>
+
+#include "workload.h"
+#include "pcio.h"
+
+// Writes a synthetic point set (see workload.h), and optionally a query set
+// drawn from the same scene, in the text format and/or the binary one:
+//
+//   rtnnGen -k lidar -n 1000000 -q 100000 -o scan
+//
+// gives scan.txt/scan.rtnn and scan_q.txt/scan_q.rtnn, to be searched with
+// optixNSearch -f scan.rtnn -q scan_q.rtnn. The same options always give the
+// same files.
+
+static void printGenUsageAndExit(const char* argv0) {
+  std::cerr << "Usage  : " << argv0 << " [options]\n";
+  std::cerr << "Options:\n";
+  std::cerr << "  --kind            | -k      uniform, clusters, surface, lidar or nbody. Default is uniform.\n";
+  std::cerr << "  --points          | -n      Number of search points. Default is 100000.\n";
+  std::cerr << "  --queries         | -q      Number of queries, written to a separate file. Default is 0 (the points are the queries).\n";
+  std::cerr << "  --extent          | -e      Size of the box the points lie in, as x,y,z or a single number. Default is 100.\n";
+  std::cerr << "  --seed            | -s      Random seed. Default is 1.\n";
+  std::cerr << "  --clusters        | -c      Number of Gaussian clusters (clusters) or halos (nbody). Default is 16.\n";
+  std::cerr << "  --spread          | -w      Cluster sigma and halo scale relative to the largest extent; a tenth of it is the surface thickness. Default is 0.02.\n";
+  std::cerr << "  --rings           | -rg     Number of LiDAR beams. Default is 64.\n";
+  std::cerr << "  --alpha           | -al     Power-law exponent of the halo masses (nbody); smaller is more skewed. Default is 1.5.\n";
+  std::cerr << "  --format          | -fmt    text, binary or both. Default is both.\n";
+  std::cerr << "  --out             | -o      Output prefix; \".txt\"/\".rtnn\" are appended, and \"_q\" for the queries. Default is the kind.\n";
+  std::cerr << "  --nt              | -nt     Number of host threads (0 = all hardware threads). Default is 0.\n";
+  exit(0);
+}
+
+static float3 parseExtent(const char* arg) {
+  std::vector<float> v;
+  std::stringstream ss(arg);
+  std::string f;
+  while (std::getline(ss, f, ',')) v.push_back(atof(f.c_str()));
+  if (v.size() == 1) return make_float3(v[0]);
+  if (v.size() != 3) {
+    fprintf(stderr, "Extent must be x,y,z or a single number: %s\n", arg);
+    exit(1);
+  }
+  return make_float3(v[0], v[1], v[2]);
+}
+
+// how skewed the density is: the share of the cells of a 64^3 grid over the
+// box that hold points, and how many more points the fullest cell has than
+// an average occupied one.
+static void printDensity(const float3* points, unsigned int N, float3 extent) {
+  const unsigned int dim = 64;
+  std::vector<unsigned int> counts(dim * dim * dim, 0);
+  for (unsigned int i = 0; i < N; i++) {
+    float3 c = points[i] / extent * (float)dim;
+    unsigned int x = std::min((unsigned int)c.x, dim - 1);
+    unsigned int y = std::min((unsigned int)c.y, dim - 1);
+    unsigned int z = std::min((unsigned int)c.z, dim - 1);
+    counts[(z * dim + y) * dim + x]++;
+  }
+  unsigned int occupied = 0, fullest = 0;
+  for (unsigned int c : counts) {
+    if (c) occupied++;
+    fullest = std::max(fullest, c);
+  }
+  fprintf(stdout, "\toccupied cells (64^3): %.2f%%, fullest cell: %.1fx the mean\n",
+      100.0 * occupied / counts.size(), occupied ? (double)fullest * occupied / N : 0.0);
+}
+
+static void writeSet(const std::string& prefix, const float3* points, unsigned int N, bool text, bool binary) {
+  if (text) {
+    std::string file = prefix + ".txt";
+    if (!writeTextPointFile(file.c_str(), points, N)) {
+      fprintf(stderr, "Could not write %s\n", file.c_str());
+      exit(1);
+    }
+    fprintf(stdout, "\twrote %s\n", file.c_str());
+  }
+  if (binary) {
+    std::string file = prefix + RTNN_FILE_EXT;
+    if (!writePointFile(file.c_str(), points, N)) {
+      fprintf(stderr, "Could not write %s\n", file.c_str());
+      exit(1);
+    }
+    fprintf(stdout, "\twrote %s\n", file.c_str());
+  }
+}
+
+int main( int argc, char* argv[] )
+{
+  WorkloadParams params;
+  unsigned int numPoints = 100000;
+  unsigned int numQueries = 0;
+  std::string format = "both";
+  std::string prefix;
+  unsigned int numThreads = 0;
+
+  for (int i = 1; i < argc; i++) {
+    const std::string arg = argv[i];
+    bool hasValue = (i < argc - 1);
+    if (arg == "--help" || arg == "-h") printGenUsageAndExit(argv[0]);
+    else if (!hasValue) printGenUsageAndExit(argv[0]);
+    else if (arg == "--kind" || arg == "-k") {
+      if (!parseWorkloadKind(argv[++i], params.kind)) {
+        fprintf(stderr, "Unknown kind: %s\n", argv[i]);
+        exit(1);
+      }
+    }
+    else if (arg == "--points" || arg == "-n") numPoints = atoi(argv[++i]);
+    else if (arg == "--queries" || arg == "-q") numQueries = atoi(argv[++i]);
+    else if (arg == "--extent" || arg == "-e") params.extent = parseExtent(argv[++i]);
+    else if (arg == "--seed" || arg == "-s") params.seed = strtoull(argv[++i], nullptr, 10);
+    else if (arg == "--clusters" || arg == "-c") params.clusters = atoi(argv[++i]);
+    else if (arg == "--spread" || arg == "-w") params.spread = atof(argv[++i]);
+    else if (arg == "--rings" || arg == "-rg") params.rings = atoi(argv[++i]);
+    else if (arg == "--alpha" || arg == "-al") params.alpha = atof(argv[++i]);
+    else if (arg == "--format" || arg == "-fmt") format = argv[++i];
+    else if (arg == "--out" || arg == "-o") prefix = argv[++i];
+    else if (arg == "--nt" || arg == "-nt") numThreads = atoi(argv[++i]);
+    else {
+      fprintf(stderr, "Unknown option: %s\n", argv[i]);
+      printGenUsageAndExit(argv[0]);
+    }
+  }
+
+  if (format != "text" && format != "binary" && format != "both") {
+    fprintf(stderr, "Format must be text, binary or both: %s\n", format.c_str());
+    exit(1);
+  }
+  if (params.extent.x <= 0 || params.extent.y <= 0 || params.extent.z <= 0) {
+    fprintf(stderr, "Extent must be positive\n");
+    exit(1);
+  }
+  bool text = (format != "binary");
+  bool binary = (format != "text");
+  if (prefix.empty()) prefix = workloadKindName(params.kind);
+
+  fprintf(stdout, "Kind: %s, extent: (%g, %g, %g), seed: %llu\n", workloadKindName(params.kind),
+      params.extent.x, params.extent.y, params.extent.z, (unsigned long long)params.seed);
+
+  std::vector<float3> points(numPoints);
+  generateWorkload(params, 0, numPoints, points.data(), numThreads);
+  fprintf(stdout, "%u points\n", numPoints);
+  printDensity(points.data(), numPoints, params.extent);
+  writeSet(prefix, points.data(), numPoints, text, binary);
+
+  if (numQueries) {
+    std::vector<float3> queries(numQueries);
+    generateWorkload(params, 1, numQueries, queries.data(), numThreads);
+    fprintf(stdout, "%u queries\n", numQueries);
+    printDensity(queries.data(), numQueries, params.extent);
+    writeSet(prefix + "_q", queries.data(), numQueries, text, binary);
+  }
+  return 0;
+}
@@ -35,12 +35,49 @@ extern "C" {
 __constant__ Params params;
 }
 
-extern "C" __device__ bool check_intersect(SearchType mode)
+// index of the intersected point in params.points. in a window search every
+// frame is a GAS of its own; the offset of its points is looked up by instance.
+extern "C" __device__ unsigned int pointIndex()
 {
   unsigned int primIdx = optixGetPrimitiveIndex();
-  const float3 center = params.points[primIdx];
+  if (params.instanced) primIdx += params.instanceOffsets[optixGetInstanceIndex()];
+  return primIdx;
+}
+
+// decide the test on the quantized point if it's clear either way; -1 means
+// the point is too close to the boundary and the real point must be tested.
+extern "C" __device__ int check_intersect_quantized(SearchType mode, unsigned int primIdx, const float3& ray_orig)
+{
+  const float3 center = quantDecode(params.quant, params.qCells[primIdx], params.qOffsets[primIdx]);
+  float lo2, hi2;
+  quantRadiusBand(params.quant, params.radius, lo2, hi2);
+
+  if (mode == AABBTEST) {
+    float3 O = ray_orig - center;
+    float3 sq = O * O;
+    if (fmaxf(sq) < lo2) return 1;
+    if (fmaxf(sq) >= hi2) return 0;
+  } else {
+    float3 O = ray_orig - center;
+    float sqdist = dot(O, O);
+    if (sqdist < lo2) return 1;
+    if (sqdist >= hi2) return 0;
+  }
+  return -1;
+}
+
+extern "C" __device__ bool check_intersect(SearchType mode)
+{
+  unsigned int primIdx = pointIndex();
   const float3 ray_orig = optixGetWorldRayOrigin();
 
+  if (params.quantized) {
+    int decided = check_intersect_quantized(mode, primIdx, ray_orig);
+    if (decided >= 0) return decided;
+  }
+
+  const float3 center = params.points[primIdx];
+
   bool intersect = false;
   if (mode == AABBTEST) {
     float3 topRight = center + params.radius;
@@ -74,7 +111,7 @@ extern "C" __device__ void write_res_radius()
   unsigned int id = optixGetPayload_1();
   if (id < params.limit) {
     unsigned int queryIdx = optixGetPayload_0();
-    unsigned int primIdx = optixGetPrimitiveIndex();
+    unsigned int primIdx = pointIndex();
     params.frame_buffer[queryIdx * params.limit + id] = primIdx;
     if (id + 1 == params.limit)
       optixReportIntersection( 0, 0 );
@@ -162,14 +199,32 @@ extern "C" __global__ void __intersection__sphere_knn()
   SearchType mode = params.mode;
 
   unsigned int queryIdx = optixGetPayload_0();
-  unsigned int primIdx = optixGetPrimitiveIndex();
+  unsigned int primIdx = pointIndex();
 
   if (mode == NOTEST) { // this implies that this is an initial traversal
     params.frame_buffer[queryIdx * params.limit] = primIdx;
     optixReportIntersection( 0, 0 );
   } else {
-    const float3 center = params.points[primIdx];
     const float3 ray_orig = optixGetWorldRayOrigin();
+
+    if (params.quantized) {
+      // the keys must be the real distances, so the quantized point can only
+      // rule out points: those surely out of the sphere, and, once K are
+      // found, those surely farther than the farthest of them.
+      const float3 qcenter = quantDecode(params.quant, params.qCells[primIdx], params.qOffsets[primIdx]);
+      float3 Oq = ray_orig - qcenter;
+      float qsqdist = dot(Oq, Oq);
+      float lo2, hi2;
+      quantRadiusBand(params.quant, params.radius, lo2, hi2);
+      if (qsqdist >= hi2) return;
+
+      if (optixGetPayload_7() == K) {
+        float lower = sqrtf(qsqdist) - quantSlack(params.quant, params.radius);
+        if ((lower > 0) && (lower * lower > uint_as_float(optixGetPayload_5()))) return;
+      }
+    }
+
+    const float3 center = params.points[primIdx];
     float3 O = ray_orig - center;
     float sqdist = dot(O, O);
 
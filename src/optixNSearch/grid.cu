@@ -6,30 +6,11 @@
 #include "helper_mortonCode.h"
 #include "helper_linearIndex.h"
 #include "grid.h"
+#include "helper_quantize.h"
 
 #include <stdio.h>
 
 /* GPU code */
-inline __host__ __device__ uint ToCellIndex_MortonMetaGrid(const GridInfo &GridInfo, int3 gridCell)
-{
-  //int3 temp = gridCell;
-
-  int3 metaGridCell = make_int3(
-    gridCell.x / GridInfo.meta_grid_dim,
-    gridCell.y / GridInfo.meta_grid_dim,
-    gridCell.z / GridInfo.meta_grid_dim);
-
-  gridCell.x %= GridInfo.meta_grid_dim;
-  gridCell.y %= GridInfo.meta_grid_dim;
-  gridCell.z %= GridInfo.meta_grid_dim;
-  uint metaGridIndex = CellIndicesToLinearIndex(GridInfo.MetaGridDimension, metaGridCell);
-
-  //if (temp.x == 283 && temp.y == 10 && temp.z == 418)
-  //  printf("(%d, %d, %d), (%d, %d, %d), %u, %u, %u\n", metaGridCell.x, metaGridCell.y, metaGridCell.z, gridCell.x, gridCell.y, gridCell.z, metaGridIndex, metaGridIndex * GridInfo.meta_grid_size, MortonCode3(gridCell.x, gridCell.y, gridCell.z));
-
-  return metaGridIndex * GridInfo.meta_grid_size + MortonCode3(gridCell.x, gridCell.y, gridCell.z);
-}
-
 inline __host__ __device__
 float getWidthFromIter(int iter, float cellSize) {
   // to be absolutely certain, we add 2 (not 1) to iter to accommodate points
@@ -44,24 +25,7 @@ float getWidthFromIter(int iter, float cellSize) {
 }
 
 inline __host__ __device__
-unsigned int getCellIdx(GridInfo gridInfo, int ix, int iy, int iz, bool morton) {
-  if (morton) // z-order sort
-    return ToCellIndex_MortonMetaGrid(gridInfo, make_int3(ix, iy, iz));
-  else // raster order
-    return (ix * gridInfo.GridDimension.y + iy) * gridInfo.GridDimension.z + iz;
-}
-
-inline __host__ __device__
-bool oob(GridInfo gridInfo, int ix, int iy, int iz) {
-  if (ix < 0 || ix >= (int)gridInfo.GridDimension.x
-   || iy < 0 || iy >= (int)gridInfo.GridDimension.y
-   || iz < 0 || iz >= (int)gridInfo.GridDimension.z)
-    return true;
-  else return false;
-}
-
-inline __host__ __device__
-void addCount(unsigned int& count, unsigned int* CellParticleCounts, GridInfo gridInfo, int ix, int iy, int iz, bool morton) {
+void addCount(unsigned int& count, const CellTable& table, unsigned int* CellParticleCounts, GridInfo gridInfo, int ix, int iy, int iz, CellOrder order) {
     if (oob(gridInfo, ix, iy, iz)) return;
 
     // TODO: weird bug using nvcc V10.0.130, Driver Version: 470.42.01, and CUDA Version: 11.4
@@ -69,14 +33,19 @@ void addCount(unsigned int& count, unsigned int* CellParticleCounts, GridInfo gr
     // that the returned result from getCellIdx is incorrect.
     // Fixed when using nvcc 11.3/.4, which, however, doesn't compile with thrust v101201. manually downgrading thrust.
 
-    //unsigned int iCellIdx = getCellIdx(gridInfo, ix, iy, iz, morton);
+    //unsigned int iCellIdx = getCellIdx(gridInfo, ix, iy, iz, order);
     int3 cell = make_int3(ix, iy, iz);
     unsigned int iCellIdx;
-    if (morton)
+    if (order == MORTON_ORDER)
       iCellIdx = ToCellIndex_MortonMetaGrid(gridInfo, cell);
+    else if (order == HILBERT_ORDER)
+      iCellIdx = ToCellIndex_HilbertMetaGrid(gridInfo, cell);
     else
       iCellIdx = (cell.x * gridInfo.GridDimension.y + cell.y) * gridInfo.GridDimension.z + cell.z;
 
+    iCellIdx = cellSlot(table, iCellIdx);
+    if (iCellIdx == NO_CELL) return; // empty cell of a sparse grid
+
     count += CellParticleCounts[iCellIdx];
     //if (ix == 87 && iy == 22 && iz == 358) printf("[%d, %d, %d]\n", ix, iy, iz, iCellIdx);
 }
@@ -84,7 +53,8 @@ void addCount(unsigned int& count, unsigned int* CellParticleCounts, GridInfo gr
 __host__ __device__
 void calcSearchSize(int3 gridCell,
                     GridInfo gridInfo,
-                    bool morton, 
+                    CellOrder order,
+                    CellTable table,
                     unsigned int* CellParticleCounts,
                     float cellSize,
                     float maxWidth,
@@ -101,21 +71,24 @@ void calcSearchSize(int3 gridCell,
   // that the returned result from getCellIdx is incorrect.
   // Fixed when using nvcc 11.3/.4, which, however, doesn't compile with thrust v101201. manually downgrading thrust.
 
-  //unsigned int cellIndex = getCellIdx(gridInfo, x, y, z, morton);
+  //unsigned int cellIndex = getCellIdx(gridInfo, x, y, z, order);
   unsigned int cellIndex;
-  if (morton)
+  if (order == MORTON_ORDER)
     cellIndex = ToCellIndex_MortonMetaGrid(gridInfo, gridCell);
+  else if (order == HILBERT_ORDER)
+    cellIndex = ToCellIndex_HilbertMetaGrid(gridInfo, gridCell);
   else
     cellIndex = (gridCell.x * gridInfo.GridDimension.y + gridCell.y) * gridInfo.GridDimension.z + gridCell.z;
+  // the query's own cell is always occupied.
+  cellIndex = cellSlot(table, cellIndex);
 
-
-  //if (x == 283 && y == 10 && z == 418) printf("cell %d has %d particles. morton? %d\n", cellIndex, CellParticleCounts[cellIndex], morton);
+  //if (x == 283 && y == 10 && z == 418) printf("cell %d has %d particles. order? %d\n", cellIndex, CellParticleCounts[cellIndex], order);
   //assert(cellIndex <= numberOfCells);
   //if (CellParticleCounts[cellIndex] == 0) return; // should never hit this.
 
   int iter = 0;
   unsigned int count = 0;
-  addCount(count, CellParticleCounts, gridInfo, x, y, z, morton);
+  addCount(count, table, CellParticleCounts, gridInfo, x, y, z, order);
 
   int xmin = x;
   int xmax = x;
@@ -153,42 +126,42 @@ void calcSearchSize(int3 gridCell,
     iz = zmin - 1;
     for (ix = xmin; ix <= xmax; ix++) {
       for (iy = ymin; iy <= ymax; iy++) {
-        addCount(count, CellParticleCounts, gridInfo, ix, iy, iz, morton);
+        addCount(count, table, CellParticleCounts, gridInfo, ix, iy, iz, order);
       }
     }
  
     iz = zmax + 1;
     for (ix = xmin; ix <= xmax; ix++) {
       for (iy = ymin; iy <= ymax; iy++) {
-        addCount(count, CellParticleCounts, gridInfo, ix, iy, iz, morton);
+        addCount(count, table, CellParticleCounts, gridInfo, ix, iy, iz, order);
       }
     }
 
     ix = xmin - 1;
     for (iy = ymin; iy <= ymax; iy++) {
       for (iz = zmin; iz <= zmax; iz++) {
-        addCount(count, CellParticleCounts, gridInfo, ix, iy, iz, morton);
+        addCount(count, table, CellParticleCounts, gridInfo, ix, iy, iz, order);
       }
     }
 
     ix = xmax + 1;
     for (iy = ymin; iy <= ymax; iy++) {
       for (iz = zmin; iz <= zmax; iz++) {
-        addCount(count, CellParticleCounts, gridInfo, ix, iy, iz, morton);
+        addCount(count, table, CellParticleCounts, gridInfo, ix, iy, iz, order);
       }
     }
  
     iy = ymin - 1;
     for (ix = xmin; ix <= xmax; ix++) {
       for (iz = zmin; iz <= zmax; iz++) {
-        addCount(count, CellParticleCounts, gridInfo, ix, iy, iz, morton);
+        addCount(count, table, CellParticleCounts, gridInfo, ix, iy, iz, order);
       }
     }
  
     iy = ymax + 1;
     for (ix = xmin; ix <= xmax; ix++) {
       for (iz = zmin; iz <= zmax; iz++) {
-        addCount(count, CellParticleCounts, gridInfo, ix, iy, iz, morton);
+        addCount(count, table, CellParticleCounts, gridInfo, ix, iy, iz, order);
       }
     }
  
@@ -199,14 +172,14 @@ void calcSearchSize(int3 gridCell,
     zmin--;
     zmax++;
  
-    addCount(count, CellParticleCounts, gridInfo, xmin, ymin, zmin, morton);
-    addCount(count, CellParticleCounts, gridInfo, xmin, ymin, zmax, morton);
-    addCount(count, CellParticleCounts, gridInfo, xmin, ymax, zmin, morton);
-    addCount(count, CellParticleCounts, gridInfo, xmin, ymax, zmax, morton);
-    addCount(count, CellParticleCounts, gridInfo, xmax, ymin, zmin, morton);
-    addCount(count, CellParticleCounts, gridInfo, xmax, ymin, zmax, morton);
-    addCount(count, CellParticleCounts, gridInfo, xmax, ymax, zmin, morton);
-    addCount(count, CellParticleCounts, gridInfo, xmax, ymax, zmax, morton);
+    addCount(count, table, CellParticleCounts, gridInfo, xmin, ymin, zmin, order);
+    addCount(count, table, CellParticleCounts, gridInfo, xmin, ymin, zmax, order);
+    addCount(count, table, CellParticleCounts, gridInfo, xmin, ymax, zmin, order);
+    addCount(count, table, CellParticleCounts, gridInfo, xmin, ymax, zmax, order);
+    addCount(count, table, CellParticleCounts, gridInfo, xmax, ymin, zmin, order);
+    addCount(count, table, CellParticleCounts, gridInfo, xmax, ymin, zmax, order);
+    addCount(count, table, CellParticleCounts, gridInfo, xmax, ymax, zmin, order);
+    addCount(count, table, CellParticleCounts, gridInfo, xmax, ymax, zmax, order);
   }
 }
 
@@ -239,8 +212,23 @@ __global__ void kComputeMinMax(
   //printf("%d %d %d Min: %d %d %d Max: %d %d %d \n", cell.x, cell.y, cell.z, minCell->x, minCell->y, minCell->z, maxCell->x, maxCell->y, maxCell->z);
 }
 
+__global__ void kQuantizePoints(
+  const QuantInfo quant,
+  const float3 *points,
+  unsigned int N,
+  unsigned int *cells,
+  ushort3 *offsets
+)
+{
+  unsigned int particleIndex = blockIdx.x * blockDim.x + threadIdx.x;
+  if (particleIndex >= N) return;
+
+  quantEncode(quant, points[particleIndex], cells[particleIndex], offsets[particleIndex]);
+}
+
 __global__ void kInsertParticles_Raster(
   const GridInfo GridInfo,
+  const CellTable table,
   const float3 *particles,
   unsigned int *particleCellIndices,
   unsigned int *cellParticleCounts,
@@ -255,6 +243,8 @@ __global__ void kInsertParticles_Raster(
   int3 gridCell = make_int3(int(gridCellF.x), int(gridCellF.y), int(gridCellF.z));
 
   unsigned int cellIndex = (gridCell.x * GridInfo.GridDimension.y + gridCell.y) * GridInfo.GridDimension.z + gridCell.z;
+  cellIndex = cellSlot(table, cellIndex);
+  if (cellIndex == NO_CELL) return; // not in the table of a sparse grid
   if (particleCellIndices)
     particleCellIndices[particleIndex] = cellIndex;
 
@@ -278,6 +268,7 @@ __global__ void kInsertParticles_Raster(
 
 __global__ void kInsertParticles_Morton(
   const GridInfo GridInfo,
+  const CellTable table,
   const float3 *particles,
   unsigned int *particleCellIndices,
   unsigned int *cellParticleCounts,
@@ -291,6 +282,8 @@ __global__ void kInsertParticles_Morton(
   int3 gridCell = make_int3(int(gridCellF.x), int(gridCellF.y), int(gridCellF.z));
 
   unsigned int cellIndex = ToCellIndex_MortonMetaGrid(GridInfo, gridCell);
+  cellIndex = cellSlot(table, cellIndex);
+  if (cellIndex == NO_CELL) return; // not in the table of a sparse grid
   if (particleCellIndices)
     particleCellIndices[particleIndex] = cellIndex;
 
@@ -309,6 +302,101 @@ __global__ void kInsertParticles_Morton(
   //printf("%u, %u, (%d, %d, %d)\n", particleIndex, cellIndex, gridCell.x, gridCell.y, gridCell.z);
 }
 
+__global__ void kInsertParticles_Hilbert(
+  const GridInfo GridInfo,
+  const CellTable table,
+  const float3 *particles,
+  unsigned int *particleCellIndices,
+  unsigned int *cellParticleCounts,
+  unsigned int *localSortedIndices
+)
+{
+  unsigned int particleIndex = blockIdx.x * blockDim.x + threadIdx.x;
+  if (particleIndex >= GridInfo.ParticleCount) return;
+
+  float3 gridCellF = (particles[particleIndex] - GridInfo.GridMin) * GridInfo.GridDelta;
+  int3 gridCell = make_int3(int(gridCellF.x), int(gridCellF.y), int(gridCellF.z));
+
+  unsigned int cellIndex = ToCellIndex_HilbertMetaGrid(GridInfo, gridCell);
+  cellIndex = cellSlot(table, cellIndex);
+  if (cellIndex == NO_CELL) return; // not in the table of a sparse grid
+  if (particleCellIndices)
+    particleCellIndices[particleIndex] = cellIndex;
+
+  // this stores the within-cell sorted indices of particles
+  if (localSortedIndices)
+    localSortedIndices[particleIndex] = atomicAdd(&cellParticleCounts[cellIndex], 1);
+  else // if localSortedIndices is nullptr, we still need to increment cellParticleCounts
+    atomicAdd(&cellParticleCounts[cellIndex], 1);
+}
+
+// cell indices (not slots) of the particles; keys of a sparse grid's table.
+__global__ void kCellKeys(
+  const GridInfo GridInfo,
+  const float3 *particles,
+  unsigned int *cellKeys,
+  CellOrder order
+)
+{
+  unsigned int particleIndex = blockIdx.x * blockDim.x + threadIdx.x;
+  if (particleIndex >= GridInfo.ParticleCount) return;
+
+  int3 gridCell = getGridCell(GridInfo, particles[particleIndex]);
+  if (order == MORTON_ORDER)
+    cellKeys[particleIndex] = ToCellIndex_MortonMetaGrid(GridInfo, gridCell);
+  else if (order == HILBERT_ORDER)
+    cellKeys[particleIndex] = ToCellIndex_HilbertMetaGrid(GridInfo, gridCell);
+  else
+    cellKeys[particleIndex] = (gridCell.x * GridInfo.GridDimension.y + gridCell.y) * GridInfo.GridDimension.z + gridCell.z;
+}
+
+// sort keys on one 64-bit morton curve (see morton.h).
+__global__ void kMortonKeys64(
+  const GridInfo GridInfo,
+  const float3 *particles,
+  unsigned long long *keys
+)
+{
+  unsigned int particleIndex = blockIdx.x * blockDim.x + threadIdx.x;
+  if (particleIndex >= GridInfo.ParticleCount) return;
+
+  keys[particleIndex] = getMortonKey64(GridInfo, particles[particleIndex]);
+}
+
+// 1D sort keys (see axiskeys.h); particles[indices[i]] if there are |indices|.
+__global__ void kAxisKeys(
+  const float3 *particles,
+  const uint *indices,
+  const uint N,
+  const int axis,
+  float *keys
+)
+{
+  uint i = blockIdx.x * blockDim.x + threadIdx.x;
+  if (i >= N) return;
+
+  keys[i] = axisKey(particles[indices ? indices[i] : i], axis);
+}
+
+// same as |kAxisKeys| but on the decoded points (see |quantizePoints|); the
+// keys only order the queries, so the decoding error doesn't matter.
+__global__ void kAxisKeysQuantized(
+  const QuantInfo quant,
+  const uint *cells,
+  const ushort3 *offsets,
+  const uint *indices,
+  const uint N,
+  const int axis,
+  float *keys
+)
+{
+  uint i = blockIdx.x * blockDim.x + threadIdx.x;
+  if (i >= N) return;
+
+  uint p = indices ? indices[i] : i;
+  keys[i] = axisKey(quantDecode(quant, cells[p], offsets[p]), axis);
+}
+
 __global__ void kCountingSortIndices(
   const GridInfo GridInfo,
   const uint* particleCellIndices,
@@ -352,7 +440,8 @@ __global__ void kCountingSortIndices_setRayMask(
 }
 
 __global__ void kGenCellMask(GridInfo gridInfo,
-                             bool morton, 
+                             CellOrder order,
+                             CellTable table,
                              unsigned int* cellParticleCounts,
                              unsigned int* repQueries,
                              float3* particles,
@@ -372,7 +461,8 @@ __global__ void kGenCellMask(GridInfo gridInfo,
 
   calcSearchSize(gridCell,
                  gridInfo,
-                 morton,
+                 order,
+                 table,
                  cellParticleCounts,
                  cellSize,
                  maxWidth,
@@ -397,10 +487,20 @@ void kComputeMinMax (unsigned int numOfBlocks, unsigned int threadsPerBlock, flo
       );
 }
 
-void kInsertParticles(unsigned int numOfBlocks, unsigned int threadsPerBlock, GridInfo gridInfo, float3* points, unsigned int* d_ParticleCellIndices, unsigned int* d_CellParticleCounts, unsigned int* d_TempSortIndices, bool morton) {
-  if (morton) {
+void kInsertParticles(unsigned int numOfBlocks, unsigned int threadsPerBlock, GridInfo gridInfo, CellTable table, float3* points, unsigned int* d_ParticleCellIndices, unsigned int* d_CellParticleCounts, unsigned int* d_TempSortIndices, CellOrder order) {
+  if (order == MORTON_ORDER) {
     kInsertParticles_Morton <<<numOfBlocks, threadsPerBlock>>> (
         gridInfo,
+        table,
+        points,
+        d_ParticleCellIndices,
+        d_CellParticleCounts,
+        d_TempSortIndices
+        );
+  } else if (order == HILBERT_ORDER) {
+    kInsertParticles_Hilbert <<<numOfBlocks, threadsPerBlock>>> (
+        gridInfo,
+        table,
         points,
         d_ParticleCellIndices,
         d_CellParticleCounts,
@@ -409,6 +509,7 @@ void kInsertParticles(unsigned int numOfBlocks, unsigned int threadsPerBlock, Gr
   } else {
     kInsertParticles_Raster <<<numOfBlocks, threadsPerBlock>>> (
         gridInfo,
+        table,
         points,
         d_ParticleCellIndices,
         d_CellParticleCounts,
@@ -417,6 +518,55 @@ void kInsertParticles(unsigned int numOfBlocks, unsigned int threadsPerBlock, Gr
   }
 }
 
+void kCellKeys(unsigned int numOfBlocks, unsigned int threadsPerBlock, GridInfo gridInfo, float3* points, unsigned int* d_cellKeys, CellOrder order) {
+  kCellKeys <<<numOfBlocks, threadsPerBlock>>> (
+      gridInfo,
+      points,
+      d_cellKeys,
+      order
+      );
+}
+
+void kMortonKeys64(unsigned int numOfBlocks, unsigned int threadsPerBlock, GridInfo gridInfo, float3* points, unsigned long long* d_keys) {
+  kMortonKeys64 <<<numOfBlocks, threadsPerBlock>>> (
+      gridInfo,
+      points,
+      d_keys
+      );
+}
+
+void kAxisKeys(unsigned int numOfBlocks, unsigned int threadsPerBlock, float3* particles, unsigned int* indices, unsigned int N, int axis, float* d_keys, cudaStream_t stream) {
+  kAxisKeys <<<numOfBlocks, threadsPerBlock, 0, stream>>> (
+      particles,
+      indices,
+      N,
+      axis,
+      d_keys
+      );
+}
+
+void kAxisKeysQuantized(unsigned int numOfBlocks, unsigned int threadsPerBlock, QuantInfo quant, const unsigned int* cells, const ushort3* offsets, unsigned int* indices, unsigned int N, int axis, float* d_keys, cudaStream_t stream) {
+  kAxisKeysQuantized <<<numOfBlocks, threadsPerBlock, 0, stream>>> (
+      quant,
+      cells,
+      offsets,
+      indices,
+      N,
+      axis,
+      d_keys
+      );
+}
+
+void kQuantizePoints(unsigned int numOfBlocks, unsigned int threadsPerBlock, QuantInfo quant, float3* points, unsigned int N, unsigned int* d_cells, ushort3* d_offsets) {
+  kQuantizePoints <<<numOfBlocks, threadsPerBlock>>> (
+      quant,
+      points,
+      N,
+      d_cells,
+      d_offsets
+      );
+}
+
 void kCountingSortIndices(unsigned int numOfBlocks, unsigned int threadsPerBlock,
       GridInfo gridInfo,
       unsigned int* d_ParticleCellIndices,
@@ -456,7 +606,8 @@ void kCountingSortIndices_setRayMask(unsigned int numOfBlocks, unsigned int thre
 void kCalcSearchSize(unsigned int numOfBlocks,
                      unsigned int threadsPerBlock,
                      GridInfo gridInfo,
-                     bool morton, 
+                     CellOrder order,
+                     CellTable table,
                      unsigned int* cellParticleCounts,
                      unsigned int* repQueries,
                      float3* particles,
@@ -467,7 +618,8 @@ void kCalcSearchSize(unsigned int numOfBlocks,
                     ) {
   kGenCellMask <<<numOfBlocks, threadsPerBlock>>> (
              gridInfo,
-             morton,
+             order,
+             table,
              cellParticleCounts,
              repQueries,
              particles,
@@ -483,12 +635,12 @@ float kGetWidthFromIter(int iter, float cellSize) {
 }
 
 __global__ void kTest(GridInfo gridInfo, int3 test, unsigned int* res, bool morton) {
-  *res = getCellIdx(gridInfo, test.x, test.y, test.z, true);
+  *res = getCellIdx(gridInfo, test.x, test.y, test.z, MORTON_ORDER);
 }
 
 void test(GridInfo gridInfo) {
   int3 test = make_int3(283, 10, 418);
-  //unsigned int h_res_cpu = getCellIdx(gridInfo, test.x, test.y, test.z, true);
+  //unsigned int h_res_cpu = getCellIdx(gridInfo, test.x, test.y, test.z, MORTON_ORDER);
   //printf("%d\n", h_res_cpu);
 
   unsigned int* d_res;
@@ -1,5 +1,11 @@
 #pragma once
 
+#include <sutil/vec_math.h>
+
+#include "helper_mortonCode.h"
+#include "helper_hilbertCode.h"
+#include "helper_linearIndex.h"
+
 struct GridInfo
 {
   float3 GridMin;
@@ -7,6 +13,136 @@ struct GridInfo
   float3 GridDelta;
   uint3 GridDimension;
   uint3 MetaGridDimension;
-  unsigned int meta_grid_dim;
+  uint3 meta_grid_dims; // cells of a meta grid per axis; the same on every axis unless adaptive (see |chooseMetaGridBits|)
+  uint3 meta_grid_bits; // log2 of meta_grid_dims, rounded up
   unsigned int meta_grid_size;
 };
+
+inline __host__ __device__ bool cubicMetaGrid(const GridInfo &GridInfo)
+{
+  return GridInfo.meta_grid_bits.x == GridInfo.meta_grid_bits.y && GridInfo.meta_grid_bits.y == GridInfo.meta_grid_bits.z;
+}
+
+// cell indexing shared by the grid kernels (grid.cu) and the host search engine (cpu.cpp).
+inline __host__ __device__ uint ToCellIndex_MortonMetaGrid(const GridInfo &GridInfo, int3 gridCell)
+{
+  int3 metaGridCell = make_int3(
+    gridCell.x / GridInfo.meta_grid_dims.x,
+    gridCell.y / GridInfo.meta_grid_dims.y,
+    gridCell.z / GridInfo.meta_grid_dims.z);
+
+  gridCell.x %= GridInfo.meta_grid_dims.x;
+  gridCell.y %= GridInfo.meta_grid_dims.y;
+  gridCell.z %= GridInfo.meta_grid_dims.z;
+  uint metaGridIndex = CellIndicesToLinearIndex(GridInfo.MetaGridDimension, metaGridCell);
+
+  uint code;
+  if (cubicMetaGrid(GridInfo))
+    code = MortonCode3(gridCell.x, gridCell.y, gridCell.z);
+  else
+    code = MortonCode3Box(gridCell.x, gridCell.y, gridCell.z, GridInfo.meta_grid_bits.x, GridInfo.meta_grid_bits.y, GridInfo.meta_grid_bits.z);
+  return metaGridIndex * GridInfo.meta_grid_size + code;
+}
+
+// same as above, but the curve within a meta grid is a Hilbert curve. a
+// Hilbert curve needs a cube, so a non-cubic meta grid is split into cubes
+// as large as its shortest side, which are visited in morton order.
+inline __host__ __device__ uint ToCellIndex_HilbertMetaGrid(const GridInfo &GridInfo, int3 gridCell)
+{
+  int3 metaGridCell = make_int3(
+    gridCell.x / GridInfo.meta_grid_dims.x,
+    gridCell.y / GridInfo.meta_grid_dims.y,
+    gridCell.z / GridInfo.meta_grid_dims.z);
+
+  gridCell.x %= GridInfo.meta_grid_dims.x;
+  gridCell.y %= GridInfo.meta_grid_dims.y;
+  gridCell.z %= GridInfo.meta_grid_dims.z;
+  uint metaGridIndex = CellIndicesToLinearIndex(GridInfo.MetaGridDimension, metaGridCell);
+
+  if (cubicMetaGrid(GridInfo))
+    return metaGridIndex * GridInfo.meta_grid_size + HilbertCode3(gridCell.x, gridCell.y, gridCell.z, GridInfo.meta_grid_bits.x);
+
+  uint bits = min(GridInfo.meta_grid_bits.x, min(GridInfo.meta_grid_bits.y, GridInfo.meta_grid_bits.z));
+  uint mask = (1u << bits) - 1;
+  uint cubeIndex = MortonCode3Box(gridCell.x >> bits, gridCell.y >> bits, gridCell.z >> bits,
+      GridInfo.meta_grid_bits.x - bits, GridInfo.meta_grid_bits.y - bits, GridInfo.meta_grid_bits.z - bits);
+  return metaGridIndex * GridInfo.meta_grid_size + (cubeIndex << (3 * bits))
+       + HilbertCode3(gridCell.x & mask, gridCell.y & mask, gridCell.z & mask, bits);
+}
+
+// the order of the cells, and so of the particles sorted by cell; see |sortParticles|.
+enum CellOrder { RASTER_ORDER, MORTON_ORDER, HILBERT_ORDER };
+
+inline __host__ __device__
+unsigned int getCellIdx(GridInfo gridInfo, int ix, int iy, int iz, CellOrder order) {
+  if (order == MORTON_ORDER) // z-order sort
+    return ToCellIndex_MortonMetaGrid(gridInfo, make_int3(ix, iy, iz));
+  else if (order == HILBERT_ORDER)
+    return ToCellIndex_HilbertMetaGrid(gridInfo, make_int3(ix, iy, iz));
+  else // raster order
+    return (ix * gridInfo.GridDimension.y + iy) * gridInfo.GridDimension.z + iz;
+}
+
+inline __host__ __device__
+bool oob(GridInfo gridInfo, int ix, int iy, int iz) {
+  if (ix < 0 || ix >= (int)gridInfo.GridDimension.x
+   || iy < 0 || iy >= (int)gridInfo.GridDimension.y
+   || iz < 0 || iz >= (int)gridInfo.GridDimension.z)
+    return true;
+  else return false;
+}
+
+// A sparse grid keeps its per-cell arrays (particle counts, offsets, cell
+// masks) only for the occupied cells, whose cell indices (|getCellIdx|) are
+// listed in ascending order in |keys|; a cell is found by binary search. A
+// dense grid has no |keys| and indexes the arrays by the cell index itself.
+#define NO_CELL 0xFFFFFFFFu
+
+struct CellTable
+{
+  const unsigned int* keys; // nullptr for a dense grid
+  unsigned int numCells;
+};
+
+// where |cellIndex| is in the per-cell arrays; NO_CELL for an empty cell of a sparse grid.
+inline __host__ __device__
+unsigned int cellSlot(const CellTable& table, unsigned int cellIndex) {
+  if (!table.keys) return cellIndex;
+
+  unsigned int lo = 0, hi = table.numCells;
+  while (lo < hi) {
+    unsigned int mid = lo + (hi - lo) / 2;
+    if (table.keys[mid] < cellIndex) lo = mid + 1;
+    else hi = mid;
+  }
+  return (lo < table.numCells && table.keys[lo] == cellIndex) ? lo : NO_CELL;
+}
+
+inline __host__ __device__
+int3 getGridCell(const GridInfo& gridInfo, float3 particle) {
+  float3 gridCellF = (particle - gridInfo.GridMin) * gridInfo.GridDelta;
+  return make_int3(int(gridCellF.x), int(gridCellF.y), int(gridCellF.z));
+}
+
+// the cell of |particle| on one 64-bit morton curve over the whole grid (no
+// meta grids); |gridInfo| must have at most 2^MORTON64_BITS cells per axis
+// (see |morton64CellSize|). cells are clamped so that points on the upper
+// boundary stay on the curve.
+inline __host__ __device__
+uint3 getMortonCell64(const GridInfo& gridInfo, float3 particle) {
+  int3 cell = getGridCell(gridInfo, particle);
+  const int maxCell = (1 << MORTON64_BITS) - 1;
+  return make_uint3(min(max(cell.x, 0), maxCell), min(max(cell.y, 0), maxCell), min(max(cell.z, 0), maxCell));
+}
+
+inline __host__ __device__
+unsigned long long getMortonKey64(const GridInfo& gridInfo, float3 particle) {
+  uint3 cell = getMortonCell64(gridInfo, particle);
+  return MortonCode3_64(cell.x, cell.y, cell.z);
+}
+
+// the 1D sort key of |particle|: its coordinate along |axis| (0/1/2 for x/y/z; see axiskeys.h).
+inline __host__ __device__
+float axisKey(float3 particle, int axis) {
+  return (axis == 0) ? particle.x : ((axis == 1) ? particle.y : particle.z);
+}
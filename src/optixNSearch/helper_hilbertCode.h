@@ -0,0 +1,76 @@
+#pragma once
+#include <cuda_runtime.h>
+
+#include "helper_mortonCode.h"
+
+// J. Skilling, "Programming the Hilbert curve", AIP Conf. Proc. 707 (2004).
+// A point on a 2^bits cube is "transposed": the Hilbert index is stored
+// across the three coordinates, and interleaving them (x first) gives the
+// index, the same way |MortonCode3| interleaves plain coordinates. bits <= 10
+// so that the index fits 32 bits. Unlike a morton curve, consecutive indices
+// are always adjacent cells.
+
+__host__ __device__ inline void AxesToTranspose3(uint X[3], uint bits)
+{
+	uint M = 1u << (bits - 1), P, Q, t;
+
+	// Inverse undo
+	for (Q = M; Q > 1; Q >>= 1) {
+		P = Q - 1;
+		for (int i = 0; i < 3; i++) {
+			if (X[i] & Q) X[0] ^= P; // invert
+			else { t = (X[0] ^ X[i]) & P; X[0] ^= t; X[i] ^= t; } // exchange
+		}
+	}
+
+	// Gray encode
+	for (int i = 1; i < 3; i++) X[i] ^= X[i - 1];
+	t = 0;
+	for (Q = M; Q > 1; Q >>= 1)
+		if (X[2] & Q) t ^= Q - 1;
+	for (int i = 0; i < 3; i++) X[i] ^= t;
+}
+
+__host__ __device__ inline void TransposeToAxes3(uint X[3], uint bits)
+{
+	uint N = 2u << (bits - 1), P, Q, t;
+
+	// Gray decode by H ^ (H/2)
+	t = X[2] >> 1;
+	for (int i = 2; i > 0; i--) X[i] ^= X[i - 1];
+	X[0] ^= t;
+
+	// Undo excess work
+	for (Q = 2; Q != N; Q <<= 1) {
+		P = Q - 1;
+		for (int i = 2; i >= 0; i--) {
+			if (X[i] & Q) X[0] ^= P; // invert
+			else { t = (X[0] ^ X[i]) & P; X[0] ^= t; X[i] ^= t; } // exchange
+		}
+	}
+}
+
+// Hilbert index of cell (x, y, z) in a 2^bits cube
+__host__ __device__ inline uint HilbertCode3(uint x, uint y, uint z, uint bits)
+{
+	if (bits == 0) return 0;
+	uint X[3] = {x, y, z};
+	AxesToTranspose3(X, bits);
+	return (Part1By2(X[0]) << 2) + (Part1By2(X[1]) << 1) + Part1By2(X[2]);
+}
+
+__host__ __device__ inline uint3 HilbertCodeToIndex3(uint hilbertCode, uint bits)
+{
+	if (bits == 0) return make_uint3(0, 0, 0);
+	uint X[3] = {Compact1By2(hilbertCode >> 2), Compact1By2(hilbertCode >> 1), Compact1By2(hilbertCode)};
+	TransposeToAxes3(X, bits);
+	return make_uint3(X[0], X[1], X[2]);
+}
+
+// bits per axis of a 2^bits cube with |dim| cells per axis
+__host__ __device__ inline uint HilbertBits(uint dim)
+{
+	uint bits = 0;
+	while ((1u << bits) < dim) bits++;
+	return bits;
+}
@@ -33,6 +33,65 @@ __host__ __device__ inline uint MortonCode3(uint x, uint y, uint z)
 	return (Part1By2(z) << 2) + (Part1By2(y) << 1) + Part1By2(x);
 }
 
+// morton code in a box of 2^bx * 2^by * 2^bz cells: the bits are interleaved
+// (x first) as long as an axis has them, so a cube gets |MortonCode3|, and
+// the codes of a box are exactly [0, 2^(bx+by+bz)).
+__host__ __device__ inline uint MortonCode3Box(uint x, uint y, uint z, uint bx, uint by, uint bz)
+{
+	uint code = 0, shift = 0;
+	uint maxBits = bx > by ? bx : by;
+	if (bz > maxBits) maxBits = bz;
+	for (uint i = 0; i < maxBits; i++) {
+		if (i < bx) code |= ((x >> i) & 1) << shift++;
+		if (i < by) code |= ((y >> i) & 1) << shift++;
+		if (i < bz) code |= ((z >> i) & 1) << shift++;
+	}
+	return code;
+}
+
+// 64-bit codes: 21 bits per axis, enough for one curve over the whole scene
+// (see |getMortonKey64| in grid.h). morton.cpp has a table-driven host
+// encoder for many points at once that produces the same codes.
+#define MORTON64_BITS 21
+
+// "Insert" two 0 bits after each of the 21 low bits of x
+__host__ __device__ inline unsigned long long Part1By2_64(unsigned long long x)
+{
+	x &= 0x00000000001fffffull;
+	x = (x ^ (x << 32)) & 0x001f00000000ffffull;
+	x = (x ^ (x << 16)) & 0x001f0000ff0000ffull;
+	x = (x ^ (x << 8)) & 0x100f00f00f00f00full;
+	x = (x ^ (x << 4)) & 0x10c30c30c30c30c3ull;
+	x = (x ^ (x << 2)) & 0x1249249249249249ull;
+	return x;
+}
+
+__host__ __device__ inline unsigned long long MortonCode3_64(uint x, uint y, uint z)
+{
+	return (Part1By2_64(z) << 2) | (Part1By2_64(y) << 1) | Part1By2_64(x);
+}
+
+// Inverse of Part1By2_64
+__host__ __device__ inline uint Compact1By2_64(unsigned long long x)
+{
+	x &= 0x1249249249249249ull;
+	x = (x ^ (x >> 2)) & 0x10c30c30c30c30c3ull;
+	x = (x ^ (x >> 4)) & 0x100f00f00f00f00full;
+	x = (x ^ (x >> 8)) & 0x001f0000ff0000ffull;
+	x = (x ^ (x >> 16)) & 0x001f00000000ffffull;
+	x = (x ^ (x >> 32)) & 0x00000000001fffffull;
+	return (uint)x;
+}
+
+__host__ __device__ inline uint3 MortonCodeToIndex3_64(unsigned long long mortonCode)
+{
+	uint3 xyz;
+	xyz.x = Compact1By2_64(mortonCode >> 0);
+	xyz.y = Compact1By2_64(mortonCode >> 1);
+	xyz.z = Compact1By2_64(mortonCode >> 2);
+	return xyz;
+}
+
 // Inverse of Part1By1 - "delete" all odd-indexed bits
 __host__ __device__ inline uint Compact1By1(uint x)
 {
@@ -0,0 +1,106 @@
+#pragma once
+
+#include <vector_types.h>
+#include <sutil/vec_math.h>
+
+// 16-bit quantized points (--quantize). a point is stored as the raster index
+// of its grid cell plus three 16-bit offsets inside the cell, i.e., 10 bytes
+// (in two arrays) instead of a 12-byte float3. decoding puts the point at the
+// center of its quantization step, so a decoded point is at most
+// |QuantInfo::errBound| away from the real one (float rounding included).
+//
+// shared by the encoding kernel (grid.cu), the AABB builds (aabb.cu), the IS
+// programs (geometry.cu) and the host; see |quantRadiusBand| for how the IS
+// programs keep results exact, and |quantizePoints| for where the float3
+// points go.
+
+#define QUANT_STEPS 65536.0f
+#define QUANT_FLT_EPS 1.1920929e-7f
+
+struct QuantInfo
+{
+    float3           gridMin;
+    float            cellSize;
+    uint3            gridDim;
+    float            errBound; // max distance between a point and its decoding
+};
+
+inline __host__ __device__
+unsigned int quantAxis(float x, float gridMin, float cellSize, unsigned int dim, unsigned int& cell) {
+  float f = (x - gridMin) / cellSize;
+  int c = (int)floorf(f);
+  c = (c < 0) ? 0 : ((c >= (int)dim) ? (int)dim - 1 : c);
+  cell = c;
+
+  float step = (f - c) * QUANT_STEPS;
+  if (step <= 0) return 0;
+  if (step >= QUANT_STEPS - 1) return 65535;
+  return (unsigned int)step;
+}
+
+inline __host__ __device__
+float dequantAxis(unsigned int cell, unsigned short step, float gridMin, float cellSize) {
+  return gridMin + (cell + (step + 0.5f) / QUANT_STEPS) * cellSize;
+}
+
+inline __host__ __device__
+void quantEncode(const QuantInfo& q, float3 p, unsigned int& cellIdx, ushort3& offset) {
+  uint3 cell;
+  offset.x = quantAxis(p.x, q.gridMin.x, q.cellSize, q.gridDim.x, cell.x);
+  offset.y = quantAxis(p.y, q.gridMin.y, q.cellSize, q.gridDim.y, cell.y);
+  offset.z = quantAxis(p.z, q.gridMin.z, q.cellSize, q.gridDim.z, cell.z);
+  // raster order, same as the non-morton cells in grid.cu
+  cellIdx = (cell.x * q.gridDim.y + cell.y) * q.gridDim.z + cell.z;
+}
+
+inline __host__ __device__
+float3 quantDecode(const QuantInfo& q, unsigned int cellIdx, ushort3 offset) {
+  unsigned int z = cellIdx % q.gridDim.z;
+  unsigned int y = (cellIdx / q.gridDim.z) % q.gridDim.y;
+  unsigned int x = cellIdx / q.gridDim.z / q.gridDim.y;
+  return make_float3(dequantAxis(x, offset.x, q.gridMin.x, q.cellSize),
+                     dequantAxis(y, offset.y, q.gridMin.y, q.cellSize),
+                     dequantAxis(z, offset.z, q.gridMin.z, q.cellSize));
+}
+
+// how far a distance to a decoded point can be from the one to the real point
+// as computed in float, for distances up to about |radius|.
+inline __host__ __device__
+float quantSlack(const QuantInfo& q, float radius) {
+  return q.errBound + 8 * QUANT_FLT_EPS * radius;
+}
+
+// a (squared) distance to a decoded point below |lo2| means the real point is
+// certainly within |radius|, and one at or above |hi2| that it certainly isn't;
+// only in between does the real point have to be read. the decisions are the
+// same as testing the real points.
+inline __host__ __device__
+void quantRadiusBand(const QuantInfo& q, float radius, float& lo2, float& hi2) {
+  float e = quantSlack(q, radius);
+  float lo = (radius > e) ? radius - e : 0;
+  lo2 = lo * lo;
+  hi2 = (radius + e) * (radius + e);
+}
+
+// the grid starts at |pMin| and covers |pMax|; |cellSize| is that of the
+// search grid (see |genGridInfo|), made larger if the cells don't fit 32 bits.
+inline QuantInfo makeQuantInfo(float3 pMin, float3 pMax, float cellSize) {
+  QuantInfo q;
+  q.gridMin = pMin;
+  float3 size = pMax - pMin;
+  while (true) {
+    q.gridDim.x = (unsigned int)ceilf(size.x / cellSize) + 1;
+    q.gridDim.y = (unsigned int)ceilf(size.y / cellSize) + 1;
+    q.gridDim.z = (unsigned int)ceilf(size.z / cellSize) + 1;
+    if ((double)q.gridDim.x * q.gridDim.y * q.gridDim.z < 4294967296.0) break;
+    cellSize *= 2;
+  }
+  q.cellSize = cellSize;
+
+  // half a step per axis, plus the rounding of decoding near the far end of
+  // the grid (a few ulps of the largest coordinate).
+  float maxAbs = fmaxf(fmaxf(fmaxf(-pMin, pMin)), fmaxf(fmaxf(-pMax, pMax)));
+  float axisErr = 0.5f * cellSize / QUANT_STEPS + 3 * QUANT_FLT_EPS * (maxAbs + cellSize);
+  q.errBound = axisErr * 1.7320508f; // sqrt(3)
+  return q;
+}
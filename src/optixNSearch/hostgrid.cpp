@@ -0,0 +1,247 @@
+#include <algorithm>
+#include <atomic>
+#include <memory>
+#include <queue>
+#include <cmath>
+
+#include "cellsize.h"
+#include "hostgrid.h"
+#include "parallel.h"
+
+float hostCellSize(float3 sceneMin, float3 sceneMax, float radius, unsigned int knn, unsigned int numPoints, bool sparse) {
+  // a cell as large as the search radius bounds a radius search to the 27
+  // surrounding cells. in KNN search the radius is usually just a loose cap,
+  // so also aim at about K points per cell, which lets |hostKnnSearch|
+  // terminate after a ring or two.
+  float3 extent = sceneMax - sceneMin;
+  float cellSize = radius;
+  if (knn) {
+    float volume = extent.x * extent.y * extent.z;
+    float knnCellSize = cbrtf(volume * knn / std::max(numPoints, 1u));
+    if (knnCellSize > 0) cellSize = std::min(cellSize, knnCellSize); // a flat scene has no volume
+  }
+
+  // dense cell arrays are bounded to a few cells per point; a sparse grid
+  // only needs its cell indices (with some room for the meta grid padding)
+  // to fit 32 bits.
+  double maxCells = sparse ? (double)NO_CELL / 8 : std::max(4.0 * numPoints, 1024.0);
+  while ((double)ceilf(extent.x / cellSize) * ceilf(extent.y / cellSize) * ceilf(extent.z / cellSize) > maxCells)
+    cellSize *= 1.26; // doubles the cell volume
+
+  return cellSize;
+}
+
+// host counterpart of kInsertParticles + exclusiveScan + kCountingSortIndices.
+void buildHostGrid(HostGrid& grid,
+                   const float3* points,
+                   unsigned int N,
+                   const GridInfo& gridInfo,
+                   unsigned int numberOfCells,
+                   CellOrder order,
+                   unsigned int numThreads,
+                   bool sparse)
+{
+  grid.gridInfo = gridInfo;
+  grid.gridInfo.ParticleCount = N;
+  grid.order = order;
+  grid.sparse = sparse;
+  grid.cellSize = 1 / gridInfo.GridDelta.x;
+
+  std::vector<unsigned int> particleCellIndices(N);
+  parallelFor(N, numThreads, [&](unsigned int b, unsigned int e, unsigned int) {
+    for (unsigned int i = b; i < e; i++) {
+      int3 cell = getGridCell(gridInfo, points[i]);
+      particleCellIndices[i] = getCellIdx(gridInfo, cell.x, cell.y, cell.z, order);
+    }
+  });
+
+  // host counterpart of |genCellTable|; from here on the cell indices are slots.
+  grid.cellKeys.clear();
+  if (sparse) {
+    grid.cellKeys = particleCellIndices;
+    std::sort(grid.cellKeys.begin(), grid.cellKeys.end());
+    grid.cellKeys.erase(std::unique(grid.cellKeys.begin(), grid.cellKeys.end()), grid.cellKeys.end());
+    numberOfCells = grid.cellKeys.size();
+    grid.numberOfCells = numberOfCells;
+
+    CellTable table = hostCellTable(grid);
+    parallelFor(N, numThreads, [&](unsigned int b, unsigned int e, unsigned int) {
+      for (unsigned int i = b; i < e; i++) particleCellIndices[i] = cellSlot(table, particleCellIndices[i]);
+    });
+  }
+  grid.numberOfCells = numberOfCells;
+
+  std::unique_ptr<std::atomic<unsigned int>[]> counts(new std::atomic<unsigned int>[numberOfCells]);
+  parallelFor(numberOfCells, numThreads, [&](unsigned int b, unsigned int e, unsigned int) {
+    for (unsigned int i = b; i < e; i++) counts[i].store(0, std::memory_order_relaxed);
+  });
+
+  // insert particles
+  parallelFor(N, numThreads, [&](unsigned int b, unsigned int e, unsigned int) {
+    for (unsigned int i = b; i < e; i++) counts[particleCellIndices[i]].fetch_add(1, std::memory_order_relaxed);
+  });
+
+  // exclusive scan to get the cell offsets
+  grid.cellParticleCounts.resize(numberOfCells);
+  grid.cellOffsets.resize(numberOfCells);
+  unsigned int offset = 0;
+  for (unsigned int c = 0; c < numberOfCells; c++) {
+    unsigned int count = counts[c].load(std::memory_order_relaxed);
+    grid.cellParticleCounts[c] = count;
+    grid.cellOffsets[c] = offset;
+    offset += count;
+    counts[c].store(0, std::memory_order_relaxed); // reused as the per-cell insertion cursor
+  }
+
+  // counting sort
+  grid.sortedIndices.resize(N);
+  parallelFor(N, numThreads, [&](unsigned int b, unsigned int e, unsigned int) {
+    for (unsigned int i = b; i < e; i++) {
+      unsigned int cellIndex = particleCellIndices[i];
+      unsigned int local = counts[cellIndex].fetch_add(1, std::memory_order_relaxed);
+      grid.sortedIndices[grid.cellOffsets[cellIndex] + local] = i;
+    }
+  });
+
+  // the order within a cell depends on thread timing; sort each cell by
+  // particle id so that results (e.g., which K neighbors a truncated radius
+  // search returns) are deterministic across runs.
+  grid.sortedPoints.resize(N);
+  parallelFor(numberOfCells, numThreads, [&](unsigned int b, unsigned int e, unsigned int) {
+    for (unsigned int c = b; c < e; c++) {
+      unsigned int begin = grid.cellOffsets[c];
+      unsigned int end = begin + grid.cellParticleCounts[c];
+      if (end - begin > 1) std::sort(grid.sortedIndices.begin() + begin, grid.sortedIndices.begin() + end);
+      for (unsigned int s = begin; s < end; s++) grid.sortedPoints[s] = points[grid.sortedIndices[s]];
+    }
+  });
+}
+
+void buildSparseHostGrid(HostGrid& grid, const float3* points, unsigned int N, float3 sceneMin, float3 sceneMax,
+                         float radius, unsigned int knn, unsigned int numThreads)
+{
+  float cellSize = hostCellSize(sceneMin, sceneMax, radius, knn, N, true);
+  GridInfo gridInfo;
+  unsigned int numberOfCells = calcGridInfo(sceneMin, sceneMax, cellSize, 1, N, gridInfo);
+  // see |genGridInfo|.
+  gridInfo.GridDimension.x = gridInfo.MetaGridDimension.x * gridInfo.meta_grid_dims.x;
+  gridInfo.GridDimension.y = gridInfo.MetaGridDimension.y * gridInfo.meta_grid_dims.y;
+  gridInfo.GridDimension.z = gridInfo.MetaGridDimension.z * gridInfo.meta_grid_dims.z;
+  buildHostGrid(grid, points, N, gridInfo, numberOfCells, MORTON_ORDER, numThreads, true);
+}
+
+CellTable hostCellTable(const HostGrid& grid) {
+  CellTable table;
+  table.keys = grid.sparse ? grid.cellKeys.data() : nullptr;
+  table.numCells = grid.numberOfCells;
+  return table;
+}
+
+static int3 clampCell(const GridInfo& gridInfo, int3 cell) {
+  // queries can sit exactly on (or, for filtered scenes, outside) the grid boundary.
+  cell.x = std::min(std::max(cell.x, 0), (int)gridInfo.GridDimension.x - 1);
+  cell.y = std::min(std::max(cell.y, 0), (int)gridInfo.GridDimension.y - 1);
+  cell.z = std::min(std::max(cell.z, 0), (int)gridInfo.GridDimension.z - 1);
+  return cell;
+}
+
+// visit all in-bound cells whose Chebyshev distance from |center| is exactly
+// |ring|, by their slot in the per-cell arrays (empty cells of a sparse grid
+// are skipped). stops early (and returns false) once |visit| returns false.
+template <typename Visit>
+static bool visitRing(const HostGrid& grid, int3 center, int ring, Visit visit) {
+  const GridInfo& gridInfo = grid.gridInfo;
+  CellTable table = hostCellTable(grid);
+  for (int dz = -ring; dz <= ring; dz++) {
+    for (int dy = -ring; dy <= ring; dy++) {
+      bool face = (dz == -ring || dz == ring || dy == -ring || dy == ring);
+      int step = face ? 1 : 2 * ring;
+      for (int dx = -ring; dx <= ring; dx += step) {
+        int ix = center.x + dx;
+        int iy = center.y + dy;
+        int iz = center.z + dz;
+        if (oob(gridInfo, ix, iy, iz)) continue;
+        unsigned int cellIndex = cellSlot(table, getCellIdx(gridInfo, ix, iy, iz, grid.order));
+        if (cellIndex == NO_CELL) continue; // empty cell of a sparse grid
+        if (!visit(cellIndex)) return false;
+      }
+    }
+  }
+  return true;
+}
+
+// same semantics as the radius IS program: every point within |radius|
+// (including the query itself) is a neighbor, and at most |limit| neighbors
+// are returned. cells are visited from the query cell outwards, so truncated
+// results favor closer neighbors.
+unsigned int hostRadiusSearch(const HostGrid& grid, float3 query, float radius, unsigned int limit, unsigned int* res) {
+  int3 center = clampCell(grid.gridInfo, getGridCell(grid.gridInfo, query));
+  int maxRing = (int)ceilf(radius / grid.cellSize);
+  float sqRadius = radius * radius;
+
+  unsigned int size = 0;
+  for (int ring = 0; ring <= maxRing && size < limit; ring++) {
+    visitRing(grid, center, ring, [&](unsigned int cellIndex) {
+      unsigned int begin = grid.cellOffsets[cellIndex];
+      unsigned int end = begin + grid.cellParticleCounts[cellIndex];
+      for (unsigned int s = begin; s < end; s++) {
+        float3 O = query - grid.sortedPoints[s];
+        if (dot(O, O) < sqRadius) {
+          res[size++] = grid.sortedIndices[s];
+          if (size == limit) return false;
+        }
+      }
+      return true;
+    });
+  }
+
+  return size;
+}
+
+// same semantics as the KNN IS program: the K nearest points within
+// |radius|, excluding the query itself. neighbors are returned in ascending
+// distance, and |dists| (if given) receives the squared distances.
+unsigned int hostKnnSearch(const HostGrid& grid, float3 query, float radius, unsigned int k, unsigned int* res, float* dists) {
+  if (k == 0) return 0;
+
+  typedef std::pair<float, unsigned int> knn_res_t;
+  std::priority_queue<knn_res_t> topKQ; // max-heap on distance
+
+  int3 center = clampCell(grid.gridInfo, getGridCell(grid.gridInfo, query));
+  int maxRing = (int)ceilf(radius / grid.cellSize);
+  float sqRadius = radius * radius;
+
+  for (int ring = 0; ring <= maxRing; ring++) {
+    visitRing(grid, center, ring, [&](unsigned int cellIndex) {
+      unsigned int begin = grid.cellOffsets[cellIndex];
+      unsigned int end = begin + grid.cellParticleCounts[cellIndex];
+      for (unsigned int s = begin; s < end; s++) {
+        float3 O = query - grid.sortedPoints[s];
+        float sqdist = dot(O, O);
+        if ((sqdist > 0) && (sqdist < sqRadius)) {
+          if (topKQ.size() < k) topKQ.push(std::make_pair(sqdist, grid.sortedIndices[s]));
+          else if (sqdist < topKQ.top().first) {
+            topKQ.pop();
+            topKQ.push(std::make_pair(sqdist, grid.sortedIndices[s]));
+          }
+        }
+      }
+      return true;
+    });
+
+    // a point in ring + 1 is at least |ring| cells away from any position in
+    // the query cell, so once the current K-th distance is within that bound
+    // the remaining rings can't contribute.
+    float bound = ring * grid.cellSize;
+    if (topKQ.size() == k && topKQ.top().first <= bound * bound) break;
+  }
+
+  unsigned int size = topKQ.size();
+  for (unsigned int i = size; i > 0; i--) {
+    res[i - 1] = topKQ.top().second;
+    if (dists) dists[i - 1] = topKQ.top().first;
+    topKQ.pop();
+  }
+
+  return size;
+}
@@ -0,0 +1,39 @@
+#pragma once
+
+#include <vector>
+
+#include "grid.h"
+
+// A host-side cell list over the same |GridInfo| (and the same morton/Hilbert/raster
+// cell indexing) as the GPU grid. The layout mirrors the device counting
+// sort: per-cell particle counts, their exclusive scan (cell offsets), and
+// the particles stored contiguously in cell order. A sparse grid keeps the
+// per-cell arrays for the occupied cells only (see |CellTable|).
+struct HostGrid
+{
+  GridInfo                    gridInfo;
+  CellOrder                   order           = MORTON_ORDER;
+  bool                        sparse          = false;
+  unsigned int                numberOfCells   = 0; // occupied cells if sparse
+  float                       cellSize        = 0;
+
+  std::vector<unsigned int>   cellKeys; // sorted cell indices of the occupied cells if sparse
+
+  std::vector<unsigned int>   cellParticleCounts;
+  std::vector<unsigned int>   cellOffsets;
+  std::vector<unsigned int>   sortedIndices; // original particle id of each sorted slot
+  std::vector<float3>         sortedPoints;
+};
+
+// the cell size of a host grid over the scene for searches within |radius|
+// (|knn| is 0 for radius search).
+float hostCellSize(float3 sceneMin, float3 sceneMax, float radius, unsigned int knn, unsigned int numPoints, bool sparse);
+void buildHostGrid(HostGrid&, const float3*, unsigned int, const GridInfo&, unsigned int, CellOrder, unsigned int, bool sparse = false);
+// a sparse morton grid of |N| points over the scene [sceneMin, sceneMax] for
+// searches within |radius| (see |hostCellSize|), so that memory follows the
+// points rather than the scene; what the exact checks build.
+void buildSparseHostGrid(HostGrid&, const float3* points, unsigned int N, float3 sceneMin, float3 sceneMax,
+                         float radius, unsigned int knn, unsigned int numThreads);
+CellTable hostCellTable(const HostGrid&);
+unsigned int hostRadiusSearch(const HostGrid&, float3, float, unsigned int, unsigned int*);
+unsigned int hostKnnSearch(const HostGrid&, float3, float, unsigned int, unsigned int*, float* dists = nullptr);
@@ -4,60 +4,34 @@
 #include "optixNSearch.h"
 #include "state.h"
 #include "func.h"
-#include "grid.h"
-
-void setDevice ( RTNNState& state ) {
-  int32_t device_count = 0;
-  CUDA_CHECK( cudaGetDeviceCount( &device_count ) );
-  std::cerr << "\tTotal GPUs visible: " << device_count << std::endl;
-  
-  cudaDeviceProp prop;
-  CUDA_CHECK( cudaGetDeviceProperties ( &prop, state.device_id ) );
-  CUDA_CHECK( cudaSetDevice( state.device_id ) );
-  std::cerr << "\tUsing [" << state.device_id << "]: " << prop.name << std::endl;
-  state.totDRAMSize = (double)prop.totalGlobalMem/1024/1024/1024;
-  std::cerr << "\tMemory: " << state.totDRAMSize << " GB" << std::endl;
-  // conservatively reduce dram size by 256 MB as the usable memory appears to
-  // be that much smaller than what is reported, presumably to store data
-  // structures that are hidden from us.
-  state.totDRAMSize -= 0.25;
-}
-
-void freeGridPointers( RTNNState& state ) {
-  for (auto it = state.d_gridPointers.begin(); it != state.d_gridPointers.end(); it++) {
-    CUDA_CHECK( cudaFree( *it ) );
-  }
-  //fprintf(stdout, "Finish early free\n");
-}
-
-void setupSearch( RTNNState& state ) {
-  if (!state.deferFree) freeGridPointers(state);
-
-  if (state.partition) return;
-
-  assert(state.numOfBatches == -1);
-  state.numOfBatches = 1;
-
-  state.numActQueries[0] = state.numQueries;
-  state.d_actQs[0] = state.params.queries;
-  state.h_actQs[0] = state.h_queries;
-  state.launchRadius[0] = state.radius;
-}
+#include "rtnn.h"
 
 int main( int argc, char* argv[] )
 {
   RTNNState state;
 
   parseArgs( state, argc, argv );
+  if (!state.traceFile.empty() || !state.traceProfileFile.empty())
+    Timing::enableTrace(state.traceFile, state.traceProfileFile);
+
+  if (state.calibrate) {
+    // needs no input; see calibrate.cpp
+    calibrateCostModel(state);
+    exit(0);
+  }
 
   readData(state);
 
   std::cout << "========================================" << std::endl;
   std::cout << "numPoints: " << state.numPoints << std::endl;
   std::cout << "numQueries: " << state.numQueries << std::endl;
+  std::cout << "backend: " << state.backend << std::endl;
   std::cout << "searchMode: " << state.searchMode << std::endl;
   std::cout << "radius: " << state.radius << std::endl;
   std::cout << "Deferred free? " << std::boolalpha << state.deferFree << std::endl;
+  std::cout << "Device arena? " << std::boolalpha << state.useArena << std::endl;
+  std::cout << "Pinned pool? " << std::boolalpha << state.usePinnedPool << std::endl;
+  std::cout << "Quantized points? " << std::boolalpha << state.quantize << std::endl;
   std::cout << "E2E Measure? " << std::boolalpha << state.msr << std::endl;
   std::cout << "K: " << state.knn << std::endl;
   std::cout << "Same P and Q? " << std::boolalpha << state.samepq << std::endl;
@@ -67,89 +41,45 @@ int main( int argc, char* argv[] )
   std::cout << "Auto crRatio? " << std::boolalpha << state.autoCR << std::endl;
   std::cout << "cellRadiusRatio: " << std::boolalpha << state.crRatio << std::endl; // only useful when preSort == 1/2 and autoCR is false
   std::cout << "mcScale: " << state.mcScale << std::endl;
+  std::cout << "Adaptive meta grids? " << std::boolalpha << state.adaptiveMetaGrid << std::endl;
+  std::cout << "metaGridWaste: " << state.metaGridWaste << std::endl; // only useful when adaptiveMetaGrid is true
+  std::cout << "Sparse grid? " << std::boolalpha << state.sparseGrid << std::endl;
   std::cout << "crStep: " << state.crStep << std::endl;
   std::cout << "Interleave? " << std::boolalpha << state.interleave << std::endl;
   std::cout << "qGasSortMode: " << state.qGasSortMode << std::endl;
   std::cout << "pointSortMode: " << state.pointSortMode << std::endl;
   std::cout << "querySortMode: " << state.querySortMode << std::endl;
+  std::cout << "sortAxis: " << state.sortAxis << std::endl; // only useful with 1D sorts
   std::cout << "gsrRatio: " << state.gsrRatio << std::endl; // only useful when qGasSortMode != 0
   std::cout << "Gather after gas sort? " << std::boolalpha << state.toGather << std::endl;
+  std::cout << "CSR results? " << std::boolalpha << state.csr << std::endl;
+  std::cout << "Output file: " << state.outFile << std::endl;
+  std::cout << "Trace file: " << state.traceFile << std::endl;
+  std::cout << "Trace profile file: " << state.traceProfileFile << std::endl;
   std::cout << "========================================" << std::endl << std::endl;
 
   try
   {
-    setDevice(state);
-
-    Timing::reset();
-    uploadData(state);
-
-    // call this after set device.
-    initBatches(state);
-
-    setupOptiX(state);
-
-    Timing::startTiming("total search time");
-
-    // TODO: streamline the logic of partition and sorting.
-    sortParticles(state, QUERY, state.querySortMode);
-
-    // samepq indicates same underlying data and sorting mode, in which case
-    // queries have been sorted so no need to sort them again.
-    if (!state.samepq) sortParticles(state, POINT, state.pointSortMode);
-
-    // early free done here too
-    setupSearch(state);
-
-    if (state.interleave) {
-      for (int i = 0; i < state.numOfBatches; i++) {
-        // it's possible that certain batches have 0 query (e.g., state.partThd too low).
-        if (state.numActQueries[i] == 0) continue;
-	    // TODO: group buildGas together to allow overlapping; this would allow
-	    // us to batch-free temp storages and non-compacted gas storages. right
-	    // now free storage serializes gas building.
-        createGeometry (state, i, state.launchRadius[i]/state.gsrRatio); // batch_id ignored if not partition.
-      }
-
-      for (int i = 0; i < state.numOfBatches; i++) {
-        if (state.numActQueries[i] == 0) continue;
-        if (state.qGasSortMode) gasSortSearch(state, i);
-      }
-
-      for (int i = 0; i < state.numOfBatches; i++) {
-        if (state.numActQueries[i] == 0) continue;
-        if (state.qGasSortMode && state.gsrRatio != 1)
-          createGeometry (state, i, state.launchRadius[i]);
-      }
-
-      for (int i = 0; i < state.numOfBatches; i++) {
-        if (state.numActQueries[i] == 0) continue;
-        // TODO: when K is too big, we can't launch all rays together. split rays.
-        search(state, i);
-      }
-    } else {
-      for (int i = 0; i < state.numOfBatches; i++) {
-        if (state.numActQueries[i] == 0) continue;
-
-        // create the GAS using the current order of points and the launchRadius of the current batch.
-        // TODO: does it make sense to have per-batch |gsrRatio|?
-        createGeometry (state, i, state.launchRadius[i]/state.gsrRatio); // batch_id ignored if not partition.
-
-        if (state.qGasSortMode) {
-          gasSortSearch(state, i);
-          if (state.gsrRatio != 1)
-            createGeometry (state, i, state.launchRadius[i]);
-        }
-
-        search(state, i);
+    if (!state.serverSock.empty()) {
+      if (state.backend != "gpu") {
+        fprintf(stderr, "The server mode needs the gpu backend.\n");
+        exit(1);
       }
+      runServer(state);
+      cleanupState(state);
+      exit(0);
     }
 
-    CUDA_SYNC_CHECK();
-    Timing::stopTiming(true);
+    // the inputs are only searched once, so let the search sort them in place
+    // rather than copying them (see |NeighborSearch::Borrow|).
+    rtnn::NeighborSearch ns(state);
+    ns.setPoints(state.h_points, state.numPoints, rtnn::NeighborSearch::Borrow);
+    if (!state.sameData) ns.setQueries(state.h_queries, state.numQueries, rtnn::NeighborSearch::Borrow);
 
-    if(state.sanCheck) sanityCheck(state);
+    Timing::reset();
+    ns.search();
 
-    cleanupState(state);
+    if(state.sanCheck) sanityCheck(ns.state());
   }
   catch( std::exception& e )
   {
@@ -157,5 +87,6 @@ int main( int argc, char* argv[] )
     exit(1);
   }
 
+  unmapPointFiles(state);
   exit(0);
 }
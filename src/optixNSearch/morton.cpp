@@ -0,0 +1,54 @@
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
+#include "morton.h"
+#include "parallel.h"
+
+float morton64CellSize(float3 sceneMin, float3 sceneMax) {
+  float3 extent = sceneMax - sceneMin;
+  float maxExtent = std::max({extent.x, extent.y, extent.z, 1e-6f});
+  // a little slack so that ceil(extent / cellSize) can't round up past the limit.
+  return maxExtent / (1 << MORTON64_BITS) * 1.001f;
+}
+
+// |Part1By2_64| of every byte.
+struct MortonTable
+{
+  unsigned long long spread[256];
+
+  MortonTable() {
+    for (unsigned int i = 0; i < 256; i++) spread[i] = Part1By2_64(i);
+  }
+};
+
+static inline unsigned long long spreadBits(const MortonTable& table, unsigned int x) {
+  // a byte spreads over 24 bits.
+  return (table.spread[(x >> 16) & 0xff] << 48) |
+         (table.spread[(x >> 8) & 0xff] << 24) |
+          table.spread[x & 0xff];
+}
+
+static const MortonTable& mortonTable() {
+  static const MortonTable table;
+  return table;
+}
+
+unsigned long long mortonCode3_64Table(uint3 cell) {
+  const MortonTable& table = mortonTable();
+  return (spreadBits(table, cell.z) << 2) | (spreadBits(table, cell.y) << 1) | spreadBits(table, cell.x);
+}
+
+void mortonKeys64(const GridInfo& gridInfo, const float3* points, unsigned int N, unsigned long long* keys, unsigned int numThreads) {
+  mortonTable(); // built once, before the threads race for it
+  parallelFor(N, numThreads, [&](unsigned int b, unsigned int e, unsigned int) {
+    for (unsigned int i = b; i < e; i++) keys[i] = mortonCode3_64Table(getMortonCell64(gridInfo, points[i]));
+  });
+}
+
+void mortonOrder64(const GridInfo& gridInfo, const float3* points, unsigned int N, unsigned int* order, unsigned int numThreads) {
+  std::vector<unsigned long long> keys(N);
+  mortonKeys64(gridInfo, points, N, keys.data(), numThreads);
+  for (unsigned int i = 0; i < N; i++) order[i] = i;
+  std::stable_sort(order, order + N, [&](unsigned int a, unsigned int b) { return keys[a] < keys[b]; });
+}
@@ -0,0 +1,21 @@
+#pragma once
+
+#include "grid.h"
+
+// One morton curve over the whole scene with 64-bit keys (sort mode 4). The
+// z-order sort of |gridSort| uses 32-bit cell indices, so its curve only
+// spans a meta grid (see |genGridInfo|) and the meta grids are visited in
+// raster order. There are no per-cell arrays here, so the keys use the
+// finest grid 21 bits per axis can address.
+//
+// The per-point encoding is |getMortonKey64| (grid.h), shared by the device
+// kernel and the host. Plain host code.
+
+// the smallest cell size with at most 2^MORTON64_BITS cells on every axis.
+float morton64CellSize(float3 sceneMin, float3 sceneMax);
+// same codes as |MortonCode3_64|, but spreading the bits by table lookups.
+unsigned long long mortonCode3_64Table(uint3 cell);
+// keys of |N| points (see |getMortonKey64|), batched over |numThreads| host threads.
+void mortonKeys64(const GridInfo&, const float3* points, unsigned int N, unsigned long long* keys, unsigned int numThreads);
+// the order in which to visit |N| points along the curve.
+void mortonOrder64(const GridInfo&, const float3* points, unsigned int N, unsigned int* order, unsigned int numThreads);
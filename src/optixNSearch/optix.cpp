@@ -37,6 +37,7 @@
 #include <sutil/sutil.h>
 #include <sutil/Timing.h>
 
+#include <algorithm>
 #include <iomanip>
 #include <cstring>
 #include <fstream>
@@ -45,11 +46,14 @@
 #include <cstdlib>
 #include <queue>
 #include <unordered_set>
+#include <ctime>
+#include <unistd.h>
 
 #include "optixNSearch.h"
 #include "state.h"
 #include "func.h"
 #include "grid.h"
+#include "gascache.h"
 
 template <typename T>
 struct Record
@@ -80,6 +84,14 @@ void filterRemoteQueries ( RTNNState& state ) {
   thrust::device_ptr<float3> tQueries;
   allocThrustDevicePtr(&tQueries, count, &state.d_pointers);
   copyIfInRange(state.params.queries, state.numQueries, thrust::device_pointer_cast(state.params.queries), tQueries, tMin, tMax);
+  if (state.d_queryIds) {
+    thrust::device_ptr<unsigned int> tQueryIds;
+    allocThrustDevicePtr(&tQueryIds, count, &state.d_pointers);
+    copyIfInRange(state.d_queryIds, state.numQueries, thrust::device_pointer_cast(state.params.queries), tQueryIds, tMin, tMax);
+    state.d_pointers.erase(state.d_pointers.find(state.d_queryIds));
+    CUDA_CHECK( cudaFree( state.d_queryIds ) );
+    state.d_queryIds = thrust::raw_pointer_cast(tQueryIds);
+  }
   fprintf(stdout, "Filter queries: %u (%.3f)\n", state.numQueries - count, (1 - (float)count/state.numQueries)*100);
 
   if (count == 0) {
@@ -120,9 +132,15 @@ void uploadData ( RTNNState& state ) {
     thrust::device_ptr<float3> d_points_ptr;
     state.params.points = allocThrustDevicePtr(&d_points_ptr, state.numPoints, &state.d_pointers);
 
-    thrust::copy(state.h_points, state.h_points + state.numPoints, d_points_ptr);
+    uploadStaged(state, state.params.points, state.h_points, state.numPoints * sizeof(float3));
     computeMinMax(state.numPoints, state.params.points, state.pMin, state.pMax);
 
+    if (state.trackIds) {
+      thrust::device_ptr<unsigned int> d_pointIds_ptr;
+      state.d_pointIds = allocThrustDevicePtr(&d_pointIds_ptr, state.numPoints, &state.d_pointers);
+      genSeqDevice(d_pointIds_ptr, state.numPoints);
+    }
+
     if (state.samepq) {
       // by default, params.queries and params.points point to the same device
       // memory. later if we decide to reorder the queries, we will allocate new
@@ -131,12 +149,20 @@ void uploadData ( RTNNState& state ) {
       state.params.queries = state.params.points;
       state.qMin = state.pMin;
       state.qMax = state.pMax;
+      // queries and points are sorted together, so share the ids too.
+      state.d_queryIds = state.d_pointIds;
     } else {
       thrust::device_ptr<float3> d_queries_ptr;
       state.params.queries = allocThrustDevicePtr(&d_queries_ptr, state.numQueries, &state.d_pointers);
       
-      thrust::copy(state.h_queries, state.h_queries + state.numQueries, d_queries_ptr);
+      uploadStaged(state, state.params.queries, state.h_queries, state.numQueries * sizeof(float3));
       computeMinMax(state.numQueries, state.params.queries, state.qMin, state.qMax);
+
+      if (state.trackIds) {
+        thrust::device_ptr<unsigned int> d_queryIds_ptr;
+        state.d_queryIds = allocThrustDevicePtr(&d_queryIds_ptr, state.numQueries, &state.d_pointers);
+        genSeqDevice(d_queryIds_ptr, state.numQueries);
+      }
     }
 
     Timing::startTiming("filter queries");
@@ -167,7 +193,8 @@ void uploadData ( RTNNState& state ) {
   Timing::stopTiming(true);
 }
 
-static void buildGas(
+// returns the size of the final (compacted, if that's smaller) GAS.
+static size_t buildGas(
     RTNNState &state,
     const OptixAccelBuildOptions &accel_options,
     const OptixBuildInput &build_input,
@@ -241,8 +268,121 @@ static void buildGas(
     {
         // original size is smaller, so point d_gas_output_buffer directly to the original device GAS memory.
         d_gas_output_buffer = d_buffer_temp_output_gas_and_compacted_size;
+        compacted_gas_size = gas_buffer_sizes.outputSizeInBytes;
     }
     fprintf(stdout, "\tFinal GAS size: %f MB\n", (float)compacted_gas_size/(1024 * 1024));
+
+    return compacted_gas_size;
+}
+
+static GasCacheKey gasCacheKey(RTNNState& state, float radius) {
+  // the GAS is built over the sorted points, so hash them once they are final
+  // (i.e., at the first GAS of a search); see where |pointsHash| is reset.
+  if (state.pointsHash == 0) {
+    Timing::startTiming("hash points");
+      state.pointsHash = hashPoints(state.h_points, state.numPoints);
+    Timing::stopTiming(true);
+  }
+
+  GasCacheKey key;
+  memset(&key, 0, sizeof(key));
+  key.pointsHash = state.pointsHash;
+  key.numPoints = state.numPoints;
+  key.radius = radius;
+  key.optixVersion = OPTIX_VERSION;
+  CUDA_CHECK( cudaDriverGetVersion( &key.driverVersion ) );
+  return key;
+}
+
+// load the GAS for |radius| from the cache and relocate it into fresh device
+// memory; false on a miss.
+static bool loadCachedGas(RTNNState& state, int batch_id, float radius) {
+  GasCacheKey key = gasCacheKey(state, radius);
+  std::string name = gasCacheName(key);
+
+  GasCacheIndex index;
+  loadGasCacheIndex(index, state.gasCacheDir);
+  if (!findGasCacheEntry(index, name)) return false;
+
+  GasFileHeader header;
+  std::vector<char> gas;
+  if (!readGasFile(state.gasCacheDir + "/" + name, key, header, gas)) {
+    // deleted or corrupted behind our back
+    removeGasCacheEntry(index, name);
+    saveGasCacheIndex(index);
+    return false;
+  }
+
+  OptixAccelRelocationInfo info;
+  memcpy(info.info, header.relocInfo, sizeof(info.info));
+  int compatible = 0;
+  OPTIX_CHECK( optixAccelCheckRelocationCompatibility( state.context, &info, &compatible ) );
+  if (!compatible) return false;
+
+  // cudaMalloc-ed memory satisfies OPTIX_ACCEL_BUFFER_BYTE_ALIGNMENT.
+  CUdeviceptr d_gas;
+  CUDA_CHECK( cudaMalloc( reinterpret_cast<void**>( &d_gas ), header.gasSize ) );
+  CUDA_CHECK( cudaMemcpyAsync( reinterpret_cast<void*>( d_gas ), gas.data(), header.gasSize,
+                  cudaMemcpyHostToDevice, state.stream[batch_id] ) );
+  OPTIX_CHECK( optixAccelRelocate( state.context, state.stream[batch_id], &info, 0, 0,
+                  d_gas, header.gasSize, &state.gas_handle[batch_id] ) );
+  // |gas| is pageable, so the copy is done by now; but the relocation isn't.
+  OMIT_ON_E2EMSR( CUDA_CHECK( cudaStreamSynchronize( state.stream[batch_id] ) ) );
+
+  if (state.d_gas_output_buffer[batch_id])
+    CUDA_CHECK( cudaFree( reinterpret_cast<void*>( state.d_gas_output_buffer[batch_id] ) ) );
+  state.d_gas_output_buffer[batch_id] = d_gas;
+  state.gas_size[batch_id] = header.gasSize;
+
+  touchGasCacheEntry(index, name, header.gasSize, (int64_t)time(nullptr));
+  saveGasCacheIndex(index);
+
+  fprintf(stdout, "\tLoaded cached GAS %s (%f MB)\n", name.c_str(), (float)header.gasSize/(1024 * 1024));
+  return true;
+}
+
+static void storeCachedGas(RTNNState& state, int batch_id, float radius, size_t gasSize) {
+  GasCacheKey key = gasCacheKey(state, radius);
+  std::string name = gasCacheName(key);
+
+  GasFileHeader header;
+  memset(&header, 0, sizeof(header));
+  memcpy(header.magic, RTNN_GAS_MAGIC, sizeof(header.magic));
+  header.version = RTNN_GAS_VERSION;
+  header.key = key;
+  header.gasSize = gasSize;
+
+  OptixAccelRelocationInfo info;
+  OPTIX_CHECK( optixAccelGetRelocationInfo( state.context, state.gas_handle[batch_id], &info ) );
+  memcpy(header.relocInfo, info.info, sizeof(header.relocInfo));
+
+  std::vector<char> gas(gasSize);
+  CUDA_CHECK( cudaMemcpyAsync( gas.data(), reinterpret_cast<void*>( state.d_gas_output_buffer[batch_id] ),
+                  gasSize, cudaMemcpyDeviceToHost, state.stream[batch_id] ) );
+  CUDA_CHECK( cudaStreamSynchronize( state.stream[batch_id] ) );
+
+  if (!writeGasFile(state.gasCacheDir + "/" + name, header, gas.data())) {
+    fprintf(stderr, "Could not write the GAS cache in %s\n", state.gasCacheDir.c_str());
+    return;
+  }
+
+  GasCacheIndex index;
+  loadGasCacheIndex(index, state.gasCacheDir);
+  touchGasCacheEntry(index, name, gasSize, (int64_t)time(nullptr));
+  for (const auto& victim : evictGasCacheEntries(index, (uint64_t)state.gasCacheSize * 1024 * 1024, name))
+    unlink((state.gasCacheDir + "/" + victim).c_str());
+  saveGasCacheIndex(index);
+}
+
+// quantized points are only on the device as their encodings (see
+// |quantizePoints|), so their AABBs are built around the decoded points, made
+// larger by the decoding error.
+static void genAABB( RTNNState& state, float radius, OptixAabb* d_aabb, cudaStream_t stream )
+{
+  if (state.params.quantized)
+    kGenAABBQuantized(state.params.quant, state.params.qCells, state.params.qOffsets,
+        radius + state.params.quant.errBound, state.numPoints, d_aabb, stream);
+  else kGenAABB(state.params.points, radius, state.numPoints, d_aabb, stream);
 }
 
 CUdeviceptr createAABB( RTNNState& state, int batch_id, float radius )
@@ -266,12 +406,7 @@ CUdeviceptr createAABB( RTNNState& state, int batch_id, float radius )
     d_aabb = reinterpret_cast<OptixAabb*>(state.d_aabb[batch_id]);
   }
 
-  kGenAABB(state.params.points,
-           radius,
-           numPrims,
-           d_aabb,
-           state.stream[batch_id]
-          );
+  genAABB(state, radius, d_aabb, state.stream[batch_id]);
 
   return reinterpret_cast<CUdeviceptr>(d_aabb);
 }
@@ -279,6 +414,13 @@ CUdeviceptr createAABB( RTNNState& state, int batch_id, float radius )
 void createGeometry( RTNNState& state, int batch_id, float radius )
 {
   Timing::startTiming("create and upload geometry");
+    // a cached GAS can't be refit (see |refitGeometry|).
+    bool useCache = !state.gasCacheDir.empty() && !state.dynamic;
+    if (useCache && loadCachedGas(state, batch_id, radius)) {
+      Timing::stopTiming(true);
+      return;
+    }
+
     CUdeviceptr d_aabb = createAABB(state, batch_id, radius);
 
     unsigned int numPrims = state.numPoints;
@@ -301,8 +443,9 @@ void createGeometry( RTNNState& state, int batch_id, float radius )
         OPTIX_BUILD_FLAG_ALLOW_COMPACTION,  // buildFlags
         OPTIX_BUILD_OPERATION_BUILD         // operation
     };
+    if (state.dynamic) accel_options.buildFlags |= OPTIX_BUILD_FLAG_ALLOW_UPDATE;
 
-    buildGas(
+    state.gas_size[batch_id] = buildGas(
         state,
         accel_options,
         aabb_input,
@@ -314,6 +457,146 @@ void createGeometry( RTNNState& state, int batch_id, float radius )
     CUDA_CHECK( cudaFree( reinterpret_cast<void*>(d_aabb) ) );
     OMIT_ON_E2EMSR( CUDA_CHECK( cudaStreamSynchronize( state.stream[batch_id] ) ) );
   Timing::stopTiming(true);
+
+  if (useCache) {
+    Timing::startTiming("store GAS in cache");
+      storeCachedGas(state, batch_id, radius, state.gas_size[batch_id]);
+    Timing::stopTiming(true);
+  }
+}
+
+// refit the GAS of |batch_id| to the current |params.points|, which must be
+// the points it was built over (same count and order), moved. the GAS must
+// have been built with |dynamic| set. the tree topology is kept, so this is
+// much cheaper than |createGeometry| but the tree degrades as the points
+// drift; see dynamic.h for when to rebuild instead.
+void refitGeometry( RTNNState& state, int batch_id, float radius )
+{
+  Timing::startTiming("refit geometry");
+    // fresh AABBs; |createGeometry| has freed the ones the GAS was built with.
+    OptixAabb* d_aabb_raw;
+    CUDA_CHECK( cudaMalloc( reinterpret_cast<void**>( &d_aabb_raw ), state.numPoints * sizeof(OptixAabb) ) );
+    genAABB(state, radius, d_aabb_raw, state.stream[batch_id]);
+    CUdeviceptr d_aabb = reinterpret_cast<CUdeviceptr>(d_aabb_raw);
+
+    // must match the build input in |createGeometry|.
+    uint32_t aabb_input_flags[1] = { OPTIX_GEOMETRY_FLAG_NONE };
+
+    OptixBuildInput aabb_input = {};
+    aabb_input.type = OPTIX_BUILD_INPUT_TYPE_CUSTOM_PRIMITIVES;
+    aabb_input.customPrimitiveArray.aabbBuffers   = &d_aabb;
+    aabb_input.customPrimitiveArray.flags         = aabb_input_flags;
+    aabb_input.customPrimitiveArray.numSbtRecords = 1;
+    aabb_input.customPrimitiveArray.numPrimitives = state.numPoints;
+    aabb_input.customPrimitiveArray.sbtIndexOffsetBuffer         = 0;
+    aabb_input.customPrimitiveArray.sbtIndexOffsetSizeInBytes    = sizeof( uint32_t );
+    aabb_input.customPrimitiveArray.primitiveIndexOffset         = 0;
+
+    OptixAccelBuildOptions accel_options = {
+        OPTIX_BUILD_FLAG_ALLOW_COMPACTION | OPTIX_BUILD_FLAG_ALLOW_UPDATE, // buildFlags
+        OPTIX_BUILD_OPERATION_UPDATE        // operation
+    };
+
+    OptixAccelBufferSizes gas_buffer_sizes;
+    OPTIX_CHECK( optixAccelComputeMemoryUsage(
+        state.context,
+        &accel_options,
+        &aabb_input,
+        1,
+        &gas_buffer_sizes));
+
+    CUdeviceptr d_temp_buffer_gas;
+    CUDA_CHECK( cudaMalloc(
+        reinterpret_cast<void**>( &d_temp_buffer_gas ),
+        gas_buffer_sizes.tempUpdateSizeInBytes));
+
+    // the update is in place; the output buffer (and the handle) stay the same.
+    // the buffer holds the compacted GAS, so pass its actual size.
+    OPTIX_CHECK( optixAccelBuild(
+        state.context,
+        state.stream[batch_id],
+        &accel_options,
+        &aabb_input,
+        1,
+        d_temp_buffer_gas,
+        gas_buffer_sizes.tempUpdateSizeInBytes,
+        state.d_gas_output_buffer[batch_id],
+        state.gas_size[batch_id],
+        &state.gas_handle[batch_id],
+        nullptr,
+        0) );
+
+    CUDA_CHECK( cudaFree( reinterpret_cast<void*>( d_temp_buffer_gas ) ) );
+    CUDA_CHECK( cudaFree( d_aabb_raw ) );
+    OMIT_ON_E2EMSR( CUDA_CHECK( cudaStreamSynchronize( state.stream[batch_id] ) ) );
+  Timing::stopTiming(true);
+}
+
+// build an IAS over the GASes in |handles| as the geometry of |batch_id|; the
+// points of the i-th GAS start at |offsets[i]| in |params.points|. the offsets
+// go in a device array indexed by the instance index (see |pointIndex| in
+// geometry.cu) rather than in the instance ids, which are limited to 28 bits
+// and so couldn't address windows of more than ~268M points. the GASes are
+// left alone, so an instance can be added, dropped or moved to another offset
+// by rebuilding just this (i.e., a pass over |numInstances| instances).
+void createInstanceGeometry( RTNNState& state, int batch_id, const OptixTraversableHandle* handles,
+                             const unsigned int* offsets, unsigned int numInstances )
+{
+  Timing::startTiming("create instance geometry");
+    std::vector<OptixInstance> instances(numInstances);
+    const float identity[12] = {1, 0, 0, 0,
+                                0, 1, 0, 0,
+                                0, 0, 1, 0};
+    for (unsigned int i = 0; i < numInstances; i++) {
+      OptixInstance& instance = instances[i];
+      memset(&instance, 0, sizeof(instance));
+      memcpy(instance.transform, identity, sizeof(identity));
+      instance.instanceId        = i;
+      instance.visibilityMask    = 255;
+      instance.sbtOffset         = 0;
+      instance.flags             = OPTIX_INSTANCE_FLAG_NONE;
+      instance.traversableHandle = handles[i];
+    }
+
+    // kept across rebuilds and only grown: a cudaFree here would synchronize
+    // the device on every pushed or dropped frame.
+    if (numInstances > state.instanceOffsetsCapacity) {
+      if (state.d_instanceOffsets) CUDA_CHECK( cudaFree( state.d_instanceOffsets ) );
+      state.instanceOffsetsCapacity = std::max(numInstances, 2 * state.instanceOffsetsCapacity);
+      CUDA_CHECK( cudaMalloc( reinterpret_cast<void**>( &state.d_instanceOffsets ), state.instanceOffsetsCapacity * sizeof(unsigned int) ) );
+    }
+    CUDA_CHECK( cudaMemcpyAsync( state.d_instanceOffsets, offsets,
+                    numInstances * sizeof(unsigned int), cudaMemcpyHostToDevice, state.stream[batch_id] ) );
+
+    CUdeviceptr d_instances;
+    CUDA_CHECK( cudaMalloc( reinterpret_cast<void**>( &d_instances ), numInstances * sizeof(OptixInstance) ) );
+    CUDA_CHECK( cudaMemcpyAsync( reinterpret_cast<void*>( d_instances ), instances.data(),
+                    numInstances * sizeof(OptixInstance), cudaMemcpyHostToDevice, state.stream[batch_id] ) );
+
+    OptixBuildInput instance_input = {};
+    instance_input.type = OPTIX_BUILD_INPUT_TYPE_INSTANCES;
+    instance_input.instanceArray.instances    = d_instances;
+    instance_input.instanceArray.numInstances = numInstances;
+
+    OptixAccelBuildOptions accel_options = {
+        OPTIX_BUILD_FLAG_ALLOW_COMPACTION,  // buildFlags
+        OPTIX_BUILD_OPERATION_BUILD         // operation
+    };
+
+    if (state.d_gas_output_buffer[batch_id])
+      CUDA_CHECK( cudaFree( reinterpret_cast<void*>( state.d_gas_output_buffer[batch_id] ) ) );
+    state.gas_size[batch_id] = buildGas(
+        state,
+        accel_options,
+        instance_input,
+        state.gas_handle[batch_id],
+        state.d_gas_output_buffer[batch_id],
+        batch_id);
+
+    // the build reads the instances on the stream.
+    CUDA_CHECK( cudaStreamSynchronize( state.stream[batch_id] ) );
+    CUDA_CHECK( cudaFree( reinterpret_cast<void*>( d_instances ) ) );
+  Timing::stopTiming(true);
 }
 
 void createModules( RTNNState &state )
@@ -434,10 +717,10 @@ static void createMissProgram( RTNNState &state, std::vector<OptixProgramGroup>
     program_groups.push_back(state.radiance_miss_prog_group);
 }
 
-void createPipeline( RTNNState &state )
-{
-    const int max_trace = 2;
+static const int max_trace = 2;
 
+void createProgramGroups( RTNNState &state )
+{
     std::vector<OptixProgramGroup> program_groups;
 
     state.pipeline_compile_options = {
@@ -448,12 +731,27 @@ void createPipeline( RTNNState &state )
         OPTIX_EXCEPTION_FLAG_NONE,                              // exceptionFlags
         "params"                                                // pipelineLaunchParamsVariableName
     };
+    // a window search traces an IAS whose instances are the per-frame GASes.
+    if (state.instanced)
+      state.pipeline_compile_options.traversableGraphFlags = OPTIX_TRAVERSABLE_GRAPH_FLAG_ALLOW_SINGLE_LEVEL_INSTANCING;
 
     // Prepare program groups
     createModules( state );
     createCameraProgram( state, program_groups );
     createMetalSphereProgram( state, program_groups );
     createMissProgram( state, program_groups );
+}
+
+// one pipeline per batch, so that batches can be launched concurrently. this
+// depends on |maxBatchCount| and so is redone for every search, whereas the
+// modules and program groups are created once per context.
+void createPipeline( RTNNState &state )
+{
+    std::vector<OptixProgramGroup> program_groups = {
+        state.raygen_prog_group,
+        state.radiance_metal_sphere_prog_group,
+        state.radiance_miss_prog_group
+    };
 
     // Link program groups to pipeline
     OptixPipelineLinkOptions pipeline_link_options = {
@@ -492,7 +790,7 @@ void createPipeline( RTNNState &state )
     for (int i = 0; i < state.maxBatchCount; i++) {
       OPTIX_CHECK( optixPipelineSetStackSize( state.pipeline[i], direct_callable_stack_size_from_traversal,
                                               direct_callable_stack_size_from_state, continuation_stack_size,
-                                              1  // maxTraversableDepth
+                                              state.instanced ? 2 : 1  // maxTraversableDepth
                                               ) );
     }
 }
@@ -596,6 +894,8 @@ void launchSubframe( unsigned int* output_buffer, RTNNState& state, int batch_id
 {
     unsigned int numQueries = state.numActQueries[batch_id];
     state.params.handle = state.gas_handle[batch_id];
+    state.params.instanced = state.instanced;
+    state.params.instanceOffsets = state.d_instanceOffsets;
     state.params.queries = state.d_actQs[batch_id];
     state.params.frame_buffer = output_buffer;
 
@@ -605,7 +905,7 @@ void launchSubframe( unsigned int* output_buffer, RTNNState& state, int batch_id
     fprintf(stdout, "\tSearch mode: %d\n", state.params.mode);
 
     thrust::device_ptr<Params> d_params_ptr;
-    state.d_params = allocThrustDevicePtr(&d_params_ptr, 1, &state.d_pointers);
+    state.d_params = allocThrustDevicePtr(&d_params_ptr, 1, state, ARENA_RESULTS);
     CUDA_CHECK( cudaMemcpyAsync( reinterpret_cast<void*>( state.d_params ),
                                  &state.params,
                                  sizeof( Params ),
@@ -625,55 +925,120 @@ void launchSubframe( unsigned int* output_buffer, RTNNState& state, int batch_id
     ) );
 }
 
-void cleanupState( RTNNState& state )
+// free everything that was created for one search (i.e., from |uploadData|
+// on); the context, modules, program groups and SBT are left alone so that
+// another search can reuse them.
+void cleanupSearch( RTNNState& state )
 {
     for (int i = 0; i < state.maxBatchCount; i++) {
-      OPTIX_CHECK( optixPipelineDestroy     ( state.pipeline[i]           ) );
+      if (state.pipeline) OPTIX_CHECK( optixPipelineDestroy( state.pipeline[i] ) );
+      if (state.stream) CUDA_CHECK( cudaStreamDestroy(state.stream[i]) );
+      if (state.d_gas_output_buffer && state.d_gas_output_buffer[i])
+        CUDA_CHECK( cudaFree( reinterpret_cast<void*>( state.d_gas_output_buffer[i] ) ) );
+      //CUDA_CHECK( cudaFree( state.d_temp_buffer_gas[i] ) );
+      // if compaction isn't successful, d_gas and d_buffer_temp point will point to the same device memory.
+      //if (reinterpret_cast<void*>(state.d_gas_output_buffer[i]) != state.d_buffer_temp_output_gas_and_compacted_size[i] )
+      //  CUDA_CHECK( cudaFree( state.d_buffer_temp_output_gas_and_compacted_size[i] ) );
     }
-    OPTIX_CHECK( optixProgramGroupDestroy ( state.raygen_prog_group       ) );
-    OPTIX_CHECK( optixProgramGroupDestroy ( state.radiance_metal_sphere_prog_group ) );
-    OPTIX_CHECK( optixProgramGroupDestroy ( state.radiance_miss_prog_group         ) );
-    OPTIX_CHECK( optixModuleDestroy       ( state.geometry_module         ) );
-    OPTIX_CHECK( optixModuleDestroy       ( state.camera_module           ) );
-    OPTIX_CHECK( optixDeviceContextDestroy( state.context                 ) );
 
     for (int i = 0; i < state.numOfBatches; i++) {
-      if (state.numActQueries[i] == 0) continue;
+      freePinned(state, state.h_res[i]);
+      freePinned(state, state.h_resOffsets[i]);
+      // h_actQs are separate copies only when partitioned or gathered.
+      if ((state.h_actQs[i] != state.h_queries) && (state.h_actQs[i] != state.h_points))
+        freePinned(state, state.h_actQs[i]);
+    }
 
-      CUDA_CHECK( cudaStreamDestroy(state.stream[i]) );
+    delete[] state.gas_handle;
+    delete[] state.d_gas_output_buffer;
+    delete[] state.gas_size;
+    delete[] state.stream;
+    delete[] state.numActQueries;
+    delete[] state.launchRadius;
+    delete[] state.h_res;
+    delete[] state.h_resOffsets;
+    delete[] state.d_res;
+    delete[] state.d_resOffsets;
+    delete[] state.d_actQs;
+    delete[] state.d_actQIds;
+    delete[] state.h_actQs;
+    delete[] state.d_aabb;
+    delete[] state.d_temp_buffer_gas;
+    delete[] state.d_buffer_temp_output_gas_and_compacted_size;
+    delete[] state.d_r2q_map;
+    delete[] state.pipeline;
+    state.gas_handle = nullptr;
+    state.d_gas_output_buffer = nullptr;
+    state.gas_size = nullptr;
+    state.stream = nullptr;
+    state.numActQueries = nullptr;
+    state.launchRadius = nullptr;
+    state.h_res = nullptr;
+    state.h_resOffsets = nullptr;
+    state.d_res = nullptr;
+    state.d_resOffsets = nullptr;
+    state.d_actQs = nullptr;
+    state.d_actQIds = nullptr;
+    state.h_actQs = nullptr;
+    state.d_aabb = nullptr;
+    state.d_temp_buffer_gas = nullptr;
+    state.d_buffer_temp_output_gas_and_compacted_size = nullptr;
+    state.d_r2q_map = nullptr;
+    state.pipeline = nullptr;
+    state.numOfBatches = -1;
+    state.maxBatchCount = 0;
+    //delete state.h_points;
 
-      CUDA_CHECK( cudaFreeHost(state.h_res[i] ) );
-      delete state.h_actQs[i];
+    if (state.d_instanceOffsets) CUDA_CHECK( cudaFree( state.d_instanceOffsets ) );
+    state.d_instanceOffsets = nullptr;
+    state.instanceOffsetsCapacity = 0;
 
-      //CUDA_CHECK( cudaFree( state.d_temp_buffer_gas[i] ) );
-      // if compaction isn't successful, d_gas and d_buffer_temp point will point to the same device memory.
-      //if (reinterpret_cast<void*>(state.d_gas_output_buffer[i]) != state.d_buffer_temp_output_gas_and_compacted_size[i] )
-      //  CUDA_CHECK( cudaFree( state.d_buffer_temp_output_gas_and_compacted_size[i] ) );
-      CUDA_CHECK( cudaFree( reinterpret_cast<void*>( state.d_gas_output_buffer[i] ) ) );
+    delete[] state.h_fltQs;
+    state.h_fltQs = nullptr;
+    state.numFltQs = 0;
+    state.pointsHash = 0;
+
+    for (auto it = state.d_pointers.begin(); it != state.d_pointers.end(); it++) {
+      CUDA_CHECK( cudaFree( *it ) );
     }
+    state.d_pointers.clear();
+    releaseArenaScope(state, ARENA_BATCH);
+    releaseArenaScope(state, ARENA_RESULTS);
+    releaseExactPoints(state);
+    state.params.points = nullptr;
+    state.params.queries = nullptr;
+    state.params.quantized = false;
+    state.params.qCells = nullptr;
+    state.params.qOffsets = nullptr;
+    state.d_pointIds = nullptr;
+    state.d_queryIds = nullptr;
+
+    // no-op if they were freed early
+    freeGridPointers(state);
+}
 
-    delete state.gas_handle;
-    delete state.d_gas_output_buffer;
-    delete state.stream;
-    delete state.numActQueries;
-    delete state.launchRadius;
-    delete state.h_res;
-    delete state.d_actQs;
-    delete state.h_actQs;
-    delete state.d_aabb;
-    delete state.d_temp_buffer_gas;
-    delete state.d_buffer_temp_output_gas_and_compacted_size;
-    delete state.d_r2q_map;
-    //delete state.h_points;
+void cleanupOptiX( RTNNState& state )
+{
+    OPTIX_CHECK( optixProgramGroupDestroy ( state.raygen_prog_group       ) );
+    OPTIX_CHECK( optixProgramGroupDestroy ( state.radiance_metal_sphere_prog_group ) );
+    OPTIX_CHECK( optixProgramGroupDestroy ( state.radiance_miss_prog_group         ) );
+    OPTIX_CHECK( optixModuleDestroy       ( state.geometry_module         ) );
+    OPTIX_CHECK( optixModuleDestroy       ( state.camera_module           ) );
+    OPTIX_CHECK( optixDeviceContextDestroy( state.context                 ) );
 
     CUDA_CHECK( cudaFree( reinterpret_cast<void*>( state.sbt.raygenRecord       ) ) );
     CUDA_CHECK( cudaFree( reinterpret_cast<void*>( state.sbt.missRecordBase     ) ) );
     CUDA_CHECK( cudaFree( reinterpret_cast<void*>( state.sbt.hitgroupRecordBase ) ) );
+    state.context = 0;
+}
 
-    for (auto it = state.d_pointers.begin(); it != state.d_pointers.end(); it++) {
-      CUDA_CHECK( cudaFree( *it ) );
-    }
-    if (state.deferFree) freeGridPointers(state);
+void cleanupState( RTNNState& state )
+{
+    cleanupSearch(state);
+    destroyDeviceArena(state);
+    destroyPinnedPool(state);
+    cleanupOptiX(state);
+    unmapPointFiles(state);
 }
 
 void setupOptiX( RTNNState& state ) {
@@ -682,6 +1047,7 @@ void setupOptiX( RTNNState& state ) {
   Timing::stopTiming(true);
  
   Timing::startTiming("create pipeline");
+    createProgramGroups ( state );
     createPipeline ( state );
   Timing::stopTiming(true);
 
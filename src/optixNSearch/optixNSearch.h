@@ -31,6 +31,8 @@
 #include <optix_types.h>
 #include <sutil/vec_math.h>
 
+#include "helper_quantize.h"
+
 enum ParticleType
 {
     POINT = 0,
@@ -61,6 +63,12 @@ struct Params
     unsigned int*    d_r2q_map;
     unsigned int     limit; // 1 for the initial run to sort indices; knn for future runs.
     SearchType       mode;
+    bool             instanced; // |handle| is an IAS over per-frame GASes (see window.h)
+    unsigned int*    instanceOffsets; // with |instanced|: first point of each instance in |points|
+    bool             quantized; // test against |qCells|/|qOffsets| first (see helper_quantize.h)
+    QuantInfo        quant;
+    unsigned int*    qCells;
+    ushort3*         qOffsets;
 
     OptixTraversableHandle handle;
 };
@@ -0,0 +1,54 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <thread>
+#include <vector>
+
+inline unsigned int numHostThreads(unsigned int numThreads) {
+  // 0 means "use all the hardware threads".
+  if (numThreads == 0) numThreads = std::thread::hardware_concurrency();
+  return std::max(numThreads, 1u);
+}
+
+// process [0, N) on a pool of |numThreads| host threads. workers grab chunks
+// of |grain| items from a shared counter, so threads that hit sparse regions
+// of the data simply pick up more chunks. |func| is called as
+// func(begin, end, threadId) and must be safe to run concurrently on
+// disjoint ranges.
+template <typename Func>
+void parallelFor(unsigned int N, unsigned int numThreads, unsigned int grain, Func func) {
+  if (N == 0) return;
+  grain = std::max(grain, 1u);
+  unsigned int numChunks = (N + grain - 1) / grain;
+  numThreads = std::min(numHostThreads(numThreads), numChunks);
+
+  if (numThreads == 1) {
+    func(0u, N, 0u);
+    return;
+  }
+
+  std::atomic<unsigned int> nextChunk(0);
+  auto worker = [&](unsigned int tid) {
+    while (1) {
+      unsigned int chunk = nextChunk.fetch_add(1);
+      if (chunk >= numChunks) break;
+      unsigned int begin = chunk * grain;
+      unsigned int end = std::min(begin + grain, N);
+      func(begin, end, tid);
+    }
+  };
+
+  std::vector<std::thread> pool;
+  pool.reserve(numThreads - 1);
+  for (unsigned int t = 1; t < numThreads; t++) pool.emplace_back(worker, t);
+  worker(0);
+  for (auto& t : pool) t.join();
+}
+
+template <typename Func>
+void parallelFor(unsigned int N, unsigned int numThreads, Func func) {
+  // default grain: a few chunks per thread so that the load can still balance
+  unsigned int grain = N / (numHostThreads(numThreads) * 8) + 1;
+  parallelFor(N, numThreads, grain, func);
+}
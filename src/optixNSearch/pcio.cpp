@@ -0,0 +1,105 @@
+#include <cstdio>
+#include <cstring>
+#include <string>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <sutil/vec_math.h>
+
+#include "pcio.h"
+
+bool statSource(const char* path, uint64_t& size, int64_t& mtime) {
+  struct stat st;
+  if (stat(path, &st) != 0) return false;
+  size = st.st_size;
+  mtime = (int64_t)st.st_mtim.tv_sec * 1000000000 + st.st_mtim.tv_nsec;
+  return true;
+}
+
+static bool validHeader(const PointFileHeader& header, size_t fileSize, uint64_t srcSize, int64_t srcMtime) {
+  if (memcmp(header.magic, RTNN_FILE_MAGIC, sizeof(header.magic)) != 0) return false;
+  if (header.version != RTNN_FILE_VERSION) return false;
+  if (header.dims != 3) return false; // only 3D for now
+  // |numPoints| is an unsigned int everywhere else
+  if (header.count > 0xFFFFFFFFull) return false;
+  // catches truncated (e.g., interrupted) writes
+  if (fileSize != sizeof(PointFileHeader) + header.count * sizeof(float3)) return false;
+  if ((srcSize != 0 || srcMtime != 0) &&
+      (header.srcSize != srcSize || header.srcMtime != srcMtime)) return false;
+  return true;
+}
+
+float3* mapPointFile(const char* path, MappedPointFile& mf, uint64_t srcSize, int64_t srcMtime) {
+  int fd = open(path, O_RDONLY);
+  if (fd < 0) return nullptr;
+
+  struct stat st;
+  PointFileHeader header;
+  if (fstat(fd, &st) != 0 ||
+      pread(fd, &header, sizeof(header), 0) != (ssize_t)sizeof(header) ||
+      !validHeader(header, st.st_size, srcSize, srcMtime)) {
+    close(fd);
+    return nullptr;
+  }
+
+  // private, writable mapping: the sorting code writes the sorted points back
+  // to |h_points|, which only copies the touched pages and never reaches the
+  // file.
+  void* base = mmap(nullptr, st.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (base == MAP_FAILED) return nullptr;
+
+  mf.base = base;
+  mf.size = st.st_size;
+  mf.header = header;
+  return reinterpret_cast<float3*>(static_cast<char*>(base) + sizeof(PointFileHeader));
+}
+
+void unmapPointFile(MappedPointFile& mf) {
+  if (mf.base) munmap(mf.base, mf.size);
+  mf.base = nullptr;
+  mf.size = 0;
+}
+
+bool writePointFile(const char* path, const float3* points, unsigned int N, uint64_t srcSize, int64_t srcMtime) {
+  PointFileHeader header;
+  memset(&header, 0, sizeof(header));
+  memcpy(header.magic, RTNN_FILE_MAGIC, sizeof(header.magic));
+  header.version = RTNN_FILE_VERSION;
+  header.dims = 3;
+  header.count = N;
+  header.srcSize = srcSize;
+  header.srcMtime = srcMtime;
+  if (N > 0) {
+    header.min = header.max = points[0];
+    for (unsigned int i = 1; i < N; i++) {
+      header.min = fminf(header.min, points[i]);
+      header.max = fmaxf(header.max, points[i]);
+    }
+  }
+
+  std::string tmp = std::string(path) + ".tmp." + std::to_string(getpid());
+  FILE* fp = fopen(tmp.c_str(), "wb");
+  if (!fp) return false;
+
+  bool ok = (fwrite(&header, sizeof(header), 1, fp) == 1);
+  if (ok && N > 0) ok = (fwrite(points, sizeof(float3), N, fp) == N);
+  ok = (fclose(fp) == 0) && ok;
+
+  if (ok) ok = (rename(tmp.c_str(), path) == 0);
+  if (!ok) unlink(tmp.c_str());
+  return ok;
+}
+
+bool writeTextPointFile(const char* path, const float3* points, unsigned int N) {
+  FILE* fp = fopen(path, "w");
+  if (!fp) return false;
+
+  bool ok = true;
+  for (unsigned int i = 0; i < N && ok; i++)
+    ok = (fprintf(fp, "%.9g,%.9g,%.9g\n", points[i].x, points[i].y, points[i].z) > 0);
+  return (fclose(fp) == 0) && ok;
+}
@@ -0,0 +1,53 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+#include <vector_types.h>
+
+// Binary point cloud layout (".rtnn"): a fixed 64-byte header followed by
+// |count| tightly packed float3s. The header stays a multiple of 16 bytes so
+// the payload is aligned when the file is mmap-ed. |srcSize| and |srcMtime|
+// identify the text file a sidecar was generated from; both are 0 for files
+// that were written directly in binary.
+#define RTNN_FILE_MAGIC "RTNNPC\0\0"
+#define RTNN_FILE_VERSION 1
+#define RTNN_FILE_EXT ".rtnn"
+
+struct PointFileHeader
+{
+  char                        magic[8];
+  uint32_t                    version;
+  uint32_t                    dims;
+  uint64_t                    count;
+  float3                      min; // exact bounding box of the points
+  float3                      max;
+  uint64_t                    srcSize;
+  int64_t                     srcMtime; // in ns
+};
+static_assert(sizeof(PointFileHeader) == 64, "the point file header must be 64 bytes");
+
+struct MappedPointFile
+{
+  void*                       base      = nullptr;
+  size_t                      size      = 0;
+  PointFileHeader             header;
+};
+
+// map |path| if it's a valid binary point file. if |srcSize| and |srcMtime|
+// aren't both 0, the file must have been generated from a source with the
+// same size and modification time (i.e., it's a sidecar that's still fresh).
+// returns nullptr (and leaves |mf| untouched) otherwise.
+float3* mapPointFile(const char* path, MappedPointFile& mf, uint64_t srcSize = 0, int64_t srcMtime = 0);
+void unmapPointFile(MappedPointFile&);
+
+// write |points| in the binary layout. the file is first written to a
+// temporary file next to |path| and then renamed, so concurrent readers never
+// see a partial file.
+bool writePointFile(const char* path, const float3* points, unsigned int N, uint64_t srcSize = 0, int64_t srcMtime = 0);
+// write |points| in the text format (see |read_pc_data|), one "x,y,z" line
+// per point with enough digits that the floats read back exactly.
+bool writeTextPointFile(const char* path, const float3* points, unsigned int N);
+
+// size and modification time (in ns) of a file; false if it can't be stat-ed.
+bool statSource(const char* path, uint64_t& size, int64_t& mtime);
@@ -0,0 +1,59 @@
+#include <algorithm>
+#include <cassert>
+
+#include "pinned.h"
+
+size_t pinnedClassSize(const PinnedPool& pool, unsigned int c) {
+  return (pool.minClass << (c / 4)) / 4 * (4 + c % 4);
+}
+
+unsigned int pinnedClass(const PinnedPool& pool, size_t bytes) {
+  unsigned int c = 0;
+  while (pinnedClassSize(pool, c) < bytes) c++;
+  return c;
+}
+
+void* pinnedAcquire(PinnedPool& pool, size_t bytes) {
+  unsigned int c = pinnedClass(pool, bytes);
+  size_t size = pinnedClassSize(pool, c);
+  if (pool.freeLists.size() <= c) pool.freeLists.resize(c + 1);
+
+  void* ptr;
+  std::vector<void*>& cached = pool.freeLists[c];
+  if (!cached.empty()) {
+    ptr = cached.back();
+    cached.pop_back();
+    pool.hits++;
+  } else {
+    ptr = pool.allocHost ? pool.allocHost(size) : nullptr;
+    if (!ptr) return nullptr;
+    pool.misses++;
+    pool.reserved += size;
+    pool.peakReserved = std::max(pool.peakReserved, pool.reserved);
+  }
+
+  pool.classOf[ptr] = c;
+  pool.inUse += size;
+  pool.highWater = std::max(pool.highWater, pool.inUse);
+  return ptr;
+}
+
+void pinnedRelease(PinnedPool& pool, void* ptr) {
+  auto it = pool.classOf.find(ptr);
+  assert(it != pool.classOf.end());
+  unsigned int c = it->second;
+  pool.classOf.erase(it);
+
+  pool.inUse -= pinnedClassSize(pool, c);
+  pool.freeLists[c].push_back(ptr);
+}
+
+void pinnedTrim(PinnedPool& pool) {
+  for (unsigned int c = 0; c < pool.freeLists.size(); c++) {
+    for (void* ptr : pool.freeLists[c]) {
+      if (pool.freeHost) pool.freeHost(ptr);
+      pool.reserved -= pinnedClassSize(pool, c);
+    }
+    pool.freeLists[c].clear();
+  }
+}
@@ -0,0 +1,43 @@
+#pragma once
+
+#include <cstddef>
+#include <functional>
+#include <unordered_map>
+#include <vector>
+
+// Pool of pinned host buffers (--pinnedpool), for the result copies, the
+// staging of uploads and the sanity-check copies. cudaMallocHost costs about
+// as much as the copy it's for, so buffers are kept when released and handed
+// out again for requests of the same size class. Classes are 4 per power of
+// two starting at |minClass| (so at most 25% is wasted); a request always gets
+// a buffer of its class's full size.
+//
+// This is plain host code; the buffers come from |allocHost| and go back
+// through |freeHost| (cudaMallocHost/cudaFreeHost, see |allocPinned| in
+// util.cpp). Not thread safe: only the main thread acquires and releases.
+struct PinnedPool
+{
+  size_t                      minClass        = 64 << 10;
+  std::vector<std::vector<void*>> freeLists; // per class
+  std::unordered_map<void*, unsigned int> classOf; // of the buffers handed out
+
+  size_t                      inUse           = 0; // bytes handed out
+  size_t                      reserved        = 0; // bytes handed out or cached
+  size_t                      highWater       = 0; // max of |inUse|
+  size_t                      peakReserved    = 0; // max of |reserved|
+  unsigned int                hits            = 0; // requests served from the cache
+  unsigned int                misses          = 0;
+
+  // returns nullptr on failure
+  std::function<void*(size_t)> allocHost;
+  std::function<void(void*)>  freeHost;
+};
+
+unsigned int pinnedClass(const PinnedPool&, size_t);
+size_t pinnedClassSize(const PinnedPool&, unsigned int);
+// nullptr if a new buffer was needed and |allocHost| failed.
+void* pinnedAcquire(PinnedPool&, size_t);
+// |ptr| must have come from |pinnedAcquire|.
+void pinnedRelease(PinnedPool&, void*);
+// free all cached buffers; the ones handed out stay valid.
+void pinnedTrim(PinnedPool&);
@@ -0,0 +1,861 @@
+#include <cuda_runtime.h>
+
+#include <sutil/Exception.h>
+#include <sutil/Timing.h>
+#include <thrust/device_vector.h>
+#include <thrust/copy.h>
+
+#include <climits>
+#include <cmath>
+
+#include "optixNSearch.h"
+#include "state.h"
+#include "func.h"
+#include "rtnn.h"
+#include "parallel.h"
+#include "verlet.h"
+
+namespace rtnn {
+
+NeighborSearch::NeighborSearch() {
+  m_state.trackIds = true;
+  m_radius = m_state.radius;
+  m_numOfBatches = m_state.numOfBatches;
+}
+
+NeighborSearch::NeighborSearch(const RTNNState& config) : m_state(config) {
+  // keep the configuration only; the data belong to whoever filled |config|.
+  m_state.h_points = nullptr;
+  m_state.h_queries = nullptr;
+  m_state.h_ndpoints = nullptr;
+  m_state.h_ndqueries = nullptr;
+  m_state.h_mappedFiles.clear();
+  m_state.numPoints = 0;
+  m_state.numQueries = 0;
+  m_state.d_pointers.clear();
+  m_state.d_gridPointers.clear();
+  m_state.arena = nullptr;
+  m_state.pinnedPool = nullptr;
+
+  m_radius = m_state.radius;
+  m_numOfBatches = m_state.numOfBatches;
+}
+
+NeighborSearch::~NeighborSearch() {
+  release();
+  destroyDeviceArena(m_state);
+  destroyPinnedPool(m_state);
+  if (m_state.context) cleanupOptiX(m_state);
+}
+
+void NeighborSearch::setPoints(const float3* points, unsigned int N) {
+  m_points.assign(points, points + N);
+  m_borrowedPoints = nullptr;
+  m_pointsMoved = false; // a new point set is always built from scratch
+  m_listsReady = false;
+}
+
+void NeighborSearch::setPoints(float3* points, unsigned int N, Ownership ownership) {
+  if (ownership == Copy) {
+    setPoints(static_cast<const float3*>(points), N);
+    return;
+  }
+  m_points.clear();
+  m_borrowedPoints = points;
+  m_numBorrowedPoints = N;
+  m_pointsMoved = false;
+  m_listsReady = false;
+}
+
+// copy borrowed arrays into the ones we own, for the modes that need the
+// caller's order across searches (see the class comment).
+void NeighborSearch::adoptBorrowed() {
+  if (m_borrowedPoints) {
+    m_points.assign(m_borrowedPoints, m_borrowedPoints + m_numBorrowedPoints);
+    m_borrowedPoints = nullptr;
+  }
+  if (m_borrowedQueries) {
+    m_queries.assign(m_borrowedQueries, m_borrowedQueries + m_numBorrowedQueries);
+    m_borrowedQueries = nullptr;
+  }
+}
+
+void NeighborSearch::updatePoints(const float3* points) {
+  adoptBorrowed();
+  std::copy(points, points + m_points.size(), m_points.begin());
+  m_pointsMoved = true;
+  m_listsMoved = true;
+}
+
+void NeighborSearch::setSkin(float skin) {
+  m_state.verletSkin = skin;
+}
+
+void NeighborSearch::setDynamic(bool dynamic) {
+  m_state.dynamic = dynamic;
+}
+
+void NeighborSearch::setQueries(const float3* queries, unsigned int N) {
+  m_listsReady = false;
+  m_borrowedQueries = nullptr;
+  m_sameData = (queries == nullptr);
+  if (m_sameData) m_queries.clear();
+  else m_queries.assign(queries, queries + N);
+}
+
+void NeighborSearch::setQueries(float3* queries, unsigned int N, Ownership ownership) {
+  if ((ownership == Copy) || (queries == nullptr)) {
+    setQueries(static_cast<const float3*>(queries), N);
+    return;
+  }
+  m_listsReady = false;
+  m_sameData = false;
+  m_queries.clear();
+  m_borrowedQueries = queries;
+  m_numBorrowedQueries = N;
+}
+
+void NeighborSearch::setRadius(float radius) {
+  m_radius = radius;
+}
+
+void NeighborSearch::setK(unsigned int k) {
+  if (m_state.searchMode == "radius") m_state.knn = k;
+}
+
+void NeighborSearch::setSearchMode(const std::string& mode) {
+  assert((mode == "radius") || (mode == "knn"));
+  m_state.searchMode = mode;
+  // see |parseArgs|
+  if (mode == "knn") m_state.knn = K;
+}
+
+// free the previous search, if any.
+void NeighborSearch::release() {
+  if (!m_searched) return;
+
+  if (m_state.backend == "cpu") cleanupCPUState(m_state);
+  else cleanupSearch(m_state);
+
+  m_searched = false;
+  m_resultsReady = false;
+  m_results.clear();
+}
+
+void NeighborSearch::launchBatches() {
+  RTNNState& state = m_state;
+
+  if (state.interleave) {
+    for (int i = 0; i < state.numOfBatches; i++) {
+      // it's possible that certain batches have 0 query (e.g., state.partThd too low).
+      if (state.numActQueries[i] == 0) continue;
+      // batch i runs on stream i; the tags label its timed phases in the trace.
+      TraceTags tags(i, i);
+      // TODO: group buildGas together to allow overlapping; this would allow
+      // us to batch-free temp storages and non-compacted gas storages. right
+      // now free storage serializes gas building.
+      createGeometry (state, i, state.launchRadius[i]/state.gsrRatio); // batch_id ignored if not partition.
+    }
+
+    for (int i = 0; i < state.numOfBatches; i++) {
+      if (state.numActQueries[i] == 0) continue;
+      TraceTags tags(i, i);
+      if (state.qGasSortMode) gasSortSearch(state, i);
+    }
+
+    for (int i = 0; i < state.numOfBatches; i++) {
+      if (state.numActQueries[i] == 0) continue;
+      TraceTags tags(i, i);
+      if (state.qGasSortMode && state.gsrRatio != 1)
+        createGeometry (state, i, state.launchRadius[i]);
+    }
+
+    for (int i = 0; i < state.numOfBatches; i++) {
+      if (state.numActQueries[i] == 0) continue;
+      TraceTags tags(i, i);
+      // TODO: when K is too big, we can't launch all rays together. split rays.
+      ::search(state, i);
+    }
+  } else {
+    for (int i = 0; i < state.numOfBatches; i++) {
+      if (state.numActQueries[i] == 0) continue;
+      TraceTags tags(i, i);
+
+      // create the GAS using the current order of points and the launchRadius of the current batch.
+      // TODO: does it make sense to have per-batch |gsrRatio|?
+      createGeometry (state, i, state.launchRadius[i]/state.gsrRatio); // batch_id ignored if not partition.
+
+      if (state.qGasSortMode) {
+        gasSortSearch(state, i);
+        if (state.gsrRatio != 1)
+          createGeometry (state, i, state.launchRadius[i]);
+      }
+
+      ::search(state, i);
+    }
+  }
+
+  finishCompactResults(state);
+}
+
+// a frame of the dynamic mode can be refit if only the point positions have
+// changed since the last build and they haven't drifted too far.
+bool NeighborSearch::canRefit() {
+  RTNNState& state = m_state;
+  if (!state.dynamic || !m_searched || !m_pointsMoved || (state.backend != "gpu")) return false;
+  if ((m_radius != m_buildRadius) || (state.knn != m_buildK) || (state.searchMode != m_optixMode)) return false;
+
+  float maxDisp = maxDisplacement(m_buildPoints.data(), m_points.data(), m_points.size(), state.numThreads);
+  FrameAction action = planFrame(m_schedule, maxDisp, state.radius, state.refitDrift, state.maxRefits);
+  fprintf(stdout, "\tMax drift since the last build: %f (%u refits so far); %s\n",
+      maxDisp, m_schedule.refits, (action == FRAME_REFIT) ? "refit" : "rebuild");
+  return action == FRAME_REFIT;
+}
+
+// free what the previous frame's search allocated; the points, the GAS and the
+// batch setup stay.
+void NeighborSearch::freeFrame() {
+  RTNNState& state = m_state;
+  freePinned(state, state.h_res[0]);
+  freePinned(state, state.h_resOffsets[0]);
+  state.h_res[0] = nullptr;
+  state.h_resOffsets[0] = nullptr;
+  state.d_r2q_map[0] = nullptr;
+
+  for (auto it = state.d_pointers.begin(); it != state.d_pointers.end(); ) {
+    if (m_persistent.count(*it)) it++;
+    else {
+      CUDA_CHECK( cudaFree( *it ) );
+      it = state.d_pointers.erase(it);
+    }
+  }
+  releaseArenaScope(state, ARENA_BATCH);
+  releaseArenaScope(state, ARENA_RESULTS);
+
+  m_resultsReady = false;
+  m_results.clear();
+}
+
+void NeighborSearch::refit() {
+  RTNNState& state = m_state;
+  freeFrame();
+
+  Timing::startTiming("total search time");
+    Timing::startTiming("upload points");
+      // the GAS (and, with samepq, the queries) keep the order of the last build.
+      parallelFor(state.numPoints, state.numThreads, [&](unsigned int b, unsigned int e, unsigned int) {
+        for (unsigned int i = b; i < e; i++) m_hPoints[i] = m_points[m_sortedIds[i]];
+      });
+      // quantized points live in host memory (see |quantizePoints|).
+      if (state.h_exactPoints)
+        std::copy(m_hPoints.begin(), m_hPoints.begin() + state.numPoints, state.h_exactPoints);
+      else uploadStaged(state, state.params.points, m_hPoints.data(), state.numPoints * sizeof(float3));
+    Timing::stopTiming(true);
+
+    if (state.quantize) quantizePoints(state);
+
+    refitGeometry(state, 0, state.launchRadius[0]);
+
+    if (!state.outFile.empty()) startResultWriter(state, m_numQueries);
+
+    if (state.qGasSortMode) gasSortSearch(state, 0);
+    ::search(state, 0);
+    finishCompactResults(state);
+
+    CUDA_SYNC_CHECK();
+  Timing::stopTiming(true);
+
+  if (state.writer) {
+    Timing::startTiming("result write wait");
+      finishResultWriter(state);
+    Timing::stopTiming(true);
+  }
+
+  recordFrame(m_schedule, FRAME_REFIT);
+  m_pointsMoved = false;
+}
+
+// the kept Verlet lists still hold every pair within the radius if only the
+// points moved since, and not too far.
+bool NeighborSearch::canReuseLists() {
+  RTNNState& state = m_state;
+  if (!m_listsReady || !m_listsMoved) return false;
+  if ((m_radius != m_listRadius) || (state.verletSkin != m_listSkin) || (state.knn != m_listK)) return false;
+
+  float maxDisp = maxDisplacement(m_listPoints.data(), m_points.data(), m_points.size(), state.numThreads);
+  bool rebuild = needVerletRebuild(maxDisp, state.verletSkin, m_sameData);
+  fprintf(stdout, "\tMax displacement since the Verlet lists were built: %f (skin %f); %s\n",
+      maxDisp, state.verletSkin, rebuild ? "rebuild" : "reuse");
+  return !rebuild;
+}
+
+void NeighborSearch::search() {
+  RTNNState& state = m_state;
+  bool verlet = (state.verletSkin > 0) && (state.searchMode == "radius");
+  if (state.dynamic || verlet) adoptBorrowed();
+  if (!verlet) {
+    m_listsReady = false;
+    searchOnce();
+    return;
+  }
+
+  const std::vector<float3>& queries = m_sameData ? m_points : m_queries;
+  if (!canReuseLists()) {
+    // search with the skin and keep the (caller-ordered) lists.
+    float radius = m_radius;
+    m_radius = radius + state.verletSkin;
+    searchOnce();
+    m_radius = radius;
+    if (!m_searched) { // nothing to search
+      m_listsReady = false;
+      return;
+    }
+
+    m_lists = results();
+    m_listPoints = m_points;
+    m_listRadius = m_radius;
+    m_listSkin = state.verletSkin;
+    m_listK = state.knn;
+    m_listsReady = true;
+    m_numListBuilds++;
+
+    unsigned int numFull = countFullLists(m_lists.data(), m_numQueries, state.knn, state.numThreads);
+    if (numFull)
+      fprintf(stderr, "Warning: %u Verlet lists hit K = %u; pairs within radius + skin may be missing. Raise K or lower the skin.\n",
+          numFull, state.knn);
+  } else m_numListReuses++;
+
+  Timing::startTiming("filter Verlet lists");
+    m_results.resize(m_lists.size());
+    filterVerletLists(m_lists.data(), m_numQueries, state.knn, queries.data(), m_points.data(),
+        m_radius, m_results.data(), state.numThreads);
+    m_resultsReady = true;
+    m_listsMoved = false;
+  Timing::stopTiming(true);
+
+  fprintf(stdout, "\tVerlet lists: %u builds, %u reuses\n", m_numListBuilds, m_numListReuses);
+}
+
+void NeighborSearch::searchOnce() {
+  RTNNState& state = m_state;
+  if (canRefit()) {
+    refit();
+    return;
+  }
+  release();
+
+  if (state.dynamic) {
+    // see |setDynamic|. with the same sort mode, searching the points
+    // themselves makes the queries the very same (refit) device array.
+    state.partition = false;
+    state.querySortMode = state.pointSortMode;
+    state.toGather = false;
+    state.filterQueries = false;
+    state.gsrRatio = 1;
+    state.trackIds = true;
+  }
+
+  // the sorts write the sorted points/queries back to the host arrays, so
+  // search on copies, unless the caller lent us the arrays.
+  if (m_borrowedPoints) {
+    state.h_points = m_borrowedPoints;
+    state.numPoints = m_numBorrowedPoints;
+  } else {
+    m_hPoints = m_points;
+    state.h_points = m_hPoints.data();
+    state.numPoints = m_hPoints.size();
+  }
+
+  // see |parseArgs| for how sameData and samepq are decided.
+  state.sameData = m_sameData;
+  state.samepq = m_sameData && (state.pointSortMode == state.querySortMode);
+  if (state.samepq) {
+    state.h_queries = state.h_points;
+    state.numQueries = state.numPoints;
+  } else if (m_borrowedQueries) {
+    state.h_queries = m_borrowedQueries;
+    state.numQueries = m_numBorrowedQueries;
+  } else {
+    // the points are sorted in place, so same-data queries sorted in another
+    // order need a copy of their own (taken before the sort).
+    if (m_sameData) m_hQueries.assign(state.h_points, state.h_points + state.numPoints);
+    else m_hQueries = m_queries;
+    state.h_queries = m_hQueries.data();
+    state.numQueries = m_hQueries.size();
+  }
+  m_numQueries = state.numQueries;
+
+  // these are updated during a search
+  state.radius = m_radius;
+  state.params.radius = m_radius;
+  state.numOfBatches = m_numOfBatches;
+
+  if (state.numPoints == 0 || state.numQueries == 0) return;
+  m_searched = true;
+
+  if (state.backend == "cpu") {
+    Timing::startTiming("total search time");
+      searchCPU(state);
+    Timing::stopTiming(true);
+
+    if (!state.outFile.empty()) {
+      Timing::startTiming("result write");
+        startResultWriter(state, m_numQueries);
+        writeResultAsync(state, 0);
+        finishResultWriter(state);
+      Timing::stopTiming(true);
+    }
+    return;
+  }
+
+  // the writer reports the neighbors by their original ids.
+  if (!state.outFile.empty()) state.trackIds = true;
+
+  if (!m_deviceSet) {
+    setDevice(state);
+    m_deviceSet = true;
+  }
+
+  uploadData(state);
+
+  // call this after set device.
+  initBatches(state);
+
+  if (state.context && (m_optixMode != state.searchMode)) cleanupOptiX(state);
+  if (!state.context) {
+    setupOptiX(state);
+    m_optixMode = state.searchMode;
+  } else {
+    Timing::startTiming("create pipeline");
+      createPipeline(state);
+    Timing::stopTiming(true);
+  }
+
+  Timing::startTiming("total search time");
+    // TODO: streamline the logic of partition and sorting.
+    sortParticles(state, QUERY, state.querySortMode);
+
+    // samepq indicates same underlying data and sorting mode, in which case
+    // queries have been sorted so no need to sort them again.
+    if (!state.samepq) sortParticles(state, POINT, state.pointSortMode);
+
+    // early free done here too
+    setupSearch(state);
+
+    if (state.dynamic) {
+      // everything allocated so far lives until the next rebuild.
+      m_persistent = state.d_pointers;
+      m_sortedIds.resize(state.numPoints);
+      thrust::copy(thrust::device_pointer_cast(state.d_pointIds),
+          thrust::device_pointer_cast(state.d_pointIds) + state.numPoints, m_sortedIds.begin());
+      m_buildPoints = m_points;
+      m_buildRadius = m_radius;
+      m_buildK = state.knn;
+      recordFrame(m_schedule, FRAME_REBUILD);
+      m_pointsMoved = false;
+    }
+
+    if (!state.outFile.empty()) startResultWriter(state, m_numQueries);
+
+    launchBatches();
+
+    CUDA_SYNC_CHECK();
+  Timing::stopTiming(true);
+
+  if (state.writer) {
+    // only the batches still being written when the search ends are waited on.
+    Timing::startTiming("result write wait");
+      finishResultWriter(state);
+    Timing::stopTiming(true);
+  }
+}
+
+const std::vector<unsigned int>& NeighborSearch::results() {
+  if (m_resultsReady || !m_searched) return m_results;
+
+  RTNNState& state = m_state;
+  unsigned int k = state.knn;
+  m_results.assign((size_t)m_numQueries * k, UINT_MAX);
+
+  if (state.backend == "cpu") {
+    // the CPU backend neither sorts nor partitions
+    for (unsigned int q = 0; q < m_numQueries; q++) {
+      unsigned int size;
+      const unsigned int* neighbors = getNeighbors(state, 0, q, size);
+      std::copy(neighbors, neighbors + size, m_results.begin() + (size_t)q * k);
+    }
+    m_resultsReady = true;
+    return m_results;
+  }
+
+  if (!state.trackIds) {
+    fprintf(stderr, "results() needs trackIds\n");
+    exit(1);
+  }
+
+  std::vector<unsigned int> pointIds(state.numPoints);
+  thrust::copy(thrust::device_pointer_cast(state.d_pointIds),
+      thrust::device_pointer_cast(state.d_pointIds) + state.numPoints, pointIds.begin());
+
+  // queries that were filtered out (|filterQueries|) keep empty rows.
+  for (int b = 0; b < state.numOfBatches; b++) {
+    unsigned int numQueries = state.numActQueries[b];
+    if (numQueries == 0) continue;
+
+    std::vector<unsigned int> queryIds(numQueries);
+    thrust::copy(thrust::device_pointer_cast(state.d_actQIds[b]),
+        thrust::device_pointer_cast(state.d_actQIds[b]) + numQueries, queryIds.begin());
+
+    for (unsigned int q = 0; q < numQueries; q++) {
+      unsigned int size;
+      const unsigned int* neighbors = getNeighbors(state, b, q, size);
+      unsigned int* row = &m_results[(size_t)queryIds[q] * k];
+      for (unsigned int j = 0; j < size; j++) row[j] = pointIds[neighbors[j]];
+    }
+  }
+
+  m_resultsReady = true;
+  return m_results;
+}
+
+SlidingWindow::SlidingWindow() : SlidingWindow(RTNNState()) {}
+
+SlidingWindow::SlidingWindow(const RTNNState& config) : m_state(config) {
+  RTNNState& state = m_state;
+  // see |NeighborSearch(const RTNNState&)|.
+  state.h_points = nullptr;
+  state.h_queries = nullptr;
+  state.h_ndpoints = nullptr;
+  state.h_ndqueries = nullptr;
+  state.h_mappedFiles.clear();
+  state.numPoints = 0;
+  state.numQueries = 0;
+  state.d_pointers.clear();
+  state.d_gridPointers.clear();
+  state.arena = nullptr;
+  state.pinnedPool = nullptr;
+
+  // one batch, queries as given; see the class comment.
+  state.partition = false;
+  state.querySortMode = 0;
+  state.toGather = false;
+  state.gsrRatio = 1;
+  state.filterQueries = false;
+  state.csr = false;
+  state.samepq = false;
+  state.sameData = false;
+  state.sanCheck = false;
+  state.deferFree = true;
+  state.trackIds = false; // the window keeps its own ids
+  state.dynamic = false;
+  state.verletSkin = 0;
+  state.gasCacheDir.clear(); // frames come and go; not worth caching
+  state.outFile.clear();
+  state.instanced = (state.backend == "gpu");
+  state.quantize = false; // frames are encoded nowhere; see |quantizePoints|
+
+  m_radius = state.radius;
+}
+
+SlidingWindow::~SlidingWindow() {
+  if (!m_deviceSet) return;
+
+  for (auto& gas : m_gas)
+    CUDA_CHECK( cudaFree( reinterpret_cast<void*>( gas.second.buffer ) ) );
+  if (m_dPoints) CUDA_CHECK( cudaFree( m_dPoints ) );
+  if (m_dIds) CUDA_CHECK( cudaFree( m_dIds ) );
+
+  // the IAS is the geometry of batch 0, which |cleanupSearch| frees.
+  m_state.h_points = nullptr;
+  m_state.h_queries = nullptr;
+  cleanupSearch(m_state);
+  destroyDeviceArena(m_state);
+  destroyPinnedPool(m_state);
+  cleanupOptiX(m_state);
+}
+
+void SlidingWindow::setRadius(float radius) {
+  m_radius = radius;
+}
+
+void SlidingWindow::setK(unsigned int k) {
+  if (m_state.searchMode == "radius") m_state.knn = k;
+}
+
+void SlidingWindow::setSearchMode(const std::string& mode) {
+  assert((mode == "radius") || (mode == "knn"));
+  assert(!m_deviceSet);
+  m_state.searchMode = mode;
+  // see |parseArgs|
+  if (mode == "knn") m_state.knn = K;
+}
+
+void SlidingWindow::setupDevice() {
+  if (m_deviceSet) return;
+  RTNNState& state = m_state;
+
+  setDevice(state);
+  initSingleBatch(state);
+  setupOptiX(state);
+  state.gas_handle[0] = 0;
+  m_gasRadius = m_radius;
+  m_deviceSet = true;
+}
+
+// free the per-search/per-frame device memory; the window arrays and the
+// GASes aren't tracked in |d_pointers|.
+void SlidingWindow::freeScratch() {
+  for (auto ptr : m_state.d_pointers) CUDA_CHECK( cudaFree( ptr ) );
+  m_state.d_pointers.clear();
+  releaseArenaScope(m_state, ARENA_BATCH);
+  releaseArenaScope(m_state, ARENA_RESULTS);
+}
+
+// make room for |N| more slots after the last segment.
+void SlidingWindow::reserveSlots(unsigned int N) {
+  unsigned int capacity = m_hPoints.size();
+  if (m_window.used + N <= capacity) return;
+
+  // reclaim the dead slots first and only grow if that isn't enough.
+  if (m_window.numLive + N > capacity) capacity = std::max(m_window.numLive + N, 2 * capacity);
+  repack(capacity);
+}
+
+// drop the dead segments and move the window into arrays of |capacity| slots.
+void SlidingWindow::repack(unsigned int capacity) {
+  Timing::startTiming("repack window");
+    std::vector<SegmentMove> moves = compactFrames(m_window);
+    applyMoves(moves, m_hPoints.data());
+    applyMoves(moves, m_ids.data());
+    if (capacity > m_hPoints.size()) {
+      m_hPoints.resize(capacity);
+      m_ids.resize(capacity);
+    }
+
+    if (onDevice()) {
+      // copy into fresh arrays: device-to-device copies must not overlap.
+      float3* dPoints;
+      unsigned int* dIds;
+      CUDA_CHECK( cudaMalloc( reinterpret_cast<void**>( &dPoints ), (size_t)m_hPoints.size() * sizeof(float3) ) );
+      CUDA_CHECK( cudaMalloc( reinterpret_cast<void**>( &dIds ), (size_t)m_ids.size() * sizeof(unsigned int) ) );
+      for (const auto& move : moves) {
+        CUDA_CHECK( cudaMemcpy( dPoints + move.to, m_dPoints + move.from,
+                        (size_t)move.count * sizeof(float3), cudaMemcpyDeviceToDevice ) );
+        CUDA_CHECK( cudaMemcpy( dIds + move.to, m_dIds + move.from,
+                        (size_t)move.count * sizeof(unsigned int), cudaMemcpyDeviceToDevice ) );
+      }
+      if (m_dPoints) CUDA_CHECK( cudaFree( m_dPoints ) );
+      if (m_dIds) CUDA_CHECK( cudaFree( m_dIds ) );
+      m_dPoints = dPoints;
+      m_dIds = dIds;
+
+      // the GASes don't care where their points are, but the instance offsets do.
+      m_iasDirty = true;
+    }
+  Timing::stopTiming(true);
+
+  fprintf(stdout, "\tWindow repacked: %u frames, %u points, %zu slots\n",
+      numLiveFrames(m_window), m_window.numLive, m_hPoints.size());
+}
+
+// sort the points of a frame within its segment; |m_ids| follows them.
+void SlidingWindow::sortFrame(const FrameSegment& seg) {
+  RTNNState& state = m_state;
+
+  state.params.points = m_dPoints + seg.offset;
+  state.h_points = m_hPoints.data() + seg.offset;
+  state.numPoints = seg.count;
+  state.d_pointIds = m_dIds + seg.offset;
+  state.radius = m_radius;
+  computeMinMax(seg.count, state.params.points, state.pMin, state.pMax);
+  state.Min = state.pMin;
+  state.Max = state.pMax;
+
+  sortParticles(state, POINT, state.pointSortMode);
+  freeGridPointers(state);
+  freeScratch();
+
+  thrust::copy(thrust::device_pointer_cast(state.d_pointIds),
+      thrust::device_pointer_cast(state.d_pointIds) + seg.count, m_ids.begin() + seg.offset);
+  state.d_pointIds = nullptr;
+}
+
+void SlidingWindow::buildFrameGas(const FrameSegment& seg) {
+  RTNNState& state = m_state;
+  freeFrameGas(seg.frameId);
+
+  // |createGeometry| builds into the geometry of batch 0, which is the IAS;
+  // park the IAS meanwhile.
+  OptixTraversableHandle ias = state.gas_handle[0];
+  CUdeviceptr iasBuffer = state.d_gas_output_buffer[0];
+  size_t iasSize = state.gas_size[0];
+
+  state.params.points = m_dPoints + seg.offset;
+  state.numPoints = seg.count;
+  state.d_gas_output_buffer[0] = 0;
+  state.d_aabb[0] = nullptr; // freed after every build
+  createGeometry(state, 0, m_radius);
+  m_gas[seg.frameId] = {state.gas_handle[0], state.d_gas_output_buffer[0]};
+
+  state.gas_handle[0] = ias;
+  state.d_gas_output_buffer[0] = iasBuffer;
+  state.gas_size[0] = iasSize;
+}
+
+void SlidingWindow::freeFrameGas(int frameId) {
+  auto it = m_gas.find(frameId);
+  if (it == m_gas.end()) return;
+  CUDA_CHECK( cudaFree( reinterpret_cast<void*>( it->second.buffer ) ) );
+  m_gas.erase(it);
+}
+
+void SlidingWindow::buildIas() {
+  std::vector<OptixTraversableHandle> handles;
+  std::vector<unsigned int> offsets;
+  for (const auto& seg : m_window.segments) {
+    auto it = m_gas.find(seg.frameId);
+    if (!seg.live || (it == m_gas.end())) continue; // empty frames have no GAS
+    handles.push_back(it->second.handle);
+    offsets.push_back(seg.offset);
+  }
+
+  createInstanceGeometry(m_state, 0, handles.data(), offsets.data(), handles.size());
+  m_iasDirty = false;
+}
+
+int SlidingWindow::pushFrame(const float3* points, unsigned int N) {
+  if (onDevice()) setupDevice();
+
+  int frameId;
+  Timing::startTiming("push frame");
+    reserveSlots(N);
+    frameId = addFrame(m_window, N);
+    const FrameSegment& seg = *findFrame(m_window, frameId);
+
+    std::copy(points, points + N, m_hPoints.begin() + seg.offset);
+    for (unsigned int i = 0; i < N; i++) m_ids[seg.offset + i] = i;
+
+    if (onDevice() && (N > 0)) {
+      uploadStaged(m_state, m_dPoints + seg.offset, points, N * sizeof(float3));
+      genSeqDevice(thrust::device_pointer_cast(m_dIds + seg.offset), N);
+      sortFrame(seg);
+      // a radius change rebuilds everything at the next search anyway.
+      if (m_radius == m_gasRadius) buildFrameGas(seg);
+      m_iasDirty = true;
+    }
+  Timing::stopTiming(true);
+
+  return frameId;
+}
+
+bool SlidingWindow::dropFrame(int frameId) {
+  if (!removeFrame(m_window, frameId)) return false;
+  if (m_gas.count(frameId)) {
+    freeFrameGas(frameId);
+    m_iasDirty = true;
+  }
+  return true;
+}
+
+void SlidingWindow::keepLatest(unsigned int numFrames) {
+  while (numLiveFrames(m_window) > numFrames) dropFrame(oldestFrame(m_window));
+}
+
+bool SlidingWindow::locate(unsigned int slot, int& frameId, unsigned int& index) const {
+  unsigned int pos;
+  if (!locateSlot(m_window, slot, frameId, pos)) return false;
+  index = m_ids[slot];
+  return true;
+}
+
+void SlidingWindow::search(const float3* queries, unsigned int N) {
+  m_hQueries.assign(queries, queries + N);
+  m_numQueries = N;
+  m_results.assign((size_t)N * m_state.knn, UINT_MAX);
+  if ((N == 0) || (m_window.numLive == 0)) return;
+
+  fprintf(stdout, "\tWindow: %u frames, %u points, %u slots used\n",
+      numLiveFrames(m_window), m_window.numLive, m_window.used);
+
+  if (onDevice()) searchGPU();
+  else searchCPU();
+}
+
+void SlidingWindow::searchCPU() {
+  RTNNState& state = m_state;
+
+  // the host grid is built over all the slots it's given.
+  if (m_window.used != m_window.numLive) repack(m_hPoints.size());
+
+  state.h_points = m_hPoints.data();
+  state.numPoints = m_window.used;
+  state.h_queries = m_hQueries.data();
+  state.numQueries = m_numQueries;
+  state.radius = m_radius;
+
+  Timing::startTiming("total search time");
+    ::searchCPU(state);
+  Timing::stopTiming(true);
+
+  unsigned int k = state.knn;
+  for (unsigned int q = 0; q < m_numQueries; q++) {
+    unsigned int size;
+    const unsigned int* neighbors = getNeighbors(state, 0, q, size);
+    std::copy(neighbors, neighbors + size, m_results.begin() + (size_t)q * k);
+  }
+
+  cleanupCPUState(state);
+}
+
+void SlidingWindow::searchGPU() {
+  RTNNState& state = m_state;
+
+  Timing::startTiming("total search time");
+    if (m_radius != m_gasRadius) {
+      Timing::startTiming("rebuild frame GASes");
+        for (const auto& seg : m_window.segments)
+          if (seg.live && (seg.count > 0)) buildFrameGas(seg);
+      Timing::stopTiming(true);
+      m_gasRadius = m_radius;
+      m_iasDirty = true;
+    }
+
+    if (needCompaction(m_window, state.windowSlack)) repack(m_hPoints.size());
+    if (m_iasDirty) buildIas();
+
+    state.params.points = m_dPoints;
+    state.h_points = m_hPoints.data();
+    state.numPoints = m_window.used;
+    state.radius = m_radius;
+
+    thrust::device_ptr<float3> d_queries_ptr;
+    state.params.queries = allocThrustDevicePtr(&d_queries_ptr, m_numQueries, &state.d_pointers);
+    uploadStaged(state, state.params.queries, m_hQueries.data(), m_numQueries * sizeof(float3));
+
+    state.h_queries = m_hQueries.data();
+    state.numQueries = m_numQueries;
+    state.numActQueries[0] = m_numQueries;
+    state.d_actQs[0] = state.params.queries;
+    state.h_actQs[0] = state.h_queries;
+    state.launchRadius[0] = m_radius;
+
+    if (state.qGasSortMode) gasSortSearch(state, 0);
+    ::search(state, 0);
+    CUDA_CHECK( cudaStreamSynchronize( state.stream[0] ) );
+  Timing::stopTiming(true);
+
+  // gas-sorted queries are written back in the original order (no gather).
+  const unsigned int* res = static_cast<const unsigned int*>(state.h_res[0]);
+  std::copy(res, res + m_results.size(), m_results.begin());
+
+  freePinned(state, state.h_res[0]);
+  state.h_res[0] = nullptr;
+  state.h_actQs[0] = nullptr;
+  state.d_actQs[0] = nullptr;
+  state.d_r2q_map[0] = nullptr;
+  state.params.queries = nullptr;
+  state.numActQueries[0] = 0;
+  freeScratch();
+}
+
+} // namespace rtnn
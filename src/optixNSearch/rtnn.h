@@ -0,0 +1,251 @@
+#pragma once
+
+#include <map>
+#include <string>
+#include <unordered_set>
+#include <vector>
+
+#include <vector_types.h>
+
+#include "state.h"
+#include "dynamic.h"
+#include "window.h"
+
+namespace rtnn {
+
+// In-process neighbor search. This is what optixNSearch runs; embed it to
+// search without going through files and processes:
+//
+//   rtnn::NeighborSearch ns;
+//   ns.setPoints(points, numPoints);
+//   ns.setQueries(queries, numQueries); // skip to use the points as queries
+//   ns.setRadius(0.5);
+//   ns.search();
+//   const std::vector<unsigned int>& res = ns.results();
+//
+// |results| has numQueries() x k() entries: row q holds the ids (indices into
+// the points passed to |setPoints|) of the neighbors of the q-th query passed
+// in; unused slots are UINT_MAX. In radius search a row lists up to k()
+// points within the radius in no particular order, and in KNN search the up
+// to k() nearest points (K is fixed at compile time, see README).
+//
+// Points and queries are copied, so the caller's arrays are never reordered,
+// unless they are passed with |Borrow|: the search then sorts the caller's
+// arrays in place instead of copies of them, which saves two host copies of
+// the data per search (the CLI borrows the points it reads or memory-maps).
+// A borrowed array must stay valid until the next |setPoints|/|setQueries|,
+// and after a search it holds the points in sorted order; the ids in
+// |results| still index the order the array had when the search started.
+// Dynamic mode and Verlet lists need the caller's order across searches, so
+// they take a copy of borrowed arrays at their first search.
+// The CUDA device and the OptiX context/program groups are set up by the first
+// |search| and reused by later ones; everything else is rebuilt per search.
+//
+// For time-stepped simulations, |setDynamic| keeps the sorted points and the
+// GAS across searches; each step then passes the moved particles to
+// |updatePoints| and calls |search|, which refits the GAS in place instead of
+// re-sorting and rebuilding, unless the particles drifted too far since the
+// last build (see dynamic.h and |refitDrift|/|maxRefits| in the state).
+// On top of that (or without it), |setSkin| turns on Verlet lists in radius
+// search: the search runs with radius + skin and its lists are kept; searches
+// after |updatePoints| then only filter the kept lists against the radius
+// until the points have moved too far (see verlet.h). K must be large enough
+// for radius + skin.
+class NeighborSearch
+{
+public:
+  NeighborSearch();
+  // start from an existing configuration (e.g., filled by |parseArgs|); the
+  // data fields in |config| are ignored.
+  explicit NeighborSearch(const RTNNState& config);
+  ~NeighborSearch();
+
+  NeighborSearch(const NeighborSearch&) = delete;
+  NeighborSearch& operator=(const NeighborSearch&) = delete;
+
+  enum Ownership
+  {
+    Copy,
+    Borrow // search the caller's array in place; see the class comment
+  };
+
+  void setPoints(const float3* points, unsigned int N);
+  void setPoints(float3* points, unsigned int N, Ownership ownership);
+  // queries == nullptr searches the points themselves.
+  void setQueries(const float3* queries, unsigned int N);
+  void setQueries(float3* queries, unsigned int N, Ownership ownership);
+  void setRadius(float radius);
+  void setK(unsigned int k); // radius search only
+  void setSearchMode(const std::string& mode); // "radius" or "knn"
+  // runs every search as a single batch, without query partitioning (the
+  // batches depend on the positions) or query gathering/filtering.
+  void setDynamic(bool dynamic);
+  // new positions of the points passed to |setPoints| (same count and order).
+  void updatePoints(const float3* points);
+  void setSkin(float skin); // 0 turns Verlet lists off
+
+  void search();
+
+  unsigned int numQueries() const { return m_numQueries; }
+  unsigned int k() const { return m_state.knn; }
+  // computed on first access after a search; needs |trackIds| (the default
+  // unless a configuration without it was passed in).
+  const std::vector<unsigned int>& results();
+
+  // the state of the last search, e.g., for |sanityCheck|, and the knobs
+  // that have no setter above. don't touch the data fields.
+  RTNNState& state() { return m_state; }
+
+private:
+  void release();
+  void adoptBorrowed();
+  void launchBatches();
+  void searchOnce();
+  bool canRefit();
+  void refit();
+  void freeFrame();
+  bool canReuseLists();
+
+  RTNNState                   m_state;
+  std::vector<float3>         m_points;
+  std::vector<float3>         m_queries;
+  bool                        m_sameData        = true;
+  // set instead of |m_points|/|m_queries| when the caller's arrays are borrowed
+  float3*                     m_borrowedPoints  = nullptr;
+  float3*                     m_borrowedQueries = nullptr;
+  unsigned int                m_numBorrowedPoints = 0;
+  unsigned int                m_numBorrowedQueries = 0;
+  // the search works on (and sorts) these copies
+  std::vector<float3>         m_hPoints;
+  std::vector<float3>         m_hQueries;
+
+  float                       m_radius;
+  int                         m_numOfBatches;
+  unsigned int                m_numQueries      = 0;
+  bool                        m_deviceSet       = false;
+  std::string                 m_optixMode; // search mode the program groups were created for
+  bool                        m_searched        = false;
+  bool                        m_resultsReady    = false;
+  std::vector<unsigned int>   m_results;
+
+  // dynamic mode; all as of the last full build
+  bool                        m_pointsMoved     = false;
+  std::vector<float3>         m_buildPoints;
+  std::vector<unsigned int>   m_sortedIds; // original id of each sorted point
+  std::unordered_set<void*>   m_persistent; // device memory that outlives a frame
+  float                       m_buildRadius     = 0;
+  unsigned int                m_buildK          = 0;
+  RefitSchedule               m_schedule;
+
+  // Verlet lists, as of the last search with radius + skin
+  bool                        m_listsReady      = false;
+  bool                        m_listsMoved      = false; // points updated since the lists were (re)used
+  std::vector<unsigned int>   m_lists;
+  std::vector<float3>         m_listPoints;
+  float                       m_listRadius      = 0;
+  float                       m_listSkin        = 0;
+  unsigned int                m_listK           = 0;
+  unsigned int                m_numListBuilds   = 0;
+  unsigned int                m_numListReuses   = 0;
+};
+
+// Searches a sliding window of frames, e.g., the last few LiDAR sweeps being
+// accumulated into a map. Frames are pushed and dropped as a whole; neither
+// re-sorts or rebuilds the frames that stay:
+//
+//   rtnn::SlidingWindow win;
+//   win.setRadius(0.5);
+//   int id = win.pushFrame(sweep, numPoints);
+//   win.keepLatest(10);
+//   win.search(queries, numQueries);
+//   const std::vector<unsigned int>& res = win.results();
+//
+// On the GPU, every frame is sorted on its own and gets a GAS of its own when
+// it is pushed; the search traces an IAS over the GASes of the live frames,
+// which is the only thing rebuilt when frames come and go (see
+// |createInstanceGeometry|). The points of all frames share one array, one
+// segment per frame (see window.h); a dropped frame leaves a dead segment that
+// is reclaimed once dead slots take |windowSlack| of the array, or when the
+// array would have to grow. The CPU backend keeps the same bookkeeping but
+// searches the packed live points with a fresh host grid every time.
+//
+// |results| has numQueries() x k() entries like |NeighborSearch::results|,
+// but the ids are slots of the window array; |locate| turns one into the frame
+// and the index of the point within the points passed to |pushFrame|. Slots
+// are valid until the next |pushFrame|, |dropFrame| or |search|. Queries are
+// searched as given: no sorting, partitioning or filtering (like the server).
+class SlidingWindow
+{
+public:
+  SlidingWindow();
+  // start from an existing configuration; the data fields are ignored.
+  explicit SlidingWindow(const RTNNState& config);
+  ~SlidingWindow();
+
+  SlidingWindow(const SlidingWindow&) = delete;
+  SlidingWindow& operator=(const SlidingWindow&) = delete;
+
+  // the search mode is baked into the pipeline, so set it before the first
+  // |pushFrame|. a new radius rebuilds the GAS of every frame at the next
+  // search.
+  void setRadius(float radius);
+  void setK(unsigned int k); // radius search only
+  void setSearchMode(const std::string& mode); // "radius" or "knn"
+
+  // returns the id of the new frame.
+  int pushFrame(const float3* points, unsigned int N);
+  // false if there is no such frame in the window.
+  bool dropFrame(int frameId);
+  // drop the oldest frames until at most |numFrames| are left.
+  void keepLatest(unsigned int numFrames);
+
+  void search(const float3* queries, unsigned int N);
+
+  unsigned int numFrames() const { return numLiveFrames(m_window); }
+  unsigned int numPoints() const { return m_window.numLive; }
+  unsigned int numQueries() const { return m_numQueries; }
+  unsigned int k() const { return m_state.knn; }
+  const std::vector<unsigned int>& results() const { return m_results; }
+  bool locate(unsigned int slot, int& frameId, unsigned int& index) const;
+
+  const FrameWindow& window() const { return m_window; }
+  RTNNState& state() { return m_state; }
+
+private:
+  struct FrameGas
+  {
+    OptixTraversableHandle    handle;
+    CUdeviceptr               buffer;
+  };
+
+  bool onDevice() const { return m_state.backend == "gpu"; }
+  void setupDevice();
+  void reserveSlots(unsigned int N);
+  void repack(unsigned int capacity);
+  void sortFrame(const FrameSegment& seg);
+  void buildFrameGas(const FrameSegment& seg);
+  void freeFrameGas(int frameId);
+  void buildIas();
+  void freeScratch();
+  void searchCPU();
+  void searchGPU();
+
+  RTNNState                   m_state;
+  FrameWindow                 m_window;
+  // window arrays, one slot per point; the size is the capacity.
+  std::vector<float3>         m_hPoints; // sorted within each frame on the GPU
+  std::vector<unsigned int>   m_ids; // index of each slot's point in its frame
+  float3*                     m_dPoints         = nullptr;
+  unsigned int*               m_dIds            = nullptr;
+  std::map<int, FrameGas>     m_gas;
+
+  float                       m_radius;
+  float                       m_gasRadius       = 0; // radius the GASes were built with
+  bool                        m_iasDirty        = true;
+  bool                        m_deviceSet       = false;
+  std::vector<float3>         m_hQueries;
+  unsigned int                m_numQueries      = 0;
+  std::vector<unsigned int>   m_results;
+};
+
+} // namespace rtnn
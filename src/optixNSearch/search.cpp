@@ -5,6 +5,157 @@
 #include "optixNSearch.h"
 #include "state.h"
 #include "func.h"
+#include "axiskeys.h"
+
+// encode the points, in their final order, for the IS programs and the AABB
+// builds (see helper_quantize.h); call it again whenever the points move. the
+// device then holds only the encodings (10 bytes a point): the float3 points
+// move to mapped host memory, which the IS programs read only for the hits
+// too close to the radius to decide on the encoding (and, in KNN search, for
+// the distances of the candidates). if the points are also the queries
+// (samepq), the float3 array stays on the device as the queries anyway and
+// encoding would only add memory, so the points are left alone.
+void quantizePoints( RTNNState& state ) {
+  unsigned int N = state.numPoints;
+  if (!state.h_exactPoints && (state.params.points == state.params.queries)) {
+    fprintf(stdout, "\tNot quantizing: the points are also the queries\n");
+    return;
+  }
+
+  Timing::startTiming("quantize points");
+    float3 pMin, pMax;
+    computeMinMax(N, state.params.points, pMin, pMax);
+    state.params.quant = makeQuantInfo(pMin, pMax, state.radius / state.crRatio);
+
+    if (!state.params.qCells) {
+      thrust::device_ptr<unsigned int> d_cells_ptr;
+      state.params.qCells = allocThrustDevicePtr(&d_cells_ptr, N, &state.d_pointers);
+      thrust::device_ptr<ushort3> d_offsets_ptr;
+      state.params.qOffsets = allocThrustDevicePtr(&d_offsets_ptr, N, &state.d_pointers);
+    }
+
+    unsigned int threadsPerBlock = 64;
+    unsigned int numOfBlocks = N / threadsPerBlock + 1;
+    kQuantizePoints(numOfBlocks,
+                    threadsPerBlock,
+                    state.params.quant,
+                    state.params.points,
+                    N,
+                    state.params.qCells,
+                    state.params.qOffsets
+                   );
+    state.params.quantized = true;
+
+    if (!state.h_exactPoints) {
+      float3* d_points = state.params.points;
+      CUDA_CHECK( cudaHostAlloc( reinterpret_cast<void**>( &state.h_exactPoints ), N * sizeof(float3), cudaHostAllocMapped ) );
+      CUDA_CHECK( cudaMemcpy( state.h_exactPoints, d_points, N * sizeof(float3), cudaMemcpyDeviceToHost ) );
+      CUDA_CHECK( cudaHostGetDevicePointer( reinterpret_cast<void**>( &state.params.points ), state.h_exactPoints, 0 ) );
+      state.d_pointers.erase(d_points);
+      CUDA_CHECK( cudaFree( d_points ) );
+    }
+  Timing::stopTiming(true);
+
+  fprintf(stdout, "\tQuantized points: %.3f MB on the device instead of %.3f MB of float3s (now in host memory), cell size %f, error bound %g\n",
+      (float)N * (sizeof(unsigned int) + sizeof(ushort3))/1024/1024, (float)N * sizeof(float3)/1024/1024,
+      state.params.quant.cellSize, state.params.quant.errBound);
+}
+
+// free the host copy |quantizePoints| moved the float3 points to; nothing
+// otherwise.
+void releaseExactPoints( RTNNState& state ) {
+  if (!state.h_exactPoints) return;
+  CUDA_CHECK( cudaFreeHost( state.h_exactPoints ) );
+  state.h_exactPoints = nullptr;
+  state.params.points = nullptr;
+}
+
+void setupSearch( RTNNState& state ) {
+  if (!state.deferFree) freeGridPointers(state);
+
+  if (state.quantize) quantizePoints(state);
+
+  if (state.partition) return;
+
+  assert(state.numOfBatches == -1);
+  state.numOfBatches = 1;
+
+  state.numActQueries[0] = state.numQueries;
+  state.d_actQs[0] = state.params.queries;
+  state.d_actQIds[0] = state.d_queryIds;
+  state.h_actQs[0] = state.h_queries;
+  state.launchRadius[0] = state.radius;
+}
+
+// compact the padded |output_buffer| into CSR (see csr.h) on the device and
+// copy only the offsets and the actual neighbors back. in range search with a
+// large K most slots are padding, so this cuts the D2H traffic to what's found.
+// the indices can only be sized once the search is done, so this only counts
+// and scans; |finishCompactResults| waits for the total and does the rest once
+// every batch has been issued, so that the batches still overlap.
+static void compactResults(RTNNState& state, thrust::device_ptr<unsigned int> output_buffer, int batch_id) {
+  unsigned int numQueries = state.numActQueries[batch_id];
+  cudaStream_t stream = state.stream[batch_id];
+
+  Timing::startTiming("result compaction");
+    // the extra count is 0 so that the scan ends with the total.
+    thrust::device_ptr<unsigned int> d_counts_ptr;
+    allocThrustDevicePtr(&d_counts_ptr, numQueries + 1, state, ARENA_RESULTS);
+    fillByValue(d_counts_ptr + numQueries, 1, 0, stream);
+    kCountNeighbors(thrust::raw_pointer_cast(output_buffer), numQueries, state.params.limit,
+        thrust::raw_pointer_cast(d_counts_ptr), stream);
+
+    thrust::device_ptr<unsigned int> d_offsets_ptr;
+    allocThrustDevicePtr(&d_offsets_ptr, numQueries + 1, state, ARENA_RESULTS);
+    exclusiveScan(d_counts_ptr, numQueries + 1, d_offsets_ptr, stream);
+
+    unsigned int* h_offsets = static_cast<unsigned int*>(allocPinned(state, (numQueries + 1) * sizeof(unsigned int)));
+    state.h_resOffsets[batch_id] = h_offsets;
+    CUDA_CHECK( cudaMemcpyAsync( h_offsets, thrust::raw_pointer_cast(d_offsets_ptr),
+                    (numQueries + 1) * sizeof(unsigned int), cudaMemcpyDeviceToHost, stream ) );
+
+    state.d_res[batch_id] = thrust::raw_pointer_cast(output_buffer);
+    state.d_resOffsets[batch_id] = thrust::raw_pointer_cast(d_offsets_ptr);
+  Timing::stopTiming(true);
+}
+
+// the rest of |compactResults| for every batch; call it after the last batch
+// is issued. each batch waits only for its own offsets.
+void finishCompactResults(RTNNState& state) {
+  if (!state.csr) return;
+
+  for (int i = 0; i < state.numOfBatches; i++) {
+    unsigned int numQueries = state.numActQueries[i];
+    if (numQueries == 0 || !state.d_res[i]) continue;
+    TraceTags tags(i, i);
+    cudaStream_t stream = state.stream[i];
+
+    Timing::startTiming("result compaction");
+      CUDA_CHECK( cudaStreamSynchronize( stream ) );
+      unsigned int numNeighbors = state.h_resOffsets[i][numQueries];
+
+      thrust::device_ptr<unsigned int> d_indices_ptr;
+      allocThrustDevicePtr(&d_indices_ptr, numNeighbors, state, ARENA_RESULTS);
+      kCompactNeighbors(state.d_res[i], numQueries, state.params.limit,
+          state.d_resOffsets[i], thrust::raw_pointer_cast(d_indices_ptr), stream);
+    Timing::stopTiming(true);
+
+    Timing::startTiming("result copy D2H");
+      void* data = allocPinned(state, numNeighbors * sizeof(unsigned int));
+      state.h_res[i] = data;
+      CUDA_CHECK( cudaMemcpyAsync( data, thrust::raw_pointer_cast(d_indices_ptr),
+                      numNeighbors * sizeof(unsigned int), cudaMemcpyDeviceToHost, stream ) );
+      OMIT_ON_E2EMSR( CUDA_CHECK( cudaStreamSynchronize( stream ) ) );
+    Timing::stopTiming(true);
+
+    if (state.writer) writeResultAsync(state, i);
+    state.d_res[i] = nullptr;
+    state.d_resOffsets[i] = nullptr;
+
+    fprintf(stdout, "\tBatch %d: %u neighbors in CSR (%.1f%% of %u slots)\n", i, numNeighbors,
+        100.0 * numNeighbors / ((double)numQueries * state.params.limit), numQueries * state.params.limit);
+  }
+}
 
 void search(RTNNState& state, int batch_id) {
   Timing::startTiming("batch search time");
@@ -13,7 +164,7 @@ void search(RTNNState& state, int batch_id) {
 
       state.params.limit = state.knn;
       thrust::device_ptr<unsigned int> output_buffer;
-      allocThrustDevicePtr(&output_buffer, numQueries * state.params.limit, &state.d_pointers);
+      allocThrustDevicePtr(&output_buffer, numQueries * state.params.limit, state, ARENA_RESULTS);
       // unused slots will become UINT_MAX
       fillByValue(output_buffer, numQueries * state.params.limit, UINT_MAX);
 
@@ -40,20 +191,26 @@ void search(RTNNState& state, int batch_id) {
       OMIT_ON_E2EMSR( CUDA_CHECK( cudaStreamSynchronize( state.stream[batch_id] ) ) );
     Timing::stopTiming(true);
 
-    Timing::startTiming("result copy D2H");
-      void* data;
-      cudaMallocHost(reinterpret_cast<void**>(&data), numQueries * state.params.limit * sizeof(unsigned int));
-      state.h_res[batch_id] = data;
-
-      CUDA_CHECK( cudaMemcpyAsync(
-                      static_cast<void*>( data ),
-                      thrust::raw_pointer_cast(output_buffer),
-                      numQueries * state.params.limit * sizeof(unsigned int),
-                      cudaMemcpyDeviceToHost,
-                      state.stream[batch_id]
-                      ) );
-      OMIT_ON_E2EMSR( CUDA_CHECK( cudaStreamSynchronize( state.stream[batch_id] ) ) );
-    Timing::stopTiming(true);
+    if (state.csr) compactResults(state, output_buffer, batch_id);
+    else {
+      Timing::startTiming("result copy D2H");
+        void* data = allocPinned(state, numQueries * state.params.limit * sizeof(unsigned int));
+        state.h_res[batch_id] = data;
+
+        CUDA_CHECK( cudaMemcpyAsync(
+                        static_cast<void*>( data ),
+                        thrust::raw_pointer_cast(output_buffer),
+                        numQueries * state.params.limit * sizeof(unsigned int),
+                        cudaMemcpyDeviceToHost,
+                        state.stream[batch_id]
+                        ) );
+        OMIT_ON_E2EMSR( CUDA_CHECK( cudaStreamSynchronize( state.stream[batch_id] ) ) );
+      Timing::stopTiming(true);
+    }
+
+    // drained on the writer thread once the copy above lands; CSR batches are
+    // handed over by |finishCompactResults|.
+    if (state.writer && !state.csr) writeResultAsync(state, batch_id);
   Timing::stopTiming(true);
 
   // this frees device memory but will block until the previous optix launch finish and the res is written back.
@@ -66,7 +223,7 @@ thrust::device_ptr<unsigned int> initialTraversal(RTNNState& state, int batch_id
 
     state.params.limit = 1;
     thrust::device_ptr<unsigned int> output_buffer;
-    allocThrustDevicePtr(&output_buffer, numQueries * state.params.limit, &state.d_pointers);
+    allocThrustDevicePtr(&output_buffer, numQueries * state.params.limit, state, ARENA_RESULTS);
     // for initial sort fill with 0. it's possible that a query has no
     // neighbors (no intersection with any of the AABB), in which case during
     // gas-sort using FHCoord, gather might use UINT_MAX as a key if filled
@@ -97,7 +254,7 @@ void gasSortSearch(RTNNState& state, int batch_id) {
   // Generate the GAS-sorted query order
   thrust::device_ptr<unsigned int> d_indices_ptr;
   if (state.qGasSortMode == 1)
-    d_indices_ptr = sortQueriesByFHCoord(state, d_firsthit_idx_ptr, batch_id);
+    d_indices_ptr = sortQueriesByFHCoord(state, d_firsthit_idx_ptr, batch_id, sortAxis(state.sortAxis, state.Min, state.Max));
   else if (state.qGasSortMode == 2)
     d_indices_ptr = sortQueriesByFHIdx(state, d_firsthit_idx_ptr, batch_id);
 
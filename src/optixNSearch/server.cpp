@@ -0,0 +1,320 @@
+#include <cuda_runtime.h>
+
+#include <sutil/Exception.h>
+#include <sutil/Timing.h>
+#include <thrust/device_vector.h>
+#include <thrust/copy.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <climits>
+#include <cstring>
+#include <new>
+#include <unordered_set>
+
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include "optixNSearch.h"
+#include "state.h"
+#include "func.h"
+#include "server.h"
+
+// a search server keeps the OptiX pipeline, the (sorted) points and the GAS
+// resident and answers query batches sent over a Unix socket. to keep the
+// device state reusable across requests, every request runs as one batch: no
+// query partitioning (the partitioning grid depends on the queries), no query
+// sorting and no query gather (so results come back in the order the queries
+// were sent). points are sorted and the GAS is built whenever the point set or
+// the radius changes, and are reused otherwise.
+
+static bool recvAll(int fd, void* buf, size_t size) {
+  char* p = static_cast<char*>(buf);
+  while (size > 0) {
+    ssize_t n = recv(fd, p, size, 0);
+    if (n <= 0) return false;
+    p += n;
+    size -= n;
+  }
+  return true;
+}
+
+static bool sendAll(int fd, const void* buf, size_t size) {
+  const char* p = static_cast<const char*>(buf);
+  while (size > 0) {
+    ssize_t n = send(fd, p, size, MSG_NOSIGNAL);
+    if (n <= 0) return false;
+    p += n;
+    size -= n;
+  }
+  return true;
+}
+
+// read and drop |size| bytes, e.g. the payload of a request that is refused,
+// so that the connection stays in sync with the client.
+static bool skipAll(int fd, size_t size) {
+  char buf[65536];
+  while (size > 0) {
+    ssize_t n = recv(fd, buf, std::min(size, sizeof(buf)), 0);
+    if (n <= 0) return false;
+    size -= n;
+  }
+  return true;
+}
+
+static bool sendReply(int fd, int status, unsigned int count, unsigned int k, const void* payload, size_t size) {
+  ServerReply reply = {RTNN_SERVER_MAGIC, status, count, k};
+  if (!sendAll(fd, &reply, sizeof(reply))) return false;
+  return (size == 0) || sendAll(fd, payload, size);
+}
+
+// |count| comes from the client, so check it before allocating anything for
+// it: an oversized request is refused (after its payload is skipped) and the
+// connection stays usable. returns the buffer for the payload, or nullptr if
+// the request was refused; |ok| is false if the connection is gone.
+static float3* recvPayload(RTNNState& state, int fd, const ServerRequest& req, bool& ok) {
+  size_t size = (size_t)req.count * sizeof(float3);
+  float3* buf = nullptr;
+  if (req.count <= state.serverMaxCount) buf = new (std::nothrow) float3[req.count];
+  if (buf == nullptr) {
+    fprintf(stderr, "Refusing a request of %u points (limit %u)\n", req.count, state.serverMaxCount);
+    ok = skipAll(fd, size) && sendReply(fd, SERVER_BAD_REQUEST, 0, 0, nullptr, 0);
+    return nullptr;
+  }
+  ok = recvAll(fd, buf, size);
+  if (!ok) {
+    delete[] buf;
+    return nullptr;
+  }
+  return buf;
+}
+
+static void freeTracked(RTNNState& state, void* ptr) {
+  if (ptr == nullptr) return;
+  state.d_pointers.erase(ptr);
+  CUDA_CHECK( cudaFree( ptr ) );
+}
+
+// upload |h_points|, sort them and build the GAS for |state.radius|.
+static void prepareServerPoints(RTNNState& state) {
+  Timing::startTiming("prepare points");
+    if (state.h_exactPoints) releaseExactPoints(state);
+    else freeTracked(state, state.params.points);
+    freeTracked(state, state.d_pointIds);
+    freeTracked(state, state.params.qCells);
+    freeTracked(state, state.params.qOffsets);
+    state.params.qCells = nullptr;
+    state.params.qOffsets = nullptr;
+    state.params.quantized = false;
+
+    thrust::device_ptr<float3> d_points_ptr;
+    state.params.points = allocThrustDevicePtr(&d_points_ptr, state.numPoints, &state.d_pointers);
+    uploadStaged(state, state.params.points, state.h_points, state.numPoints * sizeof(float3));
+    computeMinMax(state.numPoints, state.params.points, state.pMin, state.pMax);
+    state.Min = state.pMin;
+    state.Max = state.pMax;
+
+    // the sort permutes the points; remember where each one came from so that
+    // the results can be reported using the client's point ids. if the points
+    // have been sorted before (radius change), start from their current ids.
+    thrust::device_ptr<unsigned int> d_pointIds_ptr;
+    state.d_pointIds = allocThrustDevicePtr(&d_pointIds_ptr, state.numPoints, &state.d_pointers);
+    if (state.h_pointIds) thrust::copy(state.h_pointIds, state.h_pointIds + state.numPoints, d_pointIds_ptr);
+    else genSeqDevice(d_pointIds_ptr, state.numPoints);
+
+    sortParticles(state, POINT, state.pointSortMode);
+    freeGridPointers(state);
+    if (state.quantize) quantizePoints(state);
+    state.pointsHash = 0; // see |gasCacheKey|
+
+    delete[] state.h_pointIds;
+    state.h_pointIds = new unsigned int[state.numPoints];
+    thrust::copy(d_pointIds_ptr, d_pointIds_ptr + state.numPoints, state.h_pointIds);
+
+    if (state.d_gas_output_buffer[0]) {
+      CUDA_CHECK( cudaFree( reinterpret_cast<void*>( state.d_gas_output_buffer[0] ) ) );
+      state.d_gas_output_buffer[0] = 0;
+    }
+    // |createGeometry| frees the AABBs after the build, so never reuse them.
+    state.d_aabb[0] = nullptr;
+    createGeometry(state, 0, state.radius);
+    CUDA_CHECK( cudaStreamSynchronize( state.stream[0] ) );
+  Timing::stopTiming(true);
+}
+
+static bool serveSearch(RTNNState& state, int fd, const ServerRequest& req) {
+  unsigned int numQueries = req.count;
+  bool ok;
+  float3* h_queries = recvPayload(state, fd, req, ok);
+  if (h_queries == nullptr) return ok;
+
+  if ((req.radius > 0) && (req.radius != state.radius)) {
+    state.radius = req.radius;
+    prepareServerPoints(state);
+  }
+  // K is a compile-time constant in KNN search.
+  if ((req.k > 0) && (state.searchMode == "radius")) state.knn = req.k;
+
+  if (numQueries == 0) {
+    delete[] h_queries;
+    return sendReply(fd, SERVER_OK, 0, state.knn, nullptr, 0);
+  }
+
+  Timing::startTiming("serve search");
+    // everything allocated from here on lives only for this request.
+    std::unordered_set<void*> persistent = state.d_pointers;
+
+    thrust::device_ptr<float3> d_queries_ptr;
+    state.params.queries = allocThrustDevicePtr(&d_queries_ptr, numQueries, &state.d_pointers);
+    uploadStaged(state, state.params.queries, h_queries, numQueries * sizeof(float3));
+
+    state.numQueries = numQueries;
+    state.numActQueries[0] = numQueries;
+    state.d_actQs[0] = state.params.queries;
+    state.h_actQs[0] = h_queries;
+    state.launchRadius[0] = state.radius;
+
+    if (state.qGasSortMode) gasSortSearch(state, 0);
+    search(state, 0);
+    CUDA_CHECK( cudaStreamSynchronize( state.stream[0] ) );
+
+    // translate sorted point ids back to the client's ids
+    unsigned int* res = static_cast<unsigned int*>(state.h_res[0]);
+    size_t numRes = (size_t)numQueries * state.knn;
+    for (size_t i = 0; i < numRes; i++) {
+      if (res[i] != UINT_MAX) res[i] = state.h_pointIds[res[i]];
+    }
+
+    ok = sendReply(fd, SERVER_OK, numQueries, state.knn, res, numRes * sizeof(unsigned int));
+
+    freePinned(state, state.h_res[0]);
+    state.h_res[0] = nullptr;
+    state.h_actQs[0] = nullptr;
+    state.d_actQs[0] = nullptr;
+    state.d_r2q_map[0] = nullptr;
+    state.params.queries = nullptr;
+    state.numActQueries[0] = 0;
+    delete[] h_queries;
+
+    for (auto it = state.d_pointers.begin(); it != state.d_pointers.end(); ) {
+      if (persistent.count(*it)) it++;
+      else {
+        CUDA_CHECK( cudaFree( *it ) );
+        it = state.d_pointers.erase(it);
+      }
+    }
+    releaseArenaScope(state, ARENA_BATCH);
+    releaseArenaScope(state, ARENA_RESULTS);
+  Timing::stopTiming(true);
+
+  return ok;
+}
+
+static bool serveSetPoints(RTNNState& state, int fd, const ServerRequest& req) {
+  bool ok;
+  float3* h_points = recvPayload(state, fd, req, ok);
+  if (h_points == nullptr) return ok;
+
+  if (req.count == 0) {
+    delete[] h_points;
+    sendReply(fd, SERVER_BAD_REQUEST, 0, 0, nullptr, 0);
+    return false;
+  }
+
+  if (!isMappedHostPtr(state, state.h_points)) delete[] state.h_points;
+  state.h_points = h_points;
+  state.numPoints = req.count;
+  delete[] state.h_pointIds;
+  state.h_pointIds = nullptr;
+  if (req.radius > 0) state.radius = req.radius;
+  prepareServerPoints(state);
+
+  return sendReply(fd, SERVER_OK, state.numPoints, 0, nullptr, 0);
+}
+
+// returns false once a shutdown is requested.
+static bool serveConnection(RTNNState& state, int fd) {
+  while (1) {
+    ServerRequest req;
+    if (!recvAll(fd, &req, sizeof(req))) return true; // client hung up
+
+    if (req.magic != RTNN_SERVER_MAGIC) {
+      fprintf(stderr, "Bad request magic; closing the connection\n");
+      sendReply(fd, SERVER_BAD_REQUEST, 0, 0, nullptr, 0);
+      return true;
+    }
+
+    if (req.op == SERVER_SEARCH) {
+      if (!serveSearch(state, fd, req)) return true;
+    } else if (req.op == SERVER_SET_POINTS) {
+      if (!serveSetPoints(state, fd, req)) return true;
+    } else if (req.op == SERVER_SHUTDOWN) {
+      sendReply(fd, SERVER_OK, 0, 0, nullptr, 0);
+      return false;
+    } else {
+      fprintf(stderr, "Unknown request op %u; closing the connection\n", req.op);
+      sendReply(fd, SERVER_BAD_REQUEST, 0, 0, nullptr, 0);
+      return true;
+    }
+  }
+}
+
+void runServer(RTNNState& state) {
+  state.partition = false;
+  state.querySortMode = 0;
+  state.toGather = false;
+  state.gsrRatio = 1;
+  state.filterQueries = false;
+  state.csr = false; // replies carry padded rows
+  state.samepq = false;
+  state.sameData = false;
+  state.sanCheck = false;
+  state.deferFree = true;
+  state.params.points = nullptr;
+  state.h_queries = nullptr; // queries come with the requests
+
+  sockaddr_un addr;
+  memset(&addr, 0, sizeof(addr));
+  addr.sun_family = AF_UNIX;
+  if (state.serverSock.size() >= sizeof(addr.sun_path)) {
+    fprintf(stderr, "Socket path too long: %s\n", state.serverSock.c_str());
+    exit(1);
+  }
+  strncpy(addr.sun_path, state.serverSock.c_str(), sizeof(addr.sun_path) - 1);
+
+  int sfd = socket(AF_UNIX, SOCK_STREAM, 0);
+  unlink(state.serverSock.c_str());
+  if (sfd < 0 || bind(sfd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) != 0 || listen(sfd, 8) != 0) {
+    perror("Could not listen on the server socket");
+    exit(1);
+  }
+
+  setDevice(state);
+  initSingleBatch(state);
+  setupOptiX(state);
+  prepareServerPoints(state);
+
+  fprintf(stdout, "Listening on %s\n", state.serverSock.c_str());
+  fflush(stdout);
+
+  bool running = true;
+  while (running) {
+    int cfd = accept(sfd, nullptr, nullptr);
+    if (cfd < 0) {
+      // a signal or a client that gave up; anything else (e.g., out of file
+      // descriptors) would fail again right away, so stop serving.
+      if (errno == EINTR || errno == ECONNABORTED) continue;
+      perror("Could not accept a connection");
+      break;
+    }
+    running = serveConnection(state, cfd);
+    close(cfd);
+  }
+
+  close(sfd);
+  unlink(state.serverSock.c_str());
+
+  delete[] state.h_pointIds;
+  state.h_pointIds = nullptr;
+}
@@ -0,0 +1,55 @@
+#pragma once
+
+#include <stdint.h>
+
+// Wire format of the search server (see |runServer|). All fields are in host
+// byte order since the server only listens on a local Unix socket.
+//
+// A client sends a |ServerRequest| followed by |count| float3s (12 bytes
+// each), and gets back a |ServerReply| followed by the payload of the op:
+//   SERVER_SEARCH:     |count| queries in; |count| x |k| uint32 neighbor ids
+//                      out, one row per query in the order sent. ids index the
+//                      point set as the client sent it (or as it was read from
+//                      the file); unused slots are UINT_MAX. |radius| <= 0
+//                      keeps the current radius, and |k| == 0 keeps the
+//                      current K (K can't be changed in KNN search).
+//   SERVER_SET_POINTS: |count| points in; nothing out.
+//   SERVER_SHUTDOWN:   nothing in; nothing out. the server exits after the reply.
+// |status| in the reply is 0 on success; on an error the reply carries no
+// payload and the server closes the connection. The exception is a |count|
+// above the server's limit (--servermax): its payload is skipped and the
+// request answered with SERVER_BAD_REQUEST, and the connection stays open.
+
+#define RTNN_SERVER_MAGIC 0x4e4e5452 // "RTNN"
+
+enum ServerOp
+{
+    SERVER_SEARCH     = 0,
+    SERVER_SET_POINTS = 1,
+    SERVER_SHUTDOWN   = 2
+};
+
+enum ServerStatus
+{
+    SERVER_OK           = 0,
+    SERVER_BAD_REQUEST  = 1,
+    SERVER_ERROR        = 2
+};
+
+struct ServerRequest
+{
+    uint32_t                    magic;
+    uint32_t                    op;
+    uint32_t                    count;
+    float                       radius;
+    uint32_t                    k;
+    uint32_t                    reserved;
+};
+
+struct ServerReply
+{
+    uint32_t                    magic;
+    int32_t                     status;
+    uint32_t                    count;
+    uint32_t                    k;
+};
@@ -25,6 +25,8 @@
 #include "func.h"
 #include "state.h"
 #include "grid.h"
+#include "morton.h"
+#include "axiskeys.h"
 
 #ifdef MEM_STATS
   extern std::map<void*, double> memmap;
@@ -71,26 +73,7 @@ void computeMinMax(unsigned int N, float3* particles, float3& min, float3& max)
 }
 
 unsigned int genGridInfo(RTNNState& state, unsigned int N, GridInfo& gridInfo) {
-  float3 sceneMin = state.Min;
-  float3 sceneMax = state.Max;
-
-  gridInfo.ParticleCount = N;
-  gridInfo.GridMin = sceneMin;
-
   float cellSize = state.radius / state.crRatio;
-  float3 gridSize = sceneMax - sceneMin;
-  gridInfo.GridDimension.x = static_cast<unsigned int>(ceilf(gridSize.x / cellSize));
-  gridInfo.GridDimension.y = static_cast<unsigned int>(ceilf(gridSize.y / cellSize));
-  gridInfo.GridDimension.z = static_cast<unsigned int>(ceilf(gridSize.z / cellSize));
-
-  // Adjust grid size to multiple of cell size
-  gridSize.x = gridInfo.GridDimension.x * cellSize;
-  gridSize.y = gridInfo.GridDimension.y * cellSize;
-  gridSize.z = gridInfo.GridDimension.z * cellSize;
-
-  gridInfo.GridDelta.x = gridInfo.GridDimension.x / gridSize.x;
-  gridInfo.GridDelta.y = gridInfo.GridDimension.y / gridSize.y;
-  gridInfo.GridDelta.z = gridInfo.GridDimension.z / gridSize.z;
 
   // morton code can only be correctly calcuated for a cubic, where each
   //   dimension is of the same size and the dimension is a power of 2. if we
@@ -99,45 +82,47 @@ unsigned int genGridInfo(RTNNState& state, unsigned int N, GridInfo& gridInfo) {
   //   the strategy is to divide the grid into smaller equal-dimension-power-of-2
   //   smaller grids (meta_grid here). the order within each meta_grid is morton,
   //   but the order across meta_grids is raster order.
-  // TODO: the current implementation uses a heuristics. we get the largest
-  //   power of 2 that doesn't exceed the shortest side, and then divide it by a
-  //   scaling factor. the result becomes the size of a meta grid. the smaller
-  //   the scaling factor, the more space waste (which limits the number of
-  //   cells) but enforces a more global order; maybe a better strategy?
-  unsigned int shortestSide = std::min({gridInfo.GridDimension.x, gridInfo.GridDimension.y, gridInfo.GridDimension.z});
-  // dim should at least be 1; otherwise we won't get 0 cells.
-  gridInfo.meta_grid_dim = std::max((int)pow(2, floorf(log2(shortestSide)))/state.mcScale, 1);
-  gridInfo.meta_grid_size = gridInfo.meta_grid_dim * gridInfo.meta_grid_dim * gridInfo.meta_grid_dim;
-
-  // One meta grid cell contains meta_grid_dim^3 cells. The morton curve is
-  // calculated for each metagrid, and the order of metagrid is raster order.
-  // So if meta_grid_dim is 1, this is basically the same as raster order
-  // across all cells. If meta_grid_dim is the same as GridDimension, this
-  // calculates one single morton curve for the entire grid.
-  gridInfo.MetaGridDimension.x = static_cast<unsigned int>(ceilf(gridInfo.GridDimension.x / (float)gridInfo.meta_grid_dim));
-  gridInfo.MetaGridDimension.y = static_cast<unsigned int>(ceilf(gridInfo.GridDimension.y / (float)gridInfo.meta_grid_dim));
-  gridInfo.MetaGridDimension.z = static_cast<unsigned int>(ceilf(gridInfo.GridDimension.z / (float)gridInfo.meta_grid_dim));
+  // by default we use a heuristics. we get the largest power of 2 that
+  //   doesn't exceed the shortest side, and then divide it by a scaling
+  //   factor. the result becomes the size of a meta grid. the smaller the
+  //   scaling factor, the more space waste (which limits the number of cells)
+  //   but enforces a more global order. with |adaptiveMetaGrid|, the meta grid
+  //   size is picked per axis instead, capping the waste (see
+  //   |chooseMetaGridBits|).
+  // One meta grid cell contains meta_grid_dims.x * .y * .z cells. The morton
+  // curve is calculated for each metagrid, and the order of metagrid is raster
+  // order. So if meta_grid_dims are 1, this is basically the same as raster
+  // order across all cells. If meta_grid_dims are the same as GridDimension,
+  // this calculates one single morton curve for the entire grid.
+  unsigned int numberOfCells = calcGridInfo(state.Min, state.Max, cellSize, state.mcScale, N, gridInfo,
+      state.adaptiveMetaGrid ? state.metaGridWaste : -1);
 
   // metagrids will slightly increase the total cells
-  unsigned int numberOfCells = (gridInfo.MetaGridDimension.x * gridInfo.MetaGridDimension.y * gridInfo.MetaGridDimension.z) * gridInfo.meta_grid_size;
   fprintf(stdout, "\tGrid dimension (without meta grids): %u, %u, %u\n", gridInfo.GridDimension.x, gridInfo.GridDimension.y, gridInfo.GridDimension.z);
-  fprintf(stdout, "\tGrid dimension (with meta grids): %u, %u, %u\n", gridInfo.MetaGridDimension.x * gridInfo.meta_grid_dim, gridInfo.MetaGridDimension.y * gridInfo.meta_grid_dim, gridInfo.MetaGridDimension.z * gridInfo.meta_grid_dim);
+  fprintf(stdout, "\tGrid dimension (with meta grids): %u, %u, %u\n", gridInfo.MetaGridDimension.x * gridInfo.meta_grid_dims.x, gridInfo.MetaGridDimension.y * gridInfo.meta_grid_dims.y, gridInfo.MetaGridDimension.z * gridInfo.meta_grid_dims.z);
   //fprintf(stdout, "\tMeta Grid dimension: %u, %u, %u\n", gridInfo.MetaGridDimension.x, gridInfo.MetaGridDimension.y, gridInfo.MetaGridDimension.z);
-  //fprintf(stdout, "\t# of cells in a meta grid: %u\n", gridInfo.meta_grid_dim);
+  fprintf(stdout, "\tMeta grid: %u x %u x %u cells, padding overhead: %.2f%%\n", gridInfo.meta_grid_dims.x, gridInfo.meta_grid_dims.y, gridInfo.meta_grid_dims.z, metaGridPadding(gridInfo) * 100);
   //fprintf(stdout, "\tGridDelta: %f, %f, %f\n", gridInfo.GridDelta.x, gridInfo.GridDelta.y, gridInfo.GridDelta.z);
   fprintf(stdout, "\tNumber of cells: %u\n", numberOfCells);
   fprintf(stdout, "\tCell size: %f\n", cellSize);
 
+  // the dense grid silently wraps around, but a sparse grid is used exactly
+  // when the cells are many, so its cell indices must not.
+  if (state.sparseGrid && (gridCellCount(gridInfo) >= NO_CELL)) {
+    fprintf(stderr, "The sparse grid has more cells than 32-bit cell indices can address; use a larger cell size (smaller -cr)\n");
+    exit(1);
+  }
+
   // update GridDimension so that it can be used in the kernels (otherwise raster order is incorrect)
-  gridInfo.GridDimension.x = gridInfo.MetaGridDimension.x * gridInfo.meta_grid_dim;
-  gridInfo.GridDimension.y = gridInfo.MetaGridDimension.y * gridInfo.meta_grid_dim;
-  gridInfo.GridDimension.z = gridInfo.MetaGridDimension.z * gridInfo.meta_grid_dim;
+  gridInfo.GridDimension.x = gridInfo.MetaGridDimension.x * gridInfo.meta_grid_dims.x;
+  gridInfo.GridDimension.y = gridInfo.MetaGridDimension.y * gridInfo.meta_grid_dims.y;
+  gridInfo.GridDimension.z = gridInfo.MetaGridDimension.z * gridInfo.meta_grid_dims.z;
   return numberOfCells;
 }
 
 void test(GridInfo);
 
-thrust::device_ptr<int> genCellMask (RTNNState& state, unsigned int* d_repQueries, float3* particles, unsigned int* d_CellParticleCounts, unsigned int numberOfCells, GridInfo gridInfo, unsigned int N, unsigned int numUniqQs, bool morton) {
+thrust::device_ptr<int> genCellMask (RTNNState& state, unsigned int* d_repQueries, float3* particles, CellTable table, unsigned int* d_CellParticleCounts, unsigned int numberOfCells, GridInfo gridInfo, unsigned int N, unsigned int numUniqQs, CellOrder order) {
   float cellSize = state.radius / state.crRatio;
 
   // |maxWidth| is the max width of a cube that can be enclosed by the sphere.
@@ -155,7 +140,7 @@ thrust::device_ptr<int> genCellMask (RTNNState& state, unsigned int* d_repQuerie
 
   thrust::device_ptr<int> d_cellMask;
   // no need to memset this since every single cell will be updated.
-  allocThrustDevicePtr(&d_cellMask, numberOfCells, &state.d_gridPointers);
+  allocThrustDevicePtr(&d_cellMask, numberOfCells, state, ARENA_GRID);
   //CUDA_CHECK( cudaMemset ( thrust::raw_pointer_cast(d_cellMask), 0xFF, numberOfCells * sizeof(int) ) );
 
   //test(gridInfo); // to demonstrate the weird parameter passing bug.
@@ -170,7 +155,8 @@ thrust::device_ptr<int> genCellMask (RTNNState& state, unsigned int* d_repQuerie
     kCalcSearchSize(numOfBlocks,
                     threadsPerBlock,
                     gridInfo,
-                    morton, 
+                    order,
+                    table,
                     d_CellParticleCounts,
                     d_repQueries,
                     particles,
@@ -191,6 +177,14 @@ thrust::device_ptr<int> genCellMask (RTNNState& state, unsigned int* d_repQuerie
 
     thrust::host_vector<int> h_cellMask(numberOfCells);
 
+    thrust::host_vector<unsigned int> h_cellKeys;
+    CellTable h_table = table;
+    if (table.keys) {
+      h_cellKeys.resize(table.numCells);
+      thrust::copy(thrust::device_pointer_cast(table.keys), thrust::device_pointer_cast(table.keys) + table.numCells, h_cellKeys.begin());
+      h_table.keys = h_cellKeys.data();
+    }
+
     for (unsigned int i = 0; i < numUniqQs; i++) {
       unsigned int qId = h_part_seq[i];
       float3 point = state.h_points[qId];
@@ -199,7 +193,8 @@ thrust::device_ptr<int> genCellMask (RTNNState& state, unsigned int* d_repQuerie
 
       calcSearchSize(gridCell,
                      gridInfo,
-                     morton,
+                     order,
+                     h_table,
                      h_CellParticleCounts.data(),
                      cellSize,
                      maxWidth,
@@ -222,36 +217,19 @@ void autoBatchingRange(RTNNState& state, const thrust::host_vector<unsigned int>
   // now that we allow AABBTEST in all but the last batch in radius search,
   // batching could save time, since doing sphere test is much more costly than
   // aabb test. build the cost model and find the optimal batching.
-
-  // empirical coefficients on 2080Ti
-  //const float kD2H_PerB = 6e-7; // D2H memcpy time in *ms* / byte (TODO)
-  const float kBuildGas_PerAABB = 3.8e-6; // GAS building time in *ms* / AABB
-  // higher values encourage batching.
-  //const float kAABBTest_PerIS = 4e-5/50; // IS call time in *ms* if doing aabb test (by 50 as the data was ubenchmarked using K=50)
-  //const float kSphereTest_PerIS = 4e-4/50; // IS call time in *ms* if doing sphere test
-
-  // empirical coefficients on 2080
-  const float kAABBTest_PerIS = 1e-5/50;
-  const float kSphereTest_PerIS = 1e-4/50;
+  const CostModel& model = state.costModel;
 
   //float tMemcpy = state.numQueries * state.knn * sizeof(unsigned int) * kD2H_PerB; // TODO: consider max(memcpy, compute)
-  float tBuildGAS = state.numPoints * kBuildGas_PerAABB + 20; // 20 is the empirical intercept (TODO)
+  float tBuildGAS = gasBuildTime(model, state.numPoints);
   //fprintf(stdout, "tBuildGAS: %f\n", tBuildGAS);
 
-  // incrementally combine batch i with the last batch (assuming all other
-  // batches are independent) and calculate the cost. choose the min cost.
-  float overhead = 0;
-  float maxOverhead = 0; // overhead must be negative for bundling to be useful
-  int splitId = numAvailBatches - 1; // by default we don't bundle
+  // bundling batch i with the last batch turns its aabb tests into sphere tests.
+  std::vector<float> extraTime(numAvailBatches, 0);
   for (int i = numAvailBatches - 2; i >= 0; i--) {
-    float extraTime = h_rayHist[i] * (kSphereTest_PerIS - kAABBTest_PerIS) * state.knn;
-    overhead += extraTime - tBuildGAS;
-    //fprintf(stdout, "i: %d, %u extraTime: %f, overhead: %f\n", i, h_rayHist[i], extraTime, overhead);
-    if (overhead < maxOverhead) {
-      maxOverhead = overhead;
-      splitId = i;
-    }
+    extraTime[i] = h_rayHist[i] * (model.sphereTestPerIS - model.aabbTestPerIS) * state.knn;
+    //fprintf(stdout, "i: %d, %u extraTime: %f\n", i, h_rayHist[i], extraTime[i]);
   }
+  int splitId = chooseBatchSplit(extraTime, tBuildGAS);
 
   for (int i = 0; i <= splitId - 1; i++) {
     batches.push_back(i);
@@ -278,25 +256,19 @@ void autoBatchingKNN(RTNNState& state, const thrust::host_vector<unsigned int>&
   // The memcpy time is empirically observed to be linear w.r.t., to the # of queries
   // The compute time, without considering CKE, is the lump sum of the compute time of each batch, which is linear w.r.t. the # of queries in the batch and cubic w.r.t., to the radius in the batch.
 
-  // empirical coefficients on 2080Ti
-  //const float kD2H_PerB = 6e-7; // D2H memcpy time in *ms* / byte (TODO)
-  const float kBuildGas_PerAABB = 3.8e-6; // GAS building time in *ms* / AABB
   // TODO: fit a better model for IS calls? N_tl * T_tl + N_is * T_is
   // TODO: this should depend K.
-  const float kSearch_PerIS = 6e-2; // knn search time in *ms* per IS call
+  const CostModel& model = state.costModel;
 
   //float tMemcpy = state.numQueries * state.knn * sizeof(unsigned int) * kD2H_PerB; // TODO: consider max(memcpy, compute)
-  float tBuildGAS = state.numPoints * kBuildGas_PerAABB + 20; // 20 is the empirical intercept (TODO)
+  float tBuildGAS = gasBuildTime(model, state.numPoints);
   float cellSize = state.radius / state.crRatio;
   //fprintf(stdout, "tBuildGAS: %f\n", tBuildGAS);
 
   float maxWidth = kGetWidthFromIter(numAvailBatches - 1, cellSize);
   float maxRadius = std::min(state.radius, radiusFromMegacell(maxWidth, state.approxMode));
-  // incrementally combine batch i with the last batch (assuming all other
-  // batches are independent) and calculate the cost. choose the min cost.
-  float overhead = 0;
-  float maxOverhead = 0;
-  int splitId = numAvailBatches - 1;
+  // bundling batch i with the last batch searches it with the last radius.
+  std::vector<float> extraTime(numAvailBatches, 0);
   for (int i = numAvailBatches - 2; i >= 0; i--) {
     float curWidth = kGetWidthFromIter(i, cellSize);
     float curRadius = std::min(state.radius, radiusFromMegacell(curWidth, state.approxMode));
@@ -304,14 +276,10 @@ void autoBatchingKNN(RTNNState& state, const thrust::host_vector<unsigned int>&
 
     // TODO: assuming density doesn't change dramatically; consider non-uniform density?
     float extraWork = h_rayHist[i] * 8 * (maxRadius * maxRadius * maxRadius - curRadius * curRadius * curRadius) * density;
-    float extraTime = extraWork * kSearch_PerIS;
-    overhead += extraTime - tBuildGAS;
-    //fprintf(stdout, "i: %d, density: %f, extraWork: %f, extraTime: %f, overhead: %f\n", i, density, extraWork, extraTime, overhead);
-    if (overhead < maxOverhead) {
-      maxOverhead = overhead;
-      splitId = i;
-    }
+    extraTime[i] = extraWork * model.knnSearchPerIS;
+    //fprintf(stdout, "i: %d, density: %f, extraWork: %f, extraTime: %f\n", i, density, extraWork, extraTime[i]);
   }
+  int splitId = chooseBatchSplit(extraTime, tBuildGAS);
 
   for (int i = 0; i <= splitId - 1; i++) {
     batches.push_back(i);
@@ -376,13 +344,20 @@ void genBatches(RTNNState& state,
     // on will only be used to point to device queries used in kernels, and
     // will be set right before launch using d_actQs.
     thrust::device_ptr<float3> d_actQs;
-    allocThrustDevicePtr(&d_actQs, numActQs, &state.d_pointers);
+    allocThrustDevicePtr(&d_actQs, numActQs, state, ARENA_BATCH);
     copyIfIdInRange(particles, N, d_rayMask, d_actQs, lastMask + 1, maxMask);
     state.d_actQs[batchId] = thrust::raw_pointer_cast(d_actQs);
 
+    if (state.d_queryIds) {
+      thrust::device_ptr<unsigned int> d_actQIds;
+      allocThrustDevicePtr(&d_actQIds, numActQs, state, ARENA_BATCH);
+      copyIfIdInRange(state.d_queryIds, N, d_rayMask, d_actQIds, lastMask + 1, maxMask);
+      state.d_actQIds[batchId] = thrust::raw_pointer_cast(d_actQIds);
+    }
+
     // Copy the active queries to host (for sanity check).
     if (state.sanCheck) {
-      state.h_actQs[batchId] = new float3[numActQs];
+      state.h_actQs[batchId] = static_cast<float3*>(allocPinned(state, numActQs * sizeof(float3)));
       thrust::copy(d_actQs, d_actQs + numActQs, state.h_actQs[batchId]);
     }
 
@@ -392,11 +367,12 @@ void genBatches(RTNNState& state,
 
 void sortGenBatch(RTNNState& state,
                   unsigned int N,
-                  bool morton,
+                  CellOrder order,
                   unsigned int numberOfCells,
                   unsigned int numOfBlocks,
                   unsigned int threadsPerBlock,
                   GridInfo gridInfo,
+                  CellTable table,
                   float3* particles,
                   thrust::device_ptr<unsigned int> d_CellParticleCounts_ptr,
                   thrust::device_ptr<unsigned int> d_ParticleCellIndices_ptr,
@@ -407,10 +383,10 @@ void sortGenBatch(RTNNState& state,
 {
     // pick one particle from each cell, and store all their indices in |d_repQueries|
     thrust::device_ptr<unsigned int> d_ParticleCellIndices_ptr_copy;
-    allocThrustDevicePtr(&d_ParticleCellIndices_ptr_copy, N, &state.d_gridPointers);
+    allocThrustDevicePtr(&d_ParticleCellIndices_ptr_copy, N, state, ARENA_GRID);
     thrustCopyD2D(d_ParticleCellIndices_ptr_copy, d_ParticleCellIndices_ptr, N);
     thrust::device_ptr<unsigned int> d_repQueries;
-    allocThrustDevicePtr(&d_repQueries, N, &state.d_gridPointers);
+    allocThrustDevicePtr(&d_repQueries, N, state, ARENA_GRID);
     genSeqDevice(d_repQueries, N);
     sortByKey(d_ParticleCellIndices_ptr_copy, d_repQueries, N);
     unsigned int numUniqQs = uniqueByKey(d_ParticleCellIndices_ptr_copy, N, d_repQueries);
@@ -420,12 +396,13 @@ void sortGenBatch(RTNNState& state,
     thrust::device_ptr<int> d_cellMask = genCellMask(state,
             thrust::raw_pointer_cast(d_repQueries),
             particles,
+            table,
             thrust::raw_pointer_cast(d_CellParticleCounts_ptr),
             numberOfCells,
             gridInfo,
             N,
             numUniqQs,
-            morton
+            order
            );
 
     // good debugging code;
@@ -436,7 +413,7 @@ void sortGenBatch(RTNNState& state,
     //}
 
     thrust::device_ptr<int> d_rayMask;
-    allocThrustDevicePtr(&d_rayMask, N, &state.d_gridPointers);
+    allocThrustDevicePtr(&d_rayMask, N, state, ARENA_GRID);
 
     // TODO: generate the sorted indices, and also set the rayMask according to
     //   cellMask. the sorted indices |d_posInSortedPoints_ptr| is not useful
@@ -475,16 +452,34 @@ void sortGenBatch(RTNNState& state,
     // Sort the queries if sorting is enabled, in which case sort the ray masks
     // the same way as query sorting. Sorting particles MUST happen right after
     // sorting the masks so that queries and masks are consistent!!!
-    if (state.querySortMode) {
+    if (state.querySortMode == 4) {
+      // see |morton64Sort|; the sorts are stable, so the masks, ids, and
+      // queries are sorted the same way even though the keys aren't unique.
+      thrust::device_ptr<unsigned long long> d_keys_ptr = genMortonKeys64(state, N, particles);
+      thrust::device_ptr<unsigned long long> d_keys_ptr_copy;
+      allocThrustDevicePtr(&d_keys_ptr_copy, N, state, ARENA_GRID);
+      thrustCopyD2D(d_keys_ptr_copy, d_keys_ptr, N);
+
+      stableSortByKey(d_keys_ptr_copy, d_rayMask, N);
+      if (state.d_queryIds) {
+        thrustCopyD2D(d_keys_ptr_copy, d_keys_ptr, N);
+        stableSortByKey(d_keys_ptr_copy, thrust::device_pointer_cast(state.d_queryIds), N);
+      }
+      stableSortByKey(d_keys_ptr, thrust::device_pointer_cast(particles), N);
+    } else if (state.querySortMode) {
       // make a copy of the keys since they are useless after the first sort. no
       // need to use stable sort since the keys are unique, so masks and the
       // queries are gauranteed to be sorted in exactly the same way.
       // TODO: Can we do away with the extra copy by replacing sort by key with scatter? That'll need new space too...
       thrust::device_ptr<unsigned int> d_posInSortedPoints_ptr_copy;
-      allocThrustDevicePtr(&d_posInSortedPoints_ptr_copy, N, &state.d_gridPointers);
+      allocThrustDevicePtr(&d_posInSortedPoints_ptr_copy, N, state, ARENA_GRID);
       thrustCopyD2D(d_posInSortedPoints_ptr_copy, d_posInSortedPoints_ptr, N);
 
       sortByKey(d_posInSortedPoints_ptr_copy, d_rayMask, N);
+      if (state.d_queryIds) {
+        thrustCopyD2D(d_posInSortedPoints_ptr_copy, d_posInSortedPoints_ptr, N);
+        sortByKey(d_posInSortedPoints_ptr_copy, thrust::device_pointer_cast(state.d_queryIds), N);
+      }
       sortByKey(d_posInSortedPoints_ptr, thrust::device_pointer_cast(particles), N);
     }
 
@@ -497,11 +492,41 @@ void sortGenBatch(RTNNState& state,
     genBatches(state, batches, h_rayHist, particles, N, d_rayMask);
 }
 
-void gridSort(RTNNState& state, unsigned int N, float3* particles, float3* h_particles, bool morton, ParticleType type) {
+// the occupied cells of the particles (and, for a unified partitioning grid,
+// of the points too) as the table of a sparse grid. the per-cell arrays then
+// only have |numCells| elements, which is at most the number of particles
+// no matter how large the scene is.
+CellTable genCellTable(RTNNState& state, GridInfo gridInfo, float3* particles, unsigned int N, bool withPoints, CellOrder order) {
+  unsigned int numKeys = withPoints ? N + state.numPoints : N;
+  thrust::device_ptr<unsigned int> d_cellKeys_ptr;
+  allocThrustDevicePtr(&d_cellKeys_ptr, numKeys, state, ARENA_GRID);
+
+  unsigned int threadsPerBlock = 64;
+  kCellKeys(N / threadsPerBlock + 1, threadsPerBlock, gridInfo, particles, thrust::raw_pointer_cast(d_cellKeys_ptr), order);
+  if (withPoints) {
+    gridInfo.ParticleCount = state.numPoints;
+    kCellKeys(state.numPoints / threadsPerBlock + 1, threadsPerBlock, gridInfo, state.params.points, thrust::raw_pointer_cast(d_cellKeys_ptr) + N, order);
+  }
+
+  sortKeys(d_cellKeys_ptr, numKeys);
+  CellTable table;
+  table.keys = thrust::raw_pointer_cast(d_cellKeys_ptr);
+  table.numCells = countUniq(d_cellKeys_ptr, numKeys);
+  fprintf(stdout, "\tNumber of occupied cells: %u\n", table.numCells);
+  return table;
+}
+
+void gridSort(RTNNState& state, unsigned int N, float3* particles, float3* h_particles, CellOrder order, ParticleType type) {
   bool toPartition = (type == QUERY) && state.partition;
 
   GridInfo gridInfo;
   unsigned int numberOfCells = genGridInfo(state, N, gridInfo);
+  CellTable table = {nullptr, numberOfCells};
+  if (state.sparseGrid) {
+    // points are inserted into the partitioning grid too (see below).
+    table = genCellTable(state, gridInfo, particles, N, toPartition && !state.sameData, order);
+    numberOfCells = table.numCells;
+  }
 
   // need for both sorting and partitioning
   thrust::device_ptr<unsigned int> d_ParticleCellIndices_ptr;
@@ -513,34 +538,36 @@ void gridSort(RTNNState& state, unsigned int N, float3* particles, float3* h_par
       thrust::device_pointer_cast(reinterpret_cast<unsigned int*>(state.d_CellOffsets_ptr_p));
   thrust::device_ptr<unsigned int> d_posInSortedPoints_ptr;
 
-  allocThrustDevicePtr(&d_ParticleCellIndices_ptr, N, &state.d_gridPointers);
-  allocThrustDevicePtr(&d_LocalSortedIndices_ptr, N, &state.d_gridPointers);
-  allocThrustDevicePtr(&d_posInSortedPoints_ptr, N, &state.d_gridPointers);
+  allocThrustDevicePtr(&d_ParticleCellIndices_ptr, N, state, ARENA_GRID);
+  allocThrustDevicePtr(&d_LocalSortedIndices_ptr, N, state, ARENA_GRID);
+  allocThrustDevicePtr(&d_posInSortedPoints_ptr, N, state, ARENA_GRID);
 
   unsigned int threadsPerBlock = 64;
   unsigned int numOfBlocks = N / threadsPerBlock + 1;
-  if ((type == POINT) && state.partition) {
+  if ((type == POINT) && state.partition && !state.sparseGrid) {
     // indicating that this is a point sort after the query partitioning, in
     // which case the two cellArrays are created in the query partitioning
     // process and we can reuse their space so no allocation. we still have to
-    // call kInsertParticles using the correct |morton| to update them (since
-    // the query morton order and point order might be different) as well as
-    // initializing the two N arrays.
+    // call kInsertParticles using the correct |order| to update them (since
+    // the query cell order and point order might be different) as well as
+    // initializing the two N arrays. a sparse grid has a table of its own
+    // (the point and query cells differ), so it always allocates.
   } else {
     // numberOfCells takes a lot of memory
-    allocThrustDevicePtr(&d_CellParticleCounts_ptr, numberOfCells, &state.d_gridPointers);
-    allocThrustDevicePtr(&d_CellOffsets_ptr, numberOfCells, &state.d_gridPointers);
+    allocThrustDevicePtr(&d_CellParticleCounts_ptr, numberOfCells, state, ARENA_GRID);
+    allocThrustDevicePtr(&d_CellOffsets_ptr, numberOfCells, state, ARENA_GRID);
   }
 
   fillByValue(d_CellParticleCounts_ptr, numberOfCells, 0);
   kInsertParticles(numOfBlocks,
                    threadsPerBlock,
                    gridInfo,
+                   table,
                    particles,
                    thrust::raw_pointer_cast(d_ParticleCellIndices_ptr),
                    thrust::raw_pointer_cast(d_CellParticleCounts_ptr),
                    thrust::raw_pointer_cast(d_LocalSortedIndices_ptr),
-                   morton
+                   order
                   );
 
   fillByValue(d_CellOffsets_ptr, numberOfCells, 0); // need to initialize it even for exclusive scan
@@ -572,11 +599,12 @@ void gridSort(RTNNState& state, unsigned int N, float3* particles, float3* h_par
       kInsertParticles(numOfBlocks,
                        threadsPerBlock,
                        gridInfo,
+                       table,
                        state.params.points,
                        nullptr,
                        thrust::raw_pointer_cast(d_CellParticleCounts_ptr_p),
                        nullptr,
-                       morton // it's necessary to use the same |morton| as inserting queries
+                       order // it's necessary to use the same |order| as inserting queries
                       );
       gridInfo.ParticleCount = N;
       numOfBlocks = N / threadsPerBlock + 1;
@@ -587,11 +615,12 @@ void gridSort(RTNNState& state, unsigned int N, float3* particles, float3* h_par
 
     sortGenBatch(state,
                  N,
-                 morton,
+                 order,
                  numberOfCells,
                  numOfBlocks,
                  threadsPerBlock,
                  gridInfo,
+                 table,
                  particles,
                  d_CellParticleCounts_ptr_p,
                  d_ParticleCellIndices_ptr,
@@ -608,6 +637,15 @@ void gridSort(RTNNState& state, unsigned int N, float3* particles, float3* h_par
                          thrust::raw_pointer_cast(d_LocalSortedIndices_ptr),
                          thrust::raw_pointer_cast(d_posInSortedPoints_ptr)
                         );
+    unsigned int* d_ids = (type == POINT) ? state.d_pointIds : state.d_queryIds;
+    if (d_ids) {
+      // the keys are sorted in place below, so sort the ids with a copy.
+      thrust::device_ptr<unsigned int> d_posInSortedPoints_ptr_copy;
+      allocThrustDevicePtr(&d_posInSortedPoints_ptr_copy, N, state, ARENA_GRID);
+      thrustCopyD2D(d_posInSortedPoints_ptr_copy, d_posInSortedPoints_ptr, N);
+      sortByKey(d_posInSortedPoints_ptr_copy, thrust::device_pointer_cast(d_ids), N);
+    }
+
     // in-place sort; no new device memory is allocated
     sortByKey(d_posInSortedPoints_ptr, thrust::device_pointer_cast(particles), N);
   }
@@ -626,19 +664,25 @@ void gridSort(RTNNState& state, unsigned int N, float3* particles, float3* h_par
   thrust::copy(d_particles_ptr, d_particles_ptr + N, h_particles);
 }
 
-void oneDSort ( RTNNState& state, unsigned int N, float3* particles, float3* h_particles ) {
+void oneDSort ( RTNNState& state, unsigned int N, float3* particles, float3* h_particles, ParticleType type, int axis ) {
   // sort points/queries based on coordinates (x/y/z)
+  fprintf(stdout, "\t1D sort axis: %c\n", "xyz"[axis]);
 
-  // TODO: do this whole thing on GPU.
-  // create 1d points as the sorting key and upload it to device memory
-  thrust::host_vector<float> h_key(N);
-  for(unsigned int i = 0; i < N; i++) {
-    h_key[i] = h_particles[i].x;
-  }
-
+  // the keys are built on the device from the particles already there.
+  unsigned int threadsPerBlock = 64;
+  unsigned int numOfBlocks = N / threadsPerBlock + 1;
   thrust::device_ptr<float> d_key_ptr;
-  allocThrustDevicePtr(&d_key_ptr, state.numQueries, &state.d_pointers);
-  thrust::copy(h_key.begin(), h_key.end(), d_key_ptr);
+  allocThrustDevicePtr(&d_key_ptr, N, state, ARENA_GRID);
+  kAxisKeys(numOfBlocks, threadsPerBlock, particles, nullptr, N, axis, thrust::raw_pointer_cast(d_key_ptr), 0);
+
+  unsigned int* d_ids = (type == POINT) ? state.d_pointIds : state.d_queryIds;
+  if (d_ids) {
+    // the keys are useless after a sort, so make them again rather than copy them.
+    thrust::device_ptr<float> d_key_ptr_copy;
+    allocThrustDevicePtr(&d_key_ptr_copy, N, state, ARENA_GRID);
+    kAxisKeys(numOfBlocks, threadsPerBlock, particles, nullptr, N, axis, thrust::raw_pointer_cast(d_key_ptr_copy), 0);
+    sortByKey( d_key_ptr_copy, thrust::device_pointer_cast(d_ids), N );
+  }
 
   // actual sort
   thrust::device_ptr<float3> d_particles_ptr = thrust::device_pointer_cast(particles);
@@ -650,13 +694,51 @@ void oneDSort ( RTNNState& state, unsigned int N, float3* particles, float3* h_p
   thrust::copy(d_particles_ptr, d_particles_ptr + N, h_particles);
 }
 
+// sort keys on one 64-bit morton curve over the whole scene (see morton.h).
+thrust::device_ptr<unsigned long long> genMortonKeys64(RTNNState& state, unsigned int N, float3* particles) {
+  GridInfo gridInfo;
+  float cellSize = morton64CellSize(state.Min, state.Max);
+  calcGridInfo(state.Min, state.Max, cellSize, state.mcScale, N, gridInfo);
+  fprintf(stdout, "\tMorton64 grid dimension: %u, %u, %u\n", gridInfo.GridDimension.x, gridInfo.GridDimension.y, gridInfo.GridDimension.z);
+
+  thrust::device_ptr<unsigned long long> d_keys_ptr;
+  allocThrustDevicePtr(&d_keys_ptr, N, state, ARENA_GRID);
+  unsigned int threadsPerBlock = 64;
+  kMortonKeys64(N / threadsPerBlock + 1, threadsPerBlock, gridInfo, particles, thrust::raw_pointer_cast(d_keys_ptr));
+  return d_keys_ptr;
+}
+
+void morton64Sort ( RTNNState& state, unsigned int N, float3* particles, float3* h_particles, ParticleType type ) {
+  thrust::device_ptr<unsigned long long> d_keys_ptr = genMortonKeys64(state, N, particles);
+
+  // many points share a key, but the sorts are stable so the ids are sorted
+  // the same way as the particles.
+  unsigned int* d_ids = (type == POINT) ? state.d_pointIds : state.d_queryIds;
+  if (d_ids) {
+    thrust::device_ptr<unsigned long long> d_keys_ptr_copy;
+    allocThrustDevicePtr(&d_keys_ptr_copy, N, state, ARENA_GRID);
+    thrustCopyD2D(d_keys_ptr_copy, d_keys_ptr, N);
+    stableSortByKey(d_keys_ptr_copy, thrust::device_pointer_cast(d_ids), N);
+  }
+
+  thrust::device_ptr<float3> d_particles_ptr = thrust::device_pointer_cast(particles);
+  stableSortByKey(d_keys_ptr, d_particles_ptr, N);
+
+  // see the end of |gridSort|.
+  if ((type == QUERY) && !state.samepq && !state.sanCheck) return;
+  thrust::copy(d_particles_ptr, d_particles_ptr + N, h_particles);
+}
+
 // this does both sorting and query partitioning, since both use the same grid
 void sortParticles ( RTNNState& state, ParticleType type, int sortMode ) {
   // sortMode:
   // 0: no sort
   // 1: z-order sort
   // 2: raster sort
-  // 3: 1D sort; doesn't do query partitioning
+  // 3: 1D sort along |sortAxis|; doesn't do query partitioning
+  // 4: z-order sort on one 64-bit morton curve; queries are partitioned on
+  //    the z-order grid first
+  // 5: Hilbert order sort
 
   if ((type == QUERY) && !state.partition && !sortMode) return;
   else if ((type == POINT) && !sortMode) return;
@@ -678,49 +760,52 @@ void sortParticles ( RTNNState& state, ParticleType type, int sortMode ) {
 
   // the semantices of sorting is: sort data in device, and copy the sorted data back to host.
   if (sortMode == 3) {
-    oneDSort(state, N, particles, h_particles);
+    oneDSort(state, N, particles, h_particles, type, sortAxis(state.sortAxis, state.Min, state.Max));
+  } else if ((sortMode == 4) && !((type == QUERY) && state.partition)) {
+    morton64Sort(state, N, particles, h_particles, type);
   } else {
     // TODO: a slight issue is if ps and qs are 0, we will still use raster
     // order to sort queries in the partitioning grid (in
     // |kCountingSortIndices_setRayMask| function), which is perhaps OK ---
     // sorting there isn't used anyways.
-    gridSort(state, N, particles, h_particles,
-        (sortMode == 1) ? true : false, // morton
-        type);
+    CellOrder order = RASTER_ORDER;
+    if (sortMode == 1 || sortMode == 4) order = MORTON_ORDER;
+    else if (sortMode == 5) order = HILBERT_ORDER;
+    gridSort(state, N, particles, h_particles, order, type);
   }
   Timing::stopTiming(true);
 }
 
-thrust::device_ptr<unsigned int> sortQueriesByFHCoord( RTNNState& state, thrust::device_ptr<unsigned int> d_firsthit_idx_ptr, int batch_id ) {
-  // this is sorting queries by the x/y/z coordinate of the first hit primitives.
+thrust::device_ptr<unsigned int> sortQueriesByFHCoord( RTNNState& state, thrust::device_ptr<unsigned int> d_firsthit_idx_ptr, int batch_id, int axis ) {
+  // this is sorting queries by the x/y/z coordinate (|axis|) of the first hit primitives.
   unsigned int numQueries = state.numActQueries[batch_id];
 
   Timing::startTiming("gas-sort queries init");
     // allocate device memory for storing the keys, which will be generated by a gather and used in sort_by_keys
     thrust::device_ptr<float> d_key_ptr;
-    allocThrustDevicePtr(&d_key_ptr, numQueries, &state.d_pointers);
-  
-    // create keys (1d coordinate), which will become the source of gather, the
-    // result of which will be the keys for sort; the size must be
-    // state.numPoints rather than numQueries. without point/query sorting,
-    // Coord-sort can be better than ID-sort since the IDs of the FH primitives
-    // will be arbitrary.
-    thrust::host_vector<float> h_orig_points_1d(state.numPoints);
-    // TODO: do this in CUDA
-    for (unsigned int i = 0; i < state.numPoints; i++) {
-      h_orig_points_1d[i] = state.h_points[i].z; // could be other dimensions
-    }
-    thrust::device_vector<float> d_orig_points_1d = h_orig_points_1d; // one P NArray
+    allocThrustDevicePtr(&d_key_ptr, numQueries, state, ARENA_BATCH);
 
     // initialize a sequence to be sorted, which will become the r2q map.
     thrust::device_ptr<unsigned int> d_r2q_map_ptr;
-    allocThrustDevicePtr(&d_r2q_map_ptr, numQueries, &state.d_pointers);
+    allocThrustDevicePtr(&d_r2q_map_ptr, numQueries, state, ARENA_BATCH);
     genSeqDevice(d_r2q_map_ptr, numQueries, state.stream[batch_id]);
   Timing::stopTiming(true);
  
   Timing::startTiming("gas-sort queries");
-    // first use a gather to generate the keys, then sort by keys
-    gatherByKey(d_firsthit_idx_ptr, &d_orig_points_1d, d_key_ptr, numQueries, state.stream[batch_id]);
+    // the keys (1d coordinate) are the coordinates of the FH primitives, which
+    // |kAxisKeys| gathers from the points. without point/query sorting,
+    // Coord-sort can be better than ID-sort since the IDs of the FH primitives
+    // will be arbitrary.
+    // quantized points are read from their encodings, which are on the device.
+    unsigned int threadsPerBlock = 64;
+    if (state.params.quantized)
+      kAxisKeysQuantized(numQueries / threadsPerBlock + 1, threadsPerBlock, state.params.quant,
+          state.params.qCells, state.params.qOffsets, thrust::raw_pointer_cast(d_firsthit_idx_ptr), numQueries, axis,
+          thrust::raw_pointer_cast(d_key_ptr), state.stream[batch_id]);
+    else
+      kAxisKeys(numQueries / threadsPerBlock + 1, threadsPerBlock, state.params.points,
+          thrust::raw_pointer_cast(d_firsthit_idx_ptr), numQueries, axis,
+          thrust::raw_pointer_cast(d_key_ptr), state.stream[batch_id]);
     sortByKey( d_key_ptr, d_r2q_map_ptr, numQueries, state.stream[batch_id] );
     state.d_r2q_map[batch_id] = thrust::raw_pointer_cast(d_r2q_map_ptr);
   Timing::stopTiming(true);
@@ -755,7 +840,7 @@ thrust::device_ptr<unsigned int> sortQueriesByFHIdx( RTNNState& state, thrust::d
   // initialize a sequence to be sorted, which will become the r2q map
   Timing::startTiming("gas-sort queries init");
     thrust::device_ptr<unsigned int> d_r2q_map_ptr;
-    allocThrustDevicePtr(&d_r2q_map_ptr, numQueries, &state.d_pointers);
+    allocThrustDevicePtr(&d_r2q_map_ptr, numQueries, state, ARENA_BATCH);
     genSeqDevice(d_r2q_map_ptr, numQueries, state.stream[batch_id]);
   Timing::stopTiming(true);
 
@@ -822,7 +907,7 @@ void gatherQueries( RTNNState& state, thrust::device_ptr<unsigned int> d_indices
 
     // allocate device memory for reordered/gathered queries
     thrust::device_ptr<float3> d_reord_queries_ptr;
-    allocThrustDevicePtr(&d_reord_queries_ptr, numQueries, &state.d_pointers);
+    allocThrustDevicePtr(&d_reord_queries_ptr, numQueries, state, ARENA_BATCH);
 
     // get pointer to original queries in device memory
     thrust::device_ptr<float3> d_orig_queries_ptr = thrust::device_pointer_cast(state.d_actQs[batch_id]);
@@ -832,13 +917,21 @@ void gatherQueries( RTNNState& state, thrust::device_ptr<unsigned int> d_indices
 
     state.d_actQs[batch_id] = thrust::raw_pointer_cast(d_reord_queries_ptr);
     //assert(state.params.points != state.params.queries);
+
+    if (state.d_actQIds[batch_id]) {
+      thrust::device_ptr<unsigned int> d_reord_ids_ptr;
+      allocThrustDevicePtr(&d_reord_ids_ptr, numQueries, state, ARENA_BATCH);
+      gatherByKey(d_indices_ptr, thrust::device_pointer_cast(state.d_actQIds[batch_id]), d_reord_ids_ptr, numQueries, state.stream[batch_id]);
+      state.d_actQIds[batch_id] = thrust::raw_pointer_cast(d_reord_ids_ptr);
+    }
   Timing::stopTiming(true);
 
   // Copy reordered queries to host for sanity check
   if (state.sanCheck) {
-    // if not samepq, free the original query host memory first
-    if (!state.samepq || state.partition) delete state.h_actQs[batch_id];
-    state.h_actQs[batch_id] = new float3[numQueries]; // don't overwrite h_points
+    // free the previous copy first, if it's a copy (see |cleanupSearch|)
+    if ((state.h_actQs[batch_id] != state.h_queries) && (state.h_actQs[batch_id] != state.h_points))
+      freePinned(state, state.h_actQs[batch_id]);
+    state.h_actQs[batch_id] = static_cast<float3*>(allocPinned(state, numQueries * sizeof(float3))); // don't overwrite h_points
     thrust::copy(d_reord_queries_ptr, d_reord_queries_ptr+numQueries, state.h_actQs[batch_id]);
   }
 }
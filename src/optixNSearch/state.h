@@ -32,13 +32,20 @@
 #include <vector_types.h>
 #include <optix_types.h>
 #include <unordered_set>
+#include <vector>
 #include "optixNSearch.h"
+#include "pcio.h"
+#include "costmodel.h"
 
 // the SDK cmake defines NDEBUG in the Release build, but we still want to use assert
 // TODO: fix it in cmake files?
 #undef NDEBUG
 #include <assert.h>
 
+struct ResultWriter; // see writer.h
+struct DeviceArena; // see arena.h and util.cpp
+struct PinnedPool; // see pinned.h
+
 #define OMIT_ON_E2EMSR(x) \
   if (state.msr == 0) x   \
 
@@ -47,6 +54,7 @@ struct RTNNState
     OptixDeviceContext          context                   = 0;
     OptixTraversableHandle*     gas_handle                = nullptr;
     CUdeviceptr*                d_gas_output_buffer       = nullptr;
+    size_t*                     gas_size                  = nullptr; // bytes in d_gas_output_buffer
 
     OptixModule                 geometry_module           = 0;
     OptixModule                 camera_module             = 0;
@@ -67,19 +75,37 @@ struct RTNNState
     float3**                    h_ndpoints                = nullptr;
     float3**                    h_ndqueries               = nullptr;
     int                         dim;
+    std::vector<MappedPointFile> h_mappedFiles; // binary inputs mapped into h_points/h_queries
     bool                        msr                       = true;
     bool                        sanCheck                  = false;
+    bool                        exactCheck                = false; // sanity check every query against a host grid (see |sanityCheckExact|)
+    unsigned int                exactCheckSample          = 0; // queries the exact check samples per batch; 0 checks them all
 
     int32_t                     device_id                 = 0;
+    std::string                 backend                   = "gpu"; // "gpu" (OptiX) or "cpu" (host cell list)
+    unsigned int                numThreads                = 0; // host threads; 0 uses all hardware threads
     std::string                 searchMode                = "radius";
     std::string                 pfile;
     std::string                 qfile;
+    bool                        binCache                  = true; // read/write .rtnn sidecars of text inputs
+    std::string                 serverSock; // Unix socket path; non-empty runs the search server
+    unsigned int                serverMaxCount            = 1 << 25; // most points/queries one server request may carry
+    std::string                 outFile; // non-empty writes the results there as .npy
+    std::string                 traceFile; // non-empty writes a Chrome trace of the timed phases there at exit
+    std::string                 traceProfileFile; // same, but the phases summed up by nesting path (see Timing::enableTrace)
+    std::string                 gasCacheDir; // non-empty caches GASes there (see gascache.h)
+    std::string                 profileDir; // per-device cost profiles for the batching (see costmodel.h)
+    std::string                 deviceName;
+    bool                        calibrate                 = false; // measure the cost model and save it in |profileDir|
+    CostModel                   costModel;
+    unsigned int                gasCacheSize              = 4096; // MB
     unsigned int                knn                       = 50;
     float                       gRadius                   = 2.0;
     float                       radius                    = 2.0;
     int                         qGasSortMode              = 2; // no GAS-based sort vs. 1D vs. ID
-    int                         pointSortMode             = 1; // no sort vs. morton order vs. raster order vs. 1D order
-    int                         querySortMode             = 1; // no sort vs. morton order vs. raster order vs. 1D order
+    int                         pointSortMode             = 1; // no sort vs. morton order vs. raster order vs. 1D order vs. 64-bit morton vs. Hilbert
+    int                         querySortMode             = 1; // no sort vs. morton order vs. raster order vs. 1D order vs. 64-bit morton vs. Hilbert
+    int                         sortAxis                  = -1; // axis of the 1D sorts: 0/1/2 for x/y/z, -1 for the longest side of the scene
     float                       crRatio                   = 8; // cellSize = radius / crRatio
     float                       gsrRatio                  = 1;
     bool                        toGather                  = false;
@@ -91,9 +117,25 @@ struct RTNNState
     bool                        autoCR                    = true;
     int                         approxMode                = 2;
     int                         mcScale                   = 4;
+    bool                        adaptiveMetaGrid          = false; // per-axis meta grid sizes (see |chooseMetaGridBits|) instead of mcScale
+    float                       metaGridWaste             = 0.125; // most padding the adaptive meta grids may add, as a fraction of the cells
+    bool                        sparseGrid                = false; // per-cell arrays only for the occupied cells (see |CellTable|)
     float                       crStep                    = 1.01;
     bool                        deferFree                 = true;
+    bool                        useArena                  = true; // sub-allocate search intermediates (see arena.h)
+    bool                        usePinnedPool             = true; // reuse pinned host buffers (see pinned.h)
+    bool                        quantize                  = false; // IS programs test 16-bit quantized points first (see helper_quantize.h)
+    float3*                     h_exactPoints             = nullptr; // with |quantize|: the float3 points, in mapped host memory (see |quantizePoints|)
     bool                        filterQueries             = false;
+    bool                        csr                       = false; // results as CSR (see csr.h) instead of padded rows
+    bool                        dynamic                   = false; // keep the GAS across frames and refit it (see dynamic.h)
+    float                       refitDrift                = 0.25; // rebuild once a point moved this much (x radius) since the last build
+    unsigned int                maxRefits                 = 32; // rebuild after this many refits in a row
+    float                       verletSkin                = 0; // radius search: > 0 keeps Verlet lists (see verlet.h)
+    bool                        instanced                 = false; // search an IAS of per-frame GASes (see window.h)
+    unsigned int*               d_instanceOffsets         = nullptr; // with |instanced|: see |createInstanceGeometry|
+    unsigned int                instanceOffsetsCapacity   = 0; // elements allocated in d_instanceOffsets
+    float                       windowSlack               = 0.5; // compact the window once removed frames take this fraction of it
 
     unsigned int                numPoints                 = 0;
     unsigned int                numQueries                = 0;
@@ -101,6 +143,13 @@ struct RTNNState
     unsigned int*               numActQueries             = nullptr;
     float*                      launchRadius              = nullptr;
     void**                      h_res                     = nullptr;
+    unsigned int**              h_resOffsets              = nullptr; // per batch, with |csr|: numActQueries + 1 offsets into h_res
+    unsigned int**              d_res                     = nullptr; // per batch, with |csr|: padded results awaiting |finishCompactResults|
+    unsigned int**              d_resOffsets              = nullptr; // per batch, with |csr|: their offsets on the device
+    ResultWriter*               writer                    = nullptr; // set while |outFile| is being written
+    DeviceArena*                arena                     = nullptr; // created by the first arena allocation
+    PinnedPool*                 pinnedPool                = nullptr; // created by the first |allocPinned|
+    uint64_t                    pointsHash                = 0; // of the sorted points, for the GAS cache; 0 until computed
     float3**                    d_actQs                   = nullptr;
     float3**                    h_actQs                   = nullptr;
     void**                      d_aabb                    = nullptr;
@@ -110,6 +159,11 @@ struct RTNNState
     void*                       d_CellOffsets_ptr_p       = nullptr;
     float3*                     h_fltQs                   = nullptr;
     unsigned int                numFltQs                  = 0;
+    bool                        trackIds                  = false; // have |uploadData| set up the two id arrays below
+    unsigned int*               d_pointIds                = nullptr; // if not null, permuted along with point sorting
+    unsigned int*               h_pointIds                = nullptr; // original id of each sorted point
+    unsigned int*               d_queryIds                = nullptr; // if not null, permuted/filtered along with the queries
+    unsigned int**              d_actQIds                 = nullptr; // per batch: original id of each active query
 
     std::unordered_set<void*>   d_pointers;
     std::unordered_set<void*>   d_gridPointers;
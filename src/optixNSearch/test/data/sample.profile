@@ -0,0 +1,28 @@
+version 1
+device Sample GPU
+buildGasPerAABB 2.02665416e-06
+buildGasIntercept 11.0700328
+aabbTestPerIS 1.66511559e-07
+sphereTestPerIS 1.26138589e-06
+knnSearchPerIS 0.0417253228
+sample buildGas 250000 11.3438
+sample buildGas 500000 12.082
+sample buildGas 1000000 12.9978
+sample buildGas 2000000 15.2948
+sample buildGas 4000000 19.5463
+sample buildGas 8000000 27.0753
+sample aabbTest 1000000 0.1538
+sample aabbTest 2000000 0.3286
+sample aabbTest 4000000 0.6277
+sample aabbTest 8000000 1.2528
+sample aabbTest 16000000 2.6615
+sample sphereTest 1000000 1.2969
+sample sphereTest 2000000 2.67
+sample sphereTest 4000000 5.1902
+sample sphereTest 8000000 10.5157
+sample sphereTest 16000000 20.2186
+sample knnSearch 20000 831.0586
+sample knnSearch 50000 2125.4493
+sample knnSearch 100000 4109.5043
+sample knnSearch 200000 8397.8265
+sample knnSearch 400000 16681.1148
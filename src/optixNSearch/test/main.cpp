@@ -0,0 +1,36 @@
+#include <cstring>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "test.h"
+
+int testFailures = 0;
+
+static std::vector<std::pair<std::string, TestFn>>& registry() {
+  static std::vector<std::pair<std::string, TestFn>> tests;
+  return tests;
+}
+
+TestRegistrar::TestRegistrar(const char* name, TestFn fn) {
+  registry().push_back(std::make_pair(std::string(name), fn));
+}
+
+// rtnnTests [prefix]: runs the tests whose name starts with |prefix| (all of
+// them by default) and fails if any of them failed or none matched.
+int main(int argc, char* argv[]) {
+  const char* prefix = (argc > 1) ? argv[1] : "";
+  unsigned int numRun = 0, numFailed = 0;
+
+  for (auto& test : registry()) {
+    if (test.first.compare(0, strlen(prefix), prefix) != 0) continue;
+    testFailures = 0;
+    test.second();
+    numRun++;
+    if (testFailures) numFailed++;
+    fprintf(stdout, "%s %s\n", testFailures ? "FAIL" : "ok  ", test.first.c_str());
+  }
+
+  fprintf(stdout, "%u tests, %u failed\n", numRun, numFailed);
+  return (numRun == 0 || numFailed) ? 1 : 0;
+}
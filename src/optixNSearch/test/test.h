@@ -0,0 +1,41 @@
+#pragma once
+
+#include <cmath>
+#include <cstdio>
+
+// A minimal harness for the host-only unit tests (rtnnTests) and the tests of
+// the library on the CPU backend (rtnnLibTests). Tests need no GPU: they cover
+// the host halves of the search (layouts, cost models, grids, encoders and the
+// allocators with fake backends).
+//
+//   TEST(csr, roundTrip) { CHECK(...); }
+//
+// registers test "csr.roundTrip"; `rtnnTests csr` runs the tests whose name
+// starts with "csr", which is how CTest runs each suite (see CMakeLists.txt).
+// A failed CHECK reports itself and fails the test but doesn't stop it.
+
+typedef void (*TestFn)();
+
+struct TestRegistrar
+{
+  TestRegistrar(const char* name, TestFn fn);
+};
+
+// counts the failed CHECKs of the running test.
+extern int testFailures;
+
+#define TEST(suite, name) \
+  static void test_##suite##_##name(); \
+  static TestRegistrar registrar_##suite##_##name(#suite "." #name, test_##suite##_##name); \
+  static void test_##suite##_##name()
+
+#define CHECK(cond) \
+  do { \
+    if (!(cond)) { \
+      fprintf(stderr, "%s:%d: CHECK(%s) failed\n", __FILE__, __LINE__, #cond); \
+      testFailures++; \
+    } \
+  } while (0)
+
+#define CHECK_EQ(a, b) CHECK((a) == (b))
+#define CHECK_NEAR(a, b, eps) CHECK(std::fabs((double)(a) - (double)(b)) <= (eps))
@@ -0,0 +1,167 @@
+#include <vector>
+
+#include "arena.h"
+#include "test.h"
+
+// blocks come from a fake address space, and a fence is done once the fake
+// clock has reached it.
+struct FakeDevice
+{
+  uintptr_t                   next            = 0x10000000;
+  uint64_t                    clock           = 0;
+  std::vector<size_t>         blocks; // sizes of the blocks handed out
+  size_t                      limit           = 0; // fail requests past this many bytes; 0: no limit
+  size_t                      total           = 0;
+};
+
+static void attach(Arena& arena, FakeDevice& dev) {
+  arena.blockSize = 1024;
+  arena.alignment = 256;
+  arena.allocBlock = [&dev](size_t size) -> uintptr_t {
+    if (dev.limit && dev.total + size > dev.limit) return 0;
+    uintptr_t base = dev.next;
+    dev.next += size;
+    dev.total += size;
+    dev.blocks.push_back(size);
+    return base;
+  };
+  arena.fenceDone = [&dev](uint64_t fence) { return fence <= dev.clock; };
+}
+
+TEST(arena, bump) {
+  Arena arena;
+  FakeDevice dev;
+  attach(arena, dev);
+
+  uintptr_t a = arenaAlloc(arena, ARENA_BATCH, 1);
+  uintptr_t b = arenaAlloc(arena, ARENA_BATCH, 300);
+  uintptr_t c = arenaAlloc(arena, ARENA_BATCH, 256);
+  CHECK_EQ(a, (uintptr_t)0x10000000);
+  CHECK_EQ(b, a + 256); // aligned up
+  CHECK_EQ(c, b + 512);
+  CHECK_EQ(arenaUsed(arena, ARENA_BATCH), (size_t)1024);
+  CHECK_EQ(dev.blocks.size(), (size_t)1);
+
+  // the block is full, so the next allocation takes a new one.
+  uintptr_t d = arenaAlloc(arena, ARENA_BATCH, 1);
+  CHECK_EQ(dev.blocks.size(), (size_t)2);
+  CHECK_EQ(d, (uintptr_t)0x10000000 + 1024);
+  CHECK_EQ(arena.reserved, (size_t)2048);
+  CHECK_EQ(arena.peak, (size_t)2048);
+
+  // scopes don't share blocks.
+  arenaAlloc(arena, ARENA_GRID, 1);
+  CHECK_EQ(dev.blocks.size(), (size_t)3);
+  CHECK_EQ(arenaUsed(arena, ARENA_GRID), (size_t)256);
+}
+
+TEST(arena, largeRequest) {
+  Arena arena;
+  FakeDevice dev;
+  attach(arena, dev);
+
+  arenaAlloc(arena, ARENA_GRID, 5000);
+  CHECK_EQ(dev.blocks.size(), (size_t)1);
+  CHECK_EQ(dev.blocks[0], (size_t)5120);
+}
+
+TEST(arena, allocFailure) {
+  Arena arena;
+  FakeDevice dev;
+  attach(arena, dev);
+  dev.limit = 1024;
+
+  CHECK(arenaAlloc(arena, ARENA_BATCH, 1000) != 0);
+  CHECK_EQ(arenaAlloc(arena, ARENA_BATCH, 1000), (uintptr_t)0);
+  CHECK_EQ(arena.reserved, (size_t)1024);
+}
+
+TEST(arena, releaseAndReuse) {
+  Arena arena;
+  FakeDevice dev;
+  attach(arena, dev);
+
+  uintptr_t a = arenaAlloc(arena, ARENA_RESULTS, 512);
+  arenaAlloc(arena, ARENA_RESULTS, 512);
+  arenaRelease(arena, ARENA_RESULTS, 0);
+  CHECK_EQ(arenaUsed(arena, ARENA_RESULTS), (size_t)0);
+  CHECK_EQ(arena.freeBlocks.size(), (size_t)1);
+
+  // fence 0 is reusable right away, by any scope, with no new block.
+  uintptr_t b = arenaAlloc(arena, ARENA_BATCH, 100);
+  CHECK_EQ(b, a);
+  CHECK_EQ(dev.blocks.size(), (size_t)1);
+  CHECK(arena.freeBlocks.empty());
+}
+
+TEST(arena, bestFit) {
+  Arena arena;
+  FakeDevice dev;
+  attach(arena, dev);
+
+  uintptr_t big = arenaAlloc(arena, ARENA_GRID, 4096);
+  uintptr_t small = arenaAlloc(arena, ARENA_BATCH, 100);
+  arenaRelease(arena, ARENA_GRID, 0);
+  arenaRelease(arena, ARENA_BATCH, 0);
+
+  // the small request takes the small block and leaves the big one.
+  CHECK_EQ(arenaAlloc(arena, ARENA_RESULTS, 100), small);
+  CHECK_EQ(arenaAlloc(arena, ARENA_GRID, 4000), big);
+  CHECK_EQ(dev.blocks.size(), (size_t)2);
+}
+
+TEST(arena, fenceGatesReuse) {
+  Arena arena;
+  FakeDevice dev;
+  attach(arena, dev);
+
+  uintptr_t a = arenaAlloc(arena, ARENA_RESULTS, 100);
+  arenaRelease(arena, ARENA_RESULTS, 5);
+
+  // the work behind fence 5 isn't done: the block stays put.
+  dev.clock = 4;
+  uintptr_t b = arenaAlloc(arena, ARENA_RESULTS, 100);
+  CHECK(b != a);
+  CHECK_EQ(dev.blocks.size(), (size_t)2);
+  CHECK_EQ(arena.freeBlocks.size(), (size_t)1);
+
+  // once it is, the block is reused.
+  dev.clock = 5;
+  CHECK_EQ(arenaAlloc(arena, ARENA_GRID, 1024), a);
+  CHECK_EQ(dev.blocks.size(), (size_t)2);
+  CHECK(arena.freeBlocks.empty());
+}
+
+TEST(arena, trim) {
+  Arena arena;
+  FakeDevice dev;
+  attach(arena, dev);
+
+  arenaAlloc(arena, ARENA_GRID, 100);
+  arenaAlloc(arena, ARENA_BATCH, 2000);
+  arenaAlloc(arena, ARENA_RESULTS, 100);
+  CHECK_EQ(arena.reserved, (size_t)(1024 + 2048 + 1024));
+  arenaRelease(arena, ARENA_GRID, 0);
+  arenaRelease(arena, ARENA_BATCH, 7);
+
+  // only the blocks whose fence is done are trimmed.
+  dev.clock = 6;
+  std::vector<ArenaBlock> trimmed = arenaTrim(arena);
+  CHECK_EQ(trimmed.size(), (size_t)1);
+  CHECK_EQ(trimmed[0].size, (size_t)1024);
+  CHECK_EQ(arena.reserved, (size_t)(2048 + 1024));
+  CHECK_EQ(arena.freeBlocks.size(), (size_t)1);
+
+  dev.clock = 7;
+  trimmed = arenaTrim(arena);
+  CHECK_EQ(trimmed.size(), (size_t)1);
+  CHECK_EQ(trimmed[0].size, (size_t)2048);
+  CHECK_EQ(arena.reserved, (size_t)1024);
+  CHECK(arena.freeBlocks.empty());
+  // the peak stays.
+  CHECK_EQ(arena.peak, (size_t)(1024 + 2048 + 1024));
+
+  // blocks in use are never trimmed.
+  CHECK(arenaTrim(arena).empty());
+  CHECK_EQ(arenaUsed(arena, ARENA_RESULTS), (size_t)256);
+}
@@ -0,0 +1,74 @@
+#include <algorithm>
+#include <random>
+#include <vector>
+
+#include <sutil/vec_math.h>
+
+#include "axiskeys.h"
+#include "test.h"
+
+TEST(axiskeys, sortAxis) {
+  float3 origin = make_float3(0, 0, 0);
+  // explicit axes are kept, whatever the scene.
+  CHECK_EQ(sortAxis(0, origin, make_float3(1, 9, 9)), 0);
+  CHECK_EQ(sortAxis(1, origin, make_float3(9, 1, 9)), 1);
+  CHECK_EQ(sortAxis(2, origin, make_float3(9, 9, 1)), 2);
+
+  // otherwise the longest side; ties go to the earlier axis.
+  CHECK_EQ(sortAxis(-1, origin, make_float3(9, 2, 3)), 0);
+  CHECK_EQ(sortAxis(-1, origin, make_float3(2, 9, 3)), 1);
+  CHECK_EQ(sortAxis(-1, origin, make_float3(2, 3, 9)), 2);
+  CHECK_EQ(sortAxis(-1, make_float3(-10, 0, 0), make_float3(0, 5, 5)), 0);
+  CHECK_EQ(sortAxis(-1, origin, make_float3(4, 4, 4)), 0);
+  CHECK_EQ(sortAxis(-1, origin, make_float3(1, 4, 4)), 1);
+  CHECK_EQ(sortAxis(-1, origin, origin), 0);
+  CHECK_EQ(sortAxis(3, origin, make_float3(1, 1, 2)), 2);
+}
+
+static std::vector<float3> randomPoints(unsigned int N) {
+  std::mt19937 rng(5);
+  std::uniform_real_distribution<float> coord(-100, 100);
+  std::vector<float3> points(N);
+  for (float3& p : points) p = make_float3(coord(rng), coord(rng), coord(rng));
+  return points;
+}
+
+TEST(axiskeys, keys) {
+  std::vector<float3> points = randomPoints(10000);
+  std::vector<float> keys(points.size());
+  for (int axis = 0; axis < 3; axis++) {
+    axisKeys(points.data(), nullptr, points.size(), axis, keys.data(), 4);
+    for (size_t i = 0; i < points.size(); i++) {
+      float expected = (axis == 0) ? points[i].x : ((axis == 1) ? points[i].y : points[i].z);
+      CHECK_EQ(keys[i], expected);
+    }
+  }
+
+  // gathered through |indices|.
+  std::vector<unsigned int> indices = {9999, 0, 42, 42, 7};
+  axisKeys(points.data(), indices.data(), indices.size(), 1, keys.data(), 3);
+  for (size_t i = 0; i < indices.size(); i++) CHECK_EQ(keys[i], points[indices[i]].y);
+}
+
+TEST(axiskeys, order) {
+  std::vector<float3> points = randomPoints(10000);
+  // duplicated keys keep their original order.
+  for (unsigned int i = 0; i < 100; i++) points[i * 50].z = 1.5f;
+
+  std::vector<unsigned int> order(points.size()), order1(points.size());
+  for (int axis = 0; axis < 3; axis++) {
+    axisOrder(points.data(), points.size(), axis, order.data(), 4);
+    axisOrder(points.data(), points.size(), axis, order1.data(), 1);
+    CHECK(order == order1);
+
+    std::vector<bool> seen(points.size(), false);
+    for (unsigned int i : order) seen[i] = true;
+    CHECK(std::find(seen.begin(), seen.end(), false) == seen.end());
+
+    for (size_t i = 1; i < order.size(); i++) {
+      float a = axisKey(points[order[i - 1]], axis), b = axisKey(points[order[i]], axis);
+      CHECK(a <= b);
+      if (a == b) CHECK(order[i - 1] < order[i]);
+    }
+  }
+}
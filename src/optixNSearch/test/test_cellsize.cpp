@@ -0,0 +1,204 @@
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
+#include <sutil/vec_math.h>
+
+#include "cellsize.h"
+#include "test.h"
+
+// the walk |calcCRRatio| did before |solveCellSize|: from the initial
+// estimate, grow the cell size by |step| until it fits.
+static CellSizePlan linearWalk(const CellSizeProblem& problem, float initial) {
+  float largest = 2 * std::max(fmaxf(problem.sceneMax - problem.sceneMin), problem.radius);
+  float cellSize = initial;
+  while (true) {
+    CellSizePlan plan = evalCellSize(problem, cellSize);
+    if (plan.fits || cellSize >= largest) return plan;
+    cellSize *= problem.step;
+  }
+}
+
+static CellSizeProblem makeProblem(float3 extent, float radius, float spaceAvail) {
+  CellSizeProblem problem;
+  problem.sceneMin = make_float3(0, 0, 0);
+  problem.sceneMax = extent;
+  problem.mcScale = 4;
+  problem.metaGridWaste = -1;
+  problem.radius = radius;
+  problem.spaceAvail = spaceAvail;
+  problem.gasSize = 0;
+  problem.oneBatch = false;
+  problem.cellArrayCount = 3;
+  problem.step = 1.01f;
+  problem.occupied = 0;
+  return problem;
+}
+
+// the same cell size as the walk, or a smaller one that fits; the candidates
+// are computed rather than multiplied up, so they may differ in the last bits.
+static bool sameOrBetter(const CellSizePlan& solved, const CellSizePlan& walked) {
+  if (!walked.fits) return !solved.fits;
+  return solved.fits && solved.cellSize <= walked.cellSize * 1.0001f;
+}
+
+TEST(cellsize, matchesLinearWalk) {
+  const float3 extents[] = {
+    make_float3(100, 100, 100),
+    make_float3(4000, 60, 8), // a corridor
+    make_float3(500, 300, 0.5f), // nearly flat
+    make_float3(37, 910, 260),
+  };
+  const float wastes[] = {-1, 0.125f, 0.5f};
+  const int mcScales[] = {1, 4};
+  int cases = 0, mismatches = 0;
+  for (const float3& extent : extents)
+    for (int i = 0; i < 60; i++)
+      for (float waste : wastes)
+        for (int mcScale : mcScales)
+          for (float gasSize : {0.f, 4.f * (1 << 20)}) {
+            float space = 1e4f * powf(1.25f, (float)i); // 10KB to 5GB
+            CellSizeProblem problem = makeProblem(extent, 2, space);
+            problem.metaGridWaste = waste;
+            problem.mcScale = mcScale;
+            problem.gasSize = gasSize;
+            float initial = 2 / 8.f; // radius / crRatio
+            CellSizePlan solved = solveCellSize(problem, initial);
+            CellSizePlan walked = linearWalk(problem, initial);
+            cases++;
+            if (!sameOrBetter(solved, walked)) {
+              mismatches++;
+              printf("  extent %g %g %g, space %g, waste %g, mcScale %d, gas %g: solved %g (%d), walked %g (%d)\n",
+                     extent.x, extent.y, extent.z, space, waste, mcScale, gasSize,
+                     solved.cellSize, solved.fits, walked.cellSize, walked.fits);
+            }
+          }
+  CHECK(cases > 0);
+  CHECK_EQ(mismatches, 0);
+}
+
+TEST(cellsize, sparseMatchesLinearWalk) {
+  for (float occupied : {1e4f, 1e6f, 1e8f})
+    for (float space : {1.f * (1 << 20), 64.f * (1 << 20), 1024.f * (1 << 20)}) {
+      CellSizeProblem problem = makeProblem(make_float3(3000, 3000, 200), 1, space);
+      problem.occupied = occupied;
+      CellSizePlan solved = solveCellSize(problem, 1 / 8.f);
+      CellSizePlan walked = linearWalk(problem, 1 / 8.f);
+      CHECK(sameOrBetter(solved, walked));
+    }
+}
+
+// the adaptive meta grids make the bytes non-monotone in the cell size, which
+// is what the walk in |solveCellSize| after the bisection is for: bisecting on
+// |fits| alone would stop at a later candidate than the linear walk.
+TEST(cellsize, paddingIsNotMonotone) {
+  CellSizeProblem problem = makeProblem(make_float3(4000, 60, 8), 2, 0);
+  problem.metaGridWaste = 0.5f;
+  int rises = 0;
+  double last = 0;
+  for (int k = 0; k < 2000; k++) {
+    CellSizePlan plan = evalCellSize(problem, 0.05f * powf(1.01f, (float)k));
+    if (k > 0 && plan.sortBytes > last) rises++;
+    last = plan.sortBytes;
+  }
+  CHECK(rises > 0);
+}
+
+TEST(cellsize, firstCandidateFits) {
+  CellSizeProblem problem = makeProblem(make_float3(10, 10, 10), 2, 1e9f);
+  CellSizePlan plan = solveCellSize(problem, 0.25f);
+  CHECK(plan.fits);
+  CHECK_EQ(plan.cellSize, 0.25f);
+}
+
+TEST(cellsize, nothingFits) {
+  CellSizeProblem problem = makeProblem(make_float3(10, 10, 10), 2, 1);
+  problem.gasSize = 1 << 20;
+  CellSizePlan plan = solveCellSize(problem, 0.25f);
+  CHECK(!plan.fits);
+  CHECK(!linearWalk(problem, 0.25f).fits);
+}
+
+static double paddedCells(uint3 dims, uint3 bits) {
+  auto pad = [](unsigned int dim, unsigned int b) { return (double)(((dim + (1u << b) - 1) >> b) << b); };
+  return pad(dims.x, bits.x) * pad(dims.y, bits.y) * pad(dims.z, bits.z);
+}
+
+// a road corridor: the fixed heuristic makes 2^3 meta grids from the 8-cell
+// side, the adaptive ones stretch along the corridor.
+TEST(cellsize, corridorMetaGrids) {
+  uint3 bits = chooseMetaGridBits(make_uint3(4000, 60, 8), 0.125f);
+  CHECK_EQ(bits.x, 10u);
+  CHECK_EQ(bits.y, 6u);
+  CHECK_EQ(bits.z, 3u);
+
+  GridInfo gridInfo;
+  calcGridInfo(make_float3(0, 0, 0), make_float3(4000, 60, 8), 1, 4, 0, gridInfo, 0.125f);
+  CHECK_EQ(gridInfo.meta_grid_dims.x, 1024u);
+  CHECK_EQ(gridInfo.meta_grid_dims.y, 64u);
+  CHECK_EQ(gridInfo.meta_grid_dims.z, 8u);
+  CHECK_EQ(gridInfo.meta_grid_size, 1024u * 64 * 8);
+  CHECK_EQ(gridInfo.MetaGridDimension.x, 4u);
+  CHECK(metaGridPadding(gridInfo) <= 0.125);
+
+  GridInfo fixed;
+  calcGridInfo(make_float3(0, 0, 0), make_float3(4000, 60, 8), 1, 4, 0, fixed);
+  CHECK_EQ(fixed.meta_grid_dims.x, 2u);
+  CHECK_EQ(fixed.meta_grid_dims.z, 2u);
+}
+
+TEST(cellsize, metaGridEdges) {
+  // no waste: only the powers of 2 that divide each side.
+  uint3 bits = chooseMetaGridBits(make_uint3(4000, 60, 8), 0);
+  CHECK_EQ(bits.x, 5u);
+  CHECK_EQ(bits.y, 2u);
+  CHECK_EQ(bits.z, 3u);
+
+  bits = chooseMetaGridBits(make_uint3(1, 1, 1), 0.125f);
+  CHECK_EQ(bits.x + bits.y + bits.z, 0u);
+  bits = chooseMetaGridBits(make_uint3(0, 5, 0), 0.125f); // an empty axis counts as one cell
+  CHECK_EQ(bits.x, 0u);
+  CHECK_EQ(bits.z, 0u);
+
+  // at most 10 bits per axis, like |MortonCode3|.
+  bits = chooseMetaGridBits(make_uint3(4096, 4096, 4096), 0.125f);
+  CHECK_EQ(bits.x, 10u);
+  CHECK_EQ(bits.y, 10u);
+  CHECK_EQ(bits.z, 10u);
+}
+
+// the padding stays within the cap, and no meta grid with more cells would.
+TEST(cellsize, metaGridPaddingCap) {
+  std::vector<uint3> dims = {
+    make_uint3(4000, 60, 8), make_uint3(100, 100, 100), make_uint3(1025, 3, 513),
+    make_uint3(17, 17, 17), make_uint3(2000, 2000, 1), make_uint3(999, 1, 64),
+  };
+  unsigned int seed = 12345; // a fixed LCG, so that the dims are the same everywhere
+  for (int i = 0; i < 200; i++) {
+    unsigned int d[3];
+    for (unsigned int& v : d) { seed = seed * 1664525u + 1013904223u; v = 1 + (seed >> 8) % 3000; }
+    dims.push_back(make_uint3(d[0], d[1], d[2]));
+  }
+
+  for (float waste : {0.f, 0.05f, 0.125f, 0.5f}) {
+    for (const uint3& dim : dims) {
+      uint3 bits = chooseMetaGridBits(dim, waste);
+      double cells = (double)dim.x * dim.y * dim.z;
+      CHECK(bits.x <= 10 && bits.y <= 10 && bits.z <= 10);
+      // a meta grid never spans more than twice an axis.
+      CHECK((1u << bits.x) < 2 * dim.x || bits.x == 0);
+      CHECK((1u << bits.y) < 2 * dim.y || bits.y == 0);
+      CHECK((1u << bits.z) < 2 * dim.z || bits.z == 0);
+      CHECK(paddedCells(dim, bits) <= cells * (1 + waste));
+
+      unsigned int total = bits.x + bits.y + bits.z;
+      bool larger = false;
+      for (unsigned int bx = 0; bx <= 10; bx++)
+        for (unsigned int by = 0; by <= 10; by++)
+          for (unsigned int bz = 0; bz <= 10; bz++)
+            if (bx + by + bz > total && paddedCells(dim, make_uint3(bx, by, bz)) <= cells * (1 + waste))
+              larger = true;
+      CHECK(!larger);
+    }
+  }
+}
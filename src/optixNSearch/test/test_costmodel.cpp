@@ -0,0 +1,136 @@
+#include <cmath>
+#include <cstdio>
+#include <string>
+#include <vector>
+
+#include "costmodel.h"
+#include "test.h"
+
+// test/data/sample.profile is a synthetic recording in the format --calibrate
+// writes: its samples are lines with a few percent of noise, and its
+// coefficients are the fit of those samples.
+static std::string sampleProfile() {
+  return std::string(RTNN_TEST_DATA_DIR) + "/sample.profile";
+}
+
+static bool close(double a, double b, double rel) {
+  return std::fabs(a - b) <= rel * std::fabs(b);
+}
+
+// the extra times of |autoBatchingRange| (sort.cpp) for a recorded histogram
+// of queries per batch.
+static int replayRangeBatching(const CostModel& model, const std::vector<unsigned int>& rayHist,
+                               unsigned int numPoints, unsigned int knn) {
+  std::vector<float> extraTime(rayHist.size(), 0);
+  for (int i = (int)rayHist.size() - 2; i >= 0; i--)
+    extraTime[i] = rayHist[i] * (model.sphereTestPerIS - model.aabbTestPerIS) * knn;
+  return chooseBatchSplit(extraTime, gasBuildTime(model, numPoints));
+}
+
+TEST(costmodel, fitLine) {
+  std::vector<CostSample> samples = {{1, 5}, {2, 7}, {4, 11}};
+  double slope, intercept;
+  CHECK(fitLine(samples, slope, intercept));
+  CHECK_NEAR(slope, 2, 1e-12);
+  CHECK_NEAR(intercept, 3, 1e-12);
+
+  // fewer than 2 distinct x
+  std::vector<CostSample> one = {{1, 5}};
+  std::vector<CostSample> same = {{3, 5}, {3, 6}};
+  CHECK(!fitLine(one, slope, intercept));
+  CHECK(!fitLine(same, slope, intercept));
+}
+
+TEST(costmodel, unfittableKeepsDefaults) {
+  CostRecord record;
+  record.buildGas = {{1e6, 30}, {2e6, 20}}; // negative slope
+  record.aabbTest = {{1e6, 1}}; // too few
+  CostModel model = fitCostModel(record);
+  CostModel defaults;
+  CHECK_EQ(model.buildGasPerAABB, defaults.buildGasPerAABB);
+  CHECK_EQ(model.buildGasIntercept, defaults.buildGasIntercept);
+  CHECK_EQ(model.aabbTestPerIS, defaults.aabbTestPerIS);
+  CHECK_EQ(model.sphereTestPerIS, defaults.sphereTestPerIS);
+}
+
+TEST(costmodel, refitRecordedProfile) {
+  CostModel stored;
+  CostRecord record;
+  CHECK(loadCostProfile(sampleProfile(), stored, &record));
+  CHECK_EQ(stored.device, std::string("Sample GPU"));
+  CHECK_EQ(record.buildGas.size(), (size_t)6);
+  CHECK_EQ(record.aabbTest.size(), (size_t)5);
+  CHECK_EQ(record.sphereTest.size(), (size_t)5);
+  CHECK_EQ(record.knnSearch.size(), (size_t)5);
+
+  // refitting the recorded samples gives back the coefficients in the profile.
+  CostModel refit = fitCostModel(record);
+  CHECK_EQ(refit.device, stored.device);
+  CHECK(close(refit.buildGasPerAABB, stored.buildGasPerAABB, 1e-5));
+  CHECK(close(refit.buildGasIntercept, stored.buildGasIntercept, 1e-5));
+  CHECK(close(refit.aabbTestPerIS, stored.aabbTestPerIS, 1e-5));
+  CHECK(close(refit.sphereTestPerIS, stored.sphereTestPerIS, 1e-5));
+  CHECK(close(refit.knnSearchPerIS, stored.knnSearchPerIS, 1e-5));
+}
+
+TEST(costmodel, saveLoadRoundTrip) {
+  CostModel stored;
+  CostRecord record;
+  CHECK(loadCostProfile(sampleProfile(), stored, &record));
+
+  std::string path = std::string(RTNN_TEST_TMP_DIR) + "/" + costProfileName(stored.device);
+  CHECK(saveCostProfile(path, stored, record));
+  CostModel loaded;
+  CostRecord reloaded;
+  CHECK(loadCostProfile(path, loaded, &reloaded));
+  remove(path.c_str());
+
+  CHECK_EQ(loaded.device, stored.device);
+  CHECK(close(loaded.buildGasPerAABB, stored.buildGasPerAABB, 1e-7));
+  CHECK(close(loaded.knnSearchPerIS, stored.knnSearchPerIS, 1e-7));
+  CHECK_EQ(reloaded.buildGas.size(), record.buildGas.size());
+  CHECK_EQ(reloaded.sphereTest.back().ms, record.sphereTest.back().ms);
+}
+
+TEST(costmodel, rejectsOtherVersions) {
+  std::string path = std::string(RTNN_TEST_TMP_DIR) + "/rtnn-version.profile";
+  FILE* f = fopen(path.c_str(), "w");
+  fprintf(f, "version 999\nbuildGasPerAABB 1\n");
+  fclose(f);
+
+  CostModel model;
+  model.buildGasPerAABB = 42;
+  CHECK(!loadCostProfile(path, model));
+  CHECK_EQ(model.buildGasPerAABB, 42.f);
+  remove(path.c_str());
+}
+
+TEST(costmodel, profileName) {
+  CHECK_EQ(costProfileName("GeForce RTX 3090"), std::string("rtnn-GeForce_RTX_3090.profile"));
+}
+
+TEST(costmodel, chooseBatchSplit) {
+  // nothing to merge with one batch.
+  CHECK_EQ(chooseBatchSplit(std::vector<float>(1, 0), 10), 0);
+  // merging is worth it only while the extra time stays below the builds saved.
+  CHECK_EQ(chooseBatchSplit({100, 1, 1, 0}, 10), 1);
+  CHECK_EQ(chooseBatchSplit({100, 100, 100, 0}, 10), 3);
+  // the split is the cheapest point, not the first one that stops paying off.
+  CHECK_EQ(chooseBatchSplit({15, 1, 1, 0}, 10), 1);
+  CHECK_EQ(chooseBatchSplit({8, 1, 1, 0}, 10), 0);
+}
+
+// the recorded GPU builds GASes faster than the default model assumes, so it
+// merges fewer batches into the last one.
+TEST(costmodel, replayRecordedProfile) {
+  CostModel stored;
+  CHECK(loadCostProfile(sampleProfile(), stored));
+  std::vector<unsigned int> rayHist = {2000000, 300000, 50000, 20000, 10000};
+
+  CHECK_EQ(replayRangeBatching(stored, rayHist, 2000000, 50), 2);
+  CHECK_EQ(replayRangeBatching(CostModel(), rayHist, 2000000, 50), 1);
+
+  CostRecord record;
+  CHECK(loadCostProfile(sampleProfile(), stored, &record));
+  CHECK_EQ(replayRangeBatching(fitCostModel(record), rayHist, 2000000, 50), 2);
+}
@@ -0,0 +1,66 @@
+#include <climits>
+#include <vector>
+
+#include "csr.h"
+#include "test.h"
+
+static const unsigned int X = UINT_MAX;
+
+TEST(csr, countRowNeighbors) {
+  unsigned int full[] = {3, 1, 4};
+  unsigned int padded[] = {3, 1, X, X};
+  unsigned int empty[] = {X, X};
+  CHECK_EQ(countRowNeighbors(full, 3), 3u);
+  CHECK_EQ(countRowNeighbors(padded, 4), 2u);
+  CHECK_EQ(countRowNeighbors(empty, 2), 0u);
+}
+
+TEST(csr, denseToCSR) {
+  const unsigned int numQueries = 4, limit = 3;
+  unsigned int dense[numQueries * limit] = {
+    5, 2, X,
+    X, X, X,
+    0, 1, 7,
+    4, X, X,
+  };
+  unsigned int offsets[numQueries + 1];
+  unsigned int* indices = denseToCSR(dense, numQueries, limit, offsets);
+
+  unsigned int expOffsets[] = {0, 2, 2, 5, 6};
+  unsigned int expIndices[] = {5, 2, 0, 1, 7, 4};
+  for (unsigned int q = 0; q <= numQueries; q++) CHECK_EQ(offsets[q], expOffsets[q]);
+  for (unsigned int i = 0; i < 6; i++) CHECK_EQ(indices[i], expIndices[i]);
+  CHECK(validateCSR(offsets, indices, numQueries, limit, 8));
+  delete[] indices;
+}
+
+TEST(csr, denseToCSREmpty) {
+  unsigned int dense[] = {X, X, X, X};
+  unsigned int offsets[3];
+  unsigned int* indices = denseToCSR(dense, 2, 2, offsets);
+  CHECK_EQ(offsets[0], 0u);
+  CHECK_EQ(offsets[2], 0u);
+  CHECK(validateCSR(offsets, indices, 2, 2, 1));
+  delete[] indices;
+}
+
+TEST(csr, validateCSRRejects) {
+  unsigned int indices[] = {1, 2, 2, 9};
+  unsigned int distinct[] = {1, 2, 3, 9};
+
+  unsigned int badStart[] = {1, 2, 4};
+  CHECK(!validateCSR(badStart, indices, 2, 4, 10));
+
+  unsigned int decreasing[] = {0, 3, 2};
+  CHECK(!validateCSR(decreasing, distinct, 2, 4, 10));
+
+  unsigned int tooMany[] = {0, 4, 4};
+  CHECK(!validateCSR(tooMany, indices, 2, 3, 10));
+
+  unsigned int duplicate[] = {0, 1, 3}; // row 1 lists 2 twice
+  CHECK(!validateCSR(duplicate, indices, 2, 4, 10));
+
+  unsigned int outOfRange[] = {0, 1, 4}; // 9 >= 5 points
+  CHECK(!validateCSR(outOfRange, distinct, 2, 4, 5));
+  CHECK(validateCSR(outOfRange, distinct, 2, 4, 10));
+}
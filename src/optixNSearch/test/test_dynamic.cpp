@@ -0,0 +1,75 @@
+#include <cmath>
+#include <random>
+#include <vector>
+
+#include <sutil/vec_math.h>
+
+#include "dynamic.h"
+#include "test.h"
+
+TEST(dynamic, driftThreshold) {
+  RefitSchedule schedule;
+  // exactly at maxDrift * radius still refits; past it rebuilds.
+  CHECK_EQ(planFrame(schedule, 0.5f, 2.f, 0.25f, 32), FRAME_REFIT);
+  CHECK_EQ(planFrame(schedule, nextafterf(0.5f, 1.f), 2.f, 0.25f, 32), FRAME_REBUILD);
+  CHECK_EQ(planFrame(schedule, 0.f, 2.f, 0.25f, 32), FRAME_REFIT);
+  // no drift allowed: only a frame that didn't move refits.
+  CHECK_EQ(planFrame(schedule, 0.f, 2.f, 0.f, 32), FRAME_REFIT);
+  CHECK_EQ(planFrame(schedule, 1e-6f, 2.f, 0.f, 32), FRAME_REBUILD);
+}
+
+TEST(dynamic, maxRefits) {
+  RefitSchedule schedule;
+  const unsigned int maxRefits = 3;
+  for (unsigned int i = 0; i < maxRefits; i++) {
+    FrameAction action = planFrame(schedule, 0.f, 1.f, 0.25f, maxRefits);
+    CHECK_EQ(action, FRAME_REFIT);
+    recordFrame(schedule, action);
+  }
+  CHECK_EQ(schedule.refits, maxRefits);
+  CHECK_EQ(planFrame(schedule, 0.f, 1.f, 0.25f, maxRefits), FRAME_REBUILD);
+
+  // no refits at all.
+  RefitSchedule fresh;
+  CHECK_EQ(planFrame(fresh, 0.f, 1.f, 0.25f, 0), FRAME_REBUILD);
+}
+
+TEST(dynamic, recordFrame) {
+  RefitSchedule schedule;
+  recordFrame(schedule, FRAME_REFIT);
+  recordFrame(schedule, FRAME_REFIT);
+  CHECK_EQ(schedule.refits, 2u);
+  CHECK_EQ(schedule.rebuilds, 0u);
+
+  recordFrame(schedule, FRAME_REBUILD);
+  CHECK_EQ(schedule.refits, 0u);
+  CHECK_EQ(schedule.rebuilds, 1u);
+
+  // the cap counts refits since the last rebuild only.
+  recordFrame(schedule, FRAME_REFIT);
+  CHECK_EQ(schedule.refits, 1u);
+  CHECK_EQ(planFrame(schedule, 0.f, 1.f, 0.25f, 2), FRAME_REFIT);
+  recordFrame(schedule, FRAME_REBUILD);
+  CHECK_EQ(schedule.rebuilds, 2u);
+}
+
+TEST(dynamic, maxDisplacement) {
+  std::mt19937 rng(9);
+  std::uniform_real_distribution<float> coord(-10, 10), jitter(-0.1f, 0.1f);
+  const unsigned int N = 100003;
+  std::vector<float3> from(N), to(N);
+  for (unsigned int i = 0; i < N; i++) {
+    from[i] = make_float3(coord(rng), coord(rng), coord(rng));
+    to[i] = from[i] + make_float3(jitter(rng), jitter(rng), jitter(rng));
+  }
+  // one point moves the farthest.
+  to[77777] = from[77777] + make_float3(0, 3, 4);
+
+  float expected = maxDisplacement(from.data(), to.data(), N, 1);
+  CHECK_NEAR(expected, 5.f, 1e-5f);
+  for (unsigned int numThreads : {2u, 3u, 8u, 0u})
+    CHECK_EQ(maxDisplacement(from.data(), to.data(), N, numThreads), expected);
+
+  CHECK_EQ(maxDisplacement(from.data(), from.data(), N, 4), 0.f);
+  CHECK_EQ(maxDisplacement(from.data(), to.data(), 0, 4), 0.f);
+}
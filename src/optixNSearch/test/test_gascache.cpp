@@ -0,0 +1,187 @@
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <random>
+#include <string>
+#include <vector>
+
+#include <stdlib.h>
+#include <unistd.h>
+
+#include <sutil/vec_math.h>
+
+#include "gascache.h"
+#include "test.h"
+
+// a fresh directory for the cache files of one test.
+static std::string makeCacheDir() {
+  std::string tmpl = std::string(RTNN_TEST_TMP_DIR) + "/rtnn-gascache-XXXXXX";
+  std::vector<char> path(tmpl.begin(), tmpl.end());
+  path.push_back('\0');
+  return mkdtemp(path.data()) ? std::string(path.data()) : std::string();
+}
+
+static GasCacheKey sampleKey() {
+  GasCacheKey key;
+  key.pointsHash = 0x0123456789abcdefull;
+  key.numPoints = 100000;
+  key.radius = 2.5f;
+  key.optixVersion = 70300;
+  key.driverVersion = 11040;
+  return key;
+}
+
+TEST(gascache, hashPoints) {
+  std::mt19937 rng(13);
+  std::uniform_real_distribution<float> coord(-100, 100);
+  // a few hash chunks, the last one partial.
+  std::vector<float3> points(200001);
+  for (float3& p : points) p = make_float3(coord(rng), coord(rng), coord(rng));
+
+  uint64_t hash = hashPoints(points.data(), points.size(), 1);
+  for (unsigned int numThreads : {2u, 5u, 16u, 0u})
+    CHECK_EQ(hashPoints(points.data(), points.size(), numThreads), hash);
+
+  // a one-bit edit anywhere changes it.
+  for (size_t i : {(size_t)0, (size_t)65536, points.size() - 1}) {
+    std::vector<float3> edited(points);
+    uint32_t bits;
+    memcpy(&bits, &edited[i].y, sizeof(bits));
+    bits ^= 1;
+    memcpy(&edited[i].y, &bits, sizeof(bits));
+    CHECK(hashPoints(edited.data(), edited.size(), 4) != hash);
+  }
+
+  // so do the order and the count.
+  std::vector<float3> swapped(points);
+  std::swap(swapped[10], swapped[11]);
+  CHECK(hashPoints(swapped.data(), swapped.size(), 4) != hash);
+  CHECK(hashPoints(points.data(), points.size() - 1, 4) != hash);
+}
+
+TEST(gascache, names) {
+  GasCacheKey key = sampleKey();
+  std::string name = gasCacheName(key);
+  CHECK_EQ(name, gasCacheName(sampleKey()));
+
+  std::vector<GasCacheKey> variants(5, key);
+  variants[0].pointsHash ^= 1ull << 63;
+  variants[1].numPoints++;
+  variants[2].radius = nextafterf(key.radius, 3.f);
+  variants[3].optixVersion++;
+  variants[4].driverVersion = -1;
+  for (size_t i = 0; i < variants.size(); i++) {
+    CHECK(gasCacheName(variants[i]) != name);
+    for (size_t j = 0; j < i; j++) CHECK(gasCacheName(variants[i]) != gasCacheName(variants[j]));
+  }
+}
+
+TEST(gascache, indexRoundTrip) {
+  std::string dir = makeCacheDir();
+  CHECK(!dir.empty());
+
+  GasCacheIndex index;
+  loadGasCacheIndex(index, dir); // no index yet
+  CHECK(index.entries.empty());
+  touchGasCacheEntry(index, "a.gas", 100, 10);
+  touchGasCacheEntry(index, "b.gas", 200, 20);
+  touchGasCacheEntry(index, "a.gas", 150, 30); // refreshes, doesn't add
+  CHECK_EQ(index.entries.size(), (size_t)2);
+  CHECK(saveGasCacheIndex(index));
+
+  GasCacheIndex loaded;
+  loadGasCacheIndex(loaded, dir);
+  CHECK_EQ(loaded.dir, dir);
+  CHECK_EQ(loaded.entries.size(), (size_t)2);
+  GasCacheEntry* a = findGasCacheEntry(loaded, "a.gas");
+  GasCacheEntry* b = findGasCacheEntry(loaded, "b.gas");
+  CHECK(a && b);
+  if (a && b) {
+    CHECK_EQ(a->size, 150ull);
+    CHECK_EQ(a->lastUse, 30ll);
+    CHECK_EQ(b->size, 200ull);
+    CHECK_EQ(b->lastUse, 20ll);
+  }
+  CHECK(!findGasCacheEntry(loaded, "c.gas"));
+
+  removeGasCacheEntry(loaded, "a.gas");
+  CHECK(!findGasCacheEntry(loaded, "a.gas"));
+
+  unlink((dir + "/" + RTNN_GAS_INDEX).c_str());
+  rmdir(dir.c_str());
+}
+
+TEST(gascache, eviction) {
+  GasCacheIndex index;
+  touchGasCacheEntry(index, "new.gas", 100, 40);
+  touchGasCacheEntry(index, "old.gas", 100, 10);
+  touchGasCacheEntry(index, "mid.gas", 100, 20);
+  touchGasCacheEntry(index, "kept.gas", 100, 5); // the oldest, but just added
+
+  // within the limit: nothing goes.
+  CHECK(evictGasCacheEntries(index, 400, "kept.gas").empty());
+
+  std::vector<std::string> victims = evictGasCacheEntries(index, 200, "kept.gas");
+  CHECK_EQ(victims.size(), (size_t)2);
+  if (victims.size() == 2) {
+    CHECK_EQ(victims[0], std::string("old.gas"));
+    CHECK_EQ(victims[1], std::string("mid.gas"));
+  }
+  CHECK(findGasCacheEntry(index, "kept.gas"));
+  CHECK(findGasCacheEntry(index, "new.gas"));
+  CHECK_EQ(index.entries.size(), (size_t)2);
+
+  // |keep| stays even if it alone is over the limit.
+  victims = evictGasCacheEntries(index, 0, "kept.gas");
+  CHECK_EQ(victims.size(), (size_t)1);
+  CHECK_EQ(index.entries.size(), (size_t)1);
+  CHECK(findGasCacheEntry(index, "kept.gas"));
+}
+
+TEST(gascache, gasFiles) {
+  std::string dir = makeCacheDir();
+  CHECK(!dir.empty());
+  GasCacheKey key = sampleKey();
+  std::string path = dir + "/" + gasCacheName(key);
+
+  std::vector<char> gas(1000);
+  for (size_t i = 0; i < gas.size(); i++) gas[i] = (char)(i * 7);
+  GasFileHeader header;
+  memset(&header, 0, sizeof(header));
+  memcpy(header.magic, RTNN_GAS_MAGIC, sizeof(header.magic));
+  header.version = RTNN_GAS_VERSION;
+  header.key = key;
+  header.relocInfo[0] = 42;
+  header.gasSize = gas.size();
+  CHECK(writeGasFile(path, header, gas.data()));
+
+  GasFileHeader readHeader;
+  std::vector<char> readGas;
+  CHECK(readGasFile(path, key, readHeader, readGas));
+  CHECK(readGas == gas);
+  CHECK_EQ(readHeader.relocInfo[0], 42ull);
+
+  // another key misses.
+  GasCacheKey other = key;
+  other.radius = 3.f;
+  CHECK(!readGasFile(path, other, readHeader, readGas));
+
+  // so does a file with another magic or version.
+  GasFileHeader bad = header;
+  bad.magic[0] = 'X';
+  CHECK(writeGasFile(path, bad, gas.data()));
+  CHECK(!readGasFile(path, key, readHeader, readGas));
+  bad = header;
+  bad.version = RTNN_GAS_VERSION + 1;
+  CHECK(writeGasFile(path, bad, gas.data()));
+  CHECK(!readGasFile(path, key, readHeader, readGas));
+
+  // a truncated payload, and no file at all.
+  CHECK(writeGasFile(path, header, gas.data()));
+  CHECK_EQ(truncate(path.c_str(), sizeof(header) + gas.size() / 2), 0);
+  CHECK(!readGasFile(path, key, readHeader, readGas));
+  unlink(path.c_str());
+  CHECK(!readGasFile(path, key, readHeader, readGas));
+
+  rmdir(dir.c_str());
+}
@@ -0,0 +1,91 @@
+#include <cstdlib>
+#include <random>
+#include <vector>
+
+#include <sutil/vec_math.h>
+
+#include "grid.h"
+#include "test.h"
+
+// the codes of a 2^bits cube are exactly [0, 8^bits), and decode back.
+TEST(hilbert, bijection) {
+  for (unsigned int bits = 0; bits <= 6; bits++) {
+    unsigned int side = 1u << bits;
+    std::vector<bool> seen((size_t)side * side * side, false);
+    unsigned int duplicates = 0, outOfRange = 0;
+    for (unsigned int x = 0; x < side; x++)
+      for (unsigned int y = 0; y < side; y++)
+        for (unsigned int z = 0; z < side; z++) {
+          unsigned int code = HilbertCode3(x, y, z, bits);
+          if (code >= seen.size()) { outOfRange++; continue; }
+          if (seen[code]) duplicates++;
+          seen[code] = true;
+        }
+    CHECK_EQ(outOfRange, 0u);
+    CHECK_EQ(duplicates, 0u);
+  }
+}
+
+// consecutive codes are adjacent cells, the property morton codes lack.
+TEST(hilbert, adjacency) {
+  for (unsigned int bits = 1; bits <= 6; bits++) {
+    unsigned int numCodes = 1u << (3 * bits);
+    uint3 prev = HilbertCodeToIndex3(0, bits);
+    CHECK_EQ(prev.x + prev.y + prev.z, 0u); // the curve starts at the origin
+    unsigned int jumps = 0;
+    for (unsigned int code = 1; code < numCodes; code++) {
+      uint3 cell = HilbertCodeToIndex3(code, bits);
+      int steps = std::abs((int)cell.x - (int)prev.x) + std::abs((int)cell.y - (int)prev.y) + std::abs((int)cell.z - (int)prev.z);
+      if (steps != 1) jumps++;
+      prev = cell;
+    }
+    CHECK_EQ(jumps, 0u);
+  }
+}
+
+TEST(hilbert, roundTrip) {
+  std::mt19937 rng(3);
+  for (unsigned int bits = 1; bits <= 10; bits++) {
+    unsigned int mask = (1u << bits) - 1;
+    for (int i = 0; i < 2000; i++) {
+      uint3 cell = make_uint3(rng() & mask, rng() & mask, rng() & mask);
+      unsigned int code = HilbertCode3(cell.x, cell.y, cell.z, bits);
+      CHECK(bits == 10 || code < (1u << (3 * bits)));
+      uint3 decoded = HilbertCodeToIndex3(code, bits);
+      CHECK_EQ(decoded.x, cell.x);
+      CHECK_EQ(decoded.y, cell.y);
+      CHECK_EQ(decoded.z, cell.z);
+    }
+  }
+  CHECK_EQ(HilbertCode3(0, 0, 0, 0), 0u);
+}
+
+TEST(hilbert, bits) {
+  CHECK_EQ(HilbertBits(0), 0u);
+  CHECK_EQ(HilbertBits(1), 0u);
+  CHECK_EQ(HilbertBits(2), 1u);
+  CHECK_EQ(HilbertBits(5), 3u);
+  CHECK_EQ(HilbertBits(1024), 10u);
+}
+
+// a non-cubic meta grid is split into Hilbert cubes; its cell indices are
+// still a bijection onto [0, meta_grid_size).
+TEST(hilbert, boxMetaGrid) {
+  GridInfo gridInfo;
+  gridInfo.meta_grid_bits = make_uint3(4, 2, 3);
+  gridInfo.meta_grid_dims = make_uint3(16, 4, 8);
+  gridInfo.meta_grid_size = 16 * 4 * 8;
+  gridInfo.MetaGridDimension = make_uint3(1, 1, 1);
+  std::vector<bool> seen(gridInfo.meta_grid_size, false);
+  unsigned int duplicates = 0, outOfRange = 0;
+  for (int x = 0; x < 16; x++)
+    for (int y = 0; y < 4; y++)
+      for (int z = 0; z < 8; z++) {
+        unsigned int index = ToCellIndex_HilbertMetaGrid(gridInfo, make_int3(x, y, z));
+        if (index >= seen.size()) { outOfRange++; continue; }
+        if (seen[index]) duplicates++;
+        seen[index] = true;
+      }
+  CHECK_EQ(outOfRange, 0u);
+  CHECK_EQ(duplicates, 0u);
+}
@@ -0,0 +1,205 @@
+#include <algorithm>
+#include <random>
+#include <vector>
+
+#include <sutil/vec_math.h>
+
+#include "accuracy.h"
+#include "cellsize.h"
+#include "hostgrid.h"
+#include "test.h"
+
+TEST(hostgrid, cellSlotDense) {
+  CellTable table = {nullptr, 64};
+  CHECK_EQ(cellSlot(table, 0), 0u);
+  CHECK_EQ(cellSlot(table, 17), 17u);
+  CHECK_EQ(cellSlot(table, 63), 63u);
+}
+
+TEST(hostgrid, cellSlotSparse) {
+  const unsigned int keys[] = {3, 7, 8, 20, NO_CELL - 1};
+  CellTable table = {keys, 5};
+  // hits are the position in |keys|.
+  for (unsigned int i = 0; i < 5; i++) CHECK_EQ(cellSlot(table, keys[i]), i);
+  // misses before, between, and after the keys.
+  for (unsigned int cell : {0u, 2u, 4u, 9u, 19u, 21u, NO_CELL - 2})
+    CHECK_EQ(cellSlot(table, cell), NO_CELL);
+
+  CellTable one = {keys + 2, 1};
+  CHECK_EQ(cellSlot(one, 8), 0u);
+  CHECK_EQ(cellSlot(one, 7), NO_CELL);
+  CHECK_EQ(cellSlot(one, 20), NO_CELL);
+  CellTable empty = {keys, 0};
+  CHECK_EQ(cellSlot(empty, 3), NO_CELL);
+}
+
+// a few tight clusters in a large, mostly empty box: the case sparse grids are for.
+static std::vector<float3> clusteredScene(unsigned int N, unsigned int seed) {
+  std::mt19937 rng(seed);
+  std::uniform_real_distribution<float> box(0, 200);
+  std::normal_distribution<float> spread(0, 1.5f);
+  std::vector<float3> centers(6);
+  for (float3& c : centers) c = make_float3(box(rng), box(rng), box(rng) * 0.25f);
+  std::vector<float3> points(N);
+  for (unsigned int i = 0; i < N; i++) {
+    const float3& c = centers[i % centers.size()];
+    points[i] = make_float3(c.x + spread(rng), c.y + spread(rng), c.z + spread(rng));
+  }
+  return points;
+}
+
+struct GridPair
+{
+  HostGrid dense;
+  HostGrid sparse;
+};
+
+// a dense and a sparse grid over the same |GridInfo| (see accuracy.cpp).
+static void buildGrids(GridPair& grids, const std::vector<float3>& points, float radius, unsigned int knn, CellOrder order) {
+  float3 sceneMin = points[0], sceneMax = points[0];
+  for (const float3& p : points) { sceneMin = fminf(sceneMin, p); sceneMax = fmaxf(sceneMax, p); }
+  float cellSize = hostCellSize(sceneMin, sceneMax, radius, knn, points.size(), false);
+  GridInfo gridInfo;
+  unsigned int numberOfCells = calcGridInfo(sceneMin, sceneMax, cellSize, 1, points.size(), gridInfo);
+  gridInfo.GridDimension.x = gridInfo.MetaGridDimension.x * gridInfo.meta_grid_dims.x;
+  gridInfo.GridDimension.y = gridInfo.MetaGridDimension.y * gridInfo.meta_grid_dims.y;
+  gridInfo.GridDimension.z = gridInfo.MetaGridDimension.z * gridInfo.meta_grid_dims.z;
+  buildHostGrid(grids.dense, points.data(), points.size(), gridInfo, numberOfCells, order, 4, false);
+  buildHostGrid(grids.sparse, points.data(), points.size(), gridInfo, numberOfCells, order, 4, true);
+}
+
+TEST(hostgrid, sparseLayout) {
+  std::vector<float3> points = clusteredScene(20000, 1);
+  for (CellOrder order : {RASTER_ORDER, MORTON_ORDER, HILBERT_ORDER}) {
+    GridPair grids;
+    buildGrids(grids, points, 1.f, 0, order);
+    const HostGrid& dense = grids.dense;
+    const HostGrid& sparse = grids.sparse;
+    CHECK(sparse.numberOfCells < dense.numberOfCells);
+    CHECK(std::is_sorted(sparse.cellKeys.begin(), sparse.cellKeys.end()));
+
+    // every occupied cell has a slot with the same particles; every empty one misses.
+    CellTable table = hostCellTable(sparse);
+    unsigned int occupied = 0;
+    for (unsigned int c = 0; c < dense.numberOfCells; c++) {
+      unsigned int slot = cellSlot(table, c);
+      unsigned int count = dense.cellParticleCounts[c];
+      if (count == 0) {
+        CHECK_EQ(slot, NO_CELL);
+        continue;
+      }
+      occupied++;
+      CHECK(slot != NO_CELL);
+      if (slot == NO_CELL) continue;
+      CHECK_EQ(sparse.cellParticleCounts[slot], count);
+      for (unsigned int i = 0; i < count; i++)
+        CHECK_EQ(sparse.sortedIndices[sparse.cellOffsets[slot] + i], dense.sortedIndices[dense.cellOffsets[c] + i]);
+    }
+    CHECK_EQ(occupied, sparse.numberOfCells);
+    // the sparse points are in the same cell order.
+    CHECK(sparse.sortedIndices == dense.sortedIndices);
+  }
+}
+
+TEST(hostgrid, searchesAgree) {
+  std::vector<float3> points = clusteredScene(20000, 2);
+  std::vector<float3> queries = clusteredScene(2000, 3); // other clusters: some queries are far from any point
+  for (unsigned int i = 0; i < 500; i++) queries.push_back(points[i * 37]);
+
+  const float radius = 2.f;
+  const unsigned int k = 16;
+  for (CellOrder order : {MORTON_ORDER, HILBERT_ORDER}) {
+    GridPair grids;
+    buildGrids(grids, points, radius, k, order);
+
+    std::vector<unsigned int> denseRes(points.size()), sparseRes(points.size());
+    std::vector<float> denseDists(k), sparseDists(k);
+    unsigned int found = 0;
+    for (const float3& q : queries) {
+      unsigned int nd = hostRadiusSearch(grids.dense, q, radius, points.size(), denseRes.data());
+      unsigned int ns = hostRadiusSearch(grids.sparse, q, radius, points.size(), sparseRes.data());
+      CHECK_EQ(ns, nd);
+      if (ns != nd) continue;
+      found += nd;
+      std::sort(denseRes.begin(), denseRes.begin() + nd);
+      std::sort(sparseRes.begin(), sparseRes.begin() + ns);
+      CHECK(std::equal(denseRes.begin(), denseRes.begin() + nd, sparseRes.begin()));
+
+      nd = hostKnnSearch(grids.dense, q, radius, k, denseRes.data(), denseDists.data());
+      ns = hostKnnSearch(grids.sparse, q, radius, k, sparseRes.data(), sparseDists.data());
+      CHECK_EQ(ns, nd);
+      if (ns != nd) continue;
+      CHECK(std::equal(denseRes.begin(), denseRes.begin() + nd, sparseRes.begin()));
+      CHECK(std::equal(denseDists.begin(), denseDists.begin() + nd, sparseDists.begin()));
+    }
+    CHECK(found > 0);
+
+    // a truncated radius search visits the cells in the same order.
+    for (unsigned int i = 0; i < 500; i++) {
+      unsigned int nd = hostRadiusSearch(grids.dense, queries[i], radius, 5, denseRes.data());
+      unsigned int ns = hostRadiusSearch(grids.sparse, queries[i], radius, 5, sparseRes.data());
+      CHECK_EQ(ns, nd);
+      CHECK(std::equal(denseRes.begin(), denseRes.begin() + std::min(nd, ns), sparseRes.begin()));
+    }
+  }
+}
+
+// the KNN results are the brute-force ones.
+TEST(hostgrid, knnMatchesBruteForce) {
+  std::vector<float3> points = clusteredScene(3000, 4);
+  const float radius = 3.f;
+  const unsigned int k = 8;
+  GridPair grids;
+  buildGrids(grids, points, radius, k, MORTON_ORDER);
+
+  std::vector<unsigned int> res(k);
+  std::vector<float> dists(k), expected;
+  for (unsigned int qi = 0; qi < points.size(); qi += 7) {
+    const float3& q = points[qi];
+    expected.clear();
+    for (const float3& p : points) {
+      float3 O = q - p;
+      float sqdist = dot(O, O);
+      if (sqdist > 0 && sqdist < radius * radius) expected.push_back(sqdist);
+    }
+    std::sort(expected.begin(), expected.end());
+    if (expected.size() > k) expected.resize(k);
+
+    unsigned int n = hostKnnSearch(grids.sparse, q, radius, k, res.data(), dists.data());
+    CHECK_EQ(n, (unsigned int)expected.size());
+    CHECK(std::equal(expected.begin(), expected.begin() + std::min(n, (unsigned int)expected.size()), dists.begin()));
+  }
+}
+
+// the grid the exact checks build finds the same neighbors.
+TEST(hostgrid, sparseHostGrid) {
+  std::vector<float3> points = clusteredScene(5000, 5);
+  float3 sceneMin = points[0], sceneMax = points[0];
+  for (const float3& p : points) { sceneMin = fminf(sceneMin, p); sceneMax = fmaxf(sceneMax, p); }
+  const float radius = 2.f;
+  const unsigned int k = 8;
+  HostGrid grid;
+  buildSparseHostGrid(grid, points.data(), points.size(), sceneMin, sceneMax, radius, k, 4);
+  CHECK(grid.sparse);
+  CHECK_EQ(grid.order, MORTON_ORDER);
+  GridPair grids;
+  buildGrids(grids, points, radius, k, MORTON_ORDER);
+
+  std::vector<unsigned int> res(k), expected(k);
+  std::vector<float> dists(k), expectedDists(k);
+  for (unsigned int qi = 0; qi < points.size(); qi += 11) {
+    unsigned int n = hostKnnSearch(grid, points[qi], radius, k, res.data(), dists.data());
+    unsigned int ne = hostKnnSearch(grids.dense, points[qi], radius, k, expected.data(), expectedDists.data());
+    CHECK_EQ(n, ne);
+    CHECK(std::equal(dists.begin(), dists.begin() + std::min(n, ne), expectedDists.begin()));
+  }
+}
+
+TEST(hostgrid, groundTruthWithoutPoints) {
+  std::vector<float3> queries = clusteredScene(10, 6);
+  KnnGroundTruth gt;
+  knnGroundTruth(nullptr, 0, queries.data(), queries.size(), 1.f, 4, 2, gt);
+  CHECK_EQ(gt.k, 4u);
+  CHECK_EQ(gt.counts.size(), queries.size());
+  for (unsigned int count : gt.counts) CHECK_EQ(count, 0u);
+}
@@ -0,0 +1,101 @@
+#include <algorithm>
+#include <random>
+#include <vector>
+
+#include <sutil/vec_math.h>
+
+#include "cellsize.h"
+#include "morton.h"
+#include "test.h"
+
+// the definition: bit i of x goes to bit 3i.
+static unsigned long long naiveSpread(unsigned int x) {
+  unsigned long long code = 0;
+  for (int i = 0; i < MORTON64_BITS; i++) code |= (unsigned long long)((x >> i) & 1) << (3 * i);
+  return code;
+}
+
+static unsigned long long naiveMorton(uint3 cell) {
+  return (naiveSpread(cell.z) << 2) | (naiveSpread(cell.y) << 1) | naiveSpread(cell.x);
+}
+
+// edge cases first, then random cells that use all 21 bits.
+static std::vector<uint3> testCells() {
+  const unsigned int maxCell = (1u << MORTON64_BITS) - 1;
+  std::vector<uint3> cells = {
+    make_uint3(0, 0, 0), make_uint3(1, 0, 0), make_uint3(0, 1, 0), make_uint3(0, 0, 1),
+    make_uint3(maxCell, 0, 0), make_uint3(0, maxCell, 0), make_uint3(0, 0, maxCell),
+    make_uint3(maxCell, maxCell, maxCell), make_uint3(0x155555, 0x0aaaaa, 0x100001),
+    make_uint3(255, 256, 65535), make_uint3(65536, 1 << 20, 1023),
+  };
+  std::mt19937 rng(7);
+  for (int i = 0; i < 10000; i++) cells.push_back(make_uint3(rng() & maxCell, rng() & maxCell, rng() & maxCell));
+  return cells;
+}
+
+TEST(morton, spreadMatchesNaive) {
+  for (const uint3& cell : testCells()) {
+    CHECK_EQ(Part1By2_64(cell.x), naiveSpread(cell.x));
+    CHECK_EQ(Part1By2_64(cell.y), naiveSpread(cell.y));
+  }
+  // bits past the 21st are dropped.
+  CHECK_EQ(Part1By2_64(0xffffffffull), naiveSpread(0x1fffff));
+  CHECK_EQ(Part1By2_64(1u << MORTON64_BITS), 0ull);
+}
+
+TEST(morton, encodersAgree) {
+  for (const uint3& cell : testCells()) {
+    unsigned long long naive = naiveMorton(cell);
+    CHECK_EQ(MortonCode3_64(cell.x, cell.y, cell.z), naive);
+    CHECK_EQ(mortonCode3_64Table(cell), naive);
+  }
+  const unsigned int maxCell = (1u << MORTON64_BITS) - 1;
+  CHECK_EQ(MortonCode3_64(maxCell, maxCell, maxCell), (1ull << (3 * MORTON64_BITS)) - 1);
+}
+
+TEST(morton, decodeRoundTrip) {
+  for (const uint3& cell : testCells()) {
+    CHECK_EQ(Compact1By2_64(Part1By2_64(cell.x)), cell.x);
+    uint3 decoded = MortonCodeToIndex3_64(MortonCode3_64(cell.x, cell.y, cell.z));
+    CHECK_EQ(decoded.x, cell.x);
+    CHECK_EQ(decoded.y, cell.y);
+    CHECK_EQ(decoded.z, cell.z);
+  }
+}
+
+// the 64-bit codes of cells that fit 10 bits are the 32-bit ones.
+TEST(morton, extends32BitCodes) {
+  for (const uint3& cell : testCells()) {
+    uint3 small = make_uint3(cell.x & 0x3ff, cell.y & 0x3ff, cell.z & 0x3ff);
+    CHECK_EQ(MortonCode3_64(small.x, small.y, small.z), (unsigned long long)MortonCode3(small.x, small.y, small.z));
+  }
+}
+
+TEST(morton, keysAndOrder) {
+  std::mt19937 rng(11);
+  std::uniform_real_distribution<float> coord(-50, 50);
+  std::vector<float3> points(5000);
+  for (float3& p : points) p = make_float3(coord(rng), coord(rng) * 0.1f, coord(rng) * 0.01f);
+  float3 sceneMin = points[0], sceneMax = points[0];
+  for (const float3& p : points) { sceneMin = fminf(sceneMin, p); sceneMax = fmaxf(sceneMax, p); }
+
+  GridInfo gridInfo;
+  calcGridInfo(sceneMin, sceneMax, morton64CellSize(sceneMin, sceneMax), 4, points.size(), gridInfo);
+  CHECK(gridInfo.GridDimension.x <= (1u << MORTON64_BITS));
+
+  // the host keys are the device ones, and don't depend on the thread count.
+  std::vector<unsigned long long> keys(points.size()), keys4(points.size());
+  mortonKeys64(gridInfo, points.data(), points.size(), keys.data(), 1);
+  mortonKeys64(gridInfo, points.data(), points.size(), keys4.data(), 4);
+  for (size_t i = 0; i < points.size(); i++) {
+    CHECK_EQ(keys[i], getMortonKey64(gridInfo, points[i]));
+    CHECK_EQ(keys4[i], keys[i]);
+  }
+
+  std::vector<unsigned int> order(points.size());
+  mortonOrder64(gridInfo, points.data(), points.size(), order.data(), 4);
+  std::vector<unsigned int> sorted(order);
+  std::sort(sorted.begin(), sorted.end());
+  for (size_t i = 0; i < sorted.size(); i++) CHECK_EQ(sorted[i], (unsigned int)i);
+  for (size_t i = 1; i < order.size(); i++) CHECK(keys[order[i - 1]] <= keys[order[i]]);
+}
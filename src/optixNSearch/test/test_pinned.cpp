@@ -0,0 +1,157 @@
+#include <cstdlib>
+#include <set>
+
+#include "pinned.h"
+#include "test.h"
+
+// a host-only shim for cudaMallocHost/cudaFreeHost that tracks what's live.
+struct FakeHost
+{
+  std::set<void*>             live;
+  unsigned int                allocs          = 0;
+  unsigned int                frees           = 0;
+  bool                        fail            = false;
+};
+
+static void attach(PinnedPool& pool, FakeHost& host) {
+  pool.minClass = 64;
+  pool.allocHost = [&host](size_t size) -> void* {
+    if (host.fail) return nullptr;
+    void* ptr = malloc(size);
+    host.live.insert(ptr);
+    host.allocs++;
+    return ptr;
+  };
+  pool.freeHost = [&host](void* ptr) {
+    host.live.erase(ptr);
+    host.frees++;
+    free(ptr);
+  };
+}
+
+TEST(pinned, classes) {
+  PinnedPool pool;
+  pool.minClass = 64;
+  // 4 classes per power of two.
+  size_t sizes[] = {64, 80, 96, 112, 128, 160, 192, 224, 256};
+  for (unsigned int c = 0; c < 9; c++) CHECK_EQ(pinnedClassSize(pool, c), sizes[c]);
+
+  CHECK_EQ(pinnedClass(pool, 0), 0u);
+  CHECK_EQ(pinnedClass(pool, 64), 0u);
+  CHECK_EQ(pinnedClass(pool, 65), 1u);
+  CHECK_EQ(pinnedClass(pool, 128), 4u);
+  CHECK_EQ(pinnedClass(pool, 129), 5u);
+
+  // a class never wastes more than 25% of it.
+  for (size_t bytes = 65; bytes < 100000; bytes += 7) {
+    size_t size = pinnedClassSize(pool, pinnedClass(pool, bytes));
+    CHECK(size >= bytes);
+    CHECK(size - bytes < size / 4 + 1);
+  }
+}
+
+TEST(pinned, hitsAndMisses) {
+  PinnedPool pool;
+  FakeHost host;
+  attach(pool, host);
+
+  void* a = pinnedAcquire(pool, 100); // class 112
+  CHECK(a != nullptr);
+  CHECK_EQ(pool.misses, 1u);
+  CHECK_EQ(pool.hits, 0u);
+  pinnedRelease(pool, a);
+
+  // same class: served from the cache.
+  void* b = pinnedAcquire(pool, 110);
+  CHECK_EQ(b, a);
+  CHECK_EQ(pool.hits, 1u);
+  CHECK_EQ(host.allocs, 1u);
+
+  // another class: a new buffer.
+  void* c = pinnedAcquire(pool, 200);
+  CHECK(c != a);
+  CHECK_EQ(pool.misses, 2u);
+  CHECK_EQ(host.allocs, 2u);
+
+  pinnedRelease(pool, b);
+  pinnedRelease(pool, c);
+}
+
+TEST(pinned, accounting) {
+  PinnedPool pool;
+  FakeHost host;
+  attach(pool, host);
+
+  void* a = pinnedAcquire(pool, 64);  // 64
+  void* b = pinnedAcquire(pool, 100); // 112
+  CHECK_EQ(pool.inUse, (size_t)176);
+  CHECK_EQ(pool.reserved, (size_t)176);
+  CHECK_EQ(pool.highWater, (size_t)176);
+  CHECK_EQ(pool.peakReserved, (size_t)176);
+
+  pinnedRelease(pool, a);
+  CHECK_EQ(pool.inUse, (size_t)112);
+  CHECK_EQ(pool.reserved, (size_t)176); // cached, not freed
+  CHECK_EQ(pool.highWater, (size_t)176);
+
+  void* c = pinnedAcquire(pool, 50); // reuses a
+  CHECK_EQ(c, a);
+  CHECK_EQ(pool.inUse, (size_t)176);
+  CHECK_EQ(pool.reserved, (size_t)176);
+
+  void* d = pinnedAcquire(pool, 256);
+  CHECK_EQ(pool.inUse, (size_t)432);
+  CHECK_EQ(pool.highWater, (size_t)432);
+  CHECK_EQ(pool.peakReserved, (size_t)432);
+
+  pinnedRelease(pool, b);
+  pinnedRelease(pool, c);
+  pinnedRelease(pool, d);
+  CHECK_EQ(pool.inUse, (size_t)0);
+  CHECK_EQ(pool.highWater, (size_t)432);
+  pinnedTrim(pool);
+}
+
+TEST(pinned, allocFailure) {
+  PinnedPool pool;
+  FakeHost host;
+  attach(pool, host);
+  host.fail = true;
+
+  CHECK(pinnedAcquire(pool, 100) == nullptr);
+  CHECK_EQ(pool.misses, 0u);
+  CHECK_EQ(pool.inUse, (size_t)0);
+  CHECK_EQ(pool.reserved, (size_t)0);
+}
+
+TEST(pinned, trim) {
+  PinnedPool pool;
+  FakeHost host;
+  attach(pool, host);
+
+  void* a = pinnedAcquire(pool, 64);
+  void* b = pinnedAcquire(pool, 64);
+  void* c = pinnedAcquire(pool, 1000);
+  pinnedRelease(pool, a);
+  pinnedRelease(pool, c);
+
+  // only the cached buffers are freed; |b| stays valid.
+  pinnedTrim(pool);
+  CHECK_EQ(host.frees, 2u);
+  CHECK_EQ(host.live.size(), (size_t)1);
+  CHECK(host.live.count(b));
+  CHECK_EQ(pool.reserved, (size_t)64);
+  CHECK_EQ(pool.inUse, (size_t)64);
+  CHECK_EQ(pool.peakReserved, (size_t)(64 + 64 + 1024));
+
+  // the next request of a trimmed class is a miss again.
+  unsigned int misses = pool.misses;
+  void* d = pinnedAcquire(pool, 64);
+  CHECK_EQ(pool.misses, misses + 1);
+
+  pinnedRelease(pool, b);
+  pinnedRelease(pool, d);
+  pinnedTrim(pool);
+  CHECK(host.live.empty());
+  CHECK_EQ(pool.reserved, (size_t)0);
+}
@@ -0,0 +1,100 @@
+#include <cstdint>
+
+#include "helper_quantize.h"
+#include "test.h"
+
+// deterministic uniform floats in [0, 1).
+static float nextUniform(uint32_t& s) {
+  s = s * 1664525u + 1013904223u;
+  return (s >> 8) * (1.0f / 16777216.0f);
+}
+
+static float3 randomPoint(uint32_t& s, float3 lo, float3 hi) {
+  return make_float3(lo.x + (hi.x - lo.x) * nextUniform(s),
+                     lo.y + (hi.y - lo.y) * nextUniform(s),
+                     lo.z + (hi.z - lo.z) * nextUniform(s));
+}
+
+TEST(quantize, roundTrip) {
+  float3 lo = make_float3(-12.5f, 3.f, 100.f), hi = make_float3(40.f, 9.5f, 131.f);
+  QuantInfo q = makeQuantInfo(lo, hi, 0.25f);
+  CHECK_EQ(q.cellSize, 0.25f);
+
+  uint32_t s = 1;
+  for (int i = 0; i < 100000; i++) {
+    float3 p = randomPoint(s, lo, hi);
+    unsigned int cell;
+    ushort3 off;
+    quantEncode(q, p, cell, off);
+    CHECK(cell < q.gridDim.x * q.gridDim.y * q.gridDim.z);
+    float3 d = quantDecode(q, cell, off) - p;
+    CHECK(length(d) <= q.errBound);
+  }
+}
+
+TEST(quantize, edges) {
+  float3 lo = make_float3(0.f, 0.f, 0.f), hi = make_float3(1.f, 2.f, 3.f);
+  QuantInfo q = makeQuantInfo(lo, hi, 0.5f);
+  CHECK_EQ(q.gridDim.x, 3u);
+  CHECK_EQ(q.gridDim.y, 5u);
+  CHECK_EQ(q.gridDim.z, 7u);
+
+  unsigned int cell;
+  ushort3 off;
+  quantEncode(q, lo, cell, off);
+  CHECK_EQ(cell, 0u);
+  CHECK_EQ(off.x, 0);
+
+  // the far corner is in range, and so is a point just outside the grid
+  // (clamped into the last cell).
+  float3 corners[] = {hi, make_float3(1.5f - 1e-6f, 2.f, 3.f), make_float3(1.6f, 2.f, 3.f)};
+  for (float3 p : corners) {
+    quantEncode(q, p, cell, off);
+    CHECK(cell < q.gridDim.x * q.gridDim.y * q.gridDim.z);
+  }
+  quantEncode(q, corners[0], cell, off);
+  CHECK(length(quantDecode(q, cell, off) - corners[0]) <= q.errBound);
+}
+
+TEST(quantize, cellsFit32Bits) {
+  // 1e6 cells a side don't fit 32 bits, so the cells grow.
+  QuantInfo q = makeQuantInfo(make_float3(0.f, 0.f, 0.f), make_float3(1e6f, 1e6f, 1e6f), 1.f);
+  CHECK(q.cellSize > 1.f);
+  CHECK((double)q.gridDim.x * q.gridDim.y * q.gridDim.z < 4294967296.0);
+}
+
+// the band decisions must agree with testing the real points.
+TEST(quantize, radiusBand) {
+  float3 lo = make_float3(-50.f, -50.f, -50.f), hi = make_float3(50.f, 50.f, 50.f);
+  float radius = 2.f;
+  QuantInfo q = makeQuantInfo(lo, hi, radius / 8);
+
+  float lo2, hi2;
+  quantRadiusBand(q, radius, lo2, hi2);
+  CHECK(lo2 < radius * radius);
+  CHECK(hi2 > radius * radius);
+
+  uint32_t s = 7;
+  unsigned int numUndecided = 0;
+  for (int i = 0; i < 200000; i++) {
+    float3 p = randomPoint(s, lo, hi);
+    // queries around the sphere, many of them right at its boundary.
+    float3 dir = normalize(randomPoint(s, make_float3(-1.f, -1.f, -1.f), make_float3(1.f, 1.f, 1.f)));
+    float dist = radius * (0.9f + 0.2f * nextUniform(s));
+    float3 query = p + dir * dist;
+
+    unsigned int cell;
+    ushort3 off;
+    quantEncode(q, p, cell, off);
+    float3 Oq = query - quantDecode(q, cell, off);
+    float qsqdist = dot(Oq, Oq);
+
+    float3 O = query - p;
+    bool inside = dot(O, O) < radius * radius;
+    if (qsqdist < lo2) CHECK(inside);
+    else if (qsqdist >= hi2) CHECK(!inside);
+    else numUndecided++;
+  }
+  // the band is thin: only pairs very close to the radius need the real point.
+  CHECK(numUndecided < 200000 / 100);
+}
@@ -0,0 +1,161 @@
+#include <algorithm>
+#include <climits>
+#include <map>
+#include <random>
+#include <utility>
+#include <vector>
+
+#include <sutil/vec_math.h>
+
+#include "hostgrid.h"
+#include "rtnn.h"
+#include "test.h"
+
+// A CPU-backend |rtnn::SlidingWindow| after frames came and went, against a
+// fresh host grid over the points of the live frames. Needs the rtnn library,
+// but no GPU.
+
+typedef std::pair<int, unsigned int> FramePoint; // frame id, index in the frame
+
+struct LiveScene
+{
+  std::vector<float3>         points;
+  std::vector<FramePoint>     owners;
+};
+
+static std::vector<float3> makeFrame(std::mt19937& rng, float shift) {
+  std::uniform_real_distribution<float> coord(0, 20);
+  std::vector<float3> frame(3000);
+  for (float3& p : frame) p = make_float3(coord(rng) + shift, coord(rng), coord(rng) * 0.2f);
+  return frame;
+}
+
+static RTNNState windowConfig(const std::string& mode, unsigned int k) {
+  RTNNState config;
+  config.backend = "cpu";
+  config.searchMode = mode;
+  config.knn = k;
+  config.radius = 1.5f;
+  config.numThreads = 4;
+  return config;
+}
+
+// the frames the window should hold; pushes, drops and keeps the latest as
+// |window| does.
+static LiveScene runFrames(rtnn::SlidingWindow& window, std::map<int, std::vector<float3>>& frames) {
+  std::mt19937 rng(21);
+  for (int i = 0; i < 5; i++) {
+    std::vector<float3> frame = makeFrame(rng, i * 2.f);
+    frames[window.pushFrame(frame.data(), frame.size())] = frame;
+  }
+  window.keepLatest(3); // drops frames 0 and 1
+  window.dropFrame(3); // a tombstone in the middle
+  std::vector<float3> frame = makeFrame(rng, 5.f);
+  frames[window.pushFrame(frame.data(), frame.size())] = frame;
+  for (int dropped : {0, 1, 3}) frames.erase(dropped);
+
+  LiveScene scene;
+  for (const auto& f : frames)
+    for (unsigned int i = 0; i < f.second.size(); i++) {
+      scene.points.push_back(f.second[i]);
+      scene.owners.push_back(FramePoint(f.first, i));
+    }
+  return scene;
+}
+
+static std::vector<float3> makeQueries() {
+  std::mt19937 rng(22);
+  std::uniform_real_distribution<float> coord(-1, 30);
+  std::vector<float3> queries(500);
+  for (float3& q : queries) q = make_float3(coord(rng), coord(rng) * 0.7f, coord(rng) * 0.15f);
+  return queries;
+}
+
+static void sceneBounds(const LiveScene& scene, const std::vector<float3>& queries, float3& sceneMin, float3& sceneMax) {
+  sceneMin = sceneMax = scene.points[0];
+  for (const float3& p : scene.points) { sceneMin = fminf(sceneMin, p); sceneMax = fmaxf(sceneMax, p); }
+  for (const float3& q : queries) { sceneMin = fminf(sceneMin, q); sceneMax = fmaxf(sceneMax, q); }
+}
+
+TEST(slidingwindow, knnMatchesHostGrid) {
+  const unsigned int k = 8;
+  rtnn::SlidingWindow window(windowConfig("knn", k));
+  std::map<int, std::vector<float3>> frames;
+  LiveScene scene = runFrames(window, frames);
+  CHECK_EQ(window.numFrames(), 3u);
+  CHECK_EQ(window.numPoints(), (unsigned int)scene.points.size());
+
+  std::vector<float3> queries = makeQueries();
+  window.search(queries.data(), queries.size());
+  CHECK_EQ(window.k(), k);
+  const std::vector<unsigned int>& results = window.results();
+
+  float3 sceneMin, sceneMax;
+  sceneBounds(scene, queries, sceneMin, sceneMax);
+  HostGrid grid;
+  buildSparseHostGrid(grid, scene.points.data(), scene.points.size(), sceneMin, sceneMax, 1.5f, k, 4);
+
+  std::vector<unsigned int> ids(k);
+  std::vector<float> expected(k);
+  unsigned int mismatches = 0, found = 0;
+  for (unsigned int q = 0; q < queries.size(); q++) {
+    unsigned int n = hostKnnSearch(grid, queries[q], 1.5f, k, ids.data(), expected.data());
+
+    // the window's neighbors, by the point they stand for.
+    std::vector<float> dists;
+    for (unsigned int j = 0; j < k; j++) {
+      unsigned int slot = results[(size_t)q * k + j];
+      if (slot == UINT_MAX) break;
+      int frameId;
+      unsigned int index;
+      if (!window.locate(slot, frameId, index) || !frames.count(frameId)) { mismatches++; continue; }
+      float3 O = queries[q] - frames[frameId][index];
+      dists.push_back(dot(O, O));
+    }
+    std::sort(dists.begin(), dists.end());
+    found += n;
+    if (dists.size() != n || !std::equal(dists.begin(), dists.end(), expected.begin())) mismatches++;
+  }
+  CHECK(found > 0);
+  CHECK_EQ(mismatches, 0u);
+}
+
+TEST(slidingwindow, radiusMatchesHostGrid) {
+  const unsigned int limit = 256;
+  rtnn::SlidingWindow window(windowConfig("radius", limit));
+  std::map<int, std::vector<float3>> frames;
+  LiveScene scene = runFrames(window, frames);
+
+  std::vector<float3> queries = makeQueries();
+  window.search(queries.data(), queries.size());
+  const std::vector<unsigned int>& results = window.results();
+
+  float3 sceneMin, sceneMax;
+  sceneBounds(scene, queries, sceneMin, sceneMax);
+  HostGrid grid;
+  buildSparseHostGrid(grid, scene.points.data(), scene.points.size(), sceneMin, sceneMax, 1.5f, 0, 4);
+
+  std::vector<unsigned int> ids(limit);
+  unsigned int mismatches = 0, compared = 0;
+  for (unsigned int q = 0; q < queries.size(); q++) {
+    unsigned int n = hostRadiusSearch(grid, queries[q], 1.5f, limit, ids.data());
+    if (n == limit) continue; // truncated: either side may keep other neighbors
+    std::vector<FramePoint> expected;
+    for (unsigned int j = 0; j < n; j++) expected.push_back(scene.owners[ids[j]]);
+
+    std::vector<FramePoint> got;
+    for (unsigned int j = 0; j < limit; j++) {
+      unsigned int slot = results[(size_t)q * limit + j];
+      if (slot == UINT_MAX) break;
+      FramePoint owner;
+      if (window.locate(slot, owner.first, owner.second)) got.push_back(owner);
+      else mismatches++;
+    }
+    std::sort(expected.begin(), expected.end());
+    std::sort(got.begin(), got.end());
+    if (got != expected) mismatches++;
+    compared++;
+  }
+  CHECK(compared > queries.size() / 2);
+  CHECK_EQ(mismatches, 0u);
+}
@@ -0,0 +1,137 @@
+#include <vector>
+
+#include "window.h"
+#include "test.h"
+
+TEST(window, addFrame) {
+  FrameWindow window;
+  CHECK_EQ(oldestFrame(window), -1);
+  int a = addFrame(window, 10);
+  int b = addFrame(window, 0); // an empty frame still gets a segment
+  int c = addFrame(window, 5);
+  CHECK_EQ(a, 0);
+  CHECK_EQ(b, 1);
+  CHECK_EQ(c, 2);
+  CHECK_EQ(window.used, 15u);
+  CHECK_EQ(window.numLive, 15u);
+  CHECK_EQ(numLiveFrames(window), 3u);
+  CHECK_EQ(findFrame(window, c)->offset, 10u);
+  CHECK_EQ(findFrame(window, b)->count, 0u);
+  CHECK(!findFrame(window, 3));
+  CHECK_EQ(oldestFrame(window), a);
+}
+
+TEST(window, removeFrame) {
+  FrameWindow window;
+  int a = addFrame(window, 10);
+  int b = addFrame(window, 20);
+  int c = addFrame(window, 30);
+
+  // a tombstone in the middle keeps its slots.
+  CHECK(removeFrame(window, b));
+  CHECK(!removeFrame(window, b));
+  CHECK(!removeFrame(window, 42));
+  CHECK_EQ(window.used, 60u);
+  CHECK_EQ(window.numLive, 40u);
+  CHECK_EQ(window.segments.size(), (size_t)3);
+  CHECK(!findFrame(window, b));
+  CHECK_EQ(numLiveFrames(window), 2u);
+  CHECK(needCompaction(window, 0.25f));
+  CHECK(!needCompaction(window, 0.5f));
+
+  // dropping the last frame trims it and the dead segment before it.
+  CHECK(removeFrame(window, c));
+  CHECK_EQ(window.used, 10u);
+  CHECK_EQ(window.numLive, 10u);
+  CHECK_EQ(window.segments.size(), (size_t)1);
+  CHECK(!needCompaction(window, 0));
+
+  // so the next frame reuses those slots.
+  int d = addFrame(window, 7);
+  CHECK_EQ(findFrame(window, d)->offset, 10u);
+  CHECK_EQ(oldestFrame(window), a);
+
+  CHECK(removeFrame(window, a));
+  CHECK(removeFrame(window, d));
+  CHECK_EQ(window.used, 0u);
+  CHECK(window.segments.empty());
+  CHECK_EQ(oldestFrame(window), -1);
+}
+
+TEST(window, compactFrames) {
+  FrameWindow window;
+  int a = addFrame(window, 3);
+  int b = addFrame(window, 4);
+  int c = addFrame(window, 2);
+  int d = addFrame(window, 3);
+  std::vector<int> data(window.used);
+  for (unsigned int i = 0; i < window.used; i++) data[i] = (int)i;
+
+  removeFrame(window, a);
+  removeFrame(window, c);
+  std::vector<SegmentMove> moves = compactFrames(window);
+  CHECK_EQ(moves.size(), (size_t)2);
+  CHECK_EQ(window.used, 7u);
+  CHECK_EQ(window.numLive, 7u);
+  CHECK_EQ(window.segments.size(), (size_t)2);
+  CHECK_EQ(findFrame(window, b)->offset, 0u);
+  CHECK_EQ(findFrame(window, d)->offset, 4u);
+  for (const SegmentMove& move : moves) CHECK(move.to <= move.from);
+
+  applyMoves(moves, data.data());
+  const int expected[] = {3, 4, 5, 6, 9, 10, 11};
+  for (unsigned int i = 0; i < 7; i++) CHECK_EQ(data[i], expected[i]);
+
+  // the ids keep growing, and the oldest frame is still the first one left.
+  CHECK_EQ(oldestFrame(window), b);
+  int e = addFrame(window, 1);
+  CHECK_EQ(e, 4);
+  CHECK_EQ(findFrame(window, e)->offset, 7u);
+  removeFrame(window, b);
+  compactFrames(window);
+  CHECK_EQ(oldestFrame(window), d);
+  CHECK_EQ(findFrame(window, d)->offset, 0u);
+
+  // moves also cover segments that stay put, e.g., to copy into a fresh array.
+  moves = compactFrames(window);
+  CHECK_EQ(moves.size(), (size_t)2);
+  CHECK_EQ(moves[0].from, moves[0].to);
+}
+
+TEST(window, locateSlot) {
+  FrameWindow window;
+  int a = addFrame(window, 3);
+  int b = addFrame(window, 0);
+  int c = addFrame(window, 4);
+  int d = addFrame(window, 2);
+  removeFrame(window, c);
+
+  int frameId = -1;
+  unsigned int pos = 0;
+  CHECK(locateSlot(window, 2, frameId, pos));
+  CHECK_EQ(frameId, a);
+  CHECK_EQ(pos, 2u);
+  CHECK(locateSlot(window, 8, frameId, pos));
+  CHECK_EQ(frameId, d);
+  CHECK_EQ(pos, 1u);
+
+  // dead slots, and slots past the last segment.
+  for (unsigned int slot = 3; slot < 7; slot++) CHECK(!locateSlot(window, slot, frameId, pos));
+  CHECK(!locateSlot(window, 9, frameId, pos));
+  CHECK(!locateSlot(window, 1000, frameId, pos));
+
+  // the empty frame starts at slot 3 but owns none of it.
+  CHECK_EQ(findFrame(window, b)->offset, 3u);
+  removeFrame(window, a);
+  CHECK(!locateSlot(window, 0, frameId, pos));
+
+  FrameWindow empty;
+  CHECK(!locateSlot(empty, 0, frameId, pos));
+
+  // a live empty frame at the end owns no slot either.
+  FrameWindow tail;
+  addFrame(tail, 3);
+  addFrame(tail, 0);
+  CHECK(locateSlot(tail, 2, frameId, pos));
+  CHECK(!locateSlot(tail, 3, frameId, pos));
+}
@@ -42,6 +42,20 @@ void sortByKey( thrust::device_ptr<unsigned int> d_key_ptr, thrust::device_ptr<i
   thrust::sort_by_key(d_key_ptr, d_key_ptr + N, d_val_ptr);
 }
 
+// stable, so that sorting several arrays by copies of the same (non-unique)
+// keys orders them all the same way.
+void stableSortByKey( thrust::device_ptr<unsigned long long> d_key_ptr, thrust::device_ptr<float3> d_val_ptr, unsigned int N ) {
+  thrust::stable_sort_by_key(d_key_ptr, d_key_ptr + N, d_val_ptr);
+}
+
+void stableSortByKey( thrust::device_ptr<unsigned long long> d_key_ptr, thrust::device_ptr<unsigned int> d_val_ptr, unsigned int N ) {
+  thrust::stable_sort_by_key(d_key_ptr, d_key_ptr + N, d_val_ptr);
+}
+
+void stableSortByKey( thrust::device_ptr<unsigned long long> d_key_ptr, thrust::device_ptr<int> d_val_ptr, unsigned int N ) {
+  thrust::stable_sort_by_key(d_key_ptr, d_key_ptr + N, d_val_ptr);
+}
+
 void gatherByKey ( thrust::device_vector<unsigned int>* d_vec_val, thrust::device_ptr<float3> d_orig_val_ptr, thrust::device_ptr<float3> d_new_val_ptr ) {
   thrust::gather(d_vec_val->begin(), d_vec_val->end(), d_orig_val_ptr, d_new_val_ptr);
 }
@@ -54,6 +68,10 @@ void gatherByKey ( thrust::device_ptr<unsigned int> d_key_ptr, thrust::device_pt
   thrust::gather(d_key_ptr, d_key_ptr + N, d_orig_val_ptr, d_new_val_ptr);
 }
 
+void gatherByKey ( thrust::device_ptr<unsigned int> d_key_ptr, thrust::device_ptr<unsigned int> d_orig_val_ptr, thrust::device_ptr<unsigned int> d_new_val_ptr, unsigned int N, cudaStream_t stream ) {
+  thrust::gather(thrust::cuda::par.on(stream), d_key_ptr, d_key_ptr + N, d_orig_val_ptr, d_new_val_ptr);
+}
+
 void gatherByKey ( thrust::device_ptr<unsigned int> d_key_ptr, thrust::device_vector<float>* d_orig_queries, thrust::device_ptr<float> d_new_val_ptr, unsigned int N, cudaStream_t stream ) {
   thrust::gather(thrust::cuda::par.on(stream), d_key_ptr, d_key_ptr + N, d_orig_queries->begin(), d_new_val_ptr);
 }
@@ -177,12 +195,24 @@ void copyIfInRange(float3* source, unsigned int N, thrust::device_ptr<float3> ma
                     mask, dest, isInRange3D(min, max, true));
 }
 
+void copyIfInRange(unsigned int* source, unsigned int N, thrust::device_ptr<float3> mask, thrust::device_ptr<unsigned int> dest, float3 min, float3 max) {
+    thrust::copy_if(thrust::device_pointer_cast(source),
+                    thrust::device_pointer_cast(source) + N,
+                    mask, dest, isInRange3D(min, max, true));
+}
+
 void copyIfIdInRange(float3* source, unsigned int N, thrust::device_ptr<int> mask, thrust::device_ptr<float3> dest, int min, int max) {
     thrust::copy_if(thrust::device_pointer_cast(source),
                     thrust::device_pointer_cast(source) + N,
                     mask, dest, isInRange(min, max));
 }
 
+void copyIfIdInRange(unsigned int* source, unsigned int N, thrust::device_ptr<int> mask, thrust::device_ptr<unsigned int> dest, int min, int max) {
+    thrust::copy_if(thrust::device_pointer_cast(source),
+                    thrust::device_pointer_cast(source) + N,
+                    mask, dest, isInRange(min, max));
+}
+
 void copyIfNonZero(float3* source, unsigned int N, thrust::device_ptr<bool> mask, thrust::device_ptr<float3> dest) {
     thrust::copy_if(thrust::device_pointer_cast(source),
                     thrust::device_pointer_cast(source) + N,
@@ -211,6 +241,10 @@ unsigned int countUniq(thrust::device_ptr<unsigned int> d_value_ptr, unsigned in
   return end - d_value_ptr;
 }
 
+void sortKeys(thrust::device_ptr<unsigned int> d_key_ptr, unsigned int N) {
+  thrust::sort(d_key_ptr, d_key_ptr + N);
+}
+
 void thrustCopyD2D(thrust::device_ptr<unsigned int> d_dst, thrust::device_ptr<unsigned int> d_src, unsigned int N) {
     cudaMemcpy(
                 reinterpret_cast<void*>( thrust::raw_pointer_cast(d_dst) ),
@@ -220,6 +254,15 @@ void thrustCopyD2D(thrust::device_ptr<unsigned int> d_dst, thrust::device_ptr<un
     );
 }
 
+void thrustCopyD2D(thrust::device_ptr<unsigned long long> d_dst, thrust::device_ptr<unsigned long long> d_src, unsigned int N) {
+    cudaMemcpy(
+                reinterpret_cast<void*>( thrust::raw_pointer_cast(d_dst) ),
+                thrust::raw_pointer_cast(d_src),
+                N * sizeof( unsigned long long ),
+                cudaMemcpyDeviceToDevice
+    );
+}
+
 // https://github.com/NVIDIA/thrust/blob/master/examples/histogram.cu
 unsigned int thrustGenHist(const thrust::device_ptr<int> d_value_ptr, thrust::device_vector<unsigned int>& d_histogram, unsigned int N) {
     // first make a copy of d_value since we are going to sort it.
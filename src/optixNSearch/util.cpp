@@ -5,6 +5,10 @@
 #include <fstream>
 #include <string>
 #include <cstdlib>
+#include <cstdio>
+#include <cctype>
+#include <algorithm>
+#include <deque>
 
 #include <sutil/Timing.h>
 #include <sutil/Exception.h>
@@ -14,122 +18,200 @@
 
 #include "func.h"
 #include "state.h"
+#include "parallel.h"
+#include "pinned.h"
+
+// the parsers below read the whole file into memory, split it into chunks at
+// line boundaries, and parse the chunks on host threads straight into the
+// output arrays. a first pass counts the lines of each chunk so that every
+// chunk knows where its points go. the conversions are the ones the old
+// getline-based readers used (|strtod| then a cast to float for 3D points, the
+// same as sscanf("%lf"); |strtof| for nD points, the same as std::stof), so
+// the parsed points are bit-identical.
+
+static char* readFile(const char* data_file, size_t* size) {
+  FILE* fp = fopen(data_file, "rb");
+  if (!fp) {
+    std::cerr << "Could not read the frame data...\n";
+    assert(0);
+    exit(1);
+  }
 
-int tokenize(std::string s, std::string del, float3** ndpoints, unsigned int lineId)
-{
-  int start = 0;
-  int end = s.find(del);
-  int dim = 0;
+  fseek(fp, 0, SEEK_END);
+  *size = ftell(fp);
+  fseek(fp, 0, SEEK_SET);
 
-  std::vector<float> vcoords;
-  while (end != -1) {
-    float coord = std::stof(s.substr(start, end - start));
-    //std::cout << coord << std::endl;
-    if (ndpoints != nullptr) {
-      vcoords.push_back(coord);
-    }
-    start = end + del.size();
-    end = s.find(del, start);
-    dim++;
-  }
-  float coord  = std::stof(s.substr(start, end - start));
-  //std::cout << coord << std::endl;
-  if (ndpoints != nullptr) {
-    vcoords.push_back(coord);
+  // NUL-terminated so that the number parsers stop at the end of the last line
+  // even if it has no newline.
+  char* buf = new char[*size + 1];
+  if (fread(buf, 1, *size, fp) != *size) {
+    std::cerr << "Could not read the frame data...\n";
+    assert(0);
+    exit(1);
   }
-  dim++;
+  buf[*size] = '\0';
+  fclose(fp);
 
-  assert(dim > 0);
-  if ((dim % 3) != 0) dim = (dim/3+1)*3;
+  return buf;
+}
 
-  if (ndpoints != nullptr) {
-    for (int batch = 0; batch < dim/3; batch++) {
-      float3 point = make_float3(vcoords[batch*3], vcoords[batch*3+1], vcoords[batch*3+2]);
-      ndpoints[batch][lineId] = point;
+struct LineChunks
+{
+  std::vector<size_t>         begin; // byte offset of the first line of each chunk
+  std::vector<unsigned int>   firstLine; // exclusive scan of the per-chunk line counts
+  unsigned int                numLines = 0;
+};
+
+static LineChunks splitLines(const char* buf, size_t size, unsigned int numThreads) {
+  LineChunks chunks;
+
+  // a few chunks per thread; chunk boundaries are moved to the next line.
+  size_t numChunks = std::max<size_t>(1, std::min<size_t>(numHostThreads(numThreads) * 4, size / 4096));
+  size_t chunkSize = size / numChunks + 1;
+  for (size_t pos = 0; pos < size; ) {
+    chunks.begin.push_back(pos);
+    size_t next = std::min(pos + chunkSize, size);
+    const char* nl = (next < size) ? static_cast<const char*>(memchr(buf + next - 1, '\n', size - next + 1)) : nullptr;
+    pos = nl ? (nl - buf) + 1 : size;
+  }
+  chunks.begin.push_back(size);
+
+  // a line is what getline() returns: the text before a '\n', or a non-empty
+  // tail without one.
+  numChunks = chunks.begin.size() - 1;
+  std::vector<unsigned int> counts(numChunks, 0);
+  parallelFor(numChunks, numThreads, 1, [&](unsigned int b, unsigned int e, unsigned int) {
+    for (unsigned int c = b; c < e; c++) {
+      const char* p = buf + chunks.begin[c];
+      const char* end = buf + chunks.begin[c + 1];
+      counts[c] = std::count(p, end, '\n');
+      if (end > p && end[-1] != '\n') counts[c]++;
     }
+  });
+
+  chunks.firstLine.resize(numChunks);
+  for (size_t c = 0; c < numChunks; c++) {
+    chunks.firstLine[c] = chunks.numLines;
+    chunks.numLines += counts[c];
   }
 
-  return dim;
+  return chunks;
 }
 
-float3** read_pc_data(const char* data_file, unsigned int* N, int* d) {
-  std::ifstream file;
+// call |func(lineBegin, lineEnd, lineId)| for every line, in parallel over the chunks.
+template <typename Func>
+static void forEachLine(const char* buf, const LineChunks& chunks, unsigned int numThreads, Func func) {
+  parallelFor(chunks.firstLine.size(), numThreads, 1, [&](unsigned int b, unsigned int e, unsigned int) {
+    for (unsigned int c = b; c < e; c++) {
+      const char* p = buf + chunks.begin[c];
+      const char* end = buf + chunks.begin[c + 1];
+      unsigned int lineId = chunks.firstLine[c];
+      while (p < end) {
+        const char* nl = static_cast<const char*>(memchr(p, '\n', end - p));
+        const char* lineEnd = nl ? nl : end;
+        func(p, lineEnd, lineId++);
+        p = lineEnd + 1;
+      }
+    }
+  });
+}
 
-  file.open(data_file);
-  if( !file.good() ) {
-    std::cerr << "Could not read the frame data...\n";
-    assert(0);
-  }
+// skip the leading whitespace within the line; strtod/strtof would otherwise
+// happily skip the newline and continue on the next line.
+static const char* skipSpace(const char* p, const char* end) {
+  while (p < end && isspace((unsigned char)*p)) p++;
+  return p;
+}
 
-  char line[1024];
-  unsigned int lines = 0;
-  int dim = 0;
+static int countFields(const char* p, const char* end) {
+  if (p == end) return 0;
+  return std::count(p, end, ',') + 1;
+}
 
-  while (file.getline(line, 1024)) {
-    if (lines == 0) {
-      std::string str(line);
-      dim = tokenize(str, ",", nullptr, 0);
-    }
-    lines++;
-  }
-  file.clear();
-  file.seekg(0, std::ios::beg);
+float3** read_pc_data(const char* data_file, unsigned int* N, int* d, unsigned int numThreads) {
+  size_t size;
+  char* buf = readFile(data_file, &size);
+  LineChunks chunks = splitLines(buf, size, numThreads);
+
+  *N = chunks.numLines;
 
-  *N = lines;
+  int dim = 0;
+  if (chunks.numLines > 0) {
+    const char* nl = static_cast<const char*>(memchr(buf, '\n', size));
+    dim = countFields(buf, nl ? nl : buf + size);
+  }
+  assert(dim > 0);
+  if ((dim % 3) != 0) dim = (dim/3+1)*3;
   *d = dim;
 
   float3** ndpoints = new float3*[dim/3];
   for (int i = 0; i < dim/3; i++) {
-    ndpoints[i] = new float3[lines];
+    ndpoints[i] = new float3[chunks.numLines];
   }
 
-  lines = 0;
-  while (file.getline(line, 1024)) {
-    std::string str(line);
-    tokenize(str, ",", ndpoints, lines);
-
-    //std::cerr << ndpoints[0][lines].x << "," << ndpoints[0][lines].y << "," << ndpoints[0][lines].z << std::endl;
-    //std::cerr << ndpoints[1][lines].x << "," << ndpoints[1][lines].y << "," << ndpoints[1][lines].z << std::endl;
-    lines++;
-  }
+  forEachLine(buf, chunks, numThreads, [&](const char* p, const char* end, unsigned int lineId) {
+    // fields beyond the first line's dimension are dropped; missing ones are 0.
+    float coords[3] = {0, 0, 0};
+    int field = 0;
+    while (field < dim) {
+      const char* q = skipSpace(p, end);
+      char* numEnd = const_cast<char*>(q);
+      float coord = (q < end) ? strtof(q, &numEnd) : 0;
+      if (numEnd == q) {
+        fprintf(stderr, "Could not parse line %u of %s\n", lineId + 1, data_file);
+        exit(1);
+      }
+      coords[field % 3] = coord;
+      field++;
+
+      const char* comma = static_cast<const char*>(memchr(numEnd, ',', end - numEnd));
+      bool last = (comma == nullptr) || (field == dim);
+      if ((field % 3) == 0 || last) {
+        ndpoints[(field - 1) / 3][lineId] = make_float3(coords[0], coords[1], coords[2]);
+        coords[0] = coords[1] = coords[2] = 0;
+      }
+      if (last) break;
+      p = comma + 1;
+    }
+    for (int batch = (field + 2) / 3; batch < dim/3; batch++) {
+      ndpoints[batch][lineId] = make_float3(0, 0, 0);
+    }
+  });
 
-  file.close();
+  delete[] buf;
 
   return ndpoints;
 }
 
-float3* read_pc_data(const char* data_file, unsigned int* N) {
-  std::ifstream file;
-
-  file.open(data_file);
-  if( !file.good() ) {
-    std::cerr << "Could not read the frame data...\n";
-    assert(0);
-  }
-
-  char line[1024];
-  unsigned int lines = 0;
-
-  while (file.getline(line, 1024)) {
-    lines++;
-  }
-  file.clear();
-  file.seekg(0, std::ios::beg);
-  *N = lines;
-
-  float3* t_points = new float3[lines];
-
-  lines = 0;
-  while (file.getline(line, 1024)) {
-    double x, y, z;
-
-    sscanf(line, "%lf,%lf,%lf\n", &x, &y, &z);
-    t_points[lines] = make_float3(x, y, z);
-    //std::cerr << t_points[lines].x << ", " << t_points[lines].y << ", " << t_points[lines].z << std::endl;
-    lines++;
-  }
+float3* read_pc_data(const char* data_file, unsigned int* N, unsigned int numThreads) {
+  size_t size;
+  char* buf = readFile(data_file, &size);
+  LineChunks chunks = splitLines(buf, size, numThreads);
+
+  *N = chunks.numLines;
+  float3* t_points = new float3[chunks.numLines];
+
+  forEachLine(buf, chunks, numThreads, [&](const char* p, const char* end, unsigned int lineId) {
+    // same as sscanf(line, "%lf,%lf,%lf"): stop at the first field that
+    // doesn't parse or isn't followed by a comma. unparsed fields are 0.
+    double v[3] = {0, 0, 0};
+    for (int k = 0; k < 3; k++) {
+      p = skipSpace(p, end);
+      if (p == end) break;
+      char* numEnd;
+      double x = strtod(p, &numEnd);
+      if (numEnd == p) break;
+      v[k] = x;
+      p = numEnd;
+      if (k < 2) {
+        if (p < end && *p == ',') p++;
+        else break;
+      }
+    }
+    t_points[lineId] = make_float3(v[0], v[1], v[2]);
+  });
 
-  file.close();
+  delete[] buf;
 
   return t_points;
 }
@@ -149,7 +231,28 @@ void printUsageAndExit( const char* argv0 )
     std::cerr << "  --interleave      | -i      Allow interleaving kernel launches? Enable it for better performance. Default is true.\n";
     std::cerr << "  --msr             | -m      Enable end-to-end measurement? If true, disable CUDA synchronizations for more accurate time measurement (and higher performance). Default is true.\n";
     std::cerr << "  --check           | -c      Enable sanity check? Default is false.\n";
+    std::cerr << "  --exactcheck      | -ec     Sanity check every query exactly against a host grid, on all host threads (-t), and report precision, recall and truncation per batch? Implies -c. Default is false.\n";
+    std::cerr << "  --exactchecksample | -ecs   Specify how many queries per batch the exact check samples (one from each of as many equal ranges of queries). Default is 0, which checks all queries.\n";
     std::cerr << "  --deferFree       | -df     Defer free-ing intermediate device memory? Default is true.\n";
+    std::cerr << "  --arena           | -ar     Sub-allocate search intermediates from a device arena instead of cudaMalloc/cudaFree? Default is true.\n";
+    std::cerr << "  --pinnedpool      | -pp     Reuse pinned host buffers for result copies, upload staging and sanity-check copies instead of cudaMallocHost-ing each? Default is true.\n";
+    std::cerr << "  --profile         | -pf     Directory of per-GPU cost profiles for the automatic batching. The profile of the GPU in use is loaded if it's there. Default is empty (built-in costs, measured on a 2080Ti).\n";
+    std::cerr << "  --calibrate       | -cal    Measure the batching cost model on this GPU, save it as a profile in the --profile directory (default is the current directory) and exit? Default is false.\n";
+    std::cerr << "  --quantize        | -qz     Keep the points on the GPU as 16-bit offsets in grid cells (10 instead of 12 bytes a point) and the float points in host memory, which is only read near the search radius and for KNN candidates? Results stay exact but reads of host memory are slow, so this trades speed for GPU memory. Has no effect if the points are also the queries. Default is false.\n";
+    std::cerr << "  --backend         | -b      Search backend; can only be \"gpu\" or \"cpu\". \"cpu\" searches on the host using a multithreaded grid and needs no GPU. Default is \"gpu\".\n";
+    std::cerr << "  --threads         | -t      Number of host threads used by the CPU backend. Default is 0, which uses all hardware threads.\n";
+
+    std::cerr << "  --bincache        | -bc     Cache text inputs as binary .rtnn sidecar files and reuse them in later runs? Binary (.rtnn) inputs are always memory-mapped. Default is true.\n";
+
+    std::cerr << "  --out             | -o      Write the results to this .npy file (uint32, numQueries x K, in input order, neighbors as indices into the input points, padded with UINT_MAX). Batches are written on a background thread while the search goes on. Default is empty (no output).\n";
+    std::cerr << "  --trace           | -tr     Write a Chrome trace (chrome://tracing or Perfetto) of all timed phases, with their nesting and batches, to this file at exit. Default is empty (no trace).\n";
+    std::cerr << "  --traceprofile    | -tp     Write the timed phases summed up by their nesting path as JSON to this file at exit, for comparing runs. Default is empty.\n";
+    std::cerr << "  --gascache        | -gc     Directory of an on-disk GAS cache. GASes built over the same sorted points with the same radius (and OptiX/driver) are loaded and relocated instead of rebuilt. The directory must exist. Default is empty (no cache).\n";
+    std::cerr << "  --gascachesize    | -gcs    Size limit of the GAS cache in MB; least recently used GASes are evicted beyond it. Default is 4096.\n";
+    std::cerr << "  --csr             | -cs     Return results as CSR neighbor lists (per-query offsets plus indices) compacted on the device, so that only actual neighbors are copied back? Otherwise every query gets K slots padded with UINT_MAX. Default is false.\n";
+
+    std::cerr << "  --server          | -sv     Run as a search server listening on the given Unix socket path instead of searching once. Points from -f stay resident on the GPU; see server.h for the protocol. Default is empty (no server).\n";
+    std::cerr << "  --servermax       | -svm    Most points or queries a single server request may carry; larger requests are refused. Default is 33554432.\n";
 
     std::cerr << "  --help            | -h      Print this usage message\n";
 
@@ -167,14 +270,18 @@ void printUsageAndExit( const char* argv0 )
     std::cerr << "  --gsrRatio        | -sg     Radius ratio used in GAS sort. Default is 1.\n";
     std::cerr << "  --gather          | -g      Whether to gather queries after GAS sort? Default is false.\n";
 
-    std::cerr << "  --pointsort       | -ps     Grid-based point sort mode. {0: no sort. 1: morton order. 2: raster order. 3: 1D order.} Default 1.\n";
-    std::cerr << "  --querysort       | -qs     Grid-based query sort mode. {0: no sort. 1: morton order. 2: raster order. 3: 1D order.} Default 1.\n";
+    std::cerr << "  --pointsort       | -ps     Grid-based point sort mode. {0: no sort. 1: morton order. 2: raster order. 3: 1D order. 4: 64-bit morton order over the whole scene. 5: Hilbert order.} Default 1.\n";
+    std::cerr << "  --sortaxis        | -sa     Axis of the 1D sorts (-s 1, -ps 3, -qs 3). {0: x. 1: y. 2: z. -1: the longest side of the scene.} Default -1.\n";
+    std::cerr << "  --querysort       | -qs     Grid-based query sort mode. {0: no sort. 1: morton order. 2: raster order. 3: 1D order. 4: 64-bit morton order over the whole scene. 5: Hilbert order.} Default 1.\n";
 
     std::cerr << "  --autocrratio     | -ac     Automatically determining crRatio (cell/radius ratio)? cellSize = radius / crRatio. cellSize is used to create the grid for sorting queries. Default is true.\n";
     std::cerr << "  --crratio         | -cr     Specify crRatio. It's used only if \'-ac\' is false. Default is 8.\n";
     std::cerr << "  --gpumemused      | -gmu    Specify GPU memory that's occupied by other jobs. This allows a better estimation of crRatio to avoid OOM errors. Default is 0.\n";
     std::cerr << "  --crStep          | -crs    Specify the step size in iteratively determining the best crRatio. Must be > 1. Default is 1.01.\n";
     std::cerr << "  --metacellScale   | -mc     Specify the metacell scale. See comments in |genGridInfo|. Default is 4.\n";
+    std::cerr << "  --adaptivemetagrid | -amg   Size the meta grids per axis from the grid's dimensions instead of -mc? Elongated scenes then get large (non-cubic) meta grids and so longer stretches of morton/Hilbert order. Default is false.\n";
+    std::cerr << "  --metagridwaste   | -mgw    Specify the most padding (as a fraction of the grid's cells) the adaptive meta grids may add. Must be >= 0. Default is 0.125.\n";
+    std::cerr << "  --sparsegrid      | -sp     Keep the sorting/partitioning grid's per-cell arrays only for the occupied cells? Memory then scales with the particles rather than the scene volume, which allows finer cells for sparse scenes. Default is false.\n";
     std::cerr << "  --estgassize      | -egs    Specify the estimated GAS size in MB, which will be used to help determine the crRatio if -ac is enabled. Default is -1, indicating that the GAS size will be automatically inferred. If specified the value can't be negative.\n";
 
     exit( 0 );
@@ -214,6 +321,20 @@ void parseArgs( RTNNState& state,  int argc, char* argv[] ) {
           if ((state.searchMode != "knn") && (state.searchMode != "radius"))
               printUsageAndExit( argv[0] );
       }
+      else if( arg == "--backend" || arg == "-b" )
+      {
+          if( i >= argc - 1 )
+              printUsageAndExit( argv[0] );
+          state.backend = argv[++i];
+          if ((state.backend != "gpu") && (state.backend != "cpu"))
+              printUsageAndExit( argv[0] );
+      }
+      else if( arg == "--threads" || arg == "-t" )
+      {
+          if( i >= argc - 1 )
+              printUsageAndExit( argv[0] );
+          state.numThreads = atoi(argv[++i]);
+      }
       else if( arg == "--radius" || arg == "-r" )
       {
           if( i >= argc - 1 )
@@ -221,6 +342,24 @@ void parseArgs( RTNNState& state,  int argc, char* argv[] ) {
           state.radius = std::stof(argv[++i]);
           state.params.radius = state.radius; // this indicates the search radius of a launch
       }
+      else if( arg == "--server" || arg == "-sv" )
+      {
+          if( i >= argc - 1 )
+              printUsageAndExit( argv[0] );
+          state.serverSock = argv[++i];
+      }
+      else if( arg == "--servermax" || arg == "-svm" )
+      {
+          if( i >= argc - 1 )
+              printUsageAndExit( argv[0] );
+          state.serverMaxCount = std::stoul(argv[++i]);
+      }
+      else if( arg == "--bincache" || arg == "-bc" )
+      {
+          if( i >= argc - 1 )
+              printUsageAndExit( argv[0] );
+          state.binCache = (bool)(atoi(argv[++i]));
+      }
       else if( arg == "--msr" || arg == "-m" )
       {
           if( i >= argc - 1 )
@@ -233,6 +372,72 @@ void parseArgs( RTNNState& state,  int argc, char* argv[] ) {
               printUsageAndExit( argv[0] );
           state.deferFree = (bool)(atoi(argv[++i]));
       }
+      else if( arg == "--arena" || arg == "-ar" )
+      {
+          if( i >= argc - 1 )
+              printUsageAndExit( argv[0] );
+          state.useArena = (bool)(atoi(argv[++i]));
+      }
+      else if( arg == "--pinnedpool" || arg == "-pp" )
+      {
+          if( i >= argc - 1 )
+              printUsageAndExit( argv[0] );
+          state.usePinnedPool = (bool)(atoi(argv[++i]));
+      }
+      else if( arg == "--profile" || arg == "-pf" )
+      {
+          if( i >= argc - 1 )
+              printUsageAndExit( argv[0] );
+          state.profileDir = argv[++i];
+      }
+      else if( arg == "--calibrate" || arg == "-cal" )
+      {
+          if( i >= argc - 1 )
+              printUsageAndExit( argv[0] );
+          state.calibrate = (bool)(atoi(argv[++i]));
+      }
+      else if( arg == "--quantize" || arg == "-qz" )
+      {
+          if( i >= argc - 1 )
+              printUsageAndExit( argv[0] );
+          state.quantize = (bool)(atoi(argv[++i]));
+      }
+      else if( arg == "--out" || arg == "-o" )
+      {
+          if( i >= argc - 1 )
+              printUsageAndExit( argv[0] );
+          state.outFile = argv[++i];
+      }
+      else if( arg == "--trace" || arg == "-tr" )
+      {
+          if( i >= argc - 1 )
+              printUsageAndExit( argv[0] );
+          state.traceFile = argv[++i];
+      }
+      else if( arg == "--traceprofile" || arg == "-tp" )
+      {
+          if( i >= argc - 1 )
+              printUsageAndExit( argv[0] );
+          state.traceProfileFile = argv[++i];
+      }
+      else if( arg == "--gascache" || arg == "-gc" )
+      {
+          if( i >= argc - 1 )
+              printUsageAndExit( argv[0] );
+          state.gasCacheDir = argv[++i];
+      }
+      else if( arg == "--gascachesize" || arg == "-gcs" )
+      {
+          if( i >= argc - 1 )
+              printUsageAndExit( argv[0] );
+          state.gasCacheSize = atoi(argv[++i]);
+      }
+      else if( arg == "--csr" || arg == "-cs" )
+      {
+          if( i >= argc - 1 )
+              printUsageAndExit( argv[0] );
+          state.csr = (bool)(atoi(argv[++i]));
+      }
       else if( arg == "--filterQueries" || arg == "-fq" )
       {
           if( i >= argc - 1 )
@@ -295,6 +500,14 @@ void parseArgs( RTNNState& state,  int argc, char* argv[] ) {
               printUsageAndExit( argv[0] );
           state.querySortMode = atoi(argv[++i]);
       }
+      else if( arg == "--sortaxis" || arg == "-sa" )
+      {
+          if( i >= argc - 1 )
+              printUsageAndExit( argv[0] );
+          state.sortAxis = atoi(argv[++i]);
+          if (state.sortAxis > 2 || state.sortAxis < -1)
+              printUsageAndExit( argv[0] );
+      }
       else if( arg == "--crratio" || arg == "-cr" )
       {
           if( i >= argc - 1 )
@@ -325,7 +538,7 @@ void parseArgs( RTNNState& state,  int argc, char* argv[] ) {
       {
           if( i >= argc - 1 )
               printUsageAndExit( argv[0] );
-          state.approxMode = (bool)(atoi(argv[++i]));
+          state.approxMode = atoi(argv[++i]);
       }
       else if( arg == "--check" || arg == "-c" )
       {
@@ -333,6 +546,19 @@ void parseArgs( RTNNState& state,  int argc, char* argv[] ) {
               printUsageAndExit( argv[0] );
           state.sanCheck = (bool)(atoi(argv[++i]));
       }
+      else if( arg == "--exactcheck" || arg == "-ec" )
+      {
+          if( i >= argc - 1 )
+              printUsageAndExit( argv[0] );
+          state.exactCheck = (bool)(atoi(argv[++i]));
+          if (state.exactCheck) state.sanCheck = true; // it is a sanity check mode
+      }
+      else if( arg == "--exactchecksample" || arg == "-ecs" )
+      {
+          if( i >= argc - 1 )
+              printUsageAndExit( argv[0] );
+          state.exactCheckSample = atoi(argv[++i]);
+      }
       else if( arg == "--gsrRatio" || arg == "-sg" )
       {
           if( i >= argc - 1 )
@@ -347,6 +573,26 @@ void parseArgs( RTNNState& state,  int argc, char* argv[] ) {
               printUsageAndExit( argv[0] );
           state.mcScale = atoi(argv[++i]);
       }
+      else if( arg == "--adaptivemetagrid" || arg == "-amg" )
+      {
+          if( i >= argc - 1 )
+              printUsageAndExit( argv[0] );
+          state.adaptiveMetaGrid = (bool)(atoi(argv[++i]));
+      }
+      else if( arg == "--metagridwaste" || arg == "-mgw" )
+      {
+          if( i >= argc - 1 )
+              printUsageAndExit( argv[0] );
+          state.metaGridWaste = std::stof(argv[++i]);
+          if (state.metaGridWaste < 0)
+              printUsageAndExit( argv[0] );
+      }
+      else if( arg == "--sparsegrid" || arg == "-sp" )
+      {
+          if( i >= argc - 1 )
+              printUsageAndExit( argv[0] );
+          state.sparseGrid = (bool)(atoi(argv[++i]));
+      }
       else if( arg == "--crStep " || arg == "-crs" )
       {
           if( i >= argc - 1 )
@@ -382,21 +628,60 @@ void parseArgs( RTNNState& state,  int argc, char* argv[] ) {
   }
 }
 
+bool isMappedHostPtr(RTNNState& state, void* ptr) {
+  for (auto& mf : state.h_mappedFiles) {
+    char* base = static_cast<char*>(mf.base);
+    if (ptr >= base && ptr < base + mf.size) return true;
+  }
+  return false;
+}
+
+void unmapPointFiles(RTNNState& state) {
+  for (auto& mf : state.h_mappedFiles) unmapPointFile(mf);
+  state.h_mappedFiles.clear();
+}
+
+// binary inputs are mmap-ed directly. a text input is parsed once and then
+// cached as a binary sidecar (<file>.rtnn) next to it; later runs map the
+// sidecar as long as the text file's size and mtime haven't changed.
+float3* loadPoints(RTNNState& state, const std::string& file, unsigned int* N) {
+  MappedPointFile mf;
+  float3* points = mapPointFile(file.c_str(), mf);
+
+  uint64_t srcSize = 0;
+  int64_t srcMtime = 0;
+  std::string sidecar = file + RTNN_FILE_EXT;
+  if (!points && state.binCache && statSource(file.c_str(), srcSize, srcMtime)) {
+    points = mapPointFile(sidecar.c_str(), mf, srcSize, srcMtime);
+    if (points) fprintf(stdout, "\tUsing binary cache %s\n", sidecar.c_str());
+  }
+
+  if (points) {
+    *N = mf.header.count;
+    state.h_mappedFiles.push_back(mf);
+    return points;
+  }
+
+  points = read_pc_data(file.c_str(), N, state.numThreads);
+  if (state.binCache && (srcSize != 0 || srcMtime != 0)) {
+    if (!writePointFile(sidecar.c_str(), points, *N, srcSize, srcMtime))
+      fprintf(stderr, "\tCould not write binary cache %s\n", sidecar.c_str());
+  }
+  return points;
+}
+
 void readData(RTNNState& state) {
-  state.h_points = read_pc_data(state.pfile.c_str(), &state.numPoints);
+  Timing::startTiming("read data");
+  state.h_points = loadPoints(state, state.pfile, &state.numPoints);
   state.h_queries = state.h_points;
   state.numQueries = state.numPoints;
 
-  if (!state.samepq) { // if can't share the host memory
-    if (!state.qfile.empty() && (state.qfile != state.pfile)) {
-      // if the underlying data are different, read it
-      state.h_queries = read_pc_data(state.qfile.c_str(), &state.numQueries);
-    } else {
-      // if underlying data are the same, copy it
-      state.h_queries = (float3*)malloc(state.numQueries * sizeof(float3));
-      thrust::copy(state.h_points, state.h_points+state.numQueries, state.h_queries);
-    }
-  }
+  // if the underlying data are different, read them. same data sorted in
+  // another order (!samepq) get their own copy when the search starts (see
+  // |NeighborSearch::searchOnce|), so don't copy them here.
+  if (!state.sameData)
+    state.h_queries = loadPoints(state, state.qfile, &state.numQueries);
+  Timing::stopTiming(true);
 
   if (state.numPoints == 0 || state.numQueries == 0) {
     fprintf(stdout, "empty query and/or points\n");
@@ -520,6 +805,23 @@ float estGASLtdSize(RTNNState& state,
   return cellSize;
 }
 
+static CellSizeProblem cellSizeProblem(RTNNState& state, float spaceAvail, float gasSize, int cellArrayCount) {
+  CellSizeProblem problem;
+  problem.sceneMin = state.Min;
+  problem.sceneMax = state.Max;
+  problem.mcScale = state.mcScale;
+  problem.metaGridWaste = state.adaptiveMetaGrid ? state.metaGridWaste : -1;
+  problem.radius = state.radius;
+  problem.spaceAvail = spaceAvail;
+  problem.gasSize = gasSize;
+  problem.oneBatch = (!state.partition || (!state.autoNB && state.numOfBatches == 1));
+  problem.cellArrayCount = cellArrayCount;
+  problem.step = state.crStep;
+  // a unified grid has the points and queries; see |genCellTable|.
+  problem.occupied = state.sparseGrid ? (float)state.numPoints + state.numQueries : 0;
+  return problem;
+}
+
 float estSortLtdSize(RTNNState& state,
                 float spaceAvail,
                 int cellArrayCount,
@@ -527,21 +829,16 @@ float estSortLtdSize(RTNNState& state,
   // could |genGridInfo| too but doesn't matter
   float sceneVolume = (state.Max.x - state.Min.x) * (state.Max.y - state.Min.y) * (state.Max.z - state.Min.z);
   float numOfSortingCells = spaceAvail / (cellArrayCount * sizeof(unsigned int));
+  // a sparse grid's memory doesn't depend on the cells, only their indices do.
+  if (state.sparseGrid) numOfSortingCells = (float)NO_CELL;
   float cellSize = cbrt(sceneVolume / numOfSortingCells);
 
   if (refine) {
-    float curSortingSize = numOfSortingCells * (cellArrayCount * sizeof(unsigned int));
-    while (1) {
-      GridInfo gridInfo;
-      state.crRatio = state.radius / cellSize;
-      float numOfSortingCells = genGridInfo(state, state.numPoints, gridInfo);
-      curSortingSize = numOfSortingCells * (cellArrayCount * sizeof(unsigned int));
-
-      fprintf(stdout, "%f, %f\n", curSortingSize/1024/1024, spaceAvail/1024/1024);
-      if (curSortingSize < spaceAvail) break;
-      cellSize *= state.crStep;
-    }
-    fprintf(stdout, "\tMemory utilization: %.3f%%\n", (1 - (spaceAvail-curSortingSize)/(state.totDRAMSize*1024*1024*1024))*100.0);
+    // only the sorting arrays; the GASes come after they are freed.
+    CellSizePlan plan = solveCellSize(cellSizeProblem(state, spaceAvail, 0, cellArrayCount), cellSize);
+    cellSize = plan.cellSize;
+    fprintf(stdout, "%f, %f\n", plan.sortBytes/1024/1024, spaceAvail/1024/1024);
+    fprintf(stdout, "\tMemory utilization: %.3f%%\n", (1 - (spaceAvail-plan.sortBytes)/(state.totDRAMSize*1024*1024*1024))*100.0);
   }
   fprintf(stdout, "Sorting limited cellSize: %f\n", cellSize);
 
@@ -632,49 +929,264 @@ float calcCRRatio(RTNNState& state) {
     //   total gas size + total sorting structure size <= avail mem
     //   total gas size = (state.radius / (sqrt(3) * cellSize) + 1) * gasSize; // TODO (sqrt(2) for 2D)
     //   total sorting structure size = sceneVolume / power(cellSize, 3) * (cellArrayCount * sizeof(unsigned int));
-    //   it's a cubic equation. don't want to solve it analytically. let's do that
-    //   iteratively. the initial size is the smallest cell size that can
-    //   accommodate the entire gas or the entire sorting structures.
+    //   it's a cubic equation (with the grid rounding on top), so bisect over
+    //   the cell sizes the old crStep walk would have tried, starting from the
+    //   smallest cell size that can accommodate the entire gas or the entire
+    //   sorting structures. see cellsize.h.
 
     float cellSizeLimitedByGAS = estGASLtdSize(state, spaceAvail, gasSize);
     float cellSizeLimitedBySort = estSortLtdSize(state, spaceAvail, cellArrayCount);
     float cellSize = std::max(cellSizeLimitedBySort, cellSizeLimitedByGAS);
 
-    float curGASSize = 0;
-    float curSortingSize = 0;
-    float curTotalSize = 0;
-    float numOfBatches, numOfSortingCells;
-    bool isOneBatch = (!state.partition || (!state.autoNB && state.numOfBatches == 1));
     // TODO: the strategy here is to find the smallest cell size, which could
     // lead to a high batch number (>100) and thus increase the
     // |kCalcSearchSize| cost. this is particularly an issue when -df is
     // enabled and filters the vast majority of queries, in which case there
     // will be huge memory space left to find a very small cell size. an
     // example is: -f data/buddha.txt -q data/kitti6m.txt -fq 0
-    while (1) {
-      numOfBatches = isOneBatch ? 1.0 : state.radius / (sqrt(3) * cellSize) + 1;
-      curGASSize = numOfBatches * gasSize;
-
-      GridInfo gridInfo;
-      state.crRatio = state.radius / cellSize;
-      numOfSortingCells = genGridInfo(state, N, gridInfo);
-      curSortingSize = numOfSortingCells * (cellArrayCount * sizeof(unsigned int));
-
-      curTotalSize = curGASSize + curSortingSize;
-      fprintf(stdout, "%f+%f=%f, %f\n", curGASSize/1024/1024, curSortingSize/1024/1024, curTotalSize/1024/1024, spaceAvail/1024/1024);
-      if (curTotalSize < spaceAvail) break;
-      cellSize *= state.crStep;
-    }
+    CellSizePlan plan = solveCellSize(cellSizeProblem(state, spaceAvail, gasSize, cellArrayCount), cellSize);
+    if (!plan.fits) fprintf(stdout, "\tNo cell size fits in memory; using the largest\n");
+    cellSize = plan.cellSize;
+    float curTotalSize = plan.gasBytes + plan.sortBytes;
 
     ratio = state.radius / cellSize;
-    fprintf(stdout, "\tCalculated cellRadiusRatio: %f (%f, %f)\n", ratio, curGASSize/1024/1024, curSortingSize/1024/1024);
-    fprintf(stdout, "\tCalculated maxBatches: %.3f\n", numOfBatches);
+    fprintf(stdout, "%f+%f=%f, %f\n", plan.gasBytes/1024/1024, plan.sortBytes/1024/1024, curTotalSize/1024/1024, spaceAvail/1024/1024);
+    fprintf(stdout, "\tCalculated cellRadiusRatio: %f (%f, %f)\n", ratio, plan.gasBytes/1024/1024, plan.sortBytes/1024/1024);
+    fprintf(stdout, "\tCalculated maxBatches: %.3f\n", plan.numOfBatches);
     fprintf(stdout, "\tMemory utilization: %.3f%%\n", (1 - (spaceAvail-curTotalSize)/(state.totDRAMSize*1024*1024*1024))*100.0);
   }
 
   return ratio;
 }
 
+void setDevice ( RTNNState& state ) {
+  int32_t device_count = 0;
+  CUDA_CHECK( cudaGetDeviceCount( &device_count ) );
+  std::cerr << "\tTotal GPUs visible: " << device_count << std::endl;
+  
+  cudaDeviceProp prop;
+  CUDA_CHECK( cudaGetDeviceProperties ( &prop, state.device_id ) );
+  CUDA_CHECK( cudaSetDevice( state.device_id ) );
+  std::cerr << "\tUsing [" << state.device_id << "]: " << prop.name << std::endl;
+  state.totDRAMSize = (double)prop.totalGlobalMem/1024/1024/1024;
+  std::cerr << "\tMemory: " << state.totDRAMSize << " GB" << std::endl;
+  // conservatively reduce dram size by 256 MB as the usable memory appears to
+  // be that much smaller than what is reported, presumably to store data
+  // structures that are hidden from us.
+  state.totDRAMSize -= 0.25;
+
+  state.deviceName = prop.name;
+  if (!state.profileDir.empty() && !state.calibrate) loadDeviceProfile(state);
+}
+
+// use the cost model calibrated for this GPU, if there is one.
+void loadDeviceProfile( RTNNState& state ) {
+  std::string path = state.profileDir + "/" + costProfileName(state.deviceName);
+  CostModel model;
+  if (!loadCostProfile(path, model)) {
+    std::cerr << "\tNo cost profile at " << path << "; using the default cost model" << std::endl;
+    return;
+  }
+  if (model.device != state.deviceName) {
+    std::cerr << "\tCost profile " << path << " is for " << model.device << "; using the default cost model" << std::endl;
+    return;
+  }
+  state.costModel = model;
+  std::cerr << "\tCost model from " << path << std::endl;
+}
+
+void freeGridPointers( RTNNState& state ) {
+  for (auto it = state.d_gridPointers.begin(); it != state.d_gridPointers.end(); it++) {
+    CUDA_CHECK( cudaFree( *it ) );
+  }
+  state.d_gridPointers.clear();
+  releaseArenaScope(state, ARENA_GRID);
+  // early free is about having the memory back for the GAS, so really give it
+  // back rather than keeping it for reuse.
+  if (!state.deferFree) trimDeviceArena(state, true);
+  //fprintf(stdout, "Finish early free\n");
+}
+
+// the device side of the arena: blocks come from cudaMalloc and a fence is an
+// event recorded on the legacy default stream, which completes only after all
+// the work issued so far on the (blocking) batch streams.
+struct DeviceArena
+{
+  Arena                       arena;
+  std::deque<std::pair<uint64_t, cudaEvent_t>> fences; // in recording order
+  uint64_t                    nextFence       = 1;
+  uint64_t                    doneFence       = 0;
+};
+
+static bool deviceFenceDone(DeviceArena* a, uint64_t fence) {
+  while (!a->fences.empty() && (cudaEventQuery(a->fences.front().second) == cudaSuccess)) {
+    a->doneFence = a->fences.front().first;
+    CUDA_CHECK( cudaEventDestroy( a->fences.front().second ) );
+    a->fences.pop_front();
+  }
+  return fence <= a->doneFence;
+}
+
+static void createDeviceArena( RTNNState& state ) {
+  DeviceArena* a = new DeviceArena;
+  a->arena.allocBlock = [](size_t size) -> uintptr_t {
+    void* ptr;
+    if (cudaMalloc(&ptr, size) != cudaSuccess) {
+      cudaGetLastError(); // clear the error; the caller deals with it
+      return 0;
+    }
+    return reinterpret_cast<uintptr_t>(ptr);
+  };
+  a->arena.fenceDone = [a](uint64_t fence) { return deviceFenceDone(a, fence); };
+  state.arena = a;
+}
+
+void* arenaAllocDevice( RTNNState& state, ArenaScope scope, size_t bytes ) {
+  if (!state.useArena) {
+    void* ptr;
+    CUDA_CHECK( cudaMalloc( &ptr, bytes ) );
+    if (scope == ARENA_GRID) state.d_gridPointers.insert(ptr);
+    else state.d_pointers.insert(ptr);
+    return ptr;
+  }
+
+  if (!state.arena) createDeviceArena(state);
+  uintptr_t ptr = arenaAlloc(state.arena->arena, scope, bytes);
+  if (ptr == 0) {
+    // the free blocks may just be of the wrong sizes; give them back and retry.
+    trimDeviceArena(state, true);
+    ptr = arenaAlloc(state.arena->arena, scope, bytes);
+  }
+  if (ptr == 0) {
+    fprintf(stderr, "Out of device memory allocating %zu bytes (arena holds %.3f MB)\n",
+        bytes, (float)state.arena->arena.reserved/1024/1024);
+    exit(1);
+  }
+  return reinterpret_cast<void*>(ptr);
+}
+
+void releaseArenaScope( RTNNState& state, ArenaScope scope ) {
+  if (!state.arena || state.arena->arena.scopes[scope].empty()) return;
+  DeviceArena* a = state.arena;
+
+  cudaEvent_t event;
+  CUDA_CHECK( cudaEventCreateWithFlags( &event, cudaEventDisableTiming ) );
+  CUDA_CHECK( cudaEventRecord( event, 0 ) );
+  a->fences.push_back(std::make_pair(a->nextFence, event));
+  arenaRelease(a->arena, scope, a->nextFence++);
+}
+
+// free the arena's unused blocks; with |wait|, also those still fenced.
+void trimDeviceArena( RTNNState& state, bool wait ) {
+  if (!state.arena) return;
+  if (wait) CUDA_CHECK( cudaDeviceSynchronize() );
+  for (const auto& block : arenaTrim(state.arena->arena))
+    CUDA_CHECK( cudaFree( reinterpret_cast<void*>( block.base ) ) );
+}
+
+void destroyDeviceArena( RTNNState& state ) {
+  if (!state.arena) return;
+  DeviceArena* a = state.arena;
+  CUDA_CHECK( cudaDeviceSynchronize() );
+
+  fprintf(stdout, "\tArena peak: %.3f MB\n", (float)a->arena.peak/1024/1024);
+  for (int s = 0; s < ARENA_NUM_SCOPES; s++) arenaRelease(a->arena, (ArenaScope)s, 0);
+  for (const auto& block : arenaTrim(a->arena))
+    CUDA_CHECK( cudaFree( reinterpret_cast<void*>( block.base ) ) );
+  for (const auto& fence : a->fences) CUDA_CHECK( cudaEventDestroy( fence.second ) );
+
+  delete a;
+  state.arena = nullptr;
+}
+
+void* allocPinned( RTNNState& state, size_t bytes ) {
+  void* ptr;
+  if (!state.usePinnedPool) {
+    CUDA_CHECK( cudaMallocHost( &ptr, bytes ) );
+    return ptr;
+  }
+
+  if (!state.pinnedPool) {
+    PinnedPool* pool = new PinnedPool;
+    pool->allocHost = [](size_t size) -> void* {
+      void* p;
+      if (cudaMallocHost(&p, size) != cudaSuccess) {
+        cudaGetLastError(); // clear the error; the caller deals with it
+        return nullptr;
+      }
+      return p;
+    };
+    pool->freeHost = [](void* p) { CUDA_CHECK( cudaFreeHost( p ) ); };
+    state.pinnedPool = pool;
+  }
+
+  ptr = pinnedAcquire(*state.pinnedPool, bytes);
+  if (!ptr) {
+    // the cached buffers may just be of the wrong classes; give them back and retry.
+    pinnedTrim(*state.pinnedPool);
+    ptr = pinnedAcquire(*state.pinnedPool, bytes);
+  }
+  if (!ptr) {
+    fprintf(stderr, "Out of pinned host memory allocating %zu bytes\n", bytes);
+    exit(1);
+  }
+  return ptr;
+}
+
+void freePinned( RTNNState& state, void* ptr ) {
+  if (!ptr) return;
+  if (state.usePinnedPool) pinnedRelease(*state.pinnedPool, ptr);
+  else CUDA_CHECK( cudaFreeHost( ptr ) );
+}
+
+void destroyPinnedPool( RTNNState& state ) {
+  PinnedPool* pool = state.pinnedPool;
+  if (!pool) return;
+
+  fprintf(stdout, "\tPinned pool high-water: %.3f MB in use, %.3f MB reserved (%u hits, %u misses)\n",
+      (float)pool->highWater/1024/1024, (float)pool->peakReserved/1024/1024, pool->hits, pool->misses);
+  for (const auto& out : pool->classOf) pool->freeHost(out.first);
+  pinnedTrim(*pool);
+
+  delete pool;
+  state.pinnedPool = nullptr;
+}
+
+// chunks are copied into alternating pinned buffers, so the memcpy into one
+// overlaps the DMA out of the other.
+static const size_t STAGING_CHUNK = 8 << 20;
+
+void uploadStaged( RTNNState& state, void* dst, const void* src, size_t bytes ) {
+  if (!state.usePinnedPool || (bytes <= STAGING_CHUNK / 8)) {
+    CUDA_CHECK( cudaMemcpy( dst, src, bytes, cudaMemcpyHostToDevice ) );
+    return;
+  }
+
+  char* staging[2];
+  cudaEvent_t copied[2];
+  for (int b = 0; b < 2; b++) {
+    staging[b] = static_cast<char*>(allocPinned(state, STAGING_CHUNK));
+    CUDA_CHECK( cudaEventCreateWithFlags( &copied[b], cudaEventDisableTiming ) );
+  }
+
+  size_t i = 0;
+  for (size_t offset = 0; offset < bytes; offset += STAGING_CHUNK, i++) {
+    int b = i % 2;
+    size_t n = std::min(STAGING_CHUNK, bytes - offset);
+    // wait for the copy out of this buffer two chunks ago
+    if (i >= 2) CUDA_CHECK( cudaEventSynchronize( copied[b] ) );
+    memcpy(staging[b], static_cast<const char*>(src) + offset, n);
+    CUDA_CHECK( cudaMemcpyAsync( static_cast<char*>(dst) + offset, staging[b], n, cudaMemcpyHostToDevice, 0 ) );
+    CUDA_CHECK( cudaEventRecord( copied[b], 0 ) );
+  }
+  CUDA_CHECK( cudaStreamSynchronize( 0 ) );
+
+  for (int b = 0; b < 2; b++) {
+    CUDA_CHECK( cudaEventDestroy( copied[b] ) );
+    freePinned(state, staging[b]);
+  }
+}
+
 void initBatches(RTNNState& state) {
   Timing::startTiming("create data structures");
   if (state.autoCR) {
@@ -693,12 +1205,17 @@ void initBatches(RTNNState& state) {
 
   state.gas_handle = new OptixTraversableHandle[maxBatchCount];
   state.d_gas_output_buffer = new CUdeviceptr[maxBatchCount]();
+  state.gas_size = new size_t[maxBatchCount]();
   state.stream = new cudaStream_t[maxBatchCount];
   state.d_r2q_map = new unsigned int*[maxBatchCount]();
   state.numActQueries = new unsigned int[maxBatchCount];
   state.launchRadius = new float[maxBatchCount];
   state.h_res = new void*[maxBatchCount]();
+  state.h_resOffsets = new unsigned int*[maxBatchCount]();
+  state.d_res = new unsigned int*[maxBatchCount]();
+  state.d_resOffsets = new unsigned int*[maxBatchCount]();
   state.d_actQs = new float3*[maxBatchCount]();
+  state.d_actQIds = new unsigned int*[maxBatchCount]();
   state.h_actQs = new float3*[maxBatchCount]();
   state.d_aabb = new void*[maxBatchCount]();
   state.d_temp_buffer_gas = new void*[maxBatchCount]();
@@ -710,6 +1227,34 @@ void initBatches(RTNNState& state) {
   Timing::stopTiming(true);
 }
 
+// same as |initBatches| but for exactly one batch (the server, the sliding
+// window).
+void initSingleBatch(RTNNState& state) {
+  state.maxBatchCount = 1;
+  state.numOfBatches = 1;
+
+  state.gas_handle = new OptixTraversableHandle[1];
+  state.d_gas_output_buffer = new CUdeviceptr[1]();
+  state.gas_size = new size_t[1]();
+  state.stream = new cudaStream_t[1];
+  state.d_r2q_map = new unsigned int*[1]();
+  state.numActQueries = new unsigned int[1]();
+  state.launchRadius = new float[1];
+  state.h_res = new void*[1]();
+  state.h_resOffsets = new unsigned int*[1]();
+  state.d_res = new unsigned int*[1]();
+  state.d_resOffsets = new unsigned int*[1]();
+  state.d_actQs = new float3*[1]();
+  state.d_actQIds = new unsigned int*[1]();
+  state.h_actQs = new float3*[1]();
+  state.d_aabb = new void*[1]();
+  state.d_temp_buffer_gas = new void*[1]();
+  state.d_buffer_temp_output_gas_and_compacted_size = new void*[1]();
+  state.pipeline = new OptixPipeline[1];
+
+  CUDA_CHECK( cudaStreamCreate( &state.stream[0] ) );
+}
+
 bool isClose(float3 a, float3 b) {
   if (fabs(a.x - b.x) < 0.001 && fabs(a.y - b.y) < 0.001 && fabs(a.z - b.z) < 0.001) return true;
   else return false;
@@ -0,0 +1,41 @@
+#include <atomic>
+#include <climits>
+
+#include <sutil/vec_math.h>
+
+#include "verlet.h"
+#include "parallel.h"
+
+bool needVerletRebuild(float maxDisp, float skin, bool movingQueries) {
+  return maxDisp > (movingQueries ? skin / 2 : skin);
+}
+
+unsigned int countFullLists(const unsigned int* lists, unsigned int numQueries, unsigned int limit, unsigned int numThreads) {
+  std::atomic<unsigned int> numFull(0);
+  parallelFor(numQueries, numThreads, [&](unsigned int b, unsigned int e, unsigned int) {
+    unsigned int n = 0;
+    for (unsigned int q = b; q < e; q++)
+      if (lists[(size_t)q * limit + limit - 1] != UINT_MAX) n++;
+    numFull += n;
+  });
+  return numFull;
+}
+
+void filterVerletLists(const unsigned int* lists, unsigned int numQueries, unsigned int limit,
+                       const float3* queries, const float3* points, float radius,
+                       unsigned int* res, unsigned int numThreads) {
+  float sqRadius = radius * radius;
+  parallelFor(numQueries, numThreads, [&](unsigned int b, unsigned int e, unsigned int) {
+    for (unsigned int q = b; q < e; q++) {
+      const unsigned int* list = lists + (size_t)q * limit;
+      unsigned int* row = res + (size_t)q * limit;
+      unsigned int size = 0;
+      // same test as the search itself (see |check_intersect|)
+      for (unsigned int j = 0; j < limit && list[j] != UINT_MAX; j++) {
+        float3 O = queries[q] - points[list[j]];
+        if (dot(O, O) < sqRadius) row[size++] = list[j];
+      }
+      for (unsigned int j = size; j < limit; j++) row[j] = UINT_MAX;
+    }
+  });
+}
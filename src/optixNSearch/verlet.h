@@ -0,0 +1,19 @@
+#pragma once
+
+#include <vector_types.h>
+
+// Verlet neighbor lists: search once with radius + skin, keep the lists, and
+// between rebuilds only filter the kept lists against the actual radius. A
+// pair that is within the radius now was within radius + skin at the build
+// as long as the two points together moved less than the skin, i.e., as long
+// as no point moved more than skin / 2 (or skin, if only the points move and
+// the queries stay put). Lists are |limit| slots per query, padded with UINT_MAX,
+// and hold indices into |points|.
+
+bool needVerletRebuild(float maxDisp, float skin, bool movingQueries);
+// number of lists that are full; those may have dropped pairs within
+// radius + skin, which the filtering can't bring back.
+unsigned int countFullLists(const unsigned int*, unsigned int, unsigned int, unsigned int numThreads = 0);
+// keep the entries of each list within |radius| of its query (current
+// positions) and write them to |res| in the same layout.
+void filterVerletLists(const unsigned int*, unsigned int, unsigned int, const float3*, const float3*, float, unsigned int*, unsigned int numThreads = 0);
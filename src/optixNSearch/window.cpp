@@ -0,0 +1,80 @@
+#include <algorithm>
+
+#include "window.h"
+
+int addFrame(FrameWindow& window, unsigned int count) {
+  FrameSegment seg = {window.nextFrameId++, window.used, count, true};
+  window.segments.push_back(seg);
+  window.used += count;
+  window.numLive += count;
+  return seg.frameId;
+}
+
+bool removeFrame(FrameWindow& window, int frameId) {
+  auto it = std::find_if(window.segments.begin(), window.segments.end(),
+      [&](const FrameSegment& seg) { return seg.live && (seg.frameId == frameId); });
+  if (it == window.segments.end()) return false;
+
+  it->live = false;
+  window.numLive -= it->count;
+
+  // nothing lives after a dead tail, so it's free space already.
+  while (!window.segments.empty() && !window.segments.back().live) {
+    window.used = window.segments.back().offset;
+    window.segments.pop_back();
+  }
+  return true;
+}
+
+const FrameSegment* findFrame(const FrameWindow& window, int frameId) {
+  for (const auto& seg : window.segments)
+    if (seg.live && (seg.frameId == frameId)) return &seg;
+  return nullptr;
+}
+
+int oldestFrame(const FrameWindow& window) {
+  // frame ids only grow, and compaction keeps the slot order.
+  for (const auto& seg : window.segments)
+    if (seg.live) return seg.frameId;
+  return -1;
+}
+
+unsigned int numLiveFrames(const FrameWindow& window) {
+  return std::count_if(window.segments.begin(), window.segments.end(),
+      [](const FrameSegment& seg) { return seg.live; });
+}
+
+bool needCompaction(const FrameWindow& window, float maxDeadRatio) {
+  unsigned int numDead = window.used - window.numLive;
+  return (numDead > 0) && (numDead > maxDeadRatio * window.used);
+}
+
+std::vector<SegmentMove> compactFrames(FrameWindow& window) {
+  std::vector<SegmentMove> moves;
+  std::vector<FrameSegment> live;
+  unsigned int next = 0;
+
+  for (const auto& seg : window.segments) {
+    if (!seg.live) continue;
+    moves.push_back({seg.offset, next, seg.count});
+    live.push_back({seg.frameId, next, seg.count, true});
+    next += seg.count;
+  }
+
+  window.segments.swap(live);
+  window.used = next;
+  return moves;
+}
+
+bool locateSlot(const FrameWindow& window, unsigned int slot, int& frameId, unsigned int& pos) {
+  // the last segment starting at or before |slot|
+  auto it = std::upper_bound(window.segments.begin(), window.segments.end(), slot,
+      [](unsigned int s, const FrameSegment& seg) { return s < seg.offset; });
+  if (it == window.segments.begin()) return false;
+  --it;
+
+  if (!it->live || (slot >= it->offset + it->count)) return false;
+  frameId = it->frameId;
+  pos = slot - it->offset;
+  return true;
+}
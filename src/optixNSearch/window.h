@@ -0,0 +1,66 @@
+#pragma once
+
+#include <cstring>
+#include <vector>
+
+// Slot bookkeeping of a sliding window of frames (e.g., LiDAR sweeps), see
+// |rtnn::SlidingWindow|. The points of all frames in the window live in one
+// array; every frame owns a contiguous segment of slots in it. A new frame is
+// appended after the last segment. Removing a frame only marks its segment
+// dead (a tombstone), so no other frame moves and nothing built over the other
+// frames (their sorted order, their GASes) has to be redone; the dead slots are
+// reclaimed by |compactFrames|, which packs the live segments to the front.
+//
+// Everything here is plain host code and never touches the point data; the
+// caller moves the data as told by |compactFrames|.
+
+struct FrameSegment
+{
+  int                         frameId;
+  unsigned int                offset; // first slot
+  unsigned int                count;
+  bool                        live;
+};
+
+struct SegmentMove
+{
+  unsigned int                from;
+  unsigned int                to; // never after |from|
+  unsigned int                count;
+};
+
+struct FrameWindow
+{
+  std::vector<FrameSegment>   segments; // in slot order, tombstones included
+  unsigned int                used            = 0; // slots up to the end of the last segment
+  unsigned int                numLive         = 0; // slots of live segments
+  int                         nextFrameId     = 0;
+};
+
+// append a segment of |count| slots at |used|; returns its frame id.
+int addFrame(FrameWindow&, unsigned int);
+// false if there is no live frame with that id. dead segments at the end are
+// dropped right away, so their slots are reused by the next |addFrame|.
+bool removeFrame(FrameWindow&, int);
+const FrameSegment* findFrame(const FrameWindow&, int);
+// the live frame added first; -1 if the window is empty.
+int oldestFrame(const FrameWindow&);
+unsigned int numLiveFrames(const FrameWindow&);
+// true once the dead slots are more than |maxDeadRatio| of the used ones.
+bool needCompaction(const FrameWindow&, float maxDeadRatio);
+// drop the tombstones and pack the live segments to the front, in order. the
+// returned moves cover every live segment (including those that stay put, so
+// that they also describe a copy into a fresh array) in slot order.
+std::vector<SegmentMove> compactFrames(FrameWindow&);
+// the frame owning |slot| and the slot's position in that frame's segment;
+// false if the slot is unused or dead.
+bool locateSlot(const FrameWindow&, unsigned int slot, int& frameId, unsigned int& pos);
+
+// apply |moves| to an array in place. moves go towards the front and are in
+// slot order, so every source is read before it is overwritten.
+template <typename T> void applyMoves(const std::vector<SegmentMove>& moves, T* data) {
+  for (const auto& move : moves) {
+    if (move.from == move.to) continue;
+    memmove(data + move.to, data + move.from, (size_t)move.count * sizeof(T));
+  }
+}
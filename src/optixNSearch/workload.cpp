@@ -0,0 +1,216 @@
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <vector>
+
+#include <sutil/vec_math.h>
+
+#include "workload.h"
+#include "parallel.h"
+
+// the stream the scene layout is drawn from; point streams are small numbers.
+static const uint64_t LAYOUT_STREAM = ~0ull;
+
+static inline uint64_t mix64(uint64_t z) {
+  z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ull;
+  z = (z ^ (z >> 27)) * 0x94d049bb133111ebull;
+  return z ^ (z >> 31);
+}
+
+WorkloadRng::WorkloadRng(uint64_t seed, uint64_t stream, uint64_t index) {
+  state = mix64(mix64(seed) ^ (stream * 0xd1b54a32d192ed03ull)) ^ (index * 0x9e3779b97f4a7c15ull);
+}
+
+uint64_t WorkloadRng::next() {
+  state += 0x9e3779b97f4a7c15ull;
+  return mix64(state);
+}
+
+float WorkloadRng::uniform() {
+  return (next() >> 40) * (1.0f / 16777216.0f);
+}
+
+float WorkloadRng::normal() {
+  // Box-Muller; 1 - u keeps the log finite.
+  float u1 = 1.0f - uniform();
+  float u2 = uniform();
+  return sqrtf(-2.0f * logf(u1)) * cosf(2.0f * (float)M_PI * u2);
+}
+
+static const char* kindNames[] = {"uniform", "clusters", "surface", "lidar", "nbody"};
+
+bool parseWorkloadKind(const char* name, WorkloadKind& kind) {
+  for (int i = 0; i < (int)(sizeof(kindNames) / sizeof(kindNames[0])); i++) {
+    if (strcmp(name, kindNames[i]) == 0) {
+      kind = (WorkloadKind)i;
+      return true;
+    }
+  }
+  return false;
+}
+
+const char* workloadKindName(WorkloadKind kind) {
+  return kindNames[kind];
+}
+
+static inline float3 uniformIn(WorkloadRng& rng, float3 lo, float3 size) {
+  float x = rng.uniform();
+  float y = rng.uniform();
+  float z = rng.uniform();
+  return lo + size * make_float3(x, y, z);
+}
+
+static inline float3 unitVector(WorkloadRng& rng) {
+  while (1) {
+    float x = rng.normal();
+    float y = rng.normal();
+    float z = rng.normal();
+    float3 v = make_float3(x, y, z);
+    float len = length(v);
+    if (len > 1e-6f) return v / len;
+  }
+}
+
+// what the generators share across points; drawn from |LAYOUT_STREAM|.
+struct WorkloadLayout
+{
+  std::vector<float3>         centers;  // clusters and halos
+  std::vector<float>          scales;   // halo Plummer radii
+  std::vector<float>          cdf;      // cumulative halo masses
+
+  // LiDAR: per azimuth sector, the range of the background and of an
+  // obstacle (0 if none) and the obstacle height.
+  std::vector<float>          farRange;
+  std::vector<float>          obstacleRange;
+  std::vector<float>          obstacleHeight;
+};
+
+static const unsigned int LIDAR_SECTORS = 360;
+static const float LIDAR_MIN_ELEVATION = -24.9f; // degrees; the spread of a 64-beam sensor
+static const float LIDAR_MAX_ELEVATION = 2.0f;
+static const float PLUMMER_CUTOFF = 10.0f; // halos are truncated at this many scale radii
+
+static void genLayout(const WorkloadParams& p, WorkloadLayout& layout) {
+  WorkloadRng rng(p.seed, LAYOUT_STREAM, 0);
+  float maxExtent = std::max({p.extent.x, p.extent.y, p.extent.z});
+  unsigned int numClusters = std::max(p.clusters, 1u);
+
+  if (p.kind == WORKLOAD_CLUSTERS || p.kind == WORKLOAD_NBODY) {
+    // keep the centers off the walls so that most of each cluster fits.
+    for (unsigned int c = 0; c < numClusters; c++)
+      layout.centers.push_back(uniformIn(rng, p.extent * 0.1f, p.extent * 0.8f));
+  }
+
+  if (p.kind == WORKLOAD_NBODY) {
+    // Pareto masses; a halo's radius grows with the cube root of its mass
+    // so that the heavy halos are also the dense ones, but less than
+    // linearly in the point count.
+    std::vector<float> mass(numClusters);
+    for (unsigned int c = 0; c < numClusters; c++)
+      mass[c] = powf(1.0f - rng.uniform(), -1.0f / std::max(p.alpha, 0.1f));
+    float maxMass = *std::max_element(mass.begin(), mass.end());
+    float total = 0;
+    for (unsigned int c = 0; c < numClusters; c++) {
+      layout.scales.push_back(p.spread * maxExtent * cbrtf(mass[c] / maxMass));
+      total += mass[c];
+      layout.cdf.push_back(total);
+    }
+  }
+
+  if (p.kind == WORKLOAD_LIDAR) {
+    float range = 0.5f * std::min(p.extent.x, p.extent.y);
+    for (unsigned int s = 0; s < LIDAR_SECTORS; s++) {
+      layout.farRange.push_back(range * (0.5f + 0.5f * rng.uniform()));
+      bool obstacle = rng.uniform() < 0.3f;
+      float r = range * (0.05f + 0.45f * rng.uniform());
+      float h = range * (0.01f + 0.04f * rng.uniform());
+      layout.obstacleRange.push_back(obstacle ? r : 0.0f);
+      layout.obstacleHeight.push_back(h);
+    }
+  }
+}
+
+static float3 genLidarPoint(const WorkloadParams& p, const WorkloadLayout& layout, WorkloadRng& rng,
+                            unsigned int i, unsigned int N) {
+  // point i is the (i / rings)-th firing of beam i % rings, so the scan
+  // sweeps the full circle once and every beam gets the same share.
+  unsigned int rings = std::max(p.rings, 1u);
+  unsigned int ring = i % rings;
+  unsigned int firing = i / rings;
+  unsigned int firings = (N + rings - 1) / rings;
+
+  float range = 0.5f * std::min(p.extent.x, p.extent.y);
+  float height = 0.022f * range; // the sensor height of a car-mounted scanner
+  float3 sensor = make_float3(0.5f * p.extent.x, 0.5f * p.extent.y, height);
+
+  float elevation = LIDAR_MIN_ELEVATION;
+  if (rings > 1) elevation += (LIDAR_MAX_ELEVATION - LIDAR_MIN_ELEVATION) * ring / (rings - 1);
+  elevation *= (float)M_PI / 180.0f;
+  float azimuth = 2.0f * (float)M_PI * (firing + rng.uniform()) / firings;
+
+  unsigned int sector = std::min((unsigned int)(azimuth / (2.0f * (float)M_PI) * LIDAR_SECTORS), LIDAR_SECTORS - 1);
+  float hit = layout.farRange[sector];
+  if (elevation < 0) hit = std::min(hit, height / tanf(-elevation));
+  float obstacle = layout.obstacleRange[sector];
+  if (obstacle > 0 && obstacle < hit) {
+    float z = height + obstacle * tanf(elevation);
+    if (z >= 0 && z <= layout.obstacleHeight[sector]) hit = obstacle;
+  }
+  hit = std::max(hit + 0.002f * range * rng.normal(), 0.0f);
+
+  float3 dir = make_float3(cosf(elevation) * cosf(azimuth), cosf(elevation) * sinf(azimuth), sinf(elevation));
+  return sensor + dir * hit;
+}
+
+static float3 genNbodyPoint(const WorkloadLayout& layout, WorkloadRng& rng) {
+  float u = rng.uniform() * layout.cdf.back();
+  size_t h = std::min((size_t)(std::upper_bound(layout.cdf.begin(), layout.cdf.end(), u) - layout.cdf.begin()),
+                      layout.cdf.size() - 1);
+
+  // invert the Plummer mass profile M(r) = r^3 / (r^2 + a^2)^(3/2),
+  // truncated at |PLUMMER_CUTOFF| scale radii; density falls as r^-5.
+  float c = PLUMMER_CUTOFF;
+  float maxMass = c * c * c / powf(1.0f + c * c, 1.5f);
+  float m = (1.0f - rng.uniform()) * maxMass;
+  float r = layout.scales[h] / sqrtf(powf(m, -2.0f / 3.0f) - 1.0f);
+  return layout.centers[h] + unitVector(rng) * r;
+}
+
+static float3 genPoint(const WorkloadParams& p, const WorkloadLayout& layout, WorkloadRng& rng,
+                       unsigned int i, unsigned int N) {
+  float maxExtent = std::max({p.extent.x, p.extent.y, p.extent.z});
+  switch (p.kind) {
+    case WORKLOAD_CLUSTERS: {
+      unsigned int c = std::min((unsigned int)(rng.uniform() * layout.centers.size()), (unsigned int)layout.centers.size() - 1);
+      float x = rng.normal();
+      float y = rng.normal();
+      float z = rng.normal();
+      return layout.centers[c] + make_float3(x, y, z) * (p.spread * maxExtent);
+    }
+    case WORKLOAD_SURFACE: {
+      // an ellipsoid inscribed in the box, blurred along its normal.
+      float3 dir = unitVector(rng);
+      float3 radii = p.extent * 0.4f;
+      return p.extent * 0.5f + radii * dir + dir * (p.spread * 0.1f * maxExtent * rng.normal());
+    }
+    case WORKLOAD_LIDAR:
+      return genLidarPoint(p, layout, rng, i, N);
+    case WORKLOAD_NBODY:
+      return genNbodyPoint(layout, rng);
+    default:
+      return uniformIn(rng, make_float3(0.0f), p.extent);
+  }
+}
+
+void generateWorkload(const WorkloadParams& p, uint64_t stream, unsigned int N, float3* points, unsigned int numThreads) {
+  WorkloadLayout layout;
+  genLayout(p, layout);
+
+  parallelFor(N, numThreads, [&](unsigned int b, unsigned int e, unsigned int) {
+    for (unsigned int i = b; i < e; i++) {
+      WorkloadRng rng(p.seed, stream, i);
+      // whatever spills over the walls is pushed back onto them.
+      points[i] = clamp(genPoint(p, layout, rng, i, N), make_float3(0.0f), p.extent);
+    }
+  });
+}
@@ -0,0 +1,58 @@
+#pragma once
+
+#include <cstdint>
+
+#include <vector_types.h>
+
+// Synthetic point clouds with controlled density skew, for evaluating the
+// cost model and the sort modes without the original datasets; rtnnGen
+// (gen.cpp) writes them to disk. Every point lies in the box [0, |extent|].
+//
+// The output is independent of the number of threads and of <random>'s
+// distributions: each point draws from its own counter-based generator (see
+// |WorkloadRng|), and the normal and other deviates are computed here rather
+// than by those distributions, whose algorithms are implementation-defined.
+// It isn't independent of the math library: logf, sinf, cosf, powf and tanf
+// may differ in the last ulp between libm versions, and so may the points.
+// The scene layout (cluster centers, halos, obstacles) comes from the seed
+// alone, so a query set generated with another stream follows the same
+// distribution as the points. Plain host code.
+
+enum WorkloadKind
+{
+  WORKLOAD_UNIFORM,
+  WORKLOAD_CLUSTERS,  // isotropic Gaussian clusters of equal weight
+  WORKLOAD_SURFACE,   // a thin ellipsoidal shell, like a scanned object
+  WORKLOAD_LIDAR,     // rotating multi-beam scan over a ground plane; density falls off with range
+  WORKLOAD_NBODY,     // Plummer halos with power-law masses
+};
+
+struct WorkloadParams
+{
+  WorkloadKind                kind      = WORKLOAD_UNIFORM;
+  float3                      extent    = {100.0f, 100.0f, 100.0f};
+  uint64_t                    seed      = 1;
+  unsigned int                clusters  = 16;     // Gaussian clusters or N-body halos
+  float                       spread    = 0.02f;  // cluster sigma / halo scale relative to the largest extent; a tenth of it is the shell thickness
+  unsigned int                rings     = 64;     // LiDAR beams
+  float                       alpha     = 1.5f;   // Pareto exponent of the halo masses; smaller is more skewed
+};
+
+// a SplitMix64 stream; |stream| and |index| select an independent sequence.
+struct WorkloadRng
+{
+  uint64_t                    state;
+
+  WorkloadRng(uint64_t seed, uint64_t stream, uint64_t index);
+  uint64_t next();
+  float uniform(); // [0, 1)
+  float normal();
+};
+
+// "uniform", "clusters", "surface", "lidar" or "nbody"; false if unknown.
+bool parseWorkloadKind(const char*, WorkloadKind&);
+const char* workloadKindName(WorkloadKind);
+
+// |N| points of stream |stream| (e.g., 0 for the search points and 1 for the
+// queries), on |numThreads| host threads.
+void generateWorkload(const WorkloadParams&, uint64_t stream, unsigned int N, float3* points, unsigned int numThreads);
@@ -0,0 +1,149 @@
+#include <sutil/Exception.h>
+#include <thrust/device_vector.h>
+#include <thrust/copy.h>
+
+#include <climits>
+#include <cstring>
+#include <string>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include "optixNSearch.h"
+#include "state.h"
+#include "func.h"
+#include "writer.h"
+
+// npy format 1.0: magic, version, a little-endian uint16 header length, and a
+// python dict literal padded with spaces (and a final newline) so that the
+// data starts at a multiple of 64 bytes.
+static std::string npyHeader(unsigned int numQueries, unsigned int k) {
+  std::string dict = "{'descr': '<u4', 'fortran_order': False, 'shape': (" +
+      std::to_string(numQueries) + ", " + std::to_string(k) + "), }";
+  size_t len = 10 + dict.size() + 1;
+  dict.append((64 - len % 64) % 64, ' ');
+  dict += '\n';
+
+  std::string header("\x93NUMPY\x01\x00", 8);
+  header += (char)(dict.size() & 0xff);
+  header += (char)(dict.size() >> 8);
+  return header + dict;
+}
+
+static void writeBatch(RTNNState& state, ResultWriter& writer, const ResultJob& job) {
+  unsigned int numQueries = state.numActQueries[job.batch_id];
+  for (unsigned int q = 0; q < numQueries; q++) {
+    unsigned int size;
+    const unsigned int* neighbors = getNeighbors(state, job.batch_id, q, size);
+    unsigned int qid = job.h_queryIds ? job.h_queryIds[q] : q;
+    unsigned int* row = writer.rows + (size_t)qid * writer.k;
+    if (writer.pointIds.empty()) memcpy(row, neighbors, size * sizeof(unsigned int));
+    else for (unsigned int j = 0; j < size; j++) row[j] = writer.pointIds[neighbors[j]];
+  }
+}
+
+static void runWriter(RTNNState& state, ResultWriter& writer) {
+  if (state.backend == "gpu") CUDA_CHECK( cudaSetDevice( state.device_id ) );
+
+  // unused slots and filtered queries; done here so that it overlaps the search.
+  memset(writer.rows, 0xff, (size_t)writer.numQueries * writer.k * sizeof(unsigned int));
+
+  while (1) {
+    ResultJob job;
+    {
+      std::unique_lock<std::mutex> guard(writer.lock);
+      writer.cv.wait(guard, [&] { return !writer.jobs.empty() || writer.closing; });
+      if (writer.jobs.empty()) break;
+      job = writer.jobs.front();
+      writer.jobs.pop_front();
+    }
+
+    if (job.done) CUDA_CHECK( cudaEventSynchronize( job.done ) );
+    writeBatch(state, writer, job);
+
+    std::lock_guard<std::mutex> guard(writer.lock);
+    writer.finished.push_back(job);
+  }
+}
+
+// call once the points are sorted (the point ids are final) and before the
+// first batch is searched. |numQueries| is the number of queries passed in,
+// i.e., before any filtering.
+void startResultWriter(RTNNState& state, unsigned int numQueries) {
+  ResultWriter* writer = new ResultWriter();
+  writer->numQueries = numQueries;
+  writer->k = state.knn;
+
+  if (state.d_pointIds) {
+    writer->pointIds.resize(state.numPoints);
+    thrust::copy(thrust::device_pointer_cast(state.d_pointIds),
+        thrust::device_pointer_cast(state.d_pointIds) + state.numPoints, writer->pointIds.begin());
+  }
+
+  std::string header = npyHeader(numQueries, state.knn);
+  writer->size = header.size() + (size_t)numQueries * state.knn * sizeof(unsigned int);
+  writer->fd = open(state.outFile.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+  if (writer->fd < 0 || ftruncate(writer->fd, writer->size) != 0) {
+    perror(("Could not create " + state.outFile).c_str());
+    exit(1);
+  }
+  writer->base = mmap(nullptr, writer->size, PROT_READ | PROT_WRITE, MAP_SHARED, writer->fd, 0);
+  if (writer->base == MAP_FAILED) {
+    perror(("Could not map " + state.outFile).c_str());
+    exit(1);
+  }
+  memcpy(writer->base, header.data(), header.size());
+  writer->rows = reinterpret_cast<unsigned int*>(static_cast<char*>(writer->base) + header.size());
+
+  state.writer = writer;
+  writer->thread = std::thread(runWriter, std::ref(state), std::ref(*writer));
+}
+
+// hand batch |batch_id| to the writer. on the GPU, call this right after its
+// D2H copy is issued on the batch's stream.
+void writeResultAsync(RTNNState& state, int batch_id) {
+  ResultWriter* writer = state.writer;
+  ResultJob job = {batch_id, nullptr, nullptr};
+
+  if (state.backend == "gpu") {
+    unsigned int numQueries = state.numActQueries[batch_id];
+    cudaStream_t stream = state.stream[batch_id];
+    if (state.d_actQIds && state.d_actQIds[batch_id]) {
+      job.h_queryIds = static_cast<unsigned int*>(allocPinned(state, numQueries * sizeof(unsigned int)));
+      CUDA_CHECK( cudaMemcpyAsync( job.h_queryIds, state.d_actQIds[batch_id],
+                      numQueries * sizeof(unsigned int), cudaMemcpyDeviceToHost, stream ) );
+    }
+    CUDA_CHECK( cudaEventCreateWithFlags( &job.done, cudaEventDisableTiming ) );
+    CUDA_CHECK( cudaEventRecord( job.done, stream ) );
+  }
+
+  std::lock_guard<std::mutex> guard(writer->lock);
+  writer->jobs.push_back(job);
+  writer->cv.notify_one();
+}
+
+// wait for the queued batches to be written and close the file.
+void finishResultWriter(RTNNState& state) {
+  ResultWriter* writer = state.writer;
+  if (!writer) return;
+
+  {
+    std::lock_guard<std::mutex> guard(writer->lock);
+    writer->closing = true;
+  }
+  writer->cv.notify_one();
+  writer->thread.join();
+
+  for (auto& job : writer->finished) {
+    if (job.done) CUDA_CHECK( cudaEventDestroy( job.done ) );
+    freePinned(state, job.h_queryIds);
+  }
+
+  munmap(writer->base, writer->size);
+  close(writer->fd);
+  fprintf(stdout, "\tWrote %u x %u results to %s\n", writer->numQueries, writer->k, state.outFile.c_str());
+
+  delete writer;
+  state.writer = nullptr;
+}
@@ -0,0 +1,44 @@
+#pragma once
+
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include <cuda_runtime.h>
+
+// Streams the search results into a .npy file (--out) on a background thread.
+// The file holds one uint32 array of shape (numQueries, K) in the original
+// query order; each row lists the neighbors of that query as indices into the
+// original (unsorted) points and is padded with UINT_MAX, whatever the in-memory
+// result layout (padded or CSR) is. Rows of filtered queries stay all UINT_MAX.
+//
+// |search| hands each batch to the writer right after issuing its D2H copy;
+// the writer waits on an event recorded behind the copy and then scatters the
+// batch into the memory-mapped file while the following batches run.
+struct ResultJob
+{
+  int                         batch_id;
+  cudaEvent_t                 done; // null when the results are already on the host (CPU backend)
+  unsigned int*               h_queryIds; // null for the identity
+};
+
+struct ResultWriter
+{
+  int                         fd              = -1;
+  void*                       base            = nullptr;
+  size_t                      size            = 0;
+  unsigned int*               rows            = nullptr;
+  unsigned int                numQueries      = 0;
+  unsigned int                k               = 0;
+  std::vector<unsigned int>   pointIds; // original id of each sorted point; empty for the identity
+
+  std::thread                 thread;
+  std::mutex                  lock;
+  std::condition_variable     cv;
+  std::deque<ResultJob>       jobs;
+  bool                        closing         = false;
+  std::vector<ResultJob>      finished; // events and pinned ids are released in |finishResultWriter|
+};
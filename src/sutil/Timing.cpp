@@ -1,7 +1,226 @@
 #include "Timing.h"
 
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <map>
+#include <memory>
+#include <unordered_set>
+
 std::unordered_map<int, AverageTime> Timing::m_averageTimes;
-std::stack<TimingHelper> Timing::m_timingStack;
+std::mutex Timing::m_averageLock;
+thread_local std::stack<TimingHelper> Timing::m_timingStack;
 bool Timing::m_dontPrintTimes = false;
-unsigned int Timing::m_startCounter = 0;
-unsigned int Timing::m_stopCounter = 0;
+std::atomic<unsigned int> Timing::m_startCounter(0);
+std::atomic<unsigned int> Timing::m_stopCounter(0);
+
+bool Timing::m_trace = false;
+TimingClock::time_point Timing::m_traceEpoch;
+thread_local TraceBuffer* Timing::m_traceBuffer = nullptr;
+thread_local int Timing::m_batch = -1;
+thread_local int Timing::m_stream = -1;
+
+// events kept per thread; 40 bytes each.
+static const size_t TRACE_CAPACITY = 1 << 16;
+
+static std::mutex s_nameLock;
+static std::unordered_set<std::string> s_names;
+
+static std::mutex s_traceLock;
+static std::vector<std::unique_ptr<TraceBuffer>> s_traceBuffers;
+static std::string s_chromeFile;
+static std::string s_profileFile;
+
+const char* Timing::internName(const std::string& name)
+{
+	std::lock_guard<std::mutex> guard(s_nameLock);
+	return s_names.insert(name).first->c_str();
+}
+
+void Timing::registerTraceBuffer()
+{
+	// left uninitialized so that the pages are only touched as the ring fills.
+	std::lock_guard<std::mutex> guard(s_traceLock);
+	TraceBuffer* buffer = new TraceBuffer;
+	buffer->events.reset(new TraceEvent[TRACE_CAPACITY]);
+	buffer->capacity = TRACE_CAPACITY;
+	buffer->count = 0;
+	buffer->tid = (int)s_traceBuffers.size();
+	s_traceBuffers.emplace_back(buffer);
+	m_traceBuffer = buffer;
+}
+
+void Timing::recordTrace(const TimingHelper& h, TimingClock::time_point stop, int depth)
+{
+	if (!m_traceBuffer)
+		registerTraceBuffer();
+
+	TraceEvent& e = m_traceBuffer->events[m_traceBuffer->count % m_traceBuffer->capacity];
+	e.name = h.name;
+	e.begin = std::chrono::duration_cast<std::chrono::nanoseconds>(h.start - m_traceEpoch).count();
+	e.end = std::chrono::duration_cast<std::chrono::nanoseconds>(stop - m_traceEpoch).count();
+	e.depth = depth;
+	e.batch = h.batch;
+	e.stream = h.stream;
+	m_traceBuffer->count++;
+}
+
+static void dumpAtExit()
+{
+	Timing::dumpTrace();
+}
+
+void Timing::enableTrace(const std::string& chromeFile, const std::string& profileFile)
+{
+	{
+		std::lock_guard<std::mutex> guard(s_traceLock);
+		s_chromeFile = chromeFile;
+		s_profileFile = profileFile;
+		if (m_trace)
+			return;
+		m_traceEpoch = TimingClock::now();
+		m_trace = true;
+		std::atexit(dumpAtExit);
+	}
+	// the calling thread's buffer now rather than inside its first scope.
+	if (!m_traceBuffer)
+		registerTraceBuffer();
+}
+
+static std::string jsonString(const char* s)
+{
+	std::string out = "\"";
+	for (; *s; s++)
+	{
+		if (*s == '"' || *s == '\\')
+			out += '\\';
+		out += *s;
+	}
+	return out + "\"";
+}
+
+// the events still in |buffer|, in the order the scopes started (parents
+// before their children).
+static std::vector<TraceEvent> traceEvents(const TraceBuffer& buffer)
+{
+	size_t n = (size_t)std::min<uint64_t>(buffer.count, buffer.capacity);
+	std::vector<TraceEvent> events(buffer.events.get(), buffer.events.get() + n);
+	std::sort(events.begin(), events.end(), [](const TraceEvent& a, const TraceEvent& b) {
+		return (a.begin != b.begin) ? (a.begin < b.begin) : (a.depth < b.depth);
+	});
+	return events;
+}
+
+static void writeChromeTrace(const char* file, const std::vector<std::vector<TraceEvent>>& threads)
+{
+	FILE* fp = fopen(file, "w");
+	if (!fp)
+	{
+		fprintf(stderr, "Could not open %s\n", file);
+		return;
+	}
+
+	fprintf(fp, "{\"displayTimeUnit\": \"ms\", \"traceEvents\": [");
+	bool first = true;
+	for (size_t t = 0; t < threads.size(); t++)
+	{
+		for (const TraceEvent& e : threads[t])
+		{
+			fprintf(fp, "%s\n  {\"name\": %s, \"ph\": \"X\", \"pid\": 1, \"tid\": %zu, \"ts\": %.3f, \"dur\": %.3f, \"args\": {\"depth\": %d",
+				first ? "" : ",", jsonString(e.name).c_str(), t, e.begin / 1000.0, (e.end - e.begin) / 1000.0, e.depth);
+			if (e.batch >= 0)
+				fprintf(fp, ", \"batch\": %d", e.batch);
+			if (e.stream >= 0)
+				fprintf(fp, ", \"stream\": %d", e.stream);
+			fprintf(fp, "}}");
+			first = false;
+		}
+	}
+	fprintf(fp, "]}\n");
+	fclose(fp);
+}
+
+struct PhaseTime
+{
+	unsigned int count = 0;
+	double total = 0;
+	double min = 0;
+	double max = 0;
+};
+
+// sums up the scopes by their path of enclosing scopes ("a/b/c"), so that
+// the same phases line up across runs whatever the thread or batch.
+static void writeProfile(const char* file, const std::vector<std::vector<TraceEvent>>& threads, uint64_t dropped)
+{
+	std::map<std::string, PhaseTime> phases;
+	for (const std::vector<TraceEvent>& events : threads)
+	{
+		// the innermost open scope at every depth and its path.
+		std::vector<const TraceEvent*> open;
+		std::vector<std::string> paths;
+		for (const TraceEvent& e : events)
+		{
+			size_t depth = (size_t)e.depth;
+			if (open.size() <= depth)
+			{
+				open.resize(depth + 1, nullptr);
+				paths.resize(depth + 1);
+			}
+
+			// the parent may have been overwritten in the ring; then the path starts here.
+			const TraceEvent* parent = depth ? open[depth - 1] : nullptr;
+			bool nested = parent && parent->begin <= e.begin && parent->end >= e.end;
+			paths[depth] = nested ? paths[depth - 1] + "/" + e.name : std::string(e.name);
+			open[depth] = &e;
+
+			double ms = (e.end - e.begin) / 1e6;
+			PhaseTime& p = phases[paths[depth]];
+			p.min = p.count ? std::min(p.min, ms) : ms;
+			p.max = p.count ? std::max(p.max, ms) : ms;
+			p.total += ms;
+			p.count++;
+		}
+	}
+
+	FILE* fp = fopen(file, "w");
+	if (!fp)
+	{
+		fprintf(stderr, "Could not open %s\n", file);
+		return;
+	}
+
+	fprintf(fp, "{\"threads\": %zu, \"dropped\": %llu, \"phases\": [", threads.size(), (unsigned long long)dropped);
+	bool first = true;
+	for (const auto& p : phases)
+	{
+		fprintf(fp, "%s\n  {\"path\": %s, \"count\": %u, \"totalMs\": %.6f, \"meanMs\": %.6f, \"minMs\": %.6f, \"maxMs\": %.6f}",
+			first ? "" : ",", jsonString(p.first.c_str()).c_str(), p.second.count, p.second.total,
+			p.second.total / p.second.count, p.second.min, p.second.max);
+		first = false;
+	}
+	fprintf(fp, "]}\n");
+	fclose(fp);
+}
+
+void Timing::dumpTrace()
+{
+	std::lock_guard<std::mutex> guard(s_traceLock);
+	if (!m_trace)
+		return;
+
+	std::vector<std::vector<TraceEvent>> threads;
+	uint64_t dropped = 0;
+	for (const std::unique_ptr<TraceBuffer>& buffer : s_traceBuffers)
+	{
+		threads.push_back(traceEvents(*buffer));
+		if (buffer->count > buffer->capacity)
+			dropped += buffer->count - buffer->capacity;
+	}
+	if (dropped)
+		fprintf(stderr, "Trace: the oldest %llu scopes were overwritten\n", (unsigned long long)dropped);
+
+	if (!s_chromeFile.empty())
+		writeChromeTrace(s_chromeFile.c_str(), threads);
+	if (!s_profileFile.empty())
+		writeProfile(s_profileFile.c_str(), threads, dropped);
+}
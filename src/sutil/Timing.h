@@ -7,17 +7,30 @@
 #define FORCE_INLINE __attribute__((always_inline))
 #endif
 
+#include <atomic>
+#include <cstdint>
 #include <iostream>
+#include <memory>
+#include <mutex>
 #include <stack>
+#include <string>
 #include <unordered_map>
+#include <vector>
 
 #include <chrono>
 #include "IDFactory.h"
 
+typedef std::chrono::steady_clock TimingClock;
+
+// Scopes are named by pointers that must outlive the process's timings:
+// string literals as they are, other strings interned (see |internName|).
+// The stack is per thread, so any thread can time its own scopes.
 struct TimingHelper
 {
-	std::chrono::time_point<std::chrono::high_resolution_clock> start;
-	std::string name;
+	TimingClock::time_point start;
+	const char* name;
+	int batch;
+	int stream;
 };
 
 struct AverageTime
@@ -27,89 +40,122 @@ struct AverageTime
 	std::string name;
 };
 
+// a finished scope as recorded for the trace (see |Timing::enableTrace|).
+struct TraceEvent
+{
+	const char* name;
+	int64_t begin; // ns since the trace was enabled
+	int64_t end;
+	int depth;     // enclosing scopes on the same thread
+	int batch;     // -1 if untagged (see |TraceTags|)
+	int stream;
+};
+
+// the last |capacity| scopes that ended on a thread. recording neither
+// allocates nor locks; the buffers outlive their threads so that they can be
+// dumped at exit.
+struct TraceBuffer
+{
+	std::unique_ptr<TraceEvent[]> events;
+	size_t capacity;
+	uint64_t count; // events recorded so far; the older ones are overwritten
+	int tid;
+};
+
 class Timing
 {
 public:
 	static bool m_dontPrintTimes;
-	static unsigned int m_startCounter;
-	static unsigned int m_stopCounter;
-	static std::stack<TimingHelper> m_timingStack;
+	static std::atomic<unsigned int> m_startCounter;
+	static std::atomic<unsigned int> m_stopCounter;
+	static thread_local std::stack<TimingHelper> m_timingStack;
 	static std::unordered_map<int, AverageTime> m_averageTimes;
+	static std::mutex m_averageLock;
+
+	static bool m_trace;
+	static TimingClock::time_point m_traceEpoch;
+	static thread_local TraceBuffer* m_traceBuffer;
+	static thread_local int m_batch;
+	static thread_local int m_stream;
 
 	static void reset()
 	{
 		while (!m_timingStack.empty())
 			m_timingStack.pop();
+		std::lock_guard<std::mutex> guard(m_averageLock);
 		m_averageTimes.clear();
 		m_startCounter = 0;
 		m_stopCounter = 0;
 	}
 
-	FORCE_INLINE static void startTiming(const std::string& name = std::string(""))
+	// a stable copy of |name|; scopes named by temporaries go through this.
+	static const char* internName(const std::string& name);
+
+	// record every scope into the per-thread buffers from now on, and at exit
+	// write a Chrome trace (chrome://tracing, Perfetto) to |chromeFile| and/or
+	// a profile that sums up the scopes by their nesting path to
+	// |profileFile|; an empty name skips that file. call it before starting
+	// other threads that time scopes.
+	static void enableTrace(const std::string& chromeFile, const std::string& profileFile);
+	static void dumpTrace();
+
+	FORCE_INLINE static void startTiming(const char* name = "")
 	{
 		TimingHelper h;
-		h.start = std::chrono::high_resolution_clock::now();
 		h.name = name;
+		h.batch = m_batch;
+		h.stream = m_stream;
+		h.start = TimingClock::now();
 		Timing::m_timingStack.push(h);
 		Timing::m_startCounter++;
 	}
 
+	FORCE_INLINE static void startTiming(const std::string& name)
+	{
+		startTiming(internName(name));
+	}
+
 	FORCE_INLINE static double stopTiming(bool print = true)
 	{
-		if (!Timing::m_timingStack.empty())
-		{
-			Timing::m_stopCounter++;
-			std::chrono::time_point<std::chrono::high_resolution_clock> stop = std::chrono::high_resolution_clock::now();
-			TimingHelper h = Timing::m_timingStack.top();
-			Timing::m_timingStack.pop();
-			std::chrono::duration<double> elapsed_seconds = stop - h.start;
-			double t = elapsed_seconds.count() * 1000.0;
-
-			if (print)
-				std::cout << "time " << h.name.c_str() << ": " << t << " ms\n\n" << std::flush;
-			return t;
+		const char* name;
+		double t = popTiming(&name);
+		if (t >= 0 && print)
+			std::cout << "time " << name << ": " << t << " ms\n\n" << std::flush;
+		return (t >= 0) ? t : 0;
 	}
-		return 0;
-}
 
 	FORCE_INLINE static double stopTiming(bool print, int &id)
 	{
 		if (id == -1)
 			id = IDFactory::getId();
-		if (!Timing::m_timingStack.empty())
-		{
-			Timing::m_stopCounter++;
-			std::chrono::time_point<std::chrono::high_resolution_clock> stop = std::chrono::high_resolution_clock::now();
-			TimingHelper h = Timing::m_timingStack.top();
-			Timing::m_timingStack.pop();
-
-			std::chrono::duration<double> elapsed_seconds = stop - h.start;
-			double t = elapsed_seconds.count() * 1000.0;
+		const char* name;
+		double t = popTiming(&name);
+		if (t < 0)
+			return 0;
 
-			if (print && !Timing::m_dontPrintTimes)
-				std::cout << "time " << h.name.c_str() << ": " << t << " ms\n" << std::flush;
+		if (print && !Timing::m_dontPrintTimes)
+			std::cout << "time " << name << ": " << t << " ms\n" << std::flush;
 
-			if (id >= 0)
+		if (id >= 0)
+		{
+			std::lock_guard<std::mutex> guard(m_averageLock);
+			std::unordered_map<int, AverageTime>::iterator iter;
+			iter = Timing::m_averageTimes.find(id);
+			if (iter != Timing::m_averageTimes.end())
+			{
+				Timing::m_averageTimes[id].totalTime += t;
+				Timing::m_averageTimes[id].counter++;
+			}
+			else
 			{
-				std::unordered_map<int, AverageTime>::iterator iter;
-				iter = Timing::m_averageTimes.find(id);
-				if (iter != Timing::m_averageTimes.end())
-				{
-					Timing::m_averageTimes[id].totalTime += t;
-					Timing::m_averageTimes[id].counter++;
-				}
-				else
-				{
-					AverageTime at;
-					at.counter = 1;
-					at.totalTime = t;
-					at.name = h.name;
-					Timing::m_averageTimes[id] = at;
-				}
+				AverageTime at;
+				at.counter = 1;
+				at.totalTime = t;
+				at.name = name;
+				Timing::m_averageTimes[id] = at;
 			}
-			return t;
 		}
-		return 0;
+		return t;
 	}
 
 	FORCE_INLINE static void printAverageTimes()
@@ -139,7 +185,64 @@ public:
 			std::cout << "Problem: " << Timing::m_startCounter << " calls of startTiming and " << Timing::m_stopCounter << " calls of stopTiming.\n " << std::flush;
 		std::cout << "---------------------------------------------------------------------------\n\n";
 	}
+
+private:
+	static void registerTraceBuffer();
+	static void recordTrace(const TimingHelper& h, TimingClock::time_point stop, int depth);
+
+	// pop the innermost scope of this thread; its time in ms, or -1 if there's none.
+	FORCE_INLINE static double popTiming(const char** name)
+	{
+		if (Timing::m_timingStack.empty())
+			return -1;
+		TimingClock::time_point stop = TimingClock::now();
+		Timing::m_stopCounter++;
+		const TimingHelper& h = Timing::m_timingStack.top();
+		if (m_trace)
+			recordTrace(h, stop, (int)Timing::m_timingStack.size() - 1);
+		*name = h.name;
+		double t = std::chrono::duration<double, std::milli>(stop - h.start).count();
+		Timing::m_timingStack.pop();
+		return t;
+	}
+};
+
+// times the enclosing block, like a startTiming/stopTiming pair.
+class TimingScope
+{
+public:
+	explicit TimingScope(const char* name, bool print = true) : m_print(print) { Timing::startTiming(name); }
+	~TimingScope() { Timing::stopTiming(m_print); }
+
+	TimingScope(const TimingScope&) = delete;
+	TimingScope& operator=(const TimingScope&) = delete;
+
+private:
+	bool m_print;
 };
 
+// tags the scopes this thread starts while it's alive with a batch and a
+// CUDA stream (an index into the caller's streams); the trace keeps both.
+class TraceTags
+{
+public:
+	TraceTags(int batch, int stream) : m_batch(Timing::m_batch), m_stream(Timing::m_stream)
+	{
+		Timing::m_batch = batch;
+		Timing::m_stream = stream;
+	}
+	~TraceTags()
+	{
+		Timing::m_batch = m_batch;
+		Timing::m_stream = m_stream;
+	}
+
+	TraceTags(const TraceTags&) = delete;
+	TraceTags& operator=(const TraceTags&) = delete;
+
+private:
+	int m_batch;
+	int m_stream;
+};
 
 #endif